@@ -25,20 +25,105 @@
 #define _OGRE_CAIRO_CANVAS_H_
 
 #include <cairo.h>
+#include <vector>
+
+typedef struct _cairo_gral_display_list cairo_gral_display_list_t;
 
 namespace Ogre {
 
 class CairoCanvas {
 public:
+  CairoCanvas();
   virtual ~CairoCanvas();
 
+  /// Draws the canvas. The renderer keeps the context between frames and
+  /// only resets its matrix, clip and path; the rest of its state, like the
+  /// source or the font, is as the previous drawing left it.
   virtual void onDraw(cairo_t *cr) = 0;
 
+  /// Canvases that can split their drawing return in how many steps.
+  /// onDrawSteps() is then called instead of onDraw() for consecutive ranges
+  /// of steps, all with the same context, and a renderer with a frame budget
+  /// spreads them over several frames. 0 means onDraw() draws it all.
+  virtual unsigned int getDrawSteps() {
+    return 0;
+  }
+
+  /// Draws the steps from first up to first + count. A new drawing starts
+  /// with first == 0.
+  virtual void onDrawSteps(cairo_t *cr, unsigned int first, unsigned int count) {
+  }
+
+  /// Whether the whole canvas should be redrawn. Canvases that know what
+  /// changed return false and call invalidateRect() instead.
   virtual bool needsRendering() {
     return true;
   }
 
+  /// Marks a rectangle of the canvas, in pixels, to be redrawn at the next
+  /// update. onDraw() is then clipped to the union of the invalidated
+  /// rectangles and the rest of the canvas keeps its previous drawing.
+  void invalidateRect(int x, int y, int width, int height);
+  /// Marks the whole canvas to be redrawn at the next update.
+  void invalidate();
+
+  /// Caps how many times per second the canvas is redrawn, 0 for no cap.
+  /// Updates that come sooner are deferred and the previous drawing is
+  /// shown meanwhile.
+  void setMaxUpdateRate(float updatesPerSecond);
+
   static void getCanvasSize(cairo_t *cr, unsigned int &width, unsigned int &height);
+
+  struct DirtyRect {
+    int x, y, width, height;
+  };
+  typedef std::vector<DirtyRect> DirtyRects;
+
+private:
+  friend class CairoRenderer;
+
+  DirtyRects mDirtyRects;
+  bool mDirtyAll;
+
+  unsigned long mMinUpdateInterval;
+  unsigned long mLastUpdateTime;
+  bool mHasDrawn;
+
+  bool isUpdateDue(unsigned long now) const {
+    return !mHasDrawn || now - mLastUpdateTime >= mMinUpdateInterval;
+  }
+};
+
+/// Drawing that is recorded once and replayed at each onDraw. Only the
+/// matrix of the cairo_t passed to replay() needs to change to pan, rotate
+/// or zoom; the tesselated paths are kept on the GPU between replays.
+class CairoDisplayList {
+public:
+  CairoDisplayList();
+  ~CairoDisplayList();
+
+  /// Starts a new recording; draw into the returned context and pass it to
+  /// endRecording().
+  cairo_t *beginRecording();
+  void endRecording(cairo_t *cr);
+
+  /// Whether there is a successful recording to replay.
+  bool isRecorded() const {
+    return mRecorded;
+  }
+
+  void replay(cairo_t *cr);
+
+  /// The number of recorded commands, for replaying them in ranges.
+  unsigned int getNumCommands() const;
+  void replay(cairo_t *cr, unsigned int first, unsigned int count);
+
+private:
+  cairo_gral_display_list_t *mList;
+  bool mRecorded;
+
+  CairoDisplayList(const CairoDisplayList &);
+  CairoDisplayList &operator=(const CairoDisplayList &);
 };
 
 }
@@ -26,13 +26,16 @@
 
 #include <cairo.h>
 #include <OgreRenderTargetListener.h>
+#include <OgreRenderSystem.h>
+#include <OgreRenderOperation.h>
+#include <OgreTexture.h>
 #include <map>
 
 namespace Ogre {
 
   class CairoCanvas;
 
-class CairoRenderer : public RenderTargetListener {
+class CairoRenderer : public RenderTargetListener, public RenderSystem::Listener {
 public:
   CairoRenderer();
   virtual ~CairoRenderer();
@@ -40,8 +43,15 @@ public:
   void addCanvas(CairoCanvas *canvas, Viewport *vp);
   void removeCanvas(CairoCanvas *canvas, Viewport *vp);
 
+  /// Limits the time spent per frame drawing the canvases that can split
+  /// their drawing in steps (see CairoCanvas::getDrawSteps); they keep
+  /// showing their last complete drawing until the next one is done.
+  /// 0, the default, draws them in one go.
+  void setFrameBudget(Real milliseconds);
+
 protected:
   virtual void postViewportUpdate(const RenderTargetViewportEvent& evt);
+  virtual void eventOccurred(const String& eventName, const NameValuePairList* parameters);
 
 private:
   typedef std::multimap<Viewport *, CairoCanvas *> VPCanvases;
@@ -51,10 +61,62 @@ private:
   typedef std::map<Viewport *, cairo_surface_t *> VPSurfaces;
   VPSurfaces mSurfaces;
 
+  /// The contexts of the canvases that draw straight into their viewport.
+  /// They are kept between frames; only their matrix, clip and path are
+  /// reset before each drawing.
+  typedef std::map<VPCanvasPair, cairo_t *> VPContexts;
+  VPContexts mContexts;
+
+  struct LayerBuffer {
+    TexturePtr texture;
+    Viewport *viewport;
+    cairo_surface_t *surface;
+    cairo_t *context;
+  };
+
+  /// A texture that retains the drawing of a canvas over a viewport that is
+  /// cleared every frame; it is composited over the viewport at each update.
+  struct CanvasLayer {
+    LayerBuffer front;
+    /// The texture content is undefined, e.g. after a lost device.
+    bool blank;
+
+    /// Canvases drawn in steps draw into the back buffer over several frames
+    /// and swap it with the front one when they are done.
+    LayerBuffer back;
+    bool inPass;
+    unsigned int nextStep, numSteps;
+    /// Microseconds per step in the last chunk of steps.
+    unsigned long stepTime;
+  };
+  typedef std::map<VPCanvasPair, CanvasLayer> VPLayers;
+  VPLayers mLayers;
+
+  /// Screen quad used to composite the layers.
+  RenderOperation mLayerQuad;
+
+  /// Microseconds per frame for the canvases drawn in steps, and how much of
+  /// it was used in the frame mBudgetFrame.
+  unsigned long mFrameBudget;
+  unsigned long mBudgetUsed;
+  unsigned long mBudgetFrame;
+
   void attachToViewport(Viewport *vp);
   void detachFromViewport(Viewport *vp);
   void initialiseRenderState(Viewport *vp) const;
   void finaliseRenderState() const;
+
+  CanvasLayer *getLayer(Viewport *vp, CairoCanvas *canvas);
+  void destroyLayer(VPLayers::iterator layerIt);
+  void createLayerBuffer(LayerBuffer &buffer, Viewport *vp);
+  void destroyLayerBuffer(LayerBuffer &buffer);
+  void createLayerQuad(bool flipped);
+  static cairo_t *resetContext(cairo_t *&cr, cairo_surface_t *surface);
+  void drawCanvas(CairoCanvas *canvas, Viewport *target, cairo_t *cr,
+                  bool redrawAll, bool clearDamage);
+  void beginPass(CairoCanvas *canvas, CanvasLayer *layer, Viewport *vp);
+  void continuePass(CairoCanvas *canvas, CanvasLayer *layer);
+  void compositeLayer(Viewport *vp, const LayerBuffer &buffer);
 };
 
 }
@@ -23,13 +23,77 @@
 
 #include "OgreCairoCanvas.h"
 #include <cairo-gral.h>
+#include <assert.h>
+#include <algorithm>
 
 using namespace Ogre;
 
+/// Past this many separate rectangles the damage is tracked as their
+/// bounding box; clipping to many small rectangles costs more than it saves.
+#define MAX_DIRTY_RECTS 8
+
+CairoCanvas::CairoCanvas()
+  : mDirtyAll(true), mMinUpdateInterval(0), mLastUpdateTime(0), mHasDrawn(false)
+{
+}
+
 CairoCanvas::~CairoCanvas()
 {
 }
 
+static bool rectsTouch(const CairoCanvas::DirtyRect &a, const CairoCanvas::DirtyRect &b)
+{
+  return a.x <= b.x + b.width && b.x <= a.x + a.width &&
+         a.y <= b.y + b.height && b.y <= a.y + a.height;
+}
+
+static void uniteRect(CairoCanvas::DirtyRect &a, const CairoCanvas::DirtyRect &b)
+{
+  int right = std::max(a.x + a.width, b.x + b.width);
+  int bottom = std::max(a.y + a.height, b.y + b.height);
+  a.x = std::min(a.x, b.x);
+  a.y = std::min(a.y, b.y);
+  a.width = right - a.x;
+  a.height = bottom - a.y;
+}
+
+void CairoCanvas::invalidateRect(int x, int y, int width, int height)
+{
+  if (mDirtyAll || width <= 0 || height <= 0)
+    return;
+
+  DirtyRect rect = { x, y, width, height };
+
+  // Merge the rectangles that overlap the new one, so the clip stays small.
+  for (DirtyRects::iterator I = mDirtyRects.begin(); I != mDirtyRects.end(); ) {
+    if (rectsTouch(*I, rect)) {
+      uniteRect(rect, *I);
+      I = mDirtyRects.erase(I);
+    } else {
+      ++I;
+    }
+  }
+
+  if (mDirtyRects.size() == MAX_DIRTY_RECTS) {
+    for (DirtyRects::iterator I = mDirtyRects.begin(), E = mDirtyRects.end(); I != E; ++I)
+      uniteRect(rect, *I);
+    mDirtyRects.clear();
+  }
+  mDirtyRects.push_back(rect);
+}
+
+void CairoCanvas::invalidate()
+{
+  mDirtyAll = true;
+  mDirtyRects.clear();
+}
+
+void CairoCanvas::setMaxUpdateRate(float updatesPerSecond)
+{
+  assert(updatesPerSecond >= 0);
+  mMinUpdateInterval = updatesPerSecond > 0 ? (unsigned long)(1000 / updatesPerSecond) : 0;
+}
+
 void CairoCanvas::getCanvasSize(cairo_t *cr, unsigned int &width, unsigned int &height)
 {
   cairo_surface_t *cr_surf = cairo_get_target(cr);
@@ -37,4 +101,43 @@ void CairoCanvas::getCanvasSize(cairo_t *cr, unsigned int &width, unsigned int &
   height = cairo_gral_surface_get_height(cr_surf);
 }
 
+CairoDisplayList::CairoDisplayList()
+  : mList(cairo_gral_display_list_create()), mRecorded(false)
+{
+  assert(mList);
+}
+
+CairoDisplayList::~CairoDisplayList()
+{
+  cairo_gral_display_list_destroy(mList);
+}
+
+cairo_t *CairoDisplayList::beginRecording()
+{
+  mRecorded = false;
+  return cairo_gral_display_list_begin_recording(mList);
+}
+
+void CairoDisplayList::endRecording(cairo_t *cr)
+{
+  mRecorded = cairo_gral_display_list_end_recording(mList, cr) == CAIRO_STATUS_SUCCESS;
+}
+
+void CairoDisplayList::replay(cairo_t *cr)
+{
+  if (mRecorded)
+    cairo_gral_display_list_replay(mList, cr);
+}
+
+unsigned int CairoDisplayList::getNumCommands() const
+{
+  return mRecorded ? cairo_gral_display_list_get_num_commands(mList) : 0;
+}
+
+void CairoDisplayList::replay(cairo_t *cr, unsigned int first, unsigned int count)
+{
+  if (mRecorded)
+    cairo_gral_display_list_replay_range(mList, cr, first, count);
+}
+
 
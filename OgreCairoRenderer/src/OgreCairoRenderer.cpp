@@ -27,10 +27,20 @@
 #include <gral-ogre.h>
 #include <OgreRoot.h>
 #include <OgreRenderSystem.h>
+#include <OgreTextureManager.h>
+#include <OgreHardwareBufferManager.h>
+#include <OgreHardwarePixelBuffer.h>
+#include <OgreRenderTexture.h>
+#include <OgreTimer.h>
+#include <OgreViewport.h>
+#include <algorithm>
+#include <climits>
+#include <sstream>
 
 using namespace Ogre;
 
 CairoRenderer::CairoRenderer()
+  : mFrameBudget(0), mBudgetUsed(0), mBudgetFrame(0)
 {
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   if (StringUtil::startsWith(rs->getName(), "Direct3D", false/*lowerCase*/)) {
@@ -40,10 +50,22 @@ CairoRenderer::CairoRenderer()
                   "CairoRenderer::CairoRenderer");
 
   }
+
+  // Layer textures lose their drawing with the device.
+  rs->addListener(this);
 }
 
 CairoRenderer::~CairoRenderer()
 {
+  Root::getSingleton().getRenderSystem()->removeListener(this);
+
+  while (!mLayers.empty())
+    destroyLayer(mLayers.begin());
+  delete mLayerQuad.vertexData;
+
+  for (VPContexts::iterator I=mContexts.begin(), E=mContexts.end(); I!=E; ++I)
+    cairo_destroy(I->second);
+
   for (VPSurfaces::iterator I=mSurfaces.begin(), E=mSurfaces.end(); I!=E; ++I) {
     I->first->getTarget()->removeListener(this);
     cairo_surface_destroy(I->second);
@@ -79,6 +101,16 @@ void CairoRenderer::removeCanvas(CairoCanvas *canvas, Viewport *vp)
     // The canvas is attached to this viewport, remove it.
     mCanvases.erase(canvasIt);
 
+    VPLayers::iterator layerIt = mLayers.find(VPCanvasPair(vp, canvas));
+    if (layerIt != mLayers.end())
+      destroyLayer(layerIt);
+
+    VPContexts::iterator contextIt = mContexts.find(VPCanvasPair(vp, canvas));
+    if (contextIt != mContexts.end()) {
+      cairo_destroy(contextIt->second);
+      mContexts.erase(contextIt);
+    }
+
     if (mCanvases.find(vp) == mCanvases.end()) {
       // The viewport has no canvases attached to it.
       detachFromViewport(vp);
@@ -86,6 +118,12 @@ void CairoRenderer::removeCanvas(CairoCanvas *canvas, Viewport *vp)
   }
 }
 
+void CairoRenderer::setFrameBudget(Real milliseconds)
+{
+  assert(milliseconds >= 0);
+  mFrameBudget = (unsigned long)(milliseconds * 1000);
+}
+
 void CairoRenderer::attachToViewport(Viewport *vp)
 {
   gral_surface_t *gral_srf = gral_ogre_surface_from_viewport(vp);
@@ -111,11 +149,31 @@ void CairoRenderer::postViewportUpdate(const RenderTargetViewportEvent& evt)
   Viewport *vp = evt.source;
   std::pair<VPCanvases::iterator, VPCanvases::iterator> range = mCanvases.equal_range(vp);
 
+  unsigned long now = Root::getSingleton().getTimer()->getMilliseconds();
+  unsigned long frame = Root::getSingleton().getNextFrameNumber();
+  if (frame != mBudgetFrame) {
+    mBudgetFrame = frame;
+    mBudgetUsed = 0;
+  }
+
   bool renderInited = false;
   for (VPCanvases::iterator I = range.first; I != range.second; ++I) {
     CairoCanvas *canvas = I->second;
 
-    if (!canvas->needsRendering())
+    bool redrawAll = canvas->needsRendering() || canvas->mDirtyAll;
+    bool damaged = redrawAll || !canvas->mDirtyRects.empty();
+
+    if (damaged && !canvas->isUpdateDue(now)) {
+      // Over the update rate; show the previous drawing and keep the request.
+      if (redrawAll)
+        canvas->invalidate();
+      redrawAll = damaged = false;
+    }
+
+    // What isn't redrawn has to survive until the next update; over a
+    // viewport that is cleared every frame it is kept in a layer texture.
+    bool layered = vp->getClearEveryFrame();
+    if (!layered && !damaged)
       continue;
 
     if (!renderInited) {
@@ -123,16 +181,335 @@ void CairoRenderer::postViewportUpdate(const RenderTargetViewportEvent& evt)
       renderInited = true;
     }
 
-    assert(mSurfaces[vp]);
-    cairo_t *cr = cairo_create(mSurfaces[vp]);
-    canvas->onDraw(cr);
-    cairo_destroy(cr);
+    if (!layered) {
+      assert(mSurfaces[vp]);
+      cairo_t *&cr = mContexts[VPCanvasPair(vp, canvas)];
+      drawCanvas(canvas, vp, resetContext(cr, mSurfaces[vp]), redrawAll, false/*clearDamage*/);
+      continue;
+    }
+
+    CanvasLayer *layer = getLayer(vp, canvas);
+
+    if (mFrameBudget && canvas->getDrawSteps()) {
+      // A new drawing starts once the previous one is shown.
+      if (!layer->inPass && (damaged || layer->blank))
+        beginPass(canvas, layer, vp);
+      if (layer->inPass)
+        continuePass(canvas, layer);
+      if (!layer->blank)
+        compositeLayer(vp, layer->front);
+      continue;
+    }
+
+    // An unchanged canvas costs only the composition of its layer.
+    if (damaged || layer->blank) {
+      LayerBuffer &front = layer->front;
+      drawCanvas(canvas, front.viewport, resetContext(front.context, front.surface),
+                 redrawAll || layer->blank, true/*clearDamage*/);
+      layer->blank = false;
+    }
+    compositeLayer(vp, layer->front);
   }
 
   if (renderInited)
     finaliseRenderState();
 }
 
+cairo_t *CairoRenderer::resetContext(cairo_t *&cr, cairo_surface_t *surface)
+{
+  // An error sticks to a context, start over with a new one.
+  if (cr && cairo_status(cr) != CAIRO_STATUS_SUCCESS) {
+    cairo_destroy(cr);
+    cr = NULL;
+  }
+
+  if (cr == NULL) {
+    cr = cairo_create(surface);
+  } else {
+    // The rest of the state, like the source and the font, stays as the
+    // canvas left it.
+    cairo_identity_matrix(cr);
+    cairo_reset_clip(cr);
+    cairo_new_path(cr);
+  }
+  return cr;
+}
+
+void CairoRenderer::drawCanvas(CairoCanvas *canvas, Viewport *target, cairo_t *cr,
+                               bool redrawAll, bool clearDamage)
+{
+  RenderSystem *rs = Root::getSingleton().getRenderSystem();
+  cairo_surface_t *surface = cairo_get_target(cr);
+
+  bool scissored = false;
+  if (!redrawAll) {
+    // Clip to the union of the damage and scissor to its bounds, so neither
+    // the tesselation nor the cover passes touch the rest of the canvas.
+    const CairoCanvas::DirtyRects &rects = canvas->mDirtyRects;
+    int left = INT_MAX, top = INT_MAX, right = INT_MIN, bottom = INT_MIN;
+    for (CairoCanvas::DirtyRects::const_iterator I = rects.begin(), E = rects.end(); I != E; ++I) {
+      cairo_rectangle(cr, I->x, I->y, I->width, I->height);
+      left = std::min(left, I->x);
+      top = std::min(top, I->y);
+      right = std::max(right, I->x + I->width);
+      bottom = std::max(bottom, I->y + I->height);
+    }
+    cairo_clip(cr);
+
+    left = std::max(left, 0);
+    top = std::max(top, 0);
+    right = std::min(right, target->getActualWidth());
+    bottom = std::min(bottom, target->getActualHeight());
+    if (right <= left || bottom <= top) {
+      // Nothing visible was invalidated.
+      canvas->mDirtyRects.clear();
+      return;
+    }
+
+    // The scissor rect is relative to the render target of the active
+    // viewport; setting the same viewport again later keeps it.
+    rs->_setViewport(target);
+    rs->setScissorTest(true, target->getActualLeft() + left, target->getActualTop() + top,
+                       target->getActualLeft() + right, target->getActualTop() + bottom);
+    scissored = true;
+  }
+
+  if (clearDamage) {
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_restore(cr);
+  }
+
+  unsigned int steps = canvas->getDrawSteps();
+  if (steps)
+    canvas->onDrawSteps(cr, 0, steps);
+  else
+    canvas->onDraw(cr);
+  // Paint the drawing that cairo-gral deferred before the frame ends.
+  cairo_surface_flush(surface);
+
+  if (scissored)
+    rs->setScissorTest(false);
+
+  canvas->mDirtyAll = false;
+  canvas->mDirtyRects.clear();
+  canvas->mLastUpdateTime = Root::getSingleton().getTimer()->getMilliseconds();
+  canvas->mHasDrawn = true;
+}
+
+void CairoRenderer::beginPass(CairoCanvas *canvas, CanvasLayer *layer, Viewport *vp)
+{
+  if (layer->back.surface == NULL)
+    createLayerBuffer(layer->back, vp);
+
+  cairo_t *cr = resetContext(layer->back.context, layer->back.surface);
+  layer->inPass = true;
+  layer->nextStep = 0;
+  layer->numSteps = canvas->getDrawSteps();
+
+  cairo_save(cr);
+  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint(cr);
+  cairo_restore(cr);
+
+  // The whole canvas is drawn again; what is invalidated from now on is
+  // left for the next pass.
+  canvas->mDirtyAll = false;
+  canvas->mDirtyRects.clear();
+  canvas->mLastUpdateTime = Root::getSingleton().getTimer()->getMilliseconds();
+  canvas->mHasDrawn = true;
+}
+
+void CairoRenderer::continuePass(CairoCanvas *canvas, CanvasLayer *layer)
+{
+  Timer *timer = Root::getSingleton().getTimer();
+
+  while (layer->nextStep < layer->numSteps && mBudgetUsed < mFrameBudget) {
+    // Take as many steps as the time per step of the last chunk says fit.
+    unsigned int count = 1;
+    if (layer->stepTime)
+      count = (unsigned int) std::max(1UL, (mFrameBudget - mBudgetUsed) / layer->stepTime);
+    count = std::min(count, layer->numSteps - layer->nextStep);
+
+    unsigned long start = timer->getMicroseconds();
+    canvas->onDrawSteps(layer->back.context, layer->nextStep, count);
+    // Submit the deferred drawing, so that it counts for this chunk.
+    cairo_surface_flush(layer->back.surface);
+    unsigned long elapsed = timer->getMicroseconds() - start;
+
+    layer->stepTime = std::max(1UL, elapsed / count);
+    layer->nextStep += count;
+    mBudgetUsed += elapsed;
+  }
+
+  if (layer->nextStep == layer->numSteps) {
+    layer->inPass = false;
+    std::swap(layer->front, layer->back);
+    layer->blank = false;
+  }
+}
+
+CairoRenderer::CanvasLayer *CairoRenderer::getLayer(Viewport *vp, CairoCanvas *canvas)
+{
+  VPCanvasPair key(vp, canvas);
+  VPLayers::iterator layerIt = mLayers.find(key);
+  if (layerIt != mLayers.end()) {
+    const TexturePtr &tex = layerIt->second.front.texture;
+    if (tex->getWidth() == (size_t)vp->getActualWidth() &&
+        tex->getHeight() == (size_t)vp->getActualHeight())
+      return &layerIt->second;
+    // The viewport was resized, the drawing has to be redone anyway.
+    destroyLayer(layerIt);
+  }
+
+  CanvasLayer &layer = mLayers[key];
+  createLayerBuffer(layer.front, vp);
+  layer.blank = true;
+  layer.back.surface = NULL;
+  layer.back.viewport = NULL;
+  layer.back.context = NULL;
+  layer.inPass = false;
+  layer.nextStep = layer.numSteps = 0;
+  layer.stepTime = 0;
+  return &layer;
+}
+
+void CairoRenderer::createLayerBuffer(LayerBuffer &buffer, Viewport *vp)
+{
+  static unsigned int counter = 0;
+  std::ostringstream name;
+  name << "##CAIRO-CANVAS-LAYER-" << (counter++);
+
+  buffer.texture = TextureManager::getSingleton().createManual(
+          name.str(), ResourceGroupManager::INTERNAL_RESOURCE_GROUP_NAME,
+          TEX_TYPE_2D, vp->getActualWidth(), vp->getActualHeight(), 0,
+          PF_A8R8G8B8, TU_RENDERTARGET);
+  RenderTarget *rt = buffer.texture->getBuffer()->getRenderTarget();
+  // The layer is only drawn into by the renderer.
+  rt->setAutoUpdated(false);
+  buffer.viewport = rt->addViewport(NULL);
+  buffer.viewport->setClearEveryFrame(false);
+  buffer.viewport->setOverlaysEnabled(false);
+  buffer.surface = cairo_gral_surface_create(gral_ogre_surface_from_viewport(buffer.viewport));
+  assert(buffer.surface);
+  buffer.context = NULL;
+
+  if (mLayerQuad.vertexData == NULL)
+    createLayerQuad(rt->requiresTextureFlipping());
+}
+
+void CairoRenderer::destroyLayerBuffer(LayerBuffer &buffer)
+{
+  if (buffer.surface == NULL)
+    return;
+  if (buffer.context)
+    cairo_destroy(buffer.context);
+  cairo_surface_destroy(buffer.surface);
+  TextureManager::getSingleton().remove(buffer.texture->getHandle());
+  buffer.texture.setNull();
+  buffer.surface = NULL;
+  buffer.context = NULL;
+}
+
+void CairoRenderer::eventOccurred(const String& eventName, const NameValuePairList* parameters)
+{
+  if (eventName == "DeviceRestored") {
+    // Both buffers lost their drawing, start over.
+    for (VPLayers::iterator I = mLayers.begin(), E = mLayers.end(); I != E; ++I) {
+      I->second.inPass = false;
+      I->second.blank = true;
+    }
+  }
+}
+
+void CairoRenderer::destroyLayer(VPLayers::iterator layerIt)
+{
+  destroyLayerBuffer(layerIt->second.front);
+  destroyLayerBuffer(layerIt->second.back);
+  mLayers.erase(layerIt);
+}
+
+void CairoRenderer::createLayerQuad(bool flipped)
+{
+  VertexData *data = new VertexData();
+  data->vertexStart = 0;
+  data->vertexCount = 4;
+
+  VertexDeclaration *decl = data->vertexDeclaration;
+  size_t offset = 0;
+  decl->addElement(0, offset, VET_FLOAT3, VES_POSITION);
+  offset += VertexElement::getTypeSize(VET_FLOAT3);
+  decl->addElement(0, offset, VET_FLOAT2, VES_TEXTURE_COORDINATES);
+  offset += VertexElement::getTypeSize(VET_FLOAT2);
+
+  // A strip covering clip space; render textures that are upside down get
+  // their texture coordinates flipped.
+  float top = flipped ? 1.0f : 0.0f;
+  float bottom = 1.0f - top;
+  const float vertices[] = {
+    -1,  1, 0,  0, top,
+    -1, -1, 0,  0, bottom,
+     1,  1, 0,  1, top,
+     1, -1, 0,  1, bottom
+  };
+  HardwareVertexBufferSharedPtr buf = HardwareBufferManager::getSingleton().createVertexBuffer(
+          offset, 4, HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+  buf->writeData(0, sizeof(vertices), vertices, true);
+  data->vertexBufferBinding->setBinding(0, buf);
+
+  mLayerQuad.vertexData = data;
+  mLayerQuad.operationType = RenderOperation::OT_TRIANGLE_STRIP;
+  mLayerQuad.useIndexes = false;
+}
+
+void CairoRenderer::compositeLayer(Viewport *vp, const LayerBuffer &buffer)
+{
+  RenderSystem *rs = Root::getSingleton().getRenderSystem();
+  rs->_setViewport(vp);
+
+  // Line texels up with pixels, as _cairo_gral_init_render_state does.
+  Matrix4 world = Matrix4::IDENTITY;
+  world.setTrans(Vector3(rs->getHorizontalTexelOffset() * 2 / vp->getActualWidth(),
+                         -rs->getVerticalTexelOffset() * 2 / vp->getActualHeight(), 0));
+  rs->_setWorldMatrix(world);
+  rs->_setViewMatrix(Matrix4::IDENTITY);
+  rs->_setProjectionMatrix(Matrix4::IDENTITY);
+
+  rs->unbindGpuProgram(GPT_VERTEX_PROGRAM);
+  rs->unbindGpuProgram(GPT_FRAGMENT_PROGRAM);
+  rs->setLightingEnabled(false);
+  rs->_setCullingMode(CULL_NONE);
+  rs->_setDepthBufferParams(false, false);
+  rs->setStencilCheckEnabled(false);
+  rs->_setColourBufferWriteEnabled(true, true, true, true);
+  // The layer is premultiplied: cairo-gral blends the colour with the source
+  // alpha and the alpha channel with ONE, ONE_MINUS_SOURCE_ALPHA.
+  rs->_setSceneBlending(SBF_ONE, SBF_ONE_MINUS_SOURCE_ALPHA);
+
+  rs->_setTexture(0, true, buffer.texture);
+  rs->_setTextureCoordSet(0, 0);
+  rs->_setTextureCoordCalculation(0, TEXCALC_NONE);
+  rs->_setTextureMatrix(0, Matrix4::IDENTITY, 2);
+  rs->_setTextureUnitFiltering(0, FO_POINT, FO_POINT, FO_NONE);
+  TextureUnitState::UVWAddressingMode clamp;
+  clamp.u = clamp.v = clamp.w = TextureUnitState::TAM_CLAMP;
+  rs->_setTextureAddressingMode(0, clamp);
+  LayerBlendModeEx blend;
+  blend.blendType = LBT_COLOUR;
+  blend.operation = LBX_SOURCE1;
+  blend.source1 = LBS_TEXTURE;
+  rs->_setTextureBlendMode(0, blend);
+  blend.blendType = LBT_ALPHA;
+  rs->_setTextureBlendMode(0, blend);
+  rs->_disableTextureUnitsFrom(1);
+
+  rs->_render(mLayerQuad);
+
+  // Whatever gral last issued is no longer the current state.
+  gral_reset_state_cache();
+}
+
 void CairoRenderer::initialiseRenderState(Viewport *vp) const
 {
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
@@ -142,6 +519,9 @@ void CairoRenderer::initialiseRenderState(Viewport *vp) const
   rs->_setDepthBias(0, 0);
   rs->_setFog(FOG_NONE);
   rs->unbindGpuProgram(GPT_GEOMETRY_PROGRAM);
+
+  // The scene was rendered since the last time gral was used.
+  gral_reset_state_cache();
 }
 
 void CairoRenderer::finaliseRenderState() const
@@ -31,14 +31,24 @@ Clock drawing code was based on a BetaCairo sample.
 
 class CairoClock : public CairoCanvas, public ExampleFrameListener {
   float timeSince, hours, minutes, seconds;
+  unsigned int faceWidth, faceHeight;
 
 public:
   CairoClock(RenderWindow* win, Camera* cam) : ExampleFrameListener(win,cam) {
-    timeSince = 1000;
+    timeSince = 0;
+    faceWidth = faceHeight = 0;
   }
 
   bool frameRenderingQueued(const FrameEvent& evt) {
     timeSince += evt.timeSinceLastFrame;
+    if (timeSince >= CLOCK_UPDATE) {
+      timeSince = 0;
+      // Only the hands and the second marks move; they stay within the outer
+      // ring, so the border around it is left as it was drawn.
+      int rx = (int) Math::Ceil(faceWidth / 3.5f) + 2;
+      int ry = (int) Math::Ceil(faceHeight / 3.5f) + 2;
+      invalidateRect(faceWidth / 2 - rx, faceHeight / 2 - ry, 2 * rx, 2 * ry);
+    }
     return true;
   }
 
@@ -51,6 +61,8 @@ public:
 
     unsigned int width, height;
     getCanvasSize(cr, width, height); // From CairoCanvas' methods.
+    faceWidth = width;
+    faceHeight = height;
 
     // Paint the Drawing with red, this pretty much wipes over the previous drawing.
     cairo_set_source_rgb(cr, 1,0,0);
@@ -160,11 +172,7 @@ public:
   }
 
   virtual bool needsRendering() {
-    if (timeSince >= CLOCK_UPDATE) {
-      timeSince = 0;
-      return true;
-    }
-
+    // The clock invalidates what changes, see frameRenderingQueued.
     return false;
   }
 
@@ -49,6 +49,10 @@ class SvgListener : public ExampleFrameListener, public CairoCanvas
     cairo_matrix_t cr_mat_rotation;
     SvgContexts svgs;
 
+    // The current svg, recorded once; only the matrix changes per frame.
+    CairoDisplayList displayList;
+    int recordedSvgIndex;
+
 public:
     SvgListener(SvgContexts &svgCtxs, RenderWindow* win, Camera* cam)
         : ExampleFrameListener(win, cam)
@@ -58,6 +62,7 @@ public:
       scale = 1;
       spinning = true;
       svgIndex = 0;
+      recordedSvgIndex = -1;
       cairo_matrix_init_identity(&cr_mat_rotation);
     }
 
@@ -69,7 +74,17 @@ public:
 
         setupCairoMatrix(cr);
 
-        svg_cairo_render (svgs[svgIndex], cr);
+        if (recordedSvgIndex != svgIndex) {
+          cairo_t *rec = displayList.beginRecording();
+          svg_cairo_render (svgs[svgIndex], rec);
+          displayList.endRecording(rec);
+          recordedSvgIndex = svgIndex;
+        }
+
+        if (displayList.isRecorded())
+          displayList.replay(cr);
+        else
+          svg_cairo_render (svgs[svgIndex], cr);
     }
 
     void setupCairoMatrix(cairo_t *cr) {
@@ -0,0 +1,99 @@
+/* Cairo - a vector graphics library with display and print output
+ *
+ * Copyright © 2009 Argiris Kirtzidis
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it either under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation
+ * (the "LGPL") or, at your option, under the terms of the Mozilla
+ * Public License Version 1.1 (the "MPL"). If you do not alter this
+ * notice, a recipient may use your version of this file under either
+ * the MPL or the LGPL.
+ *
+ * You should have received a copy of the LGPL along with this library
+ * in the file COPYING-LGPL-2.1; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ * You should have received a copy of the MPL along with this library
+ * in the file COPYING-MPL-1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY
+ * OF ANY KIND, either express or implied. See the LGPL or the MPL for
+ * the specific language governing rights and limitations.
+ *
+ * The Original Code is the cairo graphics library.
+ *
+ * The Initial Developer of the Original Code is Argiris Kirtzidis.
+ */
+
+#include "cairo-boilerplate.h"
+#include "cairo-boilerplate-gral-private.h"
+
+#include <gral-soft.h>
+
+/* The tests and benchmarks run headless, on the software gral backend,
+ * which renders the same draws as the GPU backends. */
+
+typedef struct _gral_target_closure {
+    gral_surface_t *gral_surf;
+    cairo_surface_t *surface;
+} gral_target_closure_t;
+
+cairo_surface_t *
+_cairo_boilerplate_gral_create_surface (const char			 *name,
+					cairo_content_t			  content,
+					int				  width,
+					int				  height,
+					int				  max_width,
+					int				  max_height,
+					cairo_boilerplate_mode_t	  mode,
+					int				  id,
+					void				**closure)
+{
+    gral_target_closure_t *gtc;
+
+    if (width == 0)
+	width = 1;
+    if (height == 0)
+	height = 1;
+
+    *closure = gtc = xmalloc (sizeof (gral_target_closure_t));
+
+    gtc->gral_surf = gral_soft_surface_create (width, height);
+    if (gtc->gral_surf == NULL) {
+	free (gtc);
+	*closure = NULL;
+	return NULL;
+    }
+
+    gtc->surface = cairo_gral_surface_create (gtc->gral_surf);
+    return gtc->surface;
+}
+
+void
+_cairo_boilerplate_gral_synchronize (void *closure)
+{
+    gral_target_closure_t *gtc = closure;
+    uint32_t pixel;
+
+    /* Submit the fills cairo-gral is still batching, then wait for gral
+     * to render them by reading a pixel back. */
+    cairo_surface_flush (gtc->surface);
+    gral_read_pixels (gtc->gral_surf, 0, 0, 1, 1, &pixel, sizeof (pixel));
+}
+
+void
+_cairo_boilerplate_gral_cleanup (void *closure)
+{
+    gral_target_closure_t *gtc = closure;
+
+    if (gtc == NULL)
+	return;
+
+    gral_soft_surface_destroy (gtc->gral_surf);
+    free (gtc);
+}
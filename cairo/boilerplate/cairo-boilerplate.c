@@ -38,6 +38,9 @@
 #if CAIRO_HAS_GLITZ_SURFACE
 #include "cairo-boilerplate-glitz-private.h"
 #endif
+#if CAIRO_HAS_GRAL_SURFACE
+#include "cairo-boilerplate-gral-private.h"
+#endif
 #if CAIRO_HAS_PDF_SURFACE
 #include "cairo-boilerplate-pdf-private.h"
 #endif
@@ -418,6 +421,18 @@ static cairo_boilerplate_target_t targets[] =
     },
 #endif
 #endif /* CAIRO_HAS_GLITZ_SURFACE */
+#if CAIRO_HAS_GRAL_SURFACE
+    {
+	"gral", "gral", NULL,
+	CAIRO_SURFACE_TYPE_GRAL, CAIRO_CONTENT_COLOR_ALPHA, 0,
+	_cairo_boilerplate_gral_create_surface, NULL,
+	NULL,
+	_cairo_boilerplate_get_image_surface,
+	cairo_surface_write_to_png,
+	_cairo_boilerplate_gral_cleanup,
+	_cairo_boilerplate_gral_synchronize
+    },
+#endif
 #if CAIRO_HAS_QUARTZ_SURFACE
     {
 	"quartz", "quartz", NULL,
@@ -0,0 +1,437 @@
+/* -*- Mode: c; c-basic-offset: 4; indent-tabs-mode: t; tab-width: 8; -*- */
+/*
+ * Copyright © 2009 Argiris Kirtzidis
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the authors not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The authors make no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: Argiris Kirtzidis <akyrtzi@gmail.com>
+ */
+
+/* Renders the SVG sample media (the same files Demo_SvgViewer shows)
+ * through every measurable boilerplate target, over a matrix of zoom,
+ * rotation and tolerance settings.  The output follows cairo-perf's
+ * format so cairo-perf-diff-files can compare two runs; for gral
+ * targets the per-frame triangle and draw call counts follow each
+ * result on a "[ # ]" line, which the report parser skips. */
+
+#include "cairo-perf.h"
+#include "cairo-stats.h"
+
+#include "cairo-boilerplate-getopt.h"
+
+#include <svg-cairo.h>
+
+#if CAIRO_HAS_GRAL_SURFACE
+#include <cairo-gral.h>
+#endif
+
+#include <math.h>
+
+#define CAIRO_PERF_ITERATIONS_DEFAULT	100
+#define CAIRO_PERF_LOW_STD_DEV		0.03
+#define CAIRO_PERF_STABLE_STD_DEV_COUNT	5
+
+#define SVG_MEDIA_DIR_DEFAULT		"../../Samples/Media"
+#define SVG_SIZE_DEFAULT		512
+
+static const char *default_files[] = {
+    "lion.svg",
+    "tiger.svg",
+    "circles.svg"
+};
+
+static const double zooms[] = { 0.25, 1.0, 4.0 };
+static const double rotations[] = { 0.0, 30.0 };
+static const double tolerances[] = { 0.1, 1.0 };
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof ((a)[0]))
+
+typedef struct _svg_perf {
+    unsigned int iterations;
+    cairo_bool_t exact_iterations;
+    cairo_bool_t raw;
+    int size;
+    const char *media_dir;
+    const char **files;
+    int num_files;
+    cairo_perf_ticks_t *times;
+} svg_perf_t;
+
+typedef struct _svg_doc {
+    svg_cairo_t *svg;
+    char name[64];
+    unsigned int width, height;
+} svg_doc_t;
+
+static cairo_bool_t
+target_is_measurable (cairo_boilerplate_target_t *target)
+{
+#if CAIRO_HAS_GRAL_SURFACE
+    if (target->expected_type == CAIRO_SURFACE_TYPE_GRAL)
+	return TRUE;
+#endif
+
+    /* Vector and meta surfaces only record the drawing, there is
+     * nothing to time. */
+    return ! target->is_vector && ! target->is_meta;
+}
+
+static cairo_bool_t
+svg_doc_load (svg_doc_t *doc, const char *dir, const char *file)
+{
+    char path[1024];
+    const char *base;
+    char *dot;
+
+    snprintf (path, sizeof (path), "%s/%s", dir, file);
+
+    if (svg_cairo_create (&doc->svg) != SVG_CAIRO_STATUS_SUCCESS)
+	return FALSE;
+
+    if (svg_cairo_parse (doc->svg, path) != SVG_CAIRO_STATUS_SUCCESS) {
+	fprintf (stderr, "Error: Failed to parse %s\n", path);
+	svg_cairo_destroy (doc->svg);
+	doc->svg = NULL;
+	return FALSE;
+    }
+
+    svg_cairo_get_size (doc->svg, &doc->width, &doc->height);
+    if (doc->width == 0 || doc->height == 0) {
+	fprintf (stderr, "Error: %s has no size\n", path);
+	svg_cairo_destroy (doc->svg);
+	doc->svg = NULL;
+	return FALSE;
+    }
+
+    base = strrchr (file, '/');
+    base = base ? base + 1 : file;
+    snprintf (doc->name, sizeof (doc->name), "%s", base);
+    dot = strrchr (doc->name, '.');
+    if (dot)
+	*dot = '\0';
+
+    return TRUE;
+}
+
+/* Same view setup as Demo_SvgViewer: the document is fitted to the
+ * surface, then zoomed and rotated around its centre. */
+static cairo_perf_ticks_t
+svg_render (cairo_t *cr, const svg_doc_t *doc, int size,
+	    double zoom, double rotation, double tolerance)
+{
+    double scale;
+
+    scale = zoom * size / (doc->width > doc->height ? doc->width : doc->height);
+
+    cairo_perf_timer_start ();
+
+    cairo_save (cr);
+    cairo_set_source_rgb (cr, 1, 1, 1);
+    cairo_paint (cr);
+
+    cairo_translate (cr, size / 2., size / 2.);
+    cairo_rotate (cr, rotation * M_PI / 180.);
+    cairo_scale (cr, scale, scale);
+    cairo_translate (cr, -(doc->width / 2.), -(doc->height / 2.));
+    cairo_set_tolerance (cr, tolerance);
+
+    svg_cairo_render (doc->svg, cr);
+    cairo_restore (cr);
+
+    cairo_perf_timer_stop ();
+
+    return cairo_perf_timer_elapsed ();
+}
+
+static void
+svg_perf_run (svg_perf_t			*perf,
+	      cairo_boilerplate_target_t	*target,
+	      cairo_surface_t			*surface,
+	      cairo_t				*cr,
+	      const svg_doc_t			*doc,
+	      double				 zoom,
+	      double				 rotation,
+	      double				 tolerance,
+	      int				*test_number)
+{
+    cairo_perf_ticks_t *times = perf->times;
+    cairo_stats_t stats = {0.0, 0.0};
+    int low_std_dev_count;
+    unsigned int i, frames;
+    char name[128];
+
+    snprintf (name, sizeof (name), "svg-%s-z%g-r%g-t%g",
+	      doc->name, zoom, rotation, tolerance);
+
+    /* We run one iteration in advance to warm caches, etc. */
+    cairo_perf_yield ();
+    svg_render (cr, doc, perf->size, zoom, rotation, tolerance);
+
+#if CAIRO_HAS_GRAL_SURFACE
+    if (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_GRAL) {
+	/* The surface only resets its own counters, not the gral ones. */
+	cairo_gral_surface_reset_stats (surface);
+	gral_reset_stats ();
+    }
+#endif
+
+    low_std_dev_count = 0;
+    frames = 0;
+    for (i = 0; i < perf->iterations; i++) {
+	cairo_perf_yield ();
+	times[i] = svg_render (cr, doc, perf->size, zoom, rotation, tolerance);
+	frames++;
+
+	if (perf->raw) {
+	    if (i == 0)
+		printf ("[*] %s-%s %s-%d %g",
+			target->name, "rgba",
+			name, perf->size,
+			cairo_perf_ticks_per_second () / 1000.0);
+	    printf (" %lld", (long long) times[i]);
+	} else if (! perf->exact_iterations) {
+	    if (i > 0) {
+		_cairo_stats_compute (&stats, times, i+1);
+
+		if (stats.std_dev <= CAIRO_PERF_LOW_STD_DEV)
+		{
+		    low_std_dev_count++;
+		    if (low_std_dev_count >= CAIRO_PERF_STABLE_STD_DEV_COUNT)
+			break;
+		} else {
+		    low_std_dev_count = 0;
+		}
+	    }
+	}
+    }
+
+    if (perf->raw) {
+	printf ("\n");
+    } else {
+	_cairo_stats_compute (&stats, times, i);
+	printf ("[%3d] %8s-%-5s %26s-%-3d ",
+		*test_number, target->name, "rgba",
+		name, perf->size);
+
+	printf ("%10lld %#8.3f %#8.3f %#5.2f%% %3d\n",
+		(long long) stats.min_ticks,
+		(stats.min_ticks * 1000.0) / cairo_perf_ticks_per_second (),
+		(stats.median_ticks * 1000.0) / cairo_perf_ticks_per_second (),
+		stats.std_dev * 100.0, stats.iterations);
+    }
+
+#if CAIRO_HAS_GRAL_SURFACE
+    if (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_GRAL && frames) {
+	cairo_gral_stats_t gral_stats;
+
+	cairo_gral_surface_get_stats (surface, &gral_stats);
+	printf ("[ # ] %8s %32s-%-3d triangles %lu draw-calls %lu fallbacks %lu\n",
+		target->name, name, perf->size,
+		gral_stats.gral.triangles / frames,
+		gral_stats.gral.draw_calls / frames,
+		gral_stats.fallbacks / frames);
+    }
+#endif
+
+    (*test_number)++;
+}
+
+static void
+usage (const char *argv0)
+{
+    fprintf (stderr,
+	     "Usage: %s [-r] [-i iterations] [-s size] [-d media-dir] [files ...]\n"
+	     "\n"
+	     "Render SVG files through each cairo backend over a matrix of zoom,\n"
+	     "rotation and tolerance settings, and report the time per frame.\n"
+	     "The command-line arguments are interpreted as follows:\n"
+	     "\n"
+	     "  -r	raw; display each time measurement instead of summary statistics\n"
+	     "  -i	iterations; specify the number of iterations per test case\n"
+	     "  -s	size; width and height of the target surface (default %d)\n"
+	     "  -d	media-dir; directory the files are loaded from (default %s)\n"
+	     "\n"
+	     "Without file names the Ogre sample media (lion, tiger and circles) is used.\n",
+	     argv0, SVG_SIZE_DEFAULT, SVG_MEDIA_DIR_DEFAULT);
+}
+
+static void
+parse_options (svg_perf_t *perf, int argc, char *argv[])
+{
+    int c;
+    const char *iters;
+    char *end;
+
+    if ((iters = getenv("CAIRO_PERF_ITERATIONS")) && *iters)
+	perf->iterations = strtol(iters, NULL, 0);
+    else
+	perf->iterations = CAIRO_PERF_ITERATIONS_DEFAULT;
+    perf->exact_iterations = 0;
+
+    perf->raw = FALSE;
+    perf->size = SVG_SIZE_DEFAULT;
+    perf->media_dir = SVG_MEDIA_DIR_DEFAULT;
+    perf->files = default_files;
+    perf->num_files = ARRAY_LENGTH (default_files);
+
+    while (1) {
+	c = _cairo_getopt (argc, argv, "i:rs:d:");
+	if (c == -1)
+	    break;
+
+	switch (c) {
+	case 'i':
+	    perf->exact_iterations = TRUE;
+	    perf->iterations = strtoul (optarg, &end, 10);
+	    if (*end != '\0') {
+		fprintf (stderr, "Invalid argument for -i (not an integer): %s\n",
+			 optarg);
+		exit (1);
+	    }
+	    break;
+	case 'r':
+	    perf->raw = TRUE;
+	    break;
+	case 's':
+	    perf->size = strtoul (optarg, &end, 10);
+	    if (*end != '\0' || perf->size <= 0) {
+		fprintf (stderr, "Invalid argument for -s (not a size): %s\n",
+			 optarg);
+		exit (1);
+	    }
+	    break;
+	case 'd':
+	    perf->media_dir = optarg;
+	    break;
+	default:
+	    fprintf (stderr, "Internal error: unhandled option: %c\n", c);
+	    /* fall-through */
+	case '?':
+	    usage (argv[0]);
+	    exit (1);
+	}
+    }
+    if (optind < argc) {
+	perf->files = (const char **) &argv[optind];
+	perf->num_files = argc - optind;
+	perf->media_dir = ".";
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    svg_perf_t perf;
+    svg_doc_t *docs;
+    cairo_boilerplate_target_t **targets;
+    int num_targets, num_docs;
+    int i, j;
+    unsigned int z, r, t;
+
+    parse_options (&perf, argc, argv);
+
+    if (perf.iterations == 0)
+	perf.iterations = 1;
+
+    docs = xmalloc (perf.num_files * sizeof (svg_doc_t));
+    for (i = num_docs = 0; i < perf.num_files; i++) {
+	if (svg_doc_load (&docs[num_docs], perf.media_dir, perf.files[i]))
+	    num_docs++;
+    }
+    if (num_docs == 0) {
+	fprintf (stderr, "Error: No SVG files could be loaded\n");
+	free (docs);
+	return 1;
+    }
+
+    targets = cairo_boilerplate_get_targets (&num_targets, NULL);
+    perf.times = xmalloc (perf.iterations * sizeof (cairo_perf_ticks_t));
+
+    if (perf.raw)
+	printf ("[ # ] %s-%-s %s %s %s ...\n",
+		"backend", "content", "test-size", "ticks-per-ms", "time(ticks)");
+    else
+	printf ("[ # ] %8s-%-4s %28s %8s %8s %5s %5s %s\n",
+		"backend", "content", "test-size", "min(ticks)", "min(ms)", "median(ms)",
+		"stddev.", "iterations");
+
+    for (i = 0; i < num_targets; i++) {
+	cairo_boilerplate_target_t *target = targets[i];
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	void *closure;
+	int test_number = 0;
+
+	if (! target_is_measurable (target))
+	    continue;
+
+	/* The SVG documents carry their own alpha, so only render to
+	 * the targets that keep it. */
+	if (target->content != CAIRO_CONTENT_COLOR_ALPHA)
+	    continue;
+
+	surface = (target->create_surface) (NULL,
+					    target->content,
+					    perf.size, perf.size,
+					    perf.size, perf.size,
+					    CAIRO_BOILERPLATE_MODE_PERF,
+					    0,
+					    &closure);
+	if (surface == NULL) {
+	    fprintf (stderr,
+		     "Error: Failed to create target surface: %s\n",
+		     target->name);
+	    continue;
+	}
+
+	cairo_perf_timer_set_synchronize (target->synchronize, closure);
+
+	cr = cairo_create (surface);
+
+	for (j = 0; j < num_docs; j++)
+	    for (z = 0; z < ARRAY_LENGTH (zooms); z++)
+		for (r = 0; r < ARRAY_LENGTH (rotations); r++)
+		    for (t = 0; t < ARRAY_LENGTH (tolerances); t++)
+			svg_perf_run (&perf, target, surface, cr, &docs[j],
+				      zooms[z], rotations[r], tolerances[t],
+				      &test_number);
+
+	if (cairo_status (cr)) {
+	    fprintf (stderr, "Error: Test left cairo in an error state: %s\n",
+		     cairo_status_to_string (cairo_status (cr)));
+	}
+
+	cairo_destroy (cr);
+	cairo_surface_destroy (surface);
+
+	if (target->cleanup)
+	    target->cleanup (closure);
+    }
+
+    for (j = 0; j < num_docs; j++)
+	svg_cairo_destroy (docs[j].svg);
+    free (docs);
+
+    cairo_boilerplate_free_targets (targets);
+    free (perf.times);
+    cairo_debug_reset_static_data ();
+
+    return 0;
+}
@@ -33,6 +33,10 @@
 
 #include "cairo-boilerplate-getopt.h"
 
+#if CAIRO_HAS_GRAL_SURFACE
+#include <cairo-gral.h>
+#endif
+
 #if CAIRO_HAS_SDL_SURFACE
 #include <SDL_main.h>
 #endif
@@ -70,6 +74,12 @@ const cairo_perf_case_t perf_cases[];
 static cairo_bool_t
 target_is_measurable (cairo_boilerplate_target_t *target)
 {
+#if CAIRO_HAS_GRAL_SURFACE
+    /* Not a member of cairo_surface_type_t, so it can't be a case below. */
+    if (target->expected_type == CAIRO_SURFACE_TYPE_GRAL)
+	return TRUE;
+#endif
+
     switch (target->expected_type) {
     case CAIRO_SURFACE_TYPE_IMAGE:
 	if (strcmp (target->name, "pdf") == 0 ||
@@ -38,6 +38,194 @@
 
 cairo_gral_gpu_resources_t shared_gpu_resources = {0,0,0,0,0,0,0,0};
 
+static unsigned int max_batch_trigs = CAIRO_GRAL_DEFAULT_MAX_BATCH_TRIGS;
+
+/**
+ * cairo_gral_set_max_batch_size:
+ * @max_triangles: the maximum number of triangles of a single draw, or 0 for
+ * the default
+ *
+ * Paths that tesselate to more triangles are split into several draws. The
+ * vertex and index buffers grow on demand up to this size and are kept
+ * around, so a lower limit bounds the memory they use.
+ **/
+void
+cairo_gral_set_max_batch_size (unsigned int max_triangles)
+{
+  if (max_triangles == 0)
+    max_triangles = CAIRO_GRAL_DEFAULT_MAX_BATCH_TRIGS;
+  max_batch_trigs = max_triangles;
+}
+
+unsigned int
+cairo_gral_get_max_batch_size (void)
+{
+  return max_batch_trigs;
+}
+
+size_t
+_cairo_gral_get_max_batch_indices (void)
+{
+  return (size_t) max_batch_trigs * 3;
+}
+
+static size_t memory_budget = CAIRO_GRAL_DEFAULT_MEMORY_BUDGET;
+
+/**
+ * cairo_gral_set_memory_budget:
+ * @bytes: the GPU memory that cairo-gral may keep in caches, or 0 for no limit
+ *
+ * Before each drawing operation the least recently used textures and cached
+ * meshes (of glyphs and display lists) are evicted until they fit in @bytes;
+ * they are created again when needed. Render targets and the dynamic vertex
+ * and index buffers are never evicted and don't count towards the budget,
+ * so it only bounds what the caches keep on top of them; see
+ * cairo_gral_get_memory_stats().
+ **/
+void
+cairo_gral_set_memory_budget (size_t bytes)
+{
+  memory_budget = bytes;
+}
+
+size_t
+cairo_gral_get_memory_budget (void)
+{
+  return memory_budget;
+}
+
+/**
+ * cairo_gral_get_memory_stats:
+ * @stats: return location for the memory stats
+ *
+ * Gets the GPU memory that cairo-gral uses, by kind of resource. It's shared
+ * by all the surfaces and display lists.
+ **/
+void
+cairo_gral_get_memory_stats (cairo_gral_memory_stats_t *stats)
+{
+  cairo_gral_memory_t *memory = &shared_gpu_resources.memory;
+
+  stats->buffers = memory->bytes[CAIRO_GRAL_RESOURCE_BUFFERS];
+  stats->textures = memory->bytes[CAIRO_GRAL_RESOURCE_TEXTURES];
+  stats->ramps = memory->bytes[CAIRO_GRAL_RESOURCE_RAMPS];
+  stats->meshes = memory->bytes[CAIRO_GRAL_RESOURCE_MESHES];
+  stats->render_targets = memory->bytes[CAIRO_GRAL_RESOURCE_RENDER_TARGETS];
+  stats->total = memory->total;
+  stats->evictable = memory->evictable;
+  stats->budget = memory_budget;
+  stats->evictions = memory->evictions;
+}
+
+/* Returns the flattening tolerance for a path with the given device extents.
+ * Small paths, like the ones of a thumbnail or a zoomed out view, are
+ * flattened with fewer segments; the tolerance only changes in powers of two
+ * so that the stroke pens that are cached by tolerance can still be reused
+ * while zooming. */
+double
+_cairo_gral_lod_tolerance (double                       tolerance,
+                           const cairo_rectangle_int_t *extents)
+{
+#if CAIRO_GRAL_DISABLE_LOD
+  return tolerance;
+#else
+  int size = MAX (extents->width, extents->height);
+
+  if (size < 1)
+    size = 1;
+
+  while (size * 2 <= CAIRO_GRAL_LOD_SIZE &&
+         tolerance * 2 <= CAIRO_GRAL_LOD_MAX_TOLERANCE) {
+    size *= 2;
+    tolerance *= 2;
+  }
+
+  return tolerance;
+#endif
+}
+
+void
+_cairo_gral_surface_get_clip_extents (cairo_gral_surface_t  *gsurface,
+                                      cairo_rectangle_int_t *extents)
+{
+  extents->x = extents->y = 0;
+  extents->width = gral_surface_get_width (gsurface->gral_surf);
+  extents->height = gral_surface_get_height (gsurface->gral_surf);
+
+  if (gsurface->has_clip)
+    _cairo_rectangle_intersect (extents, &gsurface->clip_extents);
+}
+
+/* Computes the guard band for a path with the given extents: the clip
+ * extents grown by CAIRO_GRAL_GUARD_BAND and by the distance (dx, dy) that
+ * the geometry reaches away from the path. Returns FALSE if the path is
+ * inside of it, then no curve can be skipped. */
+cairo_bool_t
+_cairo_gral_surface_get_guard_band (cairo_gral_surface_t        *gsurface,
+                                    const cairo_rectangle_int_t *extents,
+                                    double                       dx,
+                                    double                       dy,
+                                    cairo_box_t                 *band)
+{
+  cairo_rectangle_int_t clip;
+  int x1, y1, x2, y2;
+
+  _cairo_gral_surface_get_clip_extents (gsurface, &clip);
+  x1 = clip.x - CAIRO_GRAL_GUARD_BAND - (int) ceil (dx);
+  y1 = clip.y - CAIRO_GRAL_GUARD_BAND - (int) ceil (dy);
+  x2 = clip.x + (int) clip.width + CAIRO_GRAL_GUARD_BAND + (int) ceil (dx);
+  y2 = clip.y + (int) clip.height + CAIRO_GRAL_GUARD_BAND + (int) ceil (dy);
+
+  if (extents->x >= x1 && extents->y >= y1 &&
+      extents->x + (int) extents->width <= x2 &&
+      extents->y + (int) extents->height <= y2)
+    return FALSE;
+
+  band->p1.x = _cairo_fixed_from_int (x1);
+  band->p1.y = _cairo_fixed_from_int (y1);
+  band->p2.x = _cairo_fixed_from_int (x2);
+  band->p2.y = _cairo_fixed_from_int (y2);
+  return TRUE;
+}
+
+/* Returns TRUE if all the control points of the spline are beyond the same
+ * edge of the box. The spline is inside of the hull of its control points, so
+ * it doesn't enter the box and neither does the area between the spline and
+ * the line from a to d. */
+cairo_bool_t
+_cairo_gral_spline_outside_box (const cairo_box_t   *box,
+                                const cairo_point_t *a,
+                                const cairo_point_t *b,
+                                const cairo_point_t *c,
+                                const cairo_point_t *d)
+{
+  if (a->x < box->p1.x && b->x < box->p1.x && c->x < box->p1.x && d->x < box->p1.x)
+    return TRUE;
+  if (a->x > box->p2.x && b->x > box->p2.x && c->x > box->p2.x && d->x > box->p2.x)
+    return TRUE;
+  if (a->y < box->p1.y && b->y < box->p1.y && c->y < box->p1.y && d->y < box->p1.y)
+    return TRUE;
+  if (a->y > box->p2.y && b->y > box->p2.y && c->y > box->p2.y && d->y > box->p2.y)
+    return TRUE;
+
+  return FALSE;
+}
+
+/* Counts the dynamic buffers, after they were created or replaced. */
+static void
+_cairo_gral_gpu_resources_count_buffers (cairo_gral_gpu_resources_t *gpu)
+{
+  size_t size = gral_vertex_buffer_get_size (gpu->vertex_buf_pos) +
+                gral_vertex_buffer_get_size (gpu->vertex_buf_tex) +
+                gral_index_buffer_get_size (gpu->index_buf);
+
+  if (gpu->index_buf_32)
+    size += gral_index_buffer_get_size (gpu->index_buf_32);
+
+  _cairo_gral_memory_add (gpu, &gpu->buffers_resource,
+                          CAIRO_GRAL_RESOURCE_BUFFERS, size, NULL);
+}
+
 static void
 _cairo_gral_gpu_resources_init (cairo_gral_gpu_resources_t *gpu) {
 
@@ -48,53 +236,70 @@ _cairo_gral_gpu_resources_init (cairo_gral_gpu_resources_t *gpu) {
   gpu->caps &= ~GRAL_CAP_FRAGMENT_PROGRAM;
 #endif
 
-  gpu->vertex_buf_pos = gral_vertex_buffer_create (sizeof(cairo_gral_vertex_pos_t),
-                                          CAIRO_GRAL_MAX_VERTICES,
+  if (gpu->caps & GRAL_CAP_VERTEX_POSITION_FLOAT2) {
+    gpu->pos_type = GRAL_VERTEX_ELEMENT_TYPE_FLOAT2;
+    gpu->pos_size = 2 * sizeof(float);
+  } else {
+    gpu->pos_type = GRAL_VERTEX_ELEMENT_TYPE_FLOAT3;
+    gpu->pos_size = 3 * sizeof(float);
+  }
+  gral_matrix_init_identity (&gpu->world_matrix);
+
+  /* Big enough for all the position formats. */
+  gpu->vertex_buf_pos = gral_vertex_buffer_create (gpu->pos_size,
+                                          CAIRO_GRAL_INITIAL_BATCH_TRIGS*3,
                                           GRAL_BUFFER_USAGE_DYNAMIC_WRITE_ONLY_DISCARDABLE);
   gpu->vertex_buf_tex = gral_vertex_buffer_create (sizeof(cairo_gral_tex_coord3_t),
-                                          CAIRO_GRAL_MAX_VERTICES,
+                                          CAIRO_GRAL_INITIAL_BATCH_TRIGS*3,
                                           GRAL_BUFFER_USAGE_DYNAMIC_WRITE_ONLY_DISCARDABLE);
-  gpu->index_buf = gral_index_buffer_create (
-#if CAIRO_GRAL_USE_SHORT_INDICES
-        GRAL_INDEX_BUFFER_TYPE_16BIT,
-#else
-        GRAL_INDEX_BUFFER_TYPE_32BIT,
-#endif
-        CAIRO_GRAL_MAX_INDICES,
-        GRAL_BUFFER_USAGE_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+  gpu->index_buf = gral_index_buffer_create (GRAL_INDEX_BUFFER_TYPE_16BIT,
+                                             CAIRO_GRAL_INITIAL_BATCH_TRIGS*3,
+                                             GRAL_BUFFER_USAGE_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+  _cairo_gral_gpu_resources_count_buffers (gpu);
 
   {
     gral_vertex_data_t *vd = gral_vertex_data_create ();
     gral_vertex_data_set_start (vd, 0);
     gral_vertex_data_add_element (vd, 0/*source*/, 0/*offset*/,
-                                  GRAL_VERTEX_ELEMENT_TYPE_FLOAT3,
+                                  gpu->pos_type,
                                   GRAL_VERTEX_ELEMENT_SEMANTIC_POSITION, 0/*index*/);
     gral_vertex_data_add_element (vd, 1/*source*/, 0/*offset*/,
-                                  GRAL_VERTEX_ELEMENT_TYPE_FLOAT3,
+                                  gpu->pos_type,
                                   GRAL_VERTEX_ELEMENT_SEMANTIC_TEXTURE_COORDINATES, 0/*index*/);
     gral_vertex_data_bind_buffer (vd, 0/*source*/, gpu->vertex_buf_pos);
     gral_vertex_data_bind_buffer (vd, 1/*source*/, gpu->vertex_buf_pos);
     gpu->vertex_data_source = vd;
-    assert (gral_vertex_data_get_vertex_size (vd, 0) == sizeof(cairo_gral_vertex_pos_t));
-    assert (gral_vertex_data_get_vertex_size (vd, 1) == sizeof(cairo_gral_vertex_pos_t));
+    assert (gral_vertex_data_get_vertex_size (vd, 0) == gpu->pos_size);
+    assert (gral_vertex_data_get_vertex_size (vd, 1) == gpu->pos_size);
   }
 
   {
     gral_vertex_data_t *vd = gral_vertex_data_create ();
     gral_vertex_data_set_start (vd, 0);
     gral_vertex_data_add_element (vd, 0/*source*/, 0/*offset*/,
-                                  GRAL_VERTEX_ELEMENT_TYPE_FLOAT3,
+                                  gpu->pos_type,
                                   GRAL_VERTEX_ELEMENT_SEMANTIC_POSITION, 0/*index*/);
     gral_vertex_data_bind_buffer (vd, 0/*source*/, gpu->vertex_buf_pos);
     gpu->vertex_data_stencil = vd;
-    assert (gral_vertex_data_get_vertex_size (vd, 0) == sizeof(cairo_gral_vertex_pos_t));
+    assert (gral_vertex_data_get_vertex_size (vd, 0) == gpu->pos_size);
+  }
+
+  if (gpu->caps & GRAL_CAP_VERTEX_POSITION_SHORT2) {
+    gral_vertex_data_t *vd = gral_vertex_data_create ();
+    gral_vertex_data_set_start (vd, 0);
+    gral_vertex_data_add_element (vd, 0/*source*/, 0/*offset*/,
+                                  GRAL_VERTEX_ELEMENT_TYPE_SHORT2,
+                                  GRAL_VERTEX_ELEMENT_SEMANTIC_POSITION, 0/*index*/);
+    gral_vertex_data_bind_buffer (vd, 0/*source*/, gpu->vertex_buf_pos);
+    gpu->vertex_data_stencil_short = vd;
+    assert (gral_vertex_data_get_vertex_size (vd, 0) == 2 * sizeof(int16_t));
   }
 
   {
     gral_vertex_data_t *vd = gral_vertex_data_create ();
     gral_vertex_data_set_start (vd, 0);
     gral_vertex_data_add_element (vd, 0/*source*/, 0/*offset*/,
-                                  GRAL_VERTEX_ELEMENT_TYPE_FLOAT3,
+                                  gpu->pos_type,
                                   GRAL_VERTEX_ELEMENT_SEMANTIC_POSITION, 0/*index*/);
     gral_vertex_data_add_element (vd, 1/*source*/, 0/*offset*/,
                                   GRAL_VERTEX_ELEMENT_TYPE_FLOAT3,
@@ -102,7 +307,7 @@ _cairo_gral_gpu_resources_init (cairo_gral_gpu_resources_t *gpu) {
     gral_vertex_data_bind_buffer (vd, 0/*source*/, gpu->vertex_buf_pos);
     gral_vertex_data_bind_buffer (vd, 1/*source*/, gpu->vertex_buf_tex);
     gpu->vertex_data_spline = vd;
-    assert (gral_vertex_data_get_vertex_size (vd, 0) == sizeof(cairo_gral_vertex_pos_t));
+    assert (gral_vertex_data_get_vertex_size (vd, 0) == gpu->pos_size);
     assert (gral_vertex_data_get_vertex_size (vd, 1) == sizeof(cairo_gral_tex_coord3_t));
   }
 
@@ -112,6 +317,25 @@ _cairo_gral_gpu_resources_init (cairo_gral_gpu_resources_t *gpu) {
     gral_index_data_set_buffer (id, gpu->index_buf);
     gpu->index_data = id;
   }
+
+  /* Load the programs now rather than in the middle of the first frame that
+   * needs them; see gral_set_program_cache_dir to skip compiling them. */
+  if (gpu->caps & GRAL_CAP_FRAGMENT_PROGRAM) {
+    gpu->radial_shader =
+        _cairo_gral_load_fragment_program ("fp_radial_gradient", "ps_2_0 arbfp1");
+#if !CAIRO_GRAL_DISABLE_SHADER_STOPS
+    gpu->linear_stops_shader =
+        _cairo_gral_load_fragment_program ("fp_linear_gradient_stops", "ps_2_0 arbfp1");
+    gpu->radial_stops_shader =
+        _cairo_gral_load_fragment_program ("fp_radial_gradient_stops", "ps_2_0 arbfp1");
+#endif
+#if !CAIRO_GRAL_DISABLE_GPU_SPLINE_RENDERING
+    gpu->spline_fill_shader =
+        _cairo_gral_load_fragment_program ("fp_cubic_bezier_fill", "ps_2_0 arbfp1");
+#endif
+    gpu->dash_shader =
+        _cairo_gral_load_fragment_program ("fp_dash", "ps_2_0 arbfp1");
+  }
 }
 
 cairo_gral_gpu_resources_t *
@@ -134,24 +358,200 @@ _cairo_gral_gpu_resources_release (cairo_gral_gpu_resources_t *gpu)
   if (! _cairo_reference_count_dec_and_test (&gpu->ref_count))
     return;
 
+  _cairo_gral_memory_fini (gpu);
+
   gral_vertex_buffer_destroy (gpu->vertex_buf_pos);
   gral_vertex_buffer_destroy (gpu->vertex_buf_tex);
   gral_index_buffer_destroy (gpu->index_buf);
+  if (gpu->index_buf_32)
+    gral_index_buffer_destroy (gpu->index_buf_32);
   gral_vertex_data_destroy (gpu->vertex_data_source);
   gral_vertex_data_destroy (gpu->vertex_data_stencil);
+  if (gpu->vertex_data_stencil_short)
+    gral_vertex_data_destroy (gpu->vertex_data_stencil_short);
   gral_vertex_data_destroy (gpu->vertex_data_spline);
   gral_index_data_destroy (gpu->index_data);
 
   if (gpu->gral_tex)
     gral_texture_destroy (gpu->gral_tex);
+  if (gpu->image_tex)
+    gral_texture_destroy (gpu->image_tex);
   if (gpu->radial_shader)
     gral_cg_program_destroy (gpu->radial_shader);
+  if (gpu->linear_stops_shader)
+    gral_cg_program_destroy (gpu->linear_stops_shader);
+  if (gpu->radial_stops_shader)
+    gral_cg_program_destroy (gpu->radial_stops_shader);
   if (gpu->spline_fill_shader)
     gral_cg_program_destroy (gpu->spline_fill_shader);
+  if (gpu->dash_tex)
+    gral_texture_destroy (gpu->dash_tex);
+  if (gpu->dash_shader)
+    gral_cg_program_destroy (gpu->dash_shader);
+  if (gpu->unit_quad)
+    _cairo_gral_cached_mesh_destroy (gpu->unit_quad);
+
+  _cairo_gral_pen_cache_fini (&gpu->pen_cache);
+
+  assert (! gpu->mesh_storage.in_use);
+  free (gpu->mesh_storage.vertices);
+  free (gpu->mesh_storage.tex_coords);
+  free (gpu->mesh_storage.indices);
 
   memset (gpu, 0, sizeof(cairo_gral_gpu_resources_t));
 }
 
+/* Returns the new size for a buffer holding count items, growing
+ * geometrically so that a path that keeps getting bigger doesn't cause a
+ * buffer re-creation on every draw. */
+static size_t
+_cairo_gral_grown_buffer_count (size_t current, size_t count)
+{
+  if (current == 0)
+    current = CAIRO_GRAL_INITIAL_BATCH_TRIGS*3;
+  while (current < count)
+    current *= 2;
+  return current;
+}
+
+static cairo_status_t
+_cairo_gral_reserve_vertex_buffer (gral_vertex_buffer_t **pbuf,
+                                   size_t                 vertex_size,
+                                   size_t                 num_vertices)
+{
+  size_t current = gral_vertex_buffer_get_size (*pbuf) / vertex_size;
+  gral_vertex_buffer_t *buf;
+
+  if (num_vertices <= current)
+    return CAIRO_STATUS_SUCCESS;
+
+  buf = gral_vertex_buffer_create (vertex_size,
+                                   _cairo_gral_grown_buffer_count (current, num_vertices),
+                                   GRAL_BUFFER_USAGE_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+  if (unlikely (buf == NULL))
+    return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+
+  gral_vertex_buffer_destroy (*pbuf);
+  *pbuf = buf;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+static cairo_status_t
+_cairo_gral_reserve_index_buffer (gral_index_buffer_t      **pbuf,
+                                  gral_index_buffer_type_t   type,
+                                  size_t                     num_indices)
+{
+  size_t index_size = type == GRAL_INDEX_BUFFER_TYPE_32BIT ? sizeof(uint32_t) : sizeof(uint16_t);
+  size_t current = *pbuf ? gral_index_buffer_get_size (*pbuf) / index_size : 0;
+  gral_index_buffer_t *buf;
+
+  if (num_indices <= current)
+    return CAIRO_STATUS_SUCCESS;
+
+  buf = gral_index_buffer_create (type,
+                                  _cairo_gral_grown_buffer_count (current, num_indices),
+                                  GRAL_BUFFER_USAGE_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+  if (unlikely (buf == NULL))
+    return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+
+  if (*pbuf)
+    gral_index_buffer_destroy (*pbuf);
+  *pbuf = buf;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/* Makes the dynamic buffers big enough for a batch of the given size. Vertex
+ * buffers that get replaced are re-bound to the vertex datas that use them. */
+cairo_status_t
+_cairo_gral_gpu_resources_reserve (cairo_gral_gpu_resources_t *gpu,
+                                   size_t                      num_vertices,
+                                   size_t                      num_indices,
+                                   cairo_bool_t                tex_coords)
+{
+  gral_vertex_buffer_t *vertex_buf_pos = gpu->vertex_buf_pos;
+  gral_vertex_buffer_t *vertex_buf_tex = gpu->vertex_buf_tex;
+  gral_index_buffer_t *index_buf = gpu->index_buf;
+  gral_index_buffer_t *index_buf_32 = gpu->index_buf_32;
+  cairo_status_t status;
+
+  status = _cairo_gral_reserve_vertex_buffer (&gpu->vertex_buf_pos, gpu->pos_size, num_vertices);
+  if (unlikely (status))
+    return status;
+
+  if (gpu->vertex_buf_pos != vertex_buf_pos) {
+    gral_vertex_data_bind_buffer (gpu->vertex_data_source, 0/*source*/, gpu->vertex_buf_pos);
+    gral_vertex_data_bind_buffer (gpu->vertex_data_source, 1/*source*/, gpu->vertex_buf_pos);
+    gral_vertex_data_bind_buffer (gpu->vertex_data_stencil, 0/*source*/, gpu->vertex_buf_pos);
+    if (gpu->vertex_data_stencil_short)
+      gral_vertex_data_bind_buffer (gpu->vertex_data_stencil_short, 0/*source*/, gpu->vertex_buf_pos);
+    gral_vertex_data_bind_buffer (gpu->vertex_data_spline, 0/*source*/, gpu->vertex_buf_pos);
+  }
+
+  if (tex_coords) {
+    status = _cairo_gral_reserve_vertex_buffer (&gpu->vertex_buf_tex,
+                                                sizeof(cairo_gral_tex_coord3_t),
+                                                num_vertices);
+    if (unlikely (status))
+      return status;
+
+    if (gpu->vertex_buf_tex != vertex_buf_tex)
+      gral_vertex_data_bind_buffer (gpu->vertex_data_spline, 1/*source*/, gpu->vertex_buf_tex);
+  }
+
+  if (num_vertices > CAIRO_GRAL_MAX_SHORT_INDEXED_VERTICES)
+    status = _cairo_gral_reserve_index_buffer (&gpu->index_buf_32,
+                                               GRAL_INDEX_BUFFER_TYPE_32BIT, num_indices);
+  else
+    status = _cairo_gral_reserve_index_buffer (&gpu->index_buf,
+                                               GRAL_INDEX_BUFFER_TYPE_16BIT, num_indices);
+
+  if (gpu->vertex_buf_pos != vertex_buf_pos ||
+      gpu->vertex_buf_tex != vertex_buf_tex ||
+      gpu->index_buf != index_buf ||
+      gpu->index_buf_32 != index_buf_32)
+    _cairo_gral_gpu_resources_count_buffers (gpu);
+
+  return status;
+}
+
+cairo_gral_cached_mesh_t *
+_cairo_gral_gpu_resources_get_unit_quad (cairo_gral_gpu_resources_t *gpu)
+{
+  cairo_gral_mesh_t mesh;
+  cairo_gral_vertex_index_t index[4];
+  cairo_status_t status;
+
+  if (gpu->unit_quad != NULL && ! _cairo_gral_cached_mesh_is_evicted (gpu->unit_quad)) {
+    _cairo_gral_cached_mesh_touch (gpu->unit_quad);
+    return gpu->unit_quad;
+  }
+
+  if (gpu->unit_quad) {
+    _cairo_gral_cached_mesh_destroy (gpu->unit_quad);
+    gpu->unit_quad = NULL;
+  }
+
+  _cairo_gral_mesh_init (&mesh, gpu, NULL, FALSE);
+
+  index[0] = _cairo_gral_mesh_add_vertex_float (&mesh, 0, 0);
+  index[1] = _cairo_gral_mesh_add_vertex_float (&mesh, 1, 0);
+  index[2] = _cairo_gral_mesh_add_vertex_float (&mesh, 0, 1);
+  index[3] = _cairo_gral_mesh_add_vertex_float (&mesh, 1, 1);
+  _cairo_gral_mesh_add_index (&mesh, &index[0]);
+  _cairo_gral_mesh_add_index (&mesh, &index[1]);
+  _cairo_gral_mesh_add_index (&mesh, &index[2]);
+  _cairo_gral_mesh_add_index (&mesh, &index[2]);
+  _cairo_gral_mesh_add_index (&mesh, &index[1]);
+  _cairo_gral_mesh_add_index (&mesh, &index[3]);
+
+  status = _cairo_gral_cached_mesh_create (&mesh, &gpu->unit_quad);
+  _cairo_gral_mesh_fini (&mesh);
+  if (unlikely (status))
+    return NULL;
+
+  return gpu->unit_quad;
+}
+
 gral_cg_program_t *
 _cairo_gral_load_fragment_program (const char *entry,
                                    const char *profiles)
@@ -175,18 +575,18 @@ _cairo_gral_render_quad (cairo_gral_surface_t *gsurface,
                          float left, float top, float right, float bottom)
 {
   cairo_gral_vertex_pos_t verts[] = {
-    {right, top,    CAIRO_GRAL_Z_VALUE},
-    {left,  top,    CAIRO_GRAL_Z_VALUE},
-    {right, bottom, CAIRO_GRAL_Z_VALUE},
-    {left,  bottom, CAIRO_GRAL_Z_VALUE},
+    {right, top},
+    {left,  top},
+    {right, bottom},
+    {left,  bottom},
   };
 
   gral_vertex_buffer_t *vbuf = gsurface->gpu->vertex_buf_pos;
   void *dat;
-  size_t length = sizeof(verts);
+  size_t length = gsurface->gpu->pos_size * ARRAY_LENGTH (verts);
   assert(length <= gral_vertex_buffer_get_size (vbuf));
   dat = gral_vertex_buffer_lock (vbuf, 0, length, GRAL_BUFFER_LOCK_OPTION_DISCARD);
-  memcpy(dat, verts, length);
+  _cairo_gral_write_positions (dat, verts, ARRAY_LENGTH (verts), gsurface->gpu->pos_type);
   gral_vertex_buffer_unlock (vbuf);
 
   gral_vertex_data_set_count (gsurface->gpu->vertex_data_source, 4);
@@ -223,7 +623,9 @@ void _cairo_gral_init_render_state(cairo_gral_surface_t *gsurface)
   gral_matrix_set_scale (&mat, scale_x, scale_y, scale_z);
 
   gral_set_render_surface(gsurface->gral_surf);
+  gsurface->gpu->bound_surface = gsurface;
 
+  gsurface->gpu->world_matrix = mat;
   gral_set_world_matrix(&mat);
   gral_set_view_matrix (GRAL_MATRIX_IDENTITY);
   gral_set_projection_matrix (GRAL_MATRIX_IDENTITY);
@@ -243,6 +645,13 @@ void _cairo_gral_init_render_state(cairo_gral_surface_t *gsurface)
   /* initialise texture settings */
   gral_disable_texture_units_from (0);
 
-  gral_set_scene_blending (GRAL_SCENE_BLEND_FACTOR_SOURCE_ALPHA,
-                           GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_SOURCE_ALPHA);
+  /* OVER with a colour that isn't premultiplied; the alpha of the surface
+   * is that of premultiplied OVER, so it can be composited as such. */
+  gral_set_separate_scene_blending (GRAL_SCENE_BLEND_FACTOR_SOURCE_ALPHA,
+                                    GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_SOURCE_ALPHA,
+                                    GRAL_SCENE_BLEND_FACTOR_SBF_ONE,
+                                    GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_SOURCE_ALPHA);
+
+  /* Nothing is bound, resources can be evicted. */
+  _cairo_gral_memory_trim (gsurface->gpu);
 }
@@ -37,14 +37,63 @@
 #ifndef CAIRO_GRAL_CONFIG_H
 #define CAIRO_GRAL_CONFIG_H
 
-#define CAIRO_GRAL_MAX_TRIGS     2048
-#define CAIRO_GRAL_MAX_VERTICES  CAIRO_GRAL_MAX_TRIGS*3
-#define CAIRO_GRAL_MAX_INDICES   CAIRO_GRAL_MAX_TRIGS*3
+/* Meshes start with room for CAIRO_GRAL_INITIAL_BATCH_TRIGS triangles and grow
+ * on demand; they are only split into several draws after reaching the batch
+ * limit, see cairo_gral_set_max_batch_size(). */
+#define CAIRO_GRAL_INITIAL_BATCH_TRIGS      2048
+#define CAIRO_GRAL_DEFAULT_MAX_BATCH_TRIGS  (256*1024)
 
 #define CAIRO_GRAL_COLOR_RAMP_TEX_WIDTH 1024
 
+/* Gradients with up to this many stops are evaluated by a fragment program
+ * from the stops, without the ramp texture. It has to match the size of the
+ * arrays in shaders.cg. */
+#define CAIRO_GRAL_MAX_SHADER_STOPS 8
+/* #define CAIRO_GRAL_DISABLE_SHADER_STOPS 1 */
+
+/* Number of stroke pens that are kept for reuse. */
+#define CAIRO_GRAL_PEN_CACHE_SIZE 8
+
+/* Dash patterns with butt caps and up to CAIRO_GRAL_MAX_GPU_DASHES entries are
+ * applied by a fragment program that reads one period of the pattern from a
+ * texture of this width. */
+#define CAIRO_GRAL_DASH_TEX_WIDTH 1024
+#define CAIRO_GRAL_MAX_GPU_DASHES 16
+/* #define CAIRO_GRAL_DISABLE_GPU_DASH 1 */
+
+/* Strokes with a solid source are drawn in a single pass, without a cover
+ * quad, see _cairo_gral_stroke_single_pass(). */
+/* #define CAIRO_GRAL_DISABLE_SINGLE_PASS_STROKES 1 */
+
+/* GPU memory budget in bytes for the textures and cached meshes, 0 for no
+ * limit; the least recently used ones are evicted to stay within it. Render
+ * targets and the dynamic buffers don't count, see
+ * cairo_gral_set_memory_budget(). */
+#define CAIRO_GRAL_DEFAULT_MEMORY_BUDGET 0
+
 #define CAIRO_GRAL_Z_VALUE 0
 
+/* Level of detail: paths whose device extents are smaller than
+ * CAIRO_GRAL_LOD_SIZE pixels are flattened with a coarser tolerance, doubled
+ * for every halving of their size but never above
+ * CAIRO_GRAL_LOD_MAX_TOLERANCE pixels. */
+#define CAIRO_GRAL_LOD_SIZE 64
+#define CAIRO_GRAL_LOD_MAX_TOLERANCE 0.5
+/* #define CAIRO_GRAL_DISABLE_LOD 1 */
+
+/* Curves that are completely further than this many pixels outside of the
+ * clip extents are not flattened; they are replaced by a line, which changes
+ * nothing inside of the visible area. */
+#define CAIRO_GRAL_GUARD_BAND 64
+
+/* Solid fills that don't overlap are stenciled one after the other and
+ * covered together, up to this many paths. */
+#define CAIRO_GRAL_MAX_FILL_BATCH 64
+
+/* Fractional bits of the SHORT2 positions that are used for the stencil
+ * passes when the backend supports them and the geometry is in range. */
+#define CAIRO_GRAL_SUBPIXEL_BITS 4
+
 /* #define CAIRO_GRAL_DISABLE_FRAGMENT_SHADERS 1 */
 #define CAIRO_GRAL_DISABLE_GPU_SPLINE_RENDERING 1
 
@@ -0,0 +1,599 @@
+/* -*- Mode: c; tab-width: 8; c-basic-offset: 4; indent-tabs-mode: t; -*- */
+/* Cairo - a vector graphics library with display and print output
+ *
+ * Copyright  2009 Argiris Kirtzidis
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it either under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation
+ * (the "LGPL") or, at your option, under the terms of the Mozilla
+ * Public License Version 1.1 (the "MPL"). If you do not alter this
+ * notice, a recipient may use your version of this file under either
+ * the MPL or the LGPL.
+ *
+ * You should have received a copy of the LGPL along with this library
+ * in the file COPYING-LGPL-2.1; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ * You should have received a copy of the MPL along with this library
+ * in the file COPYING-MPL-1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY
+ * OF ANY KIND, either express or implied. See the LGPL or the MPL for
+ * the specific language governing rights and limitations.
+ *
+ * The Original Code is the cairo graphics library.
+ *
+ * The Initial Developer of the Original Code is Argiris Kirtzidis.
+ *
+ * Contributor(s):
+ *      Argiris Kirtzidis <akyrtzi@gmail.com>
+ */
+
+
+/* Display lists record drawing once into a meta surface and replay it on a
+ * gral surface under a different matrix. The fills and strokes are kept as
+ * cached meshes in the space of the recording and drawn with the matrix as
+ * their instance transform, so a replay only tesselates again when the scale
+ * changes too much for the tolerance that the meshes were made with. */
+
+#include "cairo-gral-private.h"
+#include "cairo-gral-math.h"
+#include "cairo-gral.h"
+#include "cairo-meta-surface-private.h"
+#include "cairo-clip-private.h"
+#include "cairo-gstate-private.h"
+#include "cairo-private.h"
+#include <float.h>
+
+typedef struct _cairo_gral_display_list_entry {
+  cairo_gral_cached_mesh_t   *mesh;
+  /* The tolerance that mesh was made with, in the recording space. */
+  double                      tolerance;
+  /* Set if the path doesn't fit in a cached mesh. */
+  cairo_bool_t                unsupported;
+} cairo_gral_display_list_entry_t;
+
+struct _cairo_gral_display_list {
+  cairo_surface_t                 *meta;
+  cairo_gral_gpu_resources_t      *gpu;
+
+  /* One for each command of the meta surface. */
+  cairo_gral_display_list_entry_t *entries;
+  int                              num_entries;
+};
+
+static void
+_cairo_gral_display_list_clear (cairo_gral_display_list_t *list)
+{
+  int i;
+
+  for (i = 0; i < list->num_entries; ++i) {
+    if (list->entries[i].mesh)
+      _cairo_gral_cached_mesh_destroy (list->entries[i].mesh);
+  }
+  free (list->entries);
+  list->entries = NULL;
+  list->num_entries = 0;
+
+  if (list->meta) {
+    cairo_surface_destroy (list->meta);
+    list->meta = NULL;
+  }
+}
+
+/**
+ * cairo_gral_display_list_create:
+ *
+ * Creates an empty display list. Record into it with
+ * cairo_gral_display_list_begin_recording() and draw it with
+ * cairo_gral_display_list_replay().
+ **/
+cairo_gral_display_list_t *
+cairo_gral_display_list_create (void)
+{
+  cairo_gral_display_list_t *list;
+
+  list = malloc (sizeof (cairo_gral_display_list_t));
+  if (unlikely (list == NULL))
+    return NULL;
+
+  memset (list, 0, sizeof (cairo_gral_display_list_t));
+  list->gpu = _cairo_gral_gpu_resources_acquire ();
+
+  return list;
+}
+
+void
+cairo_gral_display_list_destroy (cairo_gral_display_list_t *list)
+{
+  if (list == NULL)
+    return;
+
+  _cairo_gral_display_list_clear (list);
+  _cairo_gral_gpu_resources_release (list->gpu);
+  free (list);
+}
+
+/**
+ * cairo_gral_display_list_begin_recording:
+ * @list: a display list
+ *
+ * Drops the current content of @list and returns a context that records
+ * into it, in the coordinates that the replay matrix later maps to the
+ * device. Finish with cairo_gral_display_list_end_recording().
+ **/
+cairo_t *
+cairo_gral_display_list_begin_recording (cairo_gral_display_list_t *list)
+{
+  _cairo_gral_display_list_clear (list);
+
+  list->meta = _cairo_meta_surface_create (CAIRO_CONTENT_COLOR_ALPHA, 0, 0);
+  return cairo_create (list->meta);
+}
+
+/**
+ * cairo_gral_display_list_end_recording:
+ * @list: a display list
+ * @cr: the context returned by cairo_gral_display_list_begin_recording()
+ *
+ * Destroys @cr and returns its status; on error the list stays empty.
+ **/
+cairo_status_t
+cairo_gral_display_list_end_recording (cairo_gral_display_list_t *list,
+                                       cairo_t                   *cr)
+{
+  cairo_meta_surface_t *meta = (cairo_meta_surface_t *) list->meta;
+  cairo_status_t status;
+
+  status = cairo_status (cr);
+  cairo_destroy (cr);
+  if (status == CAIRO_STATUS_SUCCESS)
+    status = cairo_surface_status (list->meta);
+  if (unlikely (status)) {
+    _cairo_gral_display_list_clear (list);
+    return status;
+  }
+
+  list->num_entries = meta->commands.num_elements;
+  list->entries = calloc (list->num_entries, sizeof (cairo_gral_display_list_entry_t));
+  if (unlikely (list->entries == NULL && list->num_entries)) {
+    _cairo_gral_display_list_clear (list);
+    return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+  }
+
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/* Makes sure that the mesh of the entry is at least as accurate as the
+ * tolerance, reusing the old one unless it is more than four times finer
+ * than needed or was evicted. The tolerances are powers of two so that a
+ * slow zoom doesn't tesselate at each frame. */
+static cairo_status_t
+_cairo_gral_display_list_entry_prepare (cairo_gral_display_list_t       *list,
+                                        cairo_gral_display_list_entry_t *entry,
+                                        cairo_command_t                 *command,
+                                        double                           tolerance)
+{
+  cairo_gral_cached_mesh_t *mesh;
+  cairo_status_t status;
+  int exp;
+
+  if (entry->unsupported)
+    return CAIRO_INT_STATUS_UNSUPPORTED;
+
+  if (entry->mesh != NULL && ! _cairo_gral_cached_mesh_is_evicted (entry->mesh) &&
+      entry->tolerance <= tolerance && entry->tolerance * 4 > tolerance) {
+    _cairo_gral_cached_mesh_touch (entry->mesh);
+    return CAIRO_STATUS_SUCCESS;
+  }
+
+  frexp (tolerance, &exp);
+  tolerance = ldexp (0.5, exp);
+
+  if (command->header.type == CAIRO_COMMAND_FILL)
+    status = _cairo_gral_fill_path_to_cached_mesh (list->gpu,
+                                                   &command->fill.path,
+                                                   tolerance,
+                                                   &mesh);
+  else
+    status = _cairo_gral_stroke_path_to_cached_mesh (list->gpu,
+                                                     &command->stroke.path,
+                                                     &command->stroke.style,
+                                                     &command->stroke.ctm,
+                                                     &command->stroke.ctm_inverse,
+                                                     tolerance,
+                                                     &mesh);
+  if (status == CAIRO_INT_STATUS_UNSUPPORTED)
+    entry->unsupported = TRUE;
+  if (unlikely (status))
+    return status;
+
+  if (entry->mesh)
+    _cairo_gral_cached_mesh_destroy (entry->mesh);
+  entry->mesh = mesh;
+  entry->tolerance = tolerance;
+
+  return CAIRO_STATUS_SUCCESS;
+}
+
+static void
+_cairo_gral_transform_bound_box (const cairo_gral_bound_box_t *box,
+                                 const cairo_matrix_t         *matrix,
+                                 cairo_gral_bound_box_t       *result)
+{
+  double x[4], y[4];
+  int i;
+
+  x[0] = x[3] = box->min_x; y[0] = y[1] = box->min_y;
+  x[1] = x[2] = box->max_x; y[2] = y[3] = box->max_y;
+
+  result->min_x = result->min_y = FLT_MAX;
+  result->max_x = result->max_y = -FLT_MAX;
+
+  for (i = 0; i < 4; ++i) {
+    cairo_matrix_transform_point (matrix, &x[i], &y[i]);
+    if (x[i] < result->min_x) result->min_x = (float) x[i];
+    if (y[i] < result->min_y) result->min_y = (float) y[i];
+    if (x[i] > result->max_x) result->max_x = (float) x[i];
+    if (y[i] > result->max_y) result->max_y = (float) y[i];
+  }
+}
+
+/* Stencils the cached mesh of the entry under the matrix and covers it with
+ * the source, which is already in device space. Solid strokes are drawn
+ * directly. */
+static cairo_status_t
+_cairo_gral_display_list_render_entry (cairo_gral_surface_t            *gsurface,
+                                       cairo_gral_display_list_entry_t *entry,
+                                       cairo_command_t                 *command,
+                                       const cairo_pattern_t           *source,
+                                       cairo_matrix_t                  *matrix)
+{
+  gral_instance_data_t inst;
+  cairo_gral_bound_box_t box;
+  cairo_rectangle_int_t clip;
+  cairo_status_t status;
+
+  if (_cairo_gral_cached_mesh_is_empty (entry->mesh))
+    return CAIRO_STATUS_SUCCESS;
+
+  _cairo_gral_transform_bound_box (&entry->mesh->box, matrix, &box);
+
+  _cairo_gral_surface_get_clip_extents (gsurface, &clip);
+  if (box.max_x <= clip.x || box.max_y <= clip.y ||
+      box.min_x >= clip.x + (int) clip.width ||
+      box.min_y >= clip.y + (int) clip.height)
+    return CAIRO_STATUS_SUCCESS;
+
+  status = _cairo_gral_surface_flush_fills (gsurface);
+  if (status == CAIRO_STATUS_SUCCESS)
+    status = _cairo_gral_surface_flush_source_fills (gsurface, source);
+  if (unlikely (status))
+    return status;
+
+  _cairo_gral_init_render_state (gsurface);
+
+  _cairo_gral_matrix_from_cairo_matrix (&inst.transform, matrix);
+
+#if ! CAIRO_GRAL_DISABLE_SINGLE_PASS_STROKES
+  /* Solid strokes are drawn without a cover quad, as by
+   * _cairo_gral_stroke_single_pass(). */
+  if (command->header.type == CAIRO_COMMAND_STROKE &&
+      source->type == CAIRO_PATTERN_TYPE_SOLID)
+  {
+    status = _cairo_gral_set_source (gsurface, source);
+    if (unlikely (status))
+      return status;
+
+    if (CAIRO_COLOR_IS_OPAQUE (&((const cairo_solid_pattern_t *) source)->color)) {
+      gral_set_stencil_check_enabled (FALSE);
+      _cairo_gral_cached_mesh_render_instanced (entry->mesh, &inst, 1,
+                                                GRAL_INSTANCE_DATA_TRANSFORM);
+    } else {
+      _cairo_gral_set_stroke_write_once_state ();
+      _cairo_gral_cached_mesh_render_instanced (entry->mesh, &inst, 1,
+                                                GRAL_INSTANCE_DATA_TRANSFORM);
+      _cairo_gral_set_stroke_clear_state ();
+      _cairo_gral_cached_mesh_render_instanced (entry->mesh, &inst, 1,
+                                                GRAL_INSTANCE_DATA_TRANSFORM);
+    }
+
+    /* Reset state */
+    gral_set_stencil_check_enabled (FALSE);
+    gral_set_color_buffer_write_enabled (TRUE, TRUE, TRUE, TRUE);
+
+    return CAIRO_STATUS_SUCCESS;
+  }
+#endif
+
+  /* Tesselate into stencil */
+  if (command->header.type == CAIRO_COMMAND_FILL)
+    _cairo_gral_set_fill_stencil_state (command->fill.fill_rule);
+  else
+    _cairo_gral_set_stroke_stencil_state ();
+
+  _cairo_gral_cached_mesh_render_instanced (entry->mesh, &inst, 1,
+                                            GRAL_INSTANCE_DATA_TRANSFORM);
+
+  /* Draw paint where stencil not zero */
+  gral_set_stencil_buffer_params (GRAL_COMPARE_FUNC_NOT_EQUAL,
+                                  0, 0xffffffff,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  FALSE /*two_sided_operation*/);
+
+  status = _cairo_gral_set_source (gsurface, source);
+
+  /* On failure the quad still has to go through, to clear the stencil. */
+  if (status == CAIRO_STATUS_SUCCESS)
+    gral_set_color_buffer_write_enabled (TRUE, TRUE, TRUE, TRUE);
+
+  _cairo_gral_render_quad (gsurface, box.min_x, box.min_y, box.max_x, box.max_y);
+
+  /* Reset state */
+  gral_set_stencil_check_enabled (FALSE);
+  gral_set_color_buffer_write_enabled (TRUE, TRUE, TRUE, TRUE);
+
+  return status;
+}
+
+static cairo_status_t
+_cairo_gral_display_list_show_glyphs (cairo_surface_t                  *target,
+                                      cairo_command_show_text_glyphs_t *command,
+                                      const cairo_pattern_t            *source,
+                                      const cairo_matrix_t             *matrix)
+{
+  cairo_scaled_font_t *scaled_font;
+  cairo_font_options_t options;
+  cairo_matrix_t font_matrix, ctm;
+  cairo_glyph_t *dev_glyphs;
+  cairo_status_t status;
+  unsigned int i;
+
+  dev_glyphs = _cairo_malloc_ab (command->num_glyphs, sizeof (cairo_glyph_t));
+  if (unlikely (dev_glyphs == NULL))
+    return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+
+  for (i = 0; i < command->num_glyphs; i++) {
+    dev_glyphs[i] = command->glyphs[i];
+    cairo_matrix_transform_point (matrix, &dev_glyphs[i].x, &dev_glyphs[i].y);
+  }
+
+  /* The glyph outlines are scaled by a font that includes the matrix. */
+  cairo_scaled_font_get_font_matrix (command->scaled_font, &font_matrix);
+  cairo_scaled_font_get_ctm (command->scaled_font, &ctm);
+  cairo_matrix_multiply (&ctm, &ctm, matrix);
+  ctm.x0 = ctm.y0 = 0;
+  _cairo_font_options_init_default (&options);
+  cairo_scaled_font_get_font_options (command->scaled_font, &options);
+
+  scaled_font = cairo_scaled_font_create (cairo_scaled_font_get_font_face (command->scaled_font),
+                                          &font_matrix, &ctm, &options);
+  status = scaled_font->status;
+  if (status == CAIRO_STATUS_SUCCESS)
+    status = _cairo_surface_show_text_glyphs (target,
+                                              command->op,
+                                              source,
+                                              command->utf8, command->utf8_len,
+                                              dev_glyphs, command->num_glyphs,
+                                              command->clusters, command->num_clusters,
+                                              command->cluster_flags,
+                                              scaled_font, NULL);
+
+  cairo_scaled_font_destroy (scaled_font);
+  free (dev_glyphs);
+  return status;
+}
+
+/**
+ * cairo_gral_display_list_replay:
+ * @list: a display list
+ * @cr: a context
+ *
+ * Draws the recorded content with the current matrix and clip of @cr. On a
+ * gral surface the fills and strokes reuse the meshes of the previous
+ * replays as long as they are accurate enough for the new scale.
+ **/
+cairo_status_t
+cairo_gral_display_list_replay (cairo_gral_display_list_t *list,
+                                cairo_t                   *cr)
+{
+  return cairo_gral_display_list_replay_range (list, cr, 0, list->num_entries);
+}
+
+/**
+ * cairo_gral_display_list_get_num_commands:
+ * @list: a display list
+ *
+ * Returns the number of drawing commands recorded in @list, 0 if there is no
+ * successful recording.
+ **/
+unsigned int
+cairo_gral_display_list_get_num_commands (cairo_gral_display_list_t *list)
+{
+  return list->num_entries;
+}
+
+/**
+ * cairo_gral_display_list_replay_range:
+ * @list: a display list
+ * @cr: a context
+ * @first: the first command to draw
+ * @count: the number of commands to draw
+ *
+ * Like cairo_gral_display_list_replay() but only draws the commands from
+ * @first up to @first + @count, so that a long replay can be spread over
+ * several calls. The clipping recorded before @first still applies.
+ **/
+cairo_status_t
+cairo_gral_display_list_replay_range (cairo_gral_display_list_t *list,
+                                      cairo_t                   *cr,
+                                      unsigned int               first,
+                                      unsigned int               count)
+{
+  cairo_surface_t *target = cairo_get_target (cr);
+  cairo_meta_surface_t *meta = (cairo_meta_surface_t *) list->meta;
+  cairo_command_t **elements;
+  cairo_matrix_t matrix, matrix_inverse;
+  cairo_clip_t clip, *old_clip;
+  cairo_bool_t use_meshes;
+  double tolerance, scale;
+  cairo_status_t status, status2;
+  int i, end;
+
+  if (meta == NULL || cairo_status (cr))
+    return cairo_status (cr);
+
+  if (first >= (unsigned int) list->num_entries)
+    return CAIRO_STATUS_SUCCESS;
+  end = list->num_entries;
+  if (count < (unsigned int) list->num_entries - first)
+    end = first + count;
+
+  /* Other surfaces get the paths transformed, like a meta surface replay. */
+  use_meshes = cairo_surface_get_type (target) == CAIRO_SURFACE_TYPE_GRAL;
+
+  cairo_get_matrix (cr, &matrix);
+  cairo_matrix_multiply (&matrix, &matrix, &target->device_transform);
+  matrix_inverse = matrix;
+  if (cairo_matrix_invert (&matrix_inverse))
+    return CAIRO_STATUS_SUCCESS; /* degenerate, nothing is visible */
+
+  scale = _cairo_matrix_transformed_circle_major_axis (&matrix, 1.0);
+  tolerance = cairo_get_tolerance (cr) / scale;
+
+  status = _cairo_clip_init_copy (&clip, &cr->gstate->clip);
+  if (unlikely (status))
+    return status;
+  old_clip = _cairo_surface_get_clip (target);
+
+  elements = _cairo_array_index (&meta->commands, 0);
+  for (i = 0; i < end; i++) {
+    cairo_command_t *command = elements[i];
+    cairo_gral_display_list_entry_t *entry = &list->entries[i];
+    cairo_pattern_union_t source, mask;
+    cairo_path_fixed_t path_copy, *dev_path = NULL;
+
+    if (command->header.type == CAIRO_COMMAND_INTERSECT_CLIP_PATH) {
+      if (command->intersect_clip_path.path_pointer == NULL) {
+        _cairo_clip_reset (&clip);
+        status = _cairo_clip_init_copy (&clip, &cr->gstate->clip);
+      } else {
+        status = _cairo_path_fixed_init_copy (&path_copy, &command->intersect_clip_path.path);
+        if (unlikely (status))
+          break;
+        _cairo_path_fixed_transform (&path_copy, &matrix);
+        status = _cairo_clip_clip (&clip, &path_copy,
+                                   command->intersect_clip_path.fill_rule,
+                                   cairo_get_tolerance (cr),
+                                   command->intersect_clip_path.antialias,
+                                   target);
+        _cairo_path_fixed_fini (&path_copy);
+      }
+      if (unlikely (status))
+        break;
+      continue;
+    }
+
+    /* The commands before the range only count for their clipping. */
+    if (i < (int) first)
+      continue;
+
+    status = _cairo_surface_set_clip (target, &clip);
+    if (unlikely (status))
+      break;
+
+    /* All the commands have a source, at the same place. */
+    status = _cairo_pattern_init_copy (&source.base, &command->paint.source.base);
+    if (unlikely (status))
+      break;
+    _cairo_pattern_transform (&source.base, &matrix_inverse);
+
+    switch (command->header.type) {
+    case CAIRO_COMMAND_PAINT:
+      status = _cairo_surface_paint (target, command->paint.op, &source.base, NULL);
+      break;
+
+    case CAIRO_COMMAND_MASK:
+      status = _cairo_pattern_init_copy (&mask.base, &command->mask.mask.base);
+      if (unlikely (status))
+        break;
+      _cairo_pattern_transform (&mask.base, &matrix_inverse);
+      status = _cairo_surface_mask (target, command->mask.op,
+                                    &source.base, &mask.base, NULL);
+      _cairo_pattern_fini (&mask.base);
+      break;
+
+    case CAIRO_COMMAND_FILL:
+    case CAIRO_COMMAND_STROKE:
+      status = CAIRO_INT_STATUS_UNSUPPORTED;
+      if (use_meshes)
+        status = _cairo_gral_display_list_entry_prepare (list, entry, command, tolerance);
+      if (status == CAIRO_STATUS_SUCCESS) {
+        status = _cairo_gral_display_list_render_entry ((cairo_gral_surface_t *) target,
+                                                        entry, command,
+                                                        &source.base, &matrix);
+        break;
+      }
+      if (status != CAIRO_INT_STATUS_UNSUPPORTED)
+        break;
+
+      /* Too big for a cached mesh, or not a gral surface. */
+      dev_path = &path_copy;
+      if (command->header.type == CAIRO_COMMAND_FILL) {
+        status = _cairo_path_fixed_init_copy (dev_path, &command->fill.path);
+        if (unlikely (status))
+          break;
+        _cairo_path_fixed_transform (dev_path, &matrix);
+        status = _cairo_surface_fill (target, command->fill.op, &source.base,
+                                      dev_path, command->fill.fill_rule,
+                                      cairo_get_tolerance (cr),
+                                      command->fill.antialias, NULL);
+      } else {
+        cairo_matrix_t dev_ctm, dev_ctm_inverse;
+
+        status = _cairo_path_fixed_init_copy (dev_path, &command->stroke.path);
+        if (unlikely (status))
+          break;
+        _cairo_path_fixed_transform (dev_path, &matrix);
+        cairo_matrix_multiply (&dev_ctm, &command->stroke.ctm, &matrix);
+        cairo_matrix_multiply (&dev_ctm_inverse, &matrix_inverse,
+                               &command->stroke.ctm_inverse);
+        status = _cairo_surface_stroke (target, command->stroke.op, &source.base,
+                                        dev_path, &command->stroke.style,
+                                        &dev_ctm, &dev_ctm_inverse,
+                                        cairo_get_tolerance (cr),
+                                        command->stroke.antialias, NULL);
+      }
+      _cairo_path_fixed_fini (dev_path);
+      break;
+
+    case CAIRO_COMMAND_SHOW_TEXT_GLYPHS:
+      status = _cairo_gral_display_list_show_glyphs (target,
+                                                     &command->show_text_glyphs,
+                                                     &source.base, &matrix);
+      break;
+
+    default:
+      ASSERT_NOT_REACHED;
+    }
+
+    _cairo_pattern_fini (&source.base);
+
+    if (unlikely (status))
+      break;
+  }
+
+  _cairo_clip_reset (&clip);
+  status2 = _cairo_surface_set_clip (target, old_clip);
+  if (status == CAIRO_STATUS_SUCCESS)
+    status = status2;
+
+  return status;
+}
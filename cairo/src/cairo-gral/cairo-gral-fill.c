@@ -41,10 +41,17 @@ typedef struct _cairo_gral_fill_path_mesh {
   cairo_gral_mesh_t           base;
 
   cairo_gral_vector2_t        cur_point;
+  cairo_point_t               cur_fixed_point;
   cairo_bool_t                drawing_line;
   cairo_gral_vertex_index_t   cur_centric_vertex;
   cairo_gral_vertex_index_t   prev_vertex;
 
+  cairo_bool_t                overflow;
+
+  /* For flattening curves, see _cairo_gral_fill_path_flat_curve_to(). */
+  double                      tolerance;
+  const cairo_box_t          *guard_band;
+
 } cairo_gral_fill_path_mesh_t;
 
 static cairo_status_t
@@ -63,6 +70,7 @@ _cairo_gral_fill_path_move_to (void                *closure,
 
   mesh->drawing_line = FALSE;
   VECTOR2_FROM_POINT (mesh->cur_point, *point);
+  mesh->cur_fixed_point = *point;
   return CAIRO_STATUS_SUCCESS;
 }
 
@@ -99,9 +107,101 @@ static cairo_status_t
 _cairo_gral_fill_path_line_to (void                *closure,
                                const cairo_point_t *point)
 {
+  cairo_gral_fill_path_mesh_t *mesh = closure;
   cairo_gral_vector2_t vec;
   VECTOR2_FROM_POINT (vec, *point);
-  return _cairo_gral_fill_path_line_to_vector (closure, &vec);
+  mesh->cur_fixed_point = *point;
+  return _cairo_gral_fill_path_line_to_vector (mesh, &vec);
+}
+
+/* Same as _cairo_gral_fill_path_line_to() for each of the points, but when the
+ * batch has room for the whole run the points are converted together and the
+ * triangles are written directly. */
+static cairo_status_t
+_cairo_gral_fill_path_line_to_run (void                *closure,
+                                   const cairo_point_t *points,
+                                   unsigned int         num_points)
+{
+  cairo_gral_fill_path_mesh_t *mesh = closure;
+  cairo_gral_mesh_t *base = &mesh->base;
+  cairo_gral_vertex_index_t first, next_vertex;
+  cairo_bool_t had_line = mesh->drawing_line;
+  unsigned int i;
+
+  if (! _cairo_gral_mesh_reserve (base, num_points + 2, 3 * num_points)) {
+    for (i = 0; i < num_points; i++)
+      _cairo_gral_fill_path_line_to (closure, &points[i]);
+    return CAIRO_STATUS_SUCCESS;
+  }
+
+  if (! had_line) {
+    mesh->cur_centric_vertex = _cairo_gral_mesh_add_vertex_float (base,
+                                                                  mesh->cur_point.x, mesh->cur_point.y);
+  } else {
+    /* If the batch was rendered since the line started (say at the end of
+     * a curve), copy its vertices again like _cairo_gral_mesh_add_index()
+     * does; the vertices that follow would overwrite them. */
+    if (mesh->cur_centric_vertex >= base->num_vertices)
+      mesh->cur_centric_vertex = _cairo_gral_mesh_add_vertex_float (base,
+                                                                    base->vertices[mesh->cur_centric_vertex].x,
+                                                                    base->vertices[mesh->cur_centric_vertex].y);
+    if (mesh->prev_vertex >= base->num_vertices)
+      mesh->prev_vertex = _cairo_gral_mesh_add_vertex_float (base,
+                                                             base->vertices[mesh->prev_vertex].x,
+                                                             base->vertices[mesh->prev_vertex].y);
+  }
+
+  /* The points that repeat the previous one are dropped while the triangles
+   * are written, by moving the others down. */
+  first = _cairo_gral_mesh_add_vertices_fixed (base, points, num_points);
+  next_vertex = first;
+  for (i = 0; i < num_points; i++) {
+    cairo_gral_vector2_t vec;
+
+    VECTOR2_FROM_POINT (vec, points[i]);
+    if (mesh->cur_point.x == vec.x && mesh->cur_point.y == vec.y)
+      continue;
+
+    base->vertices[next_vertex] = base->vertices[first + i];
+    if (mesh->drawing_line) {
+      base->indices[base->num_indices++] = mesh->cur_centric_vertex;
+      base->indices[base->num_indices++] = mesh->prev_vertex;
+      base->indices[base->num_indices++] = next_vertex;
+    }
+    mesh->drawing_line = TRUE;
+    mesh->prev_vertex = next_vertex++;
+    mesh->cur_point = vec;
+  }
+  base->num_vertices = next_vertex;
+
+  /* Nothing but repeated points, drop the centric vertex as well. */
+  if (! mesh->drawing_line)
+    base->num_vertices = mesh->cur_centric_vertex;
+
+  mesh->cur_fixed_point = points[num_points - 1];
+  return CAIRO_STATUS_SUCCESS;
+}
+
+static cairo_status_t
+_cairo_gral_fill_path_flat_curve_to (void                *closure,
+                                     const cairo_point_t *p0,
+                                     const cairo_point_t *p1,
+                                     const cairo_point_t *p2)
+{
+  cairo_gral_fill_path_mesh_t *mesh = closure;
+  cairo_point_t p = mesh->cur_fixed_point;
+  cairo_spline_t spline;
+
+  /* Off screen the line fills the same pixels as the curve. */
+  if (mesh->guard_band != NULL &&
+      _cairo_gral_spline_outside_box (mesh->guard_band, &p, p0, p1, p2))
+    return _cairo_gral_fill_path_line_to (closure, p2);
+
+  if (! _cairo_spline_init (&spline, _cairo_gral_fill_path_line_to, mesh,
+                            &p, p0, p1, p2))
+    return _cairo_gral_fill_path_line_to (closure, p2);
+
+  return _cairo_spline_decompose (&spline, mesh->tolerance);
 }
 
 static cairo_status_t
@@ -256,47 +356,42 @@ _cairo_path_to_verts_close_path (void *closure)
 static cairo_status_t
 _cairo_gral_render_fill_path (cairo_gral_surface_t   *gsurface,
                               cairo_path_fixed_t     *path,
+                              const cairo_rectangle_int_t *extents,
                               double                  tolerance,
                               cairo_gral_bound_box_t *box)
 {
   cairo_gral_fill_path_mesh_t mesh;
-  cairo_gral_vertex_pos_t vertices[CAIRO_GRAL_MAX_VERTICES];
-  cairo_gral_vertex_index_t indices[CAIRO_GRAL_MAX_INDICES];
   cairo_bool_t use_shader = _cairo_gral_has_capability (gsurface, GRAL_CAP_FRAGMENT_PROGRAM);
   cairo_gral_gpu_resources_t *gpu = gsurface->gpu;
+  cairo_box_t guard_band;
   cairo_status_t status;
 
-  _cairo_gral_mesh_init (&mesh.base,
-                         vertices,
-                         NULL, /*tex_coords*/
-                         indices,
-                         gpu->vertex_buf_pos,
-                         gpu->vertex_buf_tex,
-                         gpu->index_buf,
-                         gpu->vertex_data_stencil,
-                         gpu->index_data);
+  _cairo_gral_mesh_init (&mesh.base, gpu, gpu->vertex_data_stencil, FALSE);
   mesh.drawing_line = FALSE;
+  mesh.overflow = FALSE;
+  mesh.tolerance = _cairo_gral_lod_tolerance (tolerance, extents);
+  mesh.guard_band = NULL;
+  if (_cairo_gral_surface_get_guard_band (gsurface, extents, 0, 0, &guard_band))
+    mesh.guard_band = &guard_band;
 
 #if CAIRO_GRAL_DISABLE_GPU_SPLINE_RENDERING
   use_shader = FALSE;
 #endif
 
   if (use_shader) {
-    status = _cairo_path_fixed_interpret (path,
-                                          CAIRO_DIRECTION_FORWARD,
-                                          _cairo_gral_fill_path_move_to,
-                                          _cairo_gral_fill_path_line_to,
-                                          _cairo_gral_fill_path_curve_to,
-                                          _cairo_path_to_verts_close_path,
-                                          &mesh);
+    status = _cairo_path_fixed_interpret_runs (path,
+                                               _cairo_gral_fill_path_move_to,
+                                               _cairo_gral_fill_path_line_to_run,
+                                               _cairo_gral_fill_path_curve_to,
+                                               _cairo_path_to_verts_close_path,
+                                               &mesh);
   } else {
-    status = _cairo_path_fixed_interpret_flat (path,
-                                               CAIRO_DIRECTION_FORWARD,
+    status = _cairo_path_fixed_interpret_runs (path,
                                                _cairo_gral_fill_path_move_to,
-                                               _cairo_gral_fill_path_line_to,
+                                               _cairo_gral_fill_path_line_to_run,
+                                               _cairo_gral_fill_path_flat_curve_to,
                                                _cairo_path_to_verts_close_path,
-                                               &mesh,
-                                               tolerance);
+                                               &mesh);
   }
   if (unlikely (status))
     goto BAIL;
@@ -306,6 +401,8 @@ _cairo_gral_render_fill_path (cairo_gral_surface_t   *gsurface,
   if (! _cairo_gral_splines_buffer_is_empty (&mesh.base.splines))
     _cairo_gral_mesh_gpu_spline_fill (&mesh.base, gsurface->gpu);
 
+  status = mesh.base.status;
+
   if (box)
     *box = mesh.base.box;
 
@@ -314,12 +411,58 @@ BAIL:
   return status;
 }
 
+static void
+_cairo_gral_fill_path_overflow (void *closure)
+{
+  cairo_gral_fill_path_mesh_t *mesh = closure;
+
+  /* The path doesn't fit in a single mesh, drop what was collected so far;
+   * the caller sees the overflow and won't cache the result. */
+  mesh->overflow = TRUE;
+  mesh->base.num_vertices = mesh->base.num_indices = 0;
+  mesh->drawing_line = FALSE;
+}
+
 cairo_status_t
-_cairo_gral_prepare_fill_stencil_mask(cairo_gral_surface_t   *gsurface,
-                                      cairo_path_fixed_t     *path,
-                                      cairo_fill_rule_t       fill_rule,
-                                      double                  tolerance,
-                                      cairo_gral_bound_box_t *box)
+_cairo_gral_fill_path_to_cached_mesh (cairo_gral_gpu_resources_t *gpu,
+                                      cairo_path_fixed_t         *path,
+                                      double                      tolerance,
+                                      cairo_gral_cached_mesh_t  **cached_out)
+{
+  cairo_gral_fill_path_mesh_t mesh;
+  cairo_status_t status;
+
+  _cairo_gral_mesh_init (&mesh.base, gpu, NULL, FALSE);
+  mesh.base.on_full = _cairo_gral_fill_path_overflow;
+  mesh.base.on_full_closure = &mesh;
+  mesh.drawing_line = FALSE;
+  mesh.overflow = FALSE;
+  mesh.tolerance = tolerance;
+  mesh.guard_band = NULL;
+
+  status = _cairo_path_fixed_interpret_runs (path,
+                                             _cairo_gral_fill_path_move_to,
+                                             _cairo_gral_fill_path_line_to_run,
+                                             _cairo_gral_fill_path_flat_curve_to,
+                                             _cairo_path_to_verts_close_path,
+                                             &mesh);
+  if (unlikely (status))
+    goto BAIL;
+
+  if (mesh.overflow) {
+    status = CAIRO_INT_STATUS_UNSUPPORTED;
+    goto BAIL;
+  }
+
+  status = _cairo_gral_cached_mesh_create (&mesh.base, cached_out);
+
+BAIL:
+  _cairo_gral_mesh_fini (&mesh.base);
+  return status;
+}
+
+void
+_cairo_gral_set_fill_stencil_state (cairo_fill_rule_t fill_rule)
 {
   gral_set_stencil_check_enabled (TRUE);
   gral_set_color_buffer_write_enabled (FALSE, FALSE, FALSE, FALSE);
@@ -343,6 +486,17 @@ _cairo_gral_prepare_fill_stencil_mask(cairo_gral_surface_t   *gsurface,
                                       FALSE /*two_sided_operation*/);
       break;
   }
+}
+
+cairo_status_t
+_cairo_gral_prepare_fill_stencil_mask(cairo_gral_surface_t   *gsurface,
+                                      cairo_path_fixed_t     *path,
+                                      const cairo_rectangle_int_t *extents,
+                                      cairo_fill_rule_t       fill_rule,
+                                      double                  tolerance,
+                                      cairo_gral_bound_box_t *box)
+{
+  _cairo_gral_set_fill_stencil_state (fill_rule);
 
-  return _cairo_gral_render_fill_path (gsurface, path, tolerance, box);
+  return _cairo_gral_render_fill_path (gsurface, path, extents, tolerance, box);
 }
@@ -0,0 +1,245 @@
+/* -*- Mode: c; tab-width: 8; c-basic-offset: 4; indent-tabs-mode: t; -*- */
+/* Cairo - a vector graphics library with display and print output
+ *
+ * Copyright  2009 Argiris Kirtzidis
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it either under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation
+ * (the "LGPL") or, at your option, under the terms of the Mozilla
+ * Public License Version 1.1 (the "MPL"). If you do not alter this
+ * notice, a recipient may use your version of this file under either
+ * the MPL or the LGPL.
+ *
+ * You should have received a copy of the LGPL along with this library
+ * in the file COPYING-LGPL-2.1; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ * You should have received a copy of the MPL along with this library
+ * in the file COPYING-MPL-1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY
+ * OF ANY KIND, either express or implied. See the LGPL or the MPL for
+ * the specific language governing rights and limitations.
+ *
+ * The Original Code is the cairo graphics library.
+ *
+ * The Initial Developer of the Original Code is Argiris Kirtzidis.
+ *
+ * Contributor(s):
+ *      Argiris Kirtzidis <akyrtzi@gmail.com>
+ */
+
+#include "cairo-gral-private.h"
+#include <float.h>
+
+#define CAIRO_GRAL_GLYPH_INSTANCES 32
+
+typedef struct _cairo_gral_glyph_position {
+  unsigned long index;
+  float x, y;
+} cairo_gral_glyph_position_t;
+
+static int
+_cairo_gral_glyph_position_compare (const void *a, const void *b)
+{
+  const cairo_gral_glyph_position_t *ga = a;
+  const cairo_gral_glyph_position_t *gb = b;
+
+  if (ga->index < gb->index)
+    return -1;
+  if (ga->index > gb->index)
+    return 1;
+  return 0;
+}
+
+/* The tesselated outline of a glyph is kept in scaled_glyph->surface_private,
+ * relative to the glyph origin, so each glyph gets tesselated only once and
+ * every occurrence of it is a transformed instance of the same mesh. It is
+ * tesselated again if the mesh was evicted. */
+static cairo_status_t
+_cairo_gral_glyph_get_mesh (cairo_gral_surface_t      *gsurface,
+                            cairo_scaled_font_t       *scaled_font,
+                            unsigned long              index,
+                            cairo_gral_cached_mesh_t **mesh_out)
+{
+  cairo_scaled_glyph_t *scaled_glyph;
+  cairo_status_t status;
+
+  status = _cairo_scaled_glyph_lookup (scaled_font,
+                                       index,
+                                       CAIRO_SCALED_GLYPH_INFO_PATH,
+                                       &scaled_glyph);
+  if (unlikely (status))
+    return status;
+
+  if (scaled_glyph->surface_private != NULL &&
+      _cairo_gral_cached_mesh_is_evicted ((cairo_gral_cached_mesh_t *) scaled_glyph->surface_private)) {
+    _cairo_gral_cached_mesh_destroy (scaled_glyph->surface_private);
+    scaled_glyph->surface_private = NULL;
+  }
+
+  if (scaled_glyph->surface_private == NULL) {
+    cairo_gral_cached_mesh_t *mesh;
+    cairo_rectangle_int_t extents;
+
+    /* Glyphs of small font sizes get coarser meshes. */
+    _cairo_path_fixed_approximate_extents (scaled_glyph->path, &extents);
+    status = _cairo_gral_fill_path_to_cached_mesh (gsurface->gpu,
+                                                   scaled_glyph->path,
+                                                   _cairo_gral_lod_tolerance (CAIRO_GSTATE_TOLERANCE_DEFAULT,
+                                                                              &extents),
+                                                   &mesh);
+    if (unlikely (status))
+      return status;
+
+    scaled_glyph->surface_private = mesh;
+  } else {
+    _cairo_gral_cached_mesh_touch ((cairo_gral_cached_mesh_t *) scaled_glyph->surface_private);
+  }
+
+  *mesh_out = scaled_glyph->surface_private;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+cairo_int_status_t
+_cairo_gral_surface_show_glyphs (void                  *asurface,
+                                 cairo_operator_t       op,
+                                 const cairo_pattern_t *source,
+                                 cairo_glyph_t         *glyphs,
+                                 int                    num_glyphs,
+                                 cairo_scaled_font_t   *scaled_font,
+                                 int                   *remaining_glyphs,
+                                 cairo_rectangle_int_t *extents)
+{
+  cairo_gral_surface_t *gsurface = asurface;
+  cairo_gral_glyph_position_t stack_positions[CAIRO_STACK_ARRAY_LENGTH (cairo_gral_glyph_position_t)];
+  cairo_gral_glyph_position_t *positions = stack_positions;
+  gral_instance_data_t instances[CAIRO_GRAL_GLYPH_INSTANCES];
+  cairo_gral_bound_box_t box;
+  cairo_int_status_t status = CAIRO_STATUS_SUCCESS;
+  int i;
+
+  if (op == CAIRO_OPERATOR_DEST || num_glyphs == 0)
+    return CAIRO_STATUS_SUCCESS;
+
+  if (scaled_font->surface_backend != NULL &&
+      scaled_font->surface_backend != gsurface->base.backend)
+    return _cairo_gral_surface_fallback (gsurface);
+
+  status = _cairo_gral_surface_flush_fills (gsurface);
+  if (status == CAIRO_STATUS_SUCCESS)
+    status = _cairo_gral_surface_flush_source_fills (gsurface, source);
+  if (unlikely (status))
+    return status;
+
+  if (num_glyphs > ARRAY_LENGTH (stack_positions)) {
+    positions = _cairo_malloc_ab (num_glyphs, sizeof (cairo_gral_glyph_position_t));
+    if (unlikely (positions == NULL))
+      return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+  }
+
+  /* Sort by glyph so that all the occurrences of a glyph become a single
+   * instanced draw. */
+  for (i = 0; i < num_glyphs; ++i) {
+    positions[i].index = glyphs[i].index;
+    positions[i].x = (float) glyphs[i].x;
+    positions[i].y = (float) glyphs[i].y;
+  }
+  qsort (positions, num_glyphs, sizeof (cairo_gral_glyph_position_t),
+         _cairo_gral_glyph_position_compare);
+
+  box.min_x = box.min_y = FLT_MAX;
+  box.max_x = box.max_y = -FLT_MAX;
+
+  _cairo_gral_init_render_state (gsurface);
+
+  /* Tesselate into stencil */
+  _cairo_gral_set_fill_stencil_state (CAIRO_FILL_RULE_WINDING);
+
+  _cairo_scaled_font_freeze_cache (scaled_font);
+  scaled_font->surface_backend = gsurface->base.backend;
+
+  for (i = 0; i < num_glyphs; ) {
+    cairo_gral_cached_mesh_t *mesh;
+    unsigned long index = positions[i].index;
+    size_t num_instances = 0;
+
+    status = _cairo_gral_glyph_get_mesh (gsurface, scaled_font, index, &mesh);
+    if (unlikely (status)) {
+      if (status == CAIRO_INT_STATUS_UNSUPPORTED)
+        status = _cairo_gral_surface_fallback (gsurface);
+      break;
+    }
+
+    for (; i < num_glyphs && positions[i].index == index; ++i) {
+      gral_instance_data_t *inst;
+      float x = positions[i].x;
+      float y = positions[i].y;
+
+      if (_cairo_gral_cached_mesh_is_empty (mesh))
+        continue;
+
+      inst = &instances[num_instances++];
+      gral_matrix_init_translate (&inst->transform, x, y, 0);
+
+      if (mesh->box.min_x + x < box.min_x) box.min_x = mesh->box.min_x + x;
+      if (mesh->box.min_y + y < box.min_y) box.min_y = mesh->box.min_y + y;
+      if (mesh->box.max_x + x > box.max_x) box.max_x = mesh->box.max_x + x;
+      if (mesh->box.max_y + y > box.max_y) box.max_y = mesh->box.max_y + y;
+
+      if (num_instances == ARRAY_LENGTH (instances)) {
+        _cairo_gral_cached_mesh_render_instanced (mesh, instances, num_instances,
+                                                  GRAL_INSTANCE_DATA_TRANSFORM);
+        num_instances = 0;
+      }
+    }
+
+    _cairo_gral_cached_mesh_render_instanced (mesh, instances, num_instances,
+                                              GRAL_INSTANCE_DATA_TRANSFORM);
+  }
+
+  _cairo_scaled_font_thaw_cache (scaled_font);
+
+  if (box.min_x <= box.max_x) {
+    /* Draw paint where stencil not zero */
+    gral_set_stencil_buffer_params (GRAL_COMPARE_FUNC_NOT_EQUAL,
+                                    0, 0xffffffff,
+                                    GRAL_STENCIL_OPERATION_ZERO,
+                                    GRAL_STENCIL_OPERATION_ZERO,
+                                    GRAL_STENCIL_OPERATION_ZERO,
+                                    FALSE /*two_sided_operation*/);
+
+    if (status == CAIRO_STATUS_SUCCESS)
+      status = _cairo_gral_set_source (gsurface, source);
+
+    /* On failure the quad still has to go through, to clear the stencil. */
+    if (status == CAIRO_STATUS_SUCCESS)
+      gral_set_color_buffer_write_enabled (TRUE, TRUE, TRUE, TRUE);
+
+    _cairo_gral_render_quad (gsurface, box.min_x, box.min_y, box.max_x, box.max_y);
+  }
+
+  /* Reset state */
+  gral_set_stencil_check_enabled (FALSE);
+  gral_set_color_buffer_write_enabled (TRUE, TRUE, TRUE, TRUE);
+
+  if (positions != stack_positions)
+    free (positions);
+
+  return status;
+}
+
+void
+_cairo_gral_surface_scaled_glyph_fini (cairo_scaled_glyph_t *scaled_glyph,
+                                       cairo_scaled_font_t  *scaled_font)
+{
+  cairo_gral_cached_mesh_t *mesh = scaled_glyph->surface_private;
+
+  if (mesh)
+    _cairo_gral_cached_mesh_destroy (mesh);
+}
@@ -182,23 +182,13 @@ _cairo_gral_mesh_gpu_spline_fill (cairo_gral_mesh_t          *mesh,
                                   cairo_gral_gpu_resources_t *gpu)
 {
   cairo_gral_mesh_t spline_mesh;
-  cairo_gral_tex_coord3_t tex_coords[CAIRO_GRAL_MAX_VERTICES];
 
   const cairo_gral_splines_buffer_t *splines_buffer;
   const cairo_gral_splines_buf_t    *buf;
 
   assert (mesh->num_vertices == 0 && mesh->num_indices == 0);
-  assert (mesh->vertices && mesh->indices);
-
-  _cairo_gral_mesh_init (&spline_mesh,
-                         mesh->vertices,
-                         tex_coords,
-                         mesh->indices,
-                         gpu->vertex_buf_pos,
-                         gpu->vertex_buf_tex,
-                         gpu->index_buf,
-                         gpu->vertex_data_spline,
-                         gpu->index_data);
+
+  _cairo_gral_mesh_init (&spline_mesh, gpu, gpu->vertex_data_spline, TRUE);
   spline_mesh.box = mesh->box;
 
   if (gpu->spline_fill_shader == NULL) {
@@ -227,6 +217,8 @@ _cairo_gral_mesh_gpu_spline_fill (cairo_gral_mesh_t          *mesh,
   _cairo_gral_mesh_render (&spline_mesh);
 
   mesh->box = spline_mesh.box;
+  if (unlikely (spline_mesh.status))
+    mesh->status = spline_mesh.status;
 
   _cairo_gral_mesh_fini (&spline_mesh);
 }
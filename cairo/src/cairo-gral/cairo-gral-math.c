@@ -36,6 +36,11 @@
 
 #include "cairo-gral-math.h"
 
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+# define CAIRO_GRAL_HAS_SSE2 1
+# include <emmintrin.h>
+#endif
+
 double
 _cairo_gral_vector2_normalize (cairo_gral_vector2_t *v)
 {
@@ -114,3 +119,57 @@ _cairo_gral_quad_is_clockwise (cairo_gral_vector2_t p[4])
 
   return (angle1 > 0 ? TRUE : FALSE);
 }
+
+/* Converts fixed point positions to floats and grows box to include them.
+ * The result is the same as (float) _cairo_fixed_to_double (); the integer
+ * to float conversion is the only rounding, the scale is a power of two. */
+void
+_cairo_gral_points_to_float (const cairo_point_t     *points,
+                             size_t                   num_points,
+                             cairo_gral_vertex_pos_t *out,
+                             cairo_gral_bound_box_t  *box)
+{
+  const float scale = 1.0f / CAIRO_FIXED_ONE;
+  float min_x = box->min_x, min_y = box->min_y;
+  float max_x = box->max_x, max_y = box->max_y;
+  size_t i = 0;
+
+#if CAIRO_GRAL_HAS_SSE2
+  if (num_points >= 2) {
+    /* Two points, x y x y, per register. */
+    __m128 vscale = _mm_set1_ps (scale);
+    __m128 vmin = _mm_setr_ps (min_x, min_y, min_x, min_y);
+    __m128 vmax = _mm_setr_ps (max_x, max_y, max_x, max_y);
+    float lanes[4];
+
+    for (; i + 2 <= num_points; i += 2) {
+      __m128i fixed = _mm_loadu_si128 ((const __m128i *) &points[i]);
+      __m128 pos = _mm_mul_ps (_mm_cvtepi32_ps (fixed), vscale);
+      _mm_storeu_ps (&out[i].x, pos);
+      vmin = _mm_min_ps (vmin, pos);
+      vmax = _mm_max_ps (vmax, pos);
+    }
+
+    vmin = _mm_min_ps (vmin, _mm_movehl_ps (vmin, vmin));
+    vmax = _mm_max_ps (vmax, _mm_movehl_ps (vmax, vmax));
+    _mm_storeu_ps (lanes, vmin);
+    min_x = lanes[0]; min_y = lanes[1];
+    _mm_storeu_ps (lanes, vmax);
+    max_x = lanes[0]; max_y = lanes[1];
+  }
+#endif
+
+  for (; i < num_points; i++) {
+    float x = (float) points[i].x * scale;
+    float y = (float) points[i].y * scale;
+    out[i].x = x;
+    out[i].y = y;
+    if (x < min_x) min_x = x;
+    if (y < min_y) min_y = y;
+    if (x > max_x) max_x = x;
+    if (y > max_y) max_y = y;
+  }
+
+  box->min_x = min_x; box->min_y = min_y;
+  box->max_x = max_x; box->max_y = max_y;
+}
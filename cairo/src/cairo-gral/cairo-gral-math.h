@@ -111,6 +111,12 @@ _cairo_gral_subdivide_spline (double                     t,
 cairo_private cairo_bool_t
 _cairo_gral_quad_is_clockwise (cairo_gral_vector2_t p[3]);
 
+cairo_private void
+_cairo_gral_points_to_float (const cairo_point_t     *points,
+                             size_t                   num_points,
+                             cairo_gral_vertex_pos_t *out,
+                             cairo_gral_bound_box_t  *box);
+
 CAIRO_END_DECLS
 
 #endif /* CAIRO_GRAL_MATH_H */
\ No newline at end of file
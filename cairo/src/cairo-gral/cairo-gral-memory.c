@@ -0,0 +1,200 @@
+/* -*- Mode: c; tab-width: 8; c-basic-offset: 4; indent-tabs-mode: t; -*- */
+/* Cairo - a vector graphics library with display and print output
+ *
+ * Copyright  2009 Argiris Kirtzidis
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it either under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation
+ * (the "LGPL") or, at your option, under the terms of the Mozilla
+ * Public License Version 1.1 (the "MPL"). If you do not alter this
+ * notice, a recipient may use your version of this file under either
+ * the MPL or the LGPL.
+ *
+ * You should have received a copy of the LGPL along with this library
+ * in the file COPYING-LGPL-2.1; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ * You should have received a copy of the MPL along with this library
+ * in the file COPYING-MPL-1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY
+ * OF ANY KIND, either express or implied. See the LGPL or the MPL for
+ * the specific language governing rights and limitations.
+ *
+ * The Original Code is the cairo graphics library.
+ *
+ * The Initial Developer of the Original Code is Argiris Kirtzidis.
+ *
+ * Contributor(s):
+ *      Argiris Kirtzidis <akyrtzi@gmail.com>
+ */
+
+/* Accounting of the GPU memory that cairo-gral allocates. Every texture,
+ * buffer and cached mesh is a cairo_gral_resource_t in a list of the shared
+ * gpu resources, most recently used first. Before each drawing operation
+ * the evictable resources are trimmed to the budget set by
+ * cairo_gral_set_memory_budget(), evicting from the tail of the list; an
+ * evicted resource is created again by its owner the next time it's needed.
+ * Render targets and the dynamic buffers are counted in the stats but can't
+ * be evicted, so they are left out of the budget; otherwise, once they alone
+ * exceeded it, every cache would be evicted before each operation. */
+
+#include "cairo-gral-private.h"
+
+static void
+_cairo_gral_memory_unlink (cairo_gral_memory_t   *memory,
+                           cairo_gral_resource_t *resource)
+{
+  if (resource->prev)
+    resource->prev->next = resource->next;
+  else
+    memory->head = resource->next;
+  if (resource->next)
+    resource->next->prev = resource->prev;
+  else
+    memory->tail = resource->prev;
+
+  resource->prev = resource->next = NULL;
+}
+
+static void
+_cairo_gral_memory_link_head (cairo_gral_memory_t   *memory,
+                              cairo_gral_resource_t *resource)
+{
+  resource->prev = NULL;
+  resource->next = memory->head;
+  if (memory->head)
+    memory->head->prev = resource;
+  else
+    memory->tail = resource;
+  memory->head = resource;
+
+  resource->last_use = memory->use_count;
+}
+
+/* Starts counting size bytes for the resource, or changes its size if it's
+ * counted already. evict is NULL for the resources that can't be evicted. */
+void
+_cairo_gral_memory_add (cairo_gral_gpu_resources_t       *gpu,
+                        cairo_gral_resource_t            *resource,
+                        cairo_gral_resource_type_t        type,
+                        size_t                            size,
+                        cairo_gral_resource_evict_func_t  evict)
+{
+  cairo_gral_memory_t *memory = &gpu->memory;
+
+  _cairo_gral_memory_remove (gpu, resource);
+
+  resource->type = type;
+  resource->size = size;
+  resource->evict = evict;
+  resource->linked = TRUE;
+  _cairo_gral_memory_link_head (memory, resource);
+
+  memory->bytes[type] += size;
+  memory->total += size;
+  if (evict != NULL)
+    memory->evictable += size;
+}
+
+/* Stops counting the resource; does nothing if it isn't counted. */
+void
+_cairo_gral_memory_remove (cairo_gral_gpu_resources_t *gpu,
+                           cairo_gral_resource_t      *resource)
+{
+  cairo_gral_memory_t *memory = &gpu->memory;
+
+  if (! resource->linked)
+    return;
+
+  _cairo_gral_memory_unlink (memory, resource);
+  resource->linked = FALSE;
+
+  memory->bytes[resource->type] -= resource->size;
+  memory->total -= resource->size;
+  if (resource->evict != NULL)
+    memory->evictable -= resource->size;
+}
+
+/* Marks the resource as used by the current operation. */
+void
+_cairo_gral_memory_touch (cairo_gral_gpu_resources_t *gpu,
+                          cairo_gral_resource_t      *resource)
+{
+  cairo_gral_memory_t *memory = &gpu->memory;
+
+  if (! resource->linked || memory->head == resource) {
+    resource->last_use = memory->use_count;
+    return;
+  }
+
+  _cairo_gral_memory_unlink (memory, resource);
+  _cairo_gral_memory_link_head (memory, resource);
+}
+
+static void
+_cairo_gral_memory_evict (cairo_gral_gpu_resources_t *gpu,
+                          cairo_gral_resource_t      *resource)
+{
+  _cairo_gral_memory_remove (gpu, resource);
+  resource->evict (gpu, resource);
+}
+
+/* Evicts the least recently used resources until the evictable ones are
+ * within the budget. Called when nothing is bound yet for the operation that starts;
+ * the resources that were used since the previous trim are kept, as the
+ * operation may have looked them up already (e.g. the cached mesh of a
+ * display list entry). */
+void
+_cairo_gral_memory_trim (cairo_gral_gpu_resources_t *gpu)
+{
+  cairo_gral_memory_t *memory = &gpu->memory;
+  cairo_gral_resource_t *resource = memory->tail;
+  size_t budget = cairo_gral_get_memory_budget ();
+
+  while (budget != 0 && memory->evictable > budget && resource != NULL) {
+    cairo_gral_resource_t *prev = resource->prev;
+
+    /* The list is ordered by use, all the others are newer. */
+    if (resource->last_use == memory->use_count)
+      break;
+
+    if (resource->evict != NULL) {
+      _cairo_gral_memory_evict (gpu, resource);
+      memory->evictions++;
+    }
+    resource = prev;
+  }
+
+  memory->use_count++;
+}
+
+/* Evicts all the resources that are still counted when the gpu resources
+ * are released, e.g. the meshes of glyphs that outlive the last surface, and
+ * stops counting the others. */
+void
+_cairo_gral_memory_fini (cairo_gral_gpu_resources_t *gpu)
+{
+  cairo_gral_memory_t *memory = &gpu->memory;
+
+  while (memory->head != NULL) {
+    cairo_gral_resource_t *resource = memory->head;
+
+    if (resource->evict != NULL)
+      _cairo_gral_memory_evict (gpu, resource);
+    else
+      _cairo_gral_memory_remove (gpu, resource);
+  }
+}
+
+/* Bytes of a texture, at four per texel; only BGRA textures are created. */
+size_t
+_cairo_gral_texture_bytes (gral_texture_t *tex)
+{
+  return (size_t) gral_texture_get_width (tex) * gral_texture_get_height (tex) * 4;
+}
@@ -35,35 +35,110 @@
  */
 
 #include "cairo-gral-private.h"
+#include "cairo-gral-math.h"
 #include <float.h>
 
+static cairo_bool_t
+_cairo_gral_grow_array (void **array, size_t *max_items, size_t item_size, size_t min_items)
+{
+  size_t max = *max_items ? *max_items : CAIRO_GRAL_INITIAL_BATCH_TRIGS * 3;
+  void *new_array;
+
+  while (max < min_items)
+    max *= 2;
+  if (max == *max_items)
+    return TRUE;
+
+  new_array = _cairo_realloc_ab (*array, max, item_size);
+  if (unlikely (new_array == NULL))
+    return FALSE;
+
+  *array = new_array;
+  *max_items = max;
+  return TRUE;
+}
+
+/* Updates the mesh pointers after the storage changed. */
+static void
+_cairo_gral_mesh_sync_storage (cairo_gral_mesh_t *mesh, cairo_bool_t tex_coords)
+{
+  mesh->vertices = mesh->storage->vertices;
+  mesh->tex_coords = tex_coords ? mesh->storage->tex_coords : NULL;
+  mesh->indices = mesh->storage->indices;
+}
+
+static cairo_bool_t
+_cairo_gral_mesh_reserve_vertices (cairo_gral_mesh_t *mesh,
+                                   size_t             num_vertices,
+                                   cairo_bool_t       tex_coords)
+{
+  cairo_gral_mesh_storage_t *storage = mesh->storage;
+  cairo_bool_t ok;
+
+  ok = _cairo_gral_grow_array ((void **) &storage->vertices, &storage->max_vertices,
+                               sizeof (cairo_gral_vertex_pos_t), num_vertices);
+  /* The shared storage may have grown before without texture coordinates. */
+  if (ok && tex_coords)
+    ok = _cairo_gral_grow_array ((void **) &storage->tex_coords, &storage->max_tex_coords,
+                                 sizeof (cairo_gral_tex_coord3_t), storage->max_vertices);
+
+  _cairo_gral_mesh_sync_storage (mesh, tex_coords);
+  return ok;
+}
+
+static cairo_bool_t
+_cairo_gral_mesh_reserve_indices (cairo_gral_mesh_t *mesh, size_t num_indices)
+{
+  cairo_gral_mesh_storage_t *storage = mesh->storage;
+
+  if (num_indices > mesh->max_indices)
+    num_indices = mesh->max_indices;
+
+  if (! _cairo_gral_grow_array ((void **) &storage->indices, &storage->max_indices,
+                                sizeof (cairo_gral_vertex_index_t), num_indices))
+    return FALSE;
+
+  mesh->indices = storage->indices;
+  return TRUE;
+}
+
 void
 _cairo_gral_mesh_init (cairo_gral_mesh_t          *mesh,
-                       cairo_gral_vertex_pos_t    *vertices,
-                       cairo_gral_tex_coord3_t    *tex_coords,
-                       cairo_gral_vertex_index_t  *indices,
-                       gral_vertex_buffer_t       *vertex_buf_pos,
-                       gral_vertex_buffer_t       *vertex_buf_tex,
-                       gral_index_buffer_t        *index_buf,
+                       cairo_gral_gpu_resources_t *gpu,
                        gral_vertex_data_t         *vertex_data,
-                       gral_index_data_t          *index_data)
+                       cairo_bool_t                tex_coords)
 {
   mesh->op.operation_type = GRAL_RENDER_OPERATION_TYPE_TRIANGLE_LIST;
   mesh->op.vertex_data = vertex_data;
-  mesh->op.index_data = index_data;
+  mesh->op.index_data = gpu->index_data;
   mesh->op.use_indexes = TRUE;
 
-  mesh->vertex_buf_pos = vertex_buf_pos;
-  mesh->vertex_buf_tex = vertex_buf_tex;
-  mesh->index_buf = index_buf;
+  mesh->gpu = gpu;
+
+  /* A mesh can be created while another one is still filling up (e.g. the
+   * spline mesh of a fill), only the first gets the shared arrays. */
+  memset (&mesh->own_storage, 0, sizeof (cairo_gral_mesh_storage_t));
+  if (! gpu->mesh_storage.in_use)
+    mesh->storage = &gpu->mesh_storage;
+  else
+    mesh->storage = &mesh->own_storage;
+  mesh->storage->in_use = TRUE;
 
-  mesh->vertices = vertices;
-  mesh->tex_coords = tex_coords;
-  mesh->indices = indices;
+  mesh->max_indices = _cairo_gral_get_max_batch_indices ();
+  mesh->status = CAIRO_STATUS_SUCCESS;
+  _cairo_gral_mesh_sync_storage (mesh, FALSE);
+
+  if (unlikely (! _cairo_gral_mesh_reserve_vertices (mesh, 1, tex_coords) ||
+                ! _cairo_gral_mesh_reserve_indices (mesh, 1)))
+    mesh->status = _cairo_error (CAIRO_STATUS_NO_MEMORY);
 
   mesh->num_vertices = mesh->num_indices = 0;
   mesh->box.min_x = mesh->box.min_y = FLT_MAX;
-  mesh->box.max_x = mesh->box.max_y = FLT_MIN;
+  mesh->box.max_x = mesh->box.max_y = -FLT_MAX;
+
+  mesh->on_full = NULL;
+  mesh->on_full_closure = NULL;
+  mesh->clear_stencil = FALSE;
 
   _cairo_gral_splines_buffer_init (&mesh->splines);
 }
@@ -72,21 +147,36 @@ void
 _cairo_gral_mesh_fini (cairo_gral_mesh_t *mesh)
 {
   _cairo_gral_splines_buffer_fini (&mesh->splines);
+
+  mesh->storage->in_use = FALSE;
+  if (mesh->storage == &mesh->own_storage) {
+    free (mesh->own_storage.vertices);
+    free (mesh->own_storage.tex_coords);
+    free (mesh->own_storage.indices);
+  }
 }
 
 cairo_gral_vertex_index_t
 _cairo_gral_mesh_add_vertex_float (cairo_gral_mesh_t *mesh,
                                    float x, float y)
 {
+  if (mesh->num_vertices == mesh->storage->max_vertices &&
+      unlikely (! _cairo_gral_mesh_reserve_vertices (mesh, mesh->num_vertices + 1,
+                                                     mesh->tex_coords != NULL)))
+  {
+    if (mesh->status == CAIRO_STATUS_SUCCESS)
+      mesh->status = _cairo_error (CAIRO_STATUS_NO_MEMORY);
+  }
+  if (unlikely (mesh->status))
+    return 0;
+
   if (x < mesh->box.min_x) mesh->box.min_x = x;
   if (y < mesh->box.min_y) mesh->box.min_y = y;
   if (x > mesh->box.max_x) mesh->box.max_x = x;
   if (y > mesh->box.max_y) mesh->box.max_y = y;
 
-  assert(mesh->num_vertices < CAIRO_GRAL_MAX_VERTICES);
   mesh->vertices[mesh->num_vertices].x = x;
   mesh->vertices[mesh->num_vertices].y = y;
-  mesh->vertices[mesh->num_vertices].z = CAIRO_GRAL_Z_VALUE;
   ++mesh->num_vertices;
   return mesh->num_vertices-1;
 }
@@ -102,16 +192,67 @@ _cairo_gral_mesh_add_vertex_pos_and_tex (cairo_gral_mesh_t       *mesh,
   assert (mesh->tex_coords);
 
   index = _cairo_gral_mesh_add_vertex_float (mesh, x, y);
+  if (unlikely (mesh->status))
+    return index;
+
   mesh->tex_coords[index] = *tex_coord;
   return index;
 }
 
+/* Makes room for that many more vertices and indices in the batch, so that
+ * the caller can write them directly. Returns FALSE if they don't fit before
+ * the batch has to be rendered, or on error; they have to be added one by
+ * one then. */
+cairo_bool_t
+_cairo_gral_mesh_reserve (cairo_gral_mesh_t *mesh,
+                          size_t             num_vertices,
+                          size_t             num_indices)
+{
+  if (unlikely (mesh->status))
+    return FALSE;
+
+  /* _cairo_gral_mesh_add_index() expects room for one more index. */
+  if (mesh->num_indices + num_indices >= mesh->max_indices)
+    return FALSE;
+
+  if (unlikely (! _cairo_gral_mesh_reserve_vertices (mesh, mesh->num_vertices + num_vertices,
+                                                     mesh->tex_coords != NULL) ||
+                ! _cairo_gral_mesh_reserve_indices (mesh, mesh->num_indices + num_indices + 1)))
+  {
+    mesh->status = _cairo_error (CAIRO_STATUS_NO_MEMORY);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Appends the points as vertices of a mesh without texture coordinates and
+ * returns the index of the first one. The room has to be reserved by
+ * _cairo_gral_mesh_reserve(). */
+cairo_gral_vertex_index_t
+_cairo_gral_mesh_add_vertices_fixed (cairo_gral_mesh_t   *mesh,
+                                     const cairo_point_t *points,
+                                     size_t               num_points)
+{
+  cairo_gral_vertex_index_t first = mesh->num_vertices;
+
+  assert (mesh->tex_coords == NULL);
+  assert (mesh->num_vertices + num_points <= mesh->storage->max_vertices);
+
+  _cairo_gral_points_to_float (points, num_points, mesh->vertices + first, &mesh->box);
+  mesh->num_vertices += num_points;
+  return first;
+}
+
 void
 _cairo_gral_mesh_add_index (cairo_gral_mesh_t *mesh,
                             cairo_gral_vertex_index_t *pindex)
 {
   cairo_gral_vertex_index_t index = *pindex;
 
+  if (unlikely (mesh->status))
+    return;
+
   if (index >= mesh->num_vertices) {
     /* The contents of the vertices/indices buffers were rendered and now the
      * index refers to an invalid vertex. Copy the vertex that the index was
@@ -119,53 +260,174 @@ _cairo_gral_mesh_add_index (cairo_gral_mesh_t *mesh,
      * and set the index to point to the newly copied vertex.
      */
     if (mesh->tex_coords) {
+      cairo_gral_tex_coord3_t tex_coord = mesh->tex_coords[index];
       index = _cairo_gral_mesh_add_vertex_pos_and_tex (mesh,
                                                        mesh->vertices[index].x,
                                                        mesh->vertices[index].y,
-                                                       &mesh->tex_coords[index]);
+                                                       &tex_coord);
     } else {
       index = _cairo_gral_mesh_add_vertex_float (mesh,
                                                  mesh->vertices[index].x,
                                                  mesh->vertices[index].y);
     }
+    if (unlikely (mesh->status))
+      return;
 
     *pindex = index;
   }
 
-  assert(mesh->num_indices < CAIRO_GRAL_MAX_INDICES);
+  assert(mesh->num_indices < mesh->storage->max_indices);
   mesh->indices[mesh->num_indices++] = index;
 
-  if (mesh->num_indices < CAIRO_GRAL_MAX_INDICES)
+  if (mesh->num_indices < MIN (mesh->storage->max_indices, mesh->max_indices))
+    return;
+
+  /* Grow instead of splitting the batch, until the batch limit. Capacities
+   * are multiples of 3 so a full index array ends at a triangle. */
+  if (mesh->num_indices < mesh->max_indices &&
+      _cairo_gral_mesh_reserve_indices (mesh, mesh->num_indices + 1))
     return;
 
   /* Index buffer is full */
-  _cairo_gral_mesh_render (mesh);
+  if (mesh->on_full)
+    mesh->on_full (mesh->on_full_closure);
+  else
+    _cairo_gral_mesh_render (mesh);
+}
+
+/* 16 bit indices are used if there are few enough vertices. */
+static gral_index_buffer_type_t
+_cairo_gral_index_type (size_t num_vertices)
+{
+  return num_vertices <= CAIRO_GRAL_MAX_SHORT_INDEXED_VERTICES ?
+         GRAL_INDEX_BUFFER_TYPE_16BIT : GRAL_INDEX_BUFFER_TYPE_32BIT;
+}
+
+static void
+_cairo_gral_write_indices (void                            *dest,
+                           const cairo_gral_vertex_index_t *indices,
+                           size_t                           num_indices,
+                           gral_index_buffer_type_t         type)
+{
+  size_t i;
+
+  if (type == GRAL_INDEX_BUFFER_TYPE_32BIT) {
+    memcpy (dest, indices, sizeof(uint32_t) * num_indices);
+  } else {
+    uint16_t *d = dest;
+    for (i = 0; i < num_indices; ++i)
+      d[i] = (uint16_t) indices[i];
+  }
+}
+
+static size_t
+_cairo_gral_index_size (gral_index_buffer_type_t type)
+{
+  return type == GRAL_INDEX_BUFFER_TYPE_32BIT ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+void
+_cairo_gral_write_positions (void                          *dest,
+                             const cairo_gral_vertex_pos_t *vertices,
+                             size_t                         num_vertices,
+                             gral_vertex_element_type_t     type)
+{
+  size_t i;
+
+  switch (type) {
+    default: ASSERT_NOT_REACHED;
+    case GRAL_VERTEX_ELEMENT_TYPE_FLOAT2:
+      memcpy (dest, vertices, sizeof(cairo_gral_vertex_pos_t) * num_vertices);
+      break;
+
+    case GRAL_VERTEX_ELEMENT_TYPE_FLOAT3: {
+      float *d = dest;
+      for (i = 0; i < num_vertices; ++i, d += 3) {
+        d[0] = vertices[i].x;
+        d[1] = vertices[i].y;
+        d[2] = CAIRO_GRAL_Z_VALUE;
+      }
+      break;
+    }
+
+    case GRAL_VERTEX_ELEMENT_TYPE_SHORT2: {
+      int16_t *d = dest;
+      for (i = 0; i < num_vertices; ++i, d += 2) {
+        d[0] = (int16_t) _cairo_lround (vertices[i].x * (1 << CAIRO_GRAL_SUBPIXEL_BITS));
+        d[1] = (int16_t) _cairo_lround (vertices[i].y * (1 << CAIRO_GRAL_SUBPIXEL_BITS));
+      }
+      break;
+    }
+  }
+}
+
+/* Stencil passes can use SHORT2 positions if the whole mesh is in range. */
+static cairo_bool_t
+_cairo_gral_mesh_fits_short_positions (cairo_gral_mesh_t *mesh)
+{
+  const float limit = (float) (0x7fff >> CAIRO_GRAL_SUBPIXEL_BITS);
+
+  return mesh->gpu->vertex_data_stencil_short != NULL &&
+         mesh->op.vertex_data == mesh->gpu->vertex_data_stencil &&
+         mesh->box.min_x >= -limit && mesh->box.max_x <= limit &&
+         mesh->box.min_y >= -limit && mesh->box.max_y <= limit;
+}
+
+/* Draws the uploaded batch; the write-once strokes draw it a second time
+ * without colour, to clear the stencil behind them. */
+static void
+_cairo_gral_mesh_draw (cairo_gral_mesh_t *mesh, gral_render_operation_t *op)
+{
+  gral_render (op);
+  if (mesh->clear_stencil) {
+    _cairo_gral_set_stroke_clear_state ();
+    gral_render (op);
+    _cairo_gral_set_stroke_write_once_state ();
+  }
 }
 
 void
 _cairo_gral_mesh_render (cairo_gral_mesh_t *mesh)
 {
+  cairo_gral_gpu_resources_t *gpu = mesh->gpu;
+  gral_render_operation_t op = mesh->op;
+  gral_vertex_element_type_t pos_type = gpu->pos_type;
+  size_t pos_size = gpu->pos_size;
+  gral_index_buffer_type_t index_type;
   gral_vertex_buffer_t *vbuf;
   gral_index_buffer_t *ibuf;
+  cairo_status_t status;
   size_t length;
   void *dat;
 
-  if (mesh->num_indices < 3)
+  if (mesh->num_indices < 3 || unlikely (mesh->status))
     goto FINISHED_RENDER;
 
   assert(mesh->num_indices % 3 == 0);
 
-  vbuf = mesh->vertex_buf_pos;
-  length = sizeof(cairo_gral_vertex_pos_t) * mesh->num_vertices;
+  status = _cairo_gral_gpu_resources_reserve (gpu, mesh->num_vertices, mesh->num_indices,
+                                              mesh->tex_coords != NULL);
+  if (unlikely (status)) {
+    mesh->status = status;
+    goto FINISHED_RENDER;
+  }
+  index_type = _cairo_gral_index_type (mesh->num_vertices);
+
+  if (_cairo_gral_mesh_fits_short_positions (mesh)) {
+    op.vertex_data = gpu->vertex_data_stencil_short;
+    pos_type = GRAL_VERTEX_ELEMENT_TYPE_SHORT2;
+    pos_size = 2 * sizeof(int16_t);
+  }
+
+  vbuf = gpu->vertex_buf_pos;
+  length = pos_size * mesh->num_vertices;
   assert(length <= gral_vertex_buffer_get_size (vbuf));
   dat = gral_vertex_buffer_lock (vbuf, 0, length, GRAL_BUFFER_LOCK_OPTION_DISCARD);
-  memcpy(dat, mesh->vertices, length);
+  _cairo_gral_write_positions (dat, mesh->vertices, mesh->num_vertices, pos_type);
   gral_vertex_buffer_unlock (vbuf);
 
   if (mesh->tex_coords) {
-    assert(mesh->vertex_buf_tex);
-
-    vbuf = mesh->vertex_buf_tex;
+    vbuf = gpu->vertex_buf_tex;
     length = sizeof(cairo_gral_tex_coord3_t) * mesh->num_vertices;
     assert(length <= gral_vertex_buffer_get_size (vbuf));
     dat = gral_vertex_buffer_lock (vbuf, 0, length, GRAL_BUFFER_LOCK_OPTION_DISCARD);
@@ -173,18 +435,154 @@ _cairo_gral_mesh_render (cairo_gral_mesh_t *mesh)
     gral_vertex_buffer_unlock (vbuf);
   }
 
-  ibuf = mesh->index_buf;
-  length = sizeof(cairo_gral_vertex_index_t) * mesh->num_indices;
+  ibuf = index_type == GRAL_INDEX_BUFFER_TYPE_32BIT ? gpu->index_buf_32 : gpu->index_buf;
+  length = _cairo_gral_index_size (index_type) * mesh->num_indices;
   assert(length <= gral_index_buffer_get_size (ibuf));
   dat = gral_index_buffer_lock (ibuf, 0, length, GRAL_BUFFER_LOCK_OPTION_DISCARD);
-  memcpy(dat, mesh->indices, length);
+  _cairo_gral_write_indices (dat, mesh->indices, mesh->num_indices, index_type);
   gral_index_buffer_unlock (ibuf);
 
-  gral_vertex_data_set_count (mesh->op.vertex_data, mesh->num_vertices);
-  gral_index_data_set_count (mesh->op.index_data, mesh->num_indices);
+  gral_vertex_data_set_count (op.vertex_data, mesh->num_vertices);
+  gral_index_data_set_buffer (op.index_data, ibuf);
+  gral_index_data_set_count (op.index_data, mesh->num_indices);
+
+  if (pos_type == GRAL_VERTEX_ELEMENT_TYPE_SHORT2) {
+    gral_matrix_t world = gpu->world_matrix;
+    float scale = 1.0f / (1 << CAIRO_GRAL_SUBPIXEL_BITS);
 
-  gral_render (&mesh->op);
+    gral_matrix_scale (&world, scale, scale, 1);
+    gral_set_world_matrix (&world);
+    _cairo_gral_mesh_draw (mesh, &op);
+    gral_set_world_matrix (&gpu->world_matrix);
+  } else {
+    _cairo_gral_mesh_draw (mesh, &op);
+  }
 
 FINISHED_RENDER:
   mesh->num_vertices = mesh->num_indices = 0;
 }
+
+static void
+_cairo_gral_cached_mesh_free_buffers (cairo_gral_cached_mesh_t *cached)
+{
+  if (cached->vertex_data)
+    gral_vertex_data_destroy (cached->vertex_data);
+  if (cached->index_data)
+    gral_index_data_destroy (cached->index_data);
+  if (cached->vertex_buf)
+    gral_vertex_buffer_destroy (cached->vertex_buf);
+  if (cached->index_buf)
+    gral_index_buffer_destroy (cached->index_buf);
+
+  cached->vertex_data = NULL;
+  cached->index_data = NULL;
+  cached->vertex_buf = NULL;
+  cached->index_buf = NULL;
+}
+
+static void
+_cairo_gral_cached_mesh_evict (cairo_gral_gpu_resources_t *gpu,
+                               cairo_gral_resource_t      *resource)
+{
+  cairo_gral_cached_mesh_t *cached = (cairo_gral_cached_mesh_t *) resource;
+
+  _cairo_gral_cached_mesh_free_buffers (cached);
+  cached->evicted = TRUE;
+}
+
+cairo_status_t
+_cairo_gral_cached_mesh_create (cairo_gral_mesh_t         *mesh,
+                                cairo_gral_cached_mesh_t **cached_out)
+{
+  cairo_gral_cached_mesh_t *cached;
+  gral_index_buffer_type_t index_type;
+  size_t length;
+  void *dat;
+
+  if (unlikely (mesh->status))
+    return mesh->status;
+
+  cached = malloc (sizeof (cairo_gral_cached_mesh_t));
+  if (unlikely (cached == NULL))
+    return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+  memset (cached, 0, sizeof (cairo_gral_cached_mesh_t));
+
+  cached->gpu = mesh->gpu;
+  cached->box = mesh->box;
+
+  if (mesh->num_indices < 3) {
+    /* Nothing to draw, e.g. the glyph of a space. */
+    *cached_out = cached;
+    return CAIRO_STATUS_SUCCESS;
+  }
+
+  cached->vertex_buf = gral_vertex_buffer_create (mesh->gpu->pos_size,
+                                                  mesh->num_vertices,
+                                                  GRAL_BUFFER_USAGE_STATIC_WRITE_ONLY);
+  index_type = _cairo_gral_index_type (mesh->num_vertices);
+  cached->index_buf = gral_index_buffer_create (index_type,
+                                                mesh->num_indices,
+                                                GRAL_BUFFER_USAGE_STATIC_WRITE_ONLY);
+  if (unlikely (cached->vertex_buf == NULL || cached->index_buf == NULL)) {
+    _cairo_gral_cached_mesh_destroy (cached);
+    return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+  }
+
+  length = mesh->gpu->pos_size * mesh->num_vertices;
+  dat = gral_vertex_buffer_lock (cached->vertex_buf, 0, length, GRAL_BUFFER_LOCK_OPTION_NORMAL);
+  _cairo_gral_write_positions (dat, mesh->vertices, mesh->num_vertices, mesh->gpu->pos_type);
+  gral_vertex_buffer_unlock (cached->vertex_buf);
+
+  length = _cairo_gral_index_size (index_type) * mesh->num_indices;
+  dat = gral_index_buffer_lock (cached->index_buf, 0, length, GRAL_BUFFER_LOCK_OPTION_NORMAL);
+  _cairo_gral_write_indices (dat, mesh->indices, mesh->num_indices, index_type);
+  gral_index_buffer_unlock (cached->index_buf);
+
+  cached->vertex_data = gral_vertex_data_create ();
+  gral_vertex_data_set_start (cached->vertex_data, 0);
+  gral_vertex_data_set_count (cached->vertex_data, mesh->num_vertices);
+  gral_vertex_data_add_element (cached->vertex_data, 0/*source*/, 0/*offset*/,
+                                mesh->gpu->pos_type,
+                                GRAL_VERTEX_ELEMENT_SEMANTIC_POSITION, 0/*index*/);
+  gral_vertex_data_bind_buffer (cached->vertex_data, 0/*source*/, cached->vertex_buf);
+
+  cached->index_data = gral_index_data_create ();
+  gral_index_data_set_start (cached->index_data, 0);
+  gral_index_data_set_count (cached->index_data, mesh->num_indices);
+  gral_index_data_set_buffer (cached->index_data, cached->index_buf);
+
+  cached->op.operation_type = GRAL_RENDER_OPERATION_TYPE_TRIANGLE_LIST;
+  cached->op.vertex_data = cached->vertex_data;
+  cached->op.index_data = cached->index_data;
+  cached->op.use_indexes = TRUE;
+
+  _cairo_gral_memory_add (mesh->gpu, &cached->resource, CAIRO_GRAL_RESOURCE_MESHES,
+                          gral_vertex_buffer_get_size (cached->vertex_buf) +
+                          gral_index_buffer_get_size (cached->index_buf),
+                          _cairo_gral_cached_mesh_evict);
+
+  *cached_out = cached;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+void
+_cairo_gral_cached_mesh_destroy (cairo_gral_cached_mesh_t *cached)
+{
+  if (cached->gpu)
+    _cairo_gral_memory_remove (cached->gpu, &cached->resource);
+  _cairo_gral_cached_mesh_free_buffers (cached);
+
+  free (cached);
+}
+
+void
+_cairo_gral_cached_mesh_render_instanced (cairo_gral_cached_mesh_t   *cached,
+                                          const gral_instance_data_t *instances,
+                                          size_t                      num_instances,
+                                          unsigned int                data_types)
+{
+  if (_cairo_gral_cached_mesh_is_empty (cached) || num_instances == 0)
+    return;
+
+  gral_render_instanced (&cached->op, instances, num_instances, data_types);
+}
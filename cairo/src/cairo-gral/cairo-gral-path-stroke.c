@@ -50,7 +50,12 @@ typedef struct cairo_stroker {
 
     cairo_gral_stroke_path_mesh_t *mesh;
 
-    cairo_pen_t	  pen;
+    /* Owned by pen_cache, stays valid until the next lookup. */
+    const cairo_pen_t *pen;
+    cairo_gral_pen_cache_t *pen_cache;
+
+    /* Curves outside of it are stroked as lines, NULL if all are needed. */
+    const cairo_box_t *guard_band;
 
     cairo_point_t current_point;
     cairo_point_t first_point;
@@ -68,6 +73,12 @@ typedef struct cairo_stroker {
     cairo_bool_t dash_on;
     cairo_bool_t dash_starts_on;
     double dash_remain;
+
+    /* The stroke is not split into dashes; the vertices get the user space
+     * distance from the start of the sub path and the dash pattern is
+     * applied by a fragment program. */
+    cairo_bool_t dash_on_gpu;
+    double arc_length;
 } cairo_stroker_t;
 
 static void
@@ -113,6 +124,8 @@ _cairo_stroker_init (cairo_stroker_t		*stroker,
 		     cairo_matrix_t		*ctm,
 		     cairo_matrix_t		*ctm_inverse,
 		     double			 tolerance,
+		     cairo_gral_pen_cache_t	*pen_cache,
+		     cairo_bool_t		 dash_on_gpu,
 		     cairo_gral_stroke_path_mesh_t *mesh)
 {
     cairo_status_t status;
@@ -120,14 +133,16 @@ _cairo_stroker_init (cairo_stroker_t		*stroker,
     stroker->ctm = ctm;
     stroker->ctm_inverse = ctm_inverse;
     stroker->tolerance = tolerance;
+    stroker->pen_cache = pen_cache;
+    stroker->guard_band = NULL;
     stroker->mesh = mesh;
 
     stroker->ctm_determinant = _cairo_matrix_compute_determinant (stroker->ctm);
     stroker->ctm_det_positive = stroker->ctm_determinant >= 0.0;
 
-    status = _cairo_pen_init (&stroker->pen,
-		              stroke_style->line_width / 2.0,
-			      tolerance, ctm);
+    status = _cairo_gral_pen_cache_lookup (pen_cache,
+					   stroke_style->line_width / 2.0,
+					   tolerance, ctm, &stroker->pen);
     if (unlikely (status))
 	return status;
 
@@ -135,7 +150,10 @@ _cairo_stroker_init (cairo_stroker_t		*stroker,
     stroker->has_first_face = FALSE;
     stroker->has_initial_sub_path = FALSE;
 
-    if (stroker->style->dash)
+    stroker->dash_on_gpu = dash_on_gpu;
+    stroker->arc_length = 0;
+
+    if (stroker->style->dash && ! dash_on_gpu)
 	_cairo_stroker_start_dash (stroker);
     else
 	stroker->dashed = FALSE;
@@ -143,12 +161,6 @@ _cairo_stroker_init (cairo_stroker_t		*stroker,
     return CAIRO_STATUS_SUCCESS;
 }
 
-static void
-_cairo_stroker_fini (cairo_stroker_t *stroker)
-{
-    _cairo_pen_fini (&stroker->pen);
-}
-
 static void
 _translate_point (cairo_point_t *point, cairo_point_t *offset)
 {
@@ -211,7 +223,7 @@ _cairo_stroker_join (cairo_stroker_t *stroker, cairo_stroke_face_t *in, cairo_st
 	int i;
 	int start, step, stop;
 	cairo_point_t tri[3];
-	cairo_pen_t *pen = &stroker->pen;
+	const cairo_pen_t *pen = stroker->pen;
 
 	tri[0] = in->point;
 	if (clockwise) {
@@ -427,7 +439,7 @@ _cairo_stroker_add_cap (cairo_stroker_t *stroker, cairo_stroke_face_t *f)
 	int start, stop;
 	cairo_slope_t slope;
 	cairo_point_t tri[3];
-	cairo_pen_t *pen = &stroker->pen;
+	const cairo_pen_t *pen = stroker->pen;
 
 	slope = f->dev_vector;
 	start = _cairo_pen_find_active_cw_vertex_index (pen, &slope);
@@ -692,6 +704,7 @@ _cairo_stroker_move_to (void *closure,
 
     stroker->first_point = *point;
     stroker->current_point = *point;
+    stroker->arc_length = 0;
 
     stroker->has_first_face = FALSE;
     stroker->has_current_face = FALSE;
@@ -721,6 +734,7 @@ _cairo_stroker_line_to (void *closure,
     cairo_point_t *p1 = &stroker->current_point;
     cairo_slope_t dev_slope;
     double slope_dx, slope_dy;
+    double mag;
 
     stroker->has_initial_sub_path = TRUE;
 
@@ -730,7 +744,12 @@ _cairo_stroker_line_to (void *closure,
     _cairo_slope_init (&dev_slope, p1, p2);
     slope_dx = _cairo_fixed_to_double (p2->x - p1->x);
     slope_dy = _cairo_fixed_to_double (p2->y - p1->y);
-    _compute_normalized_device_slope (&slope_dx, &slope_dy, stroker->ctm_inverse, NULL);
+    _compute_normalized_device_slope (&slope_dx, &slope_dy, stroker->ctm_inverse, &mag);
+
+    if (stroker->dash_on_gpu)
+	_cairo_gral_path_stroke_set_arc_length (stroker->mesh,
+						stroker->arc_length,
+						stroker->arc_length + mag);
 
     status = _cairo_stroker_add_sub_edge (stroker,
 					  p1, p2,
@@ -740,6 +759,13 @@ _cairo_stroker_line_to (void *closure,
     if (unlikely (status))
 	return status;
 
+    /* The join is at p1 */
+    if (stroker->dash_on_gpu)
+	_cairo_gral_path_stroke_set_arc_length (stroker->mesh,
+						stroker->arc_length,
+						stroker->arc_length);
+    stroker->arc_length += mag;
+
     if (stroker->has_current_face) {
 	/* Join with final face from previous segment */
 	status = _cairo_stroker_join (stroker, &stroker->current_face, &start);
@@ -900,8 +926,12 @@ _cairo_stroker_curve_to (void *closure,
     double final_slope_dx, final_slope_dy;
     cairo_status_t status;
 
+    if (stroker->guard_band != NULL &&
+	_cairo_gral_spline_outside_box (stroker->guard_band, a, b, c, d))
+	return _cairo_stroker_line_to (closure, d);
+
     status = _cairo_gral_pen_stroke_spline_init (&spline_pen,
-					    &stroker->pen,
+					    stroker->pen, stroker->pen_cache,
 					    a, b, c, d, stroker->mesh);
     if (status == CAIRO_INT_STATUS_DEGENERATE)
 	return _cairo_stroker_line_to (closure, d);
@@ -934,7 +964,7 @@ _cairo_stroker_curve_to (void *closure,
     if (stroker->has_current_face) {
 	status = _cairo_stroker_join (stroker, &stroker->current_face, &start);
 	if (unlikely (status))
-	    goto CLEANUP_PEN;
+	    goto BAIL;
     } else if (! stroker->has_first_face) {
 	stroker->first_face = start;
 	stroker->has_first_face = TRUE;
@@ -955,16 +985,14 @@ _cairo_stroker_curve_to (void *closure,
     extra_points[3].x -= end.point.x;
     extra_points[3].y -= end.point.y;
 
-    status = _cairo_pen_add_points (&spline_pen.pen, extra_points, 4);
+    status = _cairo_gral_pen_stroke_spline_add_points (&spline_pen, extra_points, 4);
     if (unlikely (status))
-	goto CLEANUP_PEN;
+	goto BAIL;
 
     status = _cairo_gral_pen_stroke_spline (&spline_pen,
 				            stroker->tolerance);
 
-  CLEANUP_PEN:
-    _cairo_gral_pen_stroke_spline_fini (&spline_pen);
-
+  BAIL:
     stroker->current_point = *d;
 
     return status;
@@ -1007,12 +1035,14 @@ _cairo_stroker_curve_to_dashed (void *closure,
 			      stroker,
 			      a, b, c, d))
     {
-	return _cairo_stroker_line_to_dashed (closure, d);
+	return stroker->dashed ?
+	       _cairo_stroker_line_to_dashed (closure, d) :
+	       _cairo_stroker_line_to (closure, d);
     }
 
     /* If the line width is so small that the pen is reduced to a
        single point, then we have nothing to do. */
-    if (stroker->pen.num_vertices <= 1)
+    if (stroker->pen->num_vertices <= 1)
 	return CAIRO_STATUS_SUCCESS;
 
     /* Temporarily modify the stroker to use round joins to guarantee
@@ -1041,6 +1071,11 @@ _cairo_stroker_close_path (void *closure)
 	return status;
 
     if (stroker->has_first_face && stroker->has_current_face) {
+	if (stroker->dash_on_gpu)
+	    _cairo_gral_path_stroke_set_arc_length (stroker->mesh,
+						    stroker->arc_length,
+						    stroker->arc_length);
+
 	/* Join first and final faces of sub path */
 	status = _cairo_stroker_join (stroker, &stroker->current_face, &stroker->first_face);
 	if (unlikely (status))
@@ -1065,6 +1100,9 @@ _cairo_gral_path_fixed_stroke_to_mesh (cairo_path_fixed_t	*path,
 				   cairo_matrix_t	*ctm,
 				   cairo_matrix_t	*ctm_inverse,
 				   double		 tolerance,
+				   cairo_gral_pen_cache_t *pen_cache,
+				   cairo_bool_t		 dash_on_gpu,
+				   const cairo_box_t	*guard_band,
 				   cairo_gral_stroke_path_mesh_t *mesh)
 {
     cairo_status_t status;
@@ -1072,11 +1110,25 @@ _cairo_gral_path_fixed_stroke_to_mesh (cairo_path_fixed_t	*path,
 
     status = _cairo_stroker_init (&stroker, stroke_style,
 			          ctm, ctm_inverse, tolerance,
-				  mesh);
+				  pen_cache, dash_on_gpu, mesh);
     if (unlikely (status))
 	return status;
 
-    if (stroker.style->dash)
+    /* Replacing a curve by a line changes the length of the path, which
+     * moves the dashes that follow it. */
+    if (! stroker.dash_on_gpu && ! stroker.style->dash)
+	stroker.guard_band = guard_band;
+
+    if (stroker.dash_on_gpu)
+	/* Curves are flattened so that the arc length is known at each vertex. */
+	status = _cairo_path_fixed_interpret (path,
+					      CAIRO_DIRECTION_FORWARD,
+					      _cairo_stroker_move_to,
+					      _cairo_stroker_line_to,
+					      _cairo_stroker_curve_to_dashed,
+					      _cairo_stroker_close_path,
+					      &stroker);
+    else if (stroker.style->dash)
 	status = _cairo_path_fixed_interpret (path,
 					      CAIRO_DIRECTION_FORWARD,
 					      _cairo_stroker_move_to_dashed,
@@ -1099,7 +1151,5 @@ _cairo_gral_path_fixed_stroke_to_mesh (cairo_path_fixed_t	*path,
     status = _cairo_stroker_add_caps (&stroker);
 
 BAIL:
-    _cairo_stroker_fini (&stroker);
-
     return status;
 }
@@ -339,13 +339,14 @@ _cairo_pen_stroke_spline_add_point (void		    *closure,
 cairo_int_status_t
 _cairo_gral_pen_stroke_spline_init (cairo_gral_pen_stroke_spline_t *stroker,
 			       const cairo_pen_t *pen,
+			       cairo_gral_pen_cache_t *pen_cache,
 			       const cairo_point_t *a,
 			       const cairo_point_t *b,
 			       const cairo_point_t *c,
 			       const cairo_point_t *d,
                                cairo_gral_stroke_path_mesh_t *mesh)
 {
-    cairo_int_status_t status;
+    int size;
 
     if (! _cairo_spline_init (&stroker->spline,
 			      _cairo_pen_stroke_spline_add_point,
@@ -355,9 +356,27 @@ _cairo_gral_pen_stroke_spline_init (cairo_gral_pen_stroke_spline_t *stroker,
 	return CAIRO_INT_STATUS_DEGENERATE;
     }
 
-    status = _cairo_pen_init_copy (&stroker->pen, pen);
-    if (unlikely (status))
-	return status;
+    /* Copy the pen to the scratch array of the cache, with room for the
+     * points that _cairo_gral_pen_stroke_spline_add_points adds. */
+    size = pen->num_vertices + CAIRO_GRAL_PEN_STROKE_SPLINE_EXTRA_POINTS;
+    if (size > pen_cache->scratch_size) {
+	cairo_pen_vertex_t *scratch;
+
+	scratch = _cairo_malloc_ab (size, sizeof (cairo_pen_vertex_t));
+	if (unlikely (scratch == NULL))
+	    return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+
+	free (pen_cache->scratch);
+	pen_cache->scratch = scratch;
+	pen_cache->scratch_size = size;
+    }
+
+    stroker->pen.radius = pen->radius;
+    stroker->pen.tolerance = pen->tolerance;
+    stroker->pen.num_vertices = pen->num_vertices;
+    stroker->pen.vertices = pen_cache->scratch;
+    memcpy (stroker->pen.vertices, pen->vertices,
+	    pen->num_vertices * sizeof (cairo_pen_vertex_t));
 
     stroker->mesh = mesh;
 
@@ -366,8 +385,93 @@ _cairo_gral_pen_stroke_spline_init (cairo_gral_pen_stroke_spline_t *stroker,
     return CAIRO_STATUS_SUCCESS;
 }
 
+/* Like _cairo_pen_add_points, but without reallocating the vertices. */
+cairo_status_t
+_cairo_gral_pen_stroke_spline_add_points (cairo_gral_pen_stroke_spline_t *stroker,
+					  const cairo_point_t *points,
+					  int num_points)
+{
+    cairo_pen_t *pen = &stroker->pen;
+    cairo_status_t status;
+    int i;
+
+    assert (num_points <= CAIRO_GRAL_PEN_STROKE_SPLINE_EXTRA_POINTS);
+
+    for (i = 0; i < num_points; i++)
+	pen->vertices[pen->num_vertices++].point = points[i];
+
+    status = _cairo_hull_compute (pen->vertices, &pen->num_vertices);
+    if (unlikely (status))
+	return status;
+
+    _cairo_pen_compute_slopes (pen);
+
+    return CAIRO_STATUS_SUCCESS;
+}
+
+cairo_status_t
+_cairo_gral_pen_cache_lookup (cairo_gral_pen_cache_t  *cache,
+			      double                   radius,
+			      double                   tolerance,
+			      cairo_matrix_t          *ctm,
+			      const cairo_pen_t      **pen_out)
+{
+    cairo_gral_pen_cache_entry_t *entry, *lru = NULL;
+    cairo_status_t status;
+    int i;
+
+    /* The pen only depends on the linear part of the ctm, the translation
+     * doesn't need to match. */
+    for (i = 0; i < CAIRO_GRAL_PEN_CACHE_SIZE; i++) {
+	entry = &cache->entries[i];
+
+	if (entry->valid &&
+	    entry->radius == radius && entry->tolerance == tolerance &&
+	    entry->xx == ctm->xx && entry->yx == ctm->yx &&
+	    entry->xy == ctm->xy && entry->yy == ctm->yy)
+	{
+	    entry->last_use = ++cache->use_count;
+	    *pen_out = &entry->pen;
+	    return CAIRO_STATUS_SUCCESS;
+	}
+
+	if (lru == NULL || ! entry->valid ||
+	    (lru->valid && entry->last_use < lru->last_use))
+	    lru = entry;
+    }
+
+    if (lru->valid) {
+	_cairo_pen_fini (&lru->pen);
+	lru->valid = FALSE;
+    }
+
+    status = _cairo_pen_init (&lru->pen, radius, tolerance, ctm);
+    if (unlikely (status))
+	return status;
+
+    lru->valid = TRUE;
+    lru->radius = radius;
+    lru->tolerance = tolerance;
+    lru->xx = ctm->xx;
+    lru->yx = ctm->yx;
+    lru->xy = ctm->xy;
+    lru->yy = ctm->yy;
+    lru->last_use = ++cache->use_count;
+
+    *pen_out = &lru->pen;
+    return CAIRO_STATUS_SUCCESS;
+}
+
 void
-_cairo_gral_pen_stroke_spline_fini (cairo_gral_pen_stroke_spline_t *stroker)
+_cairo_gral_pen_cache_fini (cairo_gral_pen_cache_t *cache)
 {
-    _cairo_pen_fini (&stroker->pen);
+    int i;
+
+    for (i = 0; i < CAIRO_GRAL_PEN_CACHE_SIZE; i++) {
+	if (cache->entries[i].valid)
+	    _cairo_pen_fini (&cache->entries[i].pen);
+    }
+    free (cache->scratch);
+
+    memset (cache, 0, sizeof (cairo_gral_pen_cache_t));
 }
@@ -38,40 +38,155 @@
 #define CAIRO_GRAL_PRIVATE_H
 
 #include "gral.h"
+#include "cairo-gral.h"
 #include "cairo-gral-config.h"
 #include "cairoint.h"
 #include "cairo-path-fixed-private.h"
 
 CAIRO_BEGIN_DECLS
 
-#define CAIRO_SURFACE_TYPE_GRAL 200
+/* Indices are uploaded as 16 bit when the batch has few enough vertices. */
+typedef uint32_t cairo_gral_vertex_index_t;
 
-#if CAIRO_GRAL_MAX_VERTICES <= 0x10000
-  #define CAIRO_GRAL_USE_SHORT_INDICES 1
-  typedef uint16_t cairo_gral_vertex_index_t;
-#else
-  #define CAIRO_GRAL_USE_SHORT_INDICES 0
-  typedef uint32_t cairo_gral_vertex_index_t;
-#endif
+#define CAIRO_GRAL_MAX_SHORT_INDEXED_VERTICES 0x10000
 
-typedef struct _cairo_gral_gpu_resources {
+typedef struct _cairo_gral_cached_mesh cairo_gral_cached_mesh_t;
+typedef struct _cairo_gral_gpu_resources cairo_gral_gpu_resources_t;
+
+typedef struct _cairo_gral_vertex_pos {
+  float x,y;
+} cairo_gral_vertex_pos_t;
+
+typedef struct _cairo_gral_tex_coord3 {
+  float x,y,z;
+} cairo_gral_tex_coord3_t;
+
+/* CPU side arrays of a mesh, kept across draws and grown on demand. */
+typedef struct _cairo_gral_mesh_storage {
+  cairo_gral_vertex_pos_t    *vertices;
+  cairo_gral_tex_coord3_t    *tex_coords;
+  cairo_gral_vertex_index_t  *indices;
+  size_t                      max_vertices;
+  size_t                      max_tex_coords;
+  size_t                      max_indices;
+
+  cairo_bool_t                in_use;
+} cairo_gral_mesh_storage_t;
+
+/* Pens of the recent strokes, so that strokes with the same width, tolerance
+ * and transformation don't compute the pen polygon again. */
+typedef struct _cairo_gral_pen_cache_entry {
+  cairo_bool_t                valid;
+  double                      radius;
+  double                      tolerance;
+  double                      xx, yx, xy, yy; /* linear part of the ctm */
+  unsigned long               last_use;
+  cairo_pen_t                 pen;
+} cairo_gral_pen_cache_entry_t;
+
+typedef struct _cairo_gral_pen_cache {
+  cairo_gral_pen_cache_entry_t entries[CAIRO_GRAL_PEN_CACHE_SIZE];
+  unsigned long               use_count;
+
+  /* Vertices of the pens that curve strokes extend with the face points. */
+  cairo_pen_vertex_t         *scratch;
+  int                         scratch_size;
+} cairo_gral_pen_cache_t;
+
+/* GPU memory accounting, see cairo-gral-memory.c. */
+typedef enum _cairo_gral_resource_type {
+  CAIRO_GRAL_RESOURCE_BUFFERS,
+  CAIRO_GRAL_RESOURCE_TEXTURES,
+  CAIRO_GRAL_RESOURCE_RAMPS,
+  CAIRO_GRAL_RESOURCE_MESHES,
+  CAIRO_GRAL_RESOURCE_RENDER_TARGETS,
+  CAIRO_GRAL_NUM_RESOURCE_TYPES
+} cairo_gral_resource_type_t;
+
+typedef struct _cairo_gral_resource cairo_gral_resource_t;
+
+/* Frees the GPU memory of an evicted resource. */
+typedef void (*cairo_gral_resource_evict_func_t) (cairo_gral_gpu_resources_t *gpu,
+                                                  cairo_gral_resource_t      *resource);
+
+/* Embedded in the object that owns the memory. */
+struct _cairo_gral_resource {
+  cairo_gral_resource_type_t        type;
+  size_t                            size;
+  cairo_gral_resource_evict_func_t  evict;    /* NULL if it can't be evicted */
+  unsigned long                     last_use;
+  cairo_bool_t                      linked;
+  cairo_gral_resource_t            *prev, *next;
+};
+
+typedef struct _cairo_gral_memory {
+  size_t                  bytes[CAIRO_GRAL_NUM_RESOURCE_TYPES];
+  size_t                  total;
+  /* The part of total that can be evicted, held to the budget. */
+  size_t                  evictable;
+  unsigned long           evictions;
+  /* Incremented by each trim, see _cairo_gral_memory_trim. */
+  unsigned long           use_count;
+  /* The counted resources, most recently used first. */
+  cairo_gral_resource_t  *head, *tail;
+} cairo_gral_memory_t;
+
+struct _cairo_gral_gpu_resources {
   cairo_reference_count_t ref_count;
 
   gral_capabilities_t     caps;
 
+  /* Positions are kept as cairo_gral_vertex_pos_t and converted to this
+   * format (FLOAT2 or FLOAT3) when uploaded. */
+  gral_vertex_element_type_t pos_type;
+  size_t                  pos_size;
+
+  /* The device space to clip space transform set by _cairo_gral_init_render_state,
+   * and the surface it was set for. */
+  gral_matrix_t           world_matrix;
+  struct _cairo_gral_surface *bound_surface;
+
+  /* Dynamic buffers, replaced by bigger ones by _cairo_gral_gpu_resources_reserve. */
   gral_vertex_buffer_t   *vertex_buf_pos;
   gral_vertex_buffer_t   *vertex_buf_tex;
   gral_index_buffer_t    *index_buf;
+  gral_index_buffer_t    *index_buf_32;       /* NULL until a batch needs it */
   gral_vertex_data_t     *vertex_data_source;
   gral_vertex_data_t     *vertex_data_stencil;
+  gral_vertex_data_t     *vertex_data_stencil_short; /* NULL without SHORT2 positions */
   gral_vertex_data_t     *vertex_data_spline;
   gral_index_data_t      *index_data;
+  cairo_gral_resource_t   buffers_resource;
 
   gral_texture_t         *gral_tex;
+  cairo_gral_resource_t   gral_tex_resource;
+  /* Image sources are uploaded here; replaced when the image size changes.
+   * image_tex_id is the unique_id of the image it holds, 0 for none. */
+  gral_texture_t         *image_tex;
+  unsigned int            image_tex_id;
+  cairo_gral_resource_t   image_tex_resource;
   gral_cg_program_t      *radial_shader;
+  gral_cg_program_t      *linear_stops_shader;
+  gral_cg_program_t      *radial_stops_shader;
   gral_cg_program_t      *spline_fill_shader;
 
-} cairo_gral_gpu_resources_t;
+  gral_texture_t         *dash_tex;
+  cairo_gral_resource_t   dash_tex_resource;
+  gral_cg_program_t      *dash_shader;
+  /* The pattern in dash_tex, so that it's only written when it changes. */
+  double                  dash_tex_pattern[CAIRO_GRAL_MAX_GPU_DASHES];
+  unsigned int            dash_tex_num_dashes;
+
+  cairo_gral_cached_mesh_t *unit_quad;
+
+  /* Used by one mesh at a time, the others allocate their own. */
+  cairo_gral_mesh_storage_t mesh_storage;
+
+  cairo_gral_pen_cache_t  pen_cache;
+
+  cairo_gral_memory_t     memory;
+
+};
 
 cairo_private cairo_gral_gpu_resources_t *
 _cairo_gral_gpu_resources_acquire (void);
@@ -79,28 +194,112 @@ _cairo_gral_gpu_resources_acquire (void);
 cairo_private void
 _cairo_gral_gpu_resources_release (cairo_gral_gpu_resources_t *gpu);
 
+cairo_private cairo_status_t
+_cairo_gral_gpu_resources_reserve (cairo_gral_gpu_resources_t *gpu,
+                                   size_t                      num_vertices,
+                                   size_t                      num_indices,
+                                   cairo_bool_t                tex_coords);
+
+cairo_private size_t
+_cairo_gral_get_max_batch_indices (void);
+
+cairo_private double
+_cairo_gral_lod_tolerance (double                       tolerance,
+                           const cairo_rectangle_int_t *extents);
+
+/* Memory functions. */
+
+cairo_private void
+_cairo_gral_memory_add (cairo_gral_gpu_resources_t       *gpu,
+                        cairo_gral_resource_t            *resource,
+                        cairo_gral_resource_type_t        type,
+                        size_t                            size,
+                        cairo_gral_resource_evict_func_t  evict);
+
+cairo_private void
+_cairo_gral_memory_remove (cairo_gral_gpu_resources_t *gpu,
+                           cairo_gral_resource_t      *resource);
+
+cairo_private void
+_cairo_gral_memory_touch (cairo_gral_gpu_resources_t *gpu,
+                          cairo_gral_resource_t      *resource);
+
+cairo_private void
+_cairo_gral_memory_trim (cairo_gral_gpu_resources_t *gpu);
+
+cairo_private void
+_cairo_gral_memory_fini (cairo_gral_gpu_resources_t *gpu);
+
+cairo_private size_t
+_cairo_gral_texture_bytes (gral_texture_t *tex);
+
+typedef struct _cairo_gral_bound_box {
+  float min_x, min_y;
+  float max_x, max_y;
+} cairo_gral_bound_box_t;
+
+/* Fills that are in the stencil but not covered yet. They share the operator
+ * and the solid source and their extents don't intersect, so one cover pass
+ * paints all of them. */
+typedef struct _cairo_gral_fill_batch {
+  int                         num_paths;
+  cairo_operator_t            op;
+  cairo_color_t               color;
+  cairo_content_t             content;
+  cairo_rectangle_int_t       extents[CAIRO_GRAL_MAX_FILL_BATCH];
+  cairo_gral_bound_box_t      boxes[CAIRO_GRAL_MAX_FILL_BATCH];
+} cairo_gral_fill_batch_t;
+
 typedef struct _cairo_gral_surface {
   cairo_surface_t             base;
 
   gral_surface_t             *gral_surf;
   cairo_gral_gpu_resources_t *gpu;
+  /* The texture that gral_surf draws into, so that the surface can be a
+   * source. NULL unless created by cairo_gral_surface_create_for_texture. */
+  gral_texture_t             *gral_tex;
 
   cairo_bool_t                has_clip;
+  /* Bounds of the clip paths, valid while has_clip is set. */
+  cairo_rectangle_int_t       clip_extents;
+
+  cairo_gral_fill_batch_t     fill_batch;
+
+  unsigned long               fallbacks;
+
+  /* The size of gral_surf, counted but never evicted. */
+  cairo_gral_resource_t       render_target;
 
 } cairo_gral_surface_t;
 
-typedef struct _cairo_gral_vertex_pos {
-  float x,y,z;
-} cairo_gral_vertex_pos_t;
+cairo_private cairo_status_t
+_cairo_gral_surface_flush_fills (cairo_gral_surface_t *gsurface);
 
-typedef struct _cairo_gral_tex_coord3 {
-  float x,y,z;
-} cairo_gral_tex_coord3_t;
+cairo_private cairo_status_t
+_cairo_gral_surface_flush_source_fills (cairo_gral_surface_t  *gsurface,
+                                        const cairo_pattern_t *source);
 
-typedef struct _cairo_gral_bound_box {
-  float min_x, min_y;
-  float max_x, max_y;
-} cairo_gral_bound_box_t;
+cairo_private void
+_cairo_gral_surface_get_clip_extents (cairo_gral_surface_t  *gsurface,
+                                      cairo_rectangle_int_t *extents);
+
+cairo_private cairo_bool_t
+_cairo_gral_surface_get_guard_band (cairo_gral_surface_t        *gsurface,
+                                    const cairo_rectangle_int_t *extents,
+                                    double                       dx,
+                                    double                       dy,
+                                    cairo_box_t                 *band);
+
+cairo_private cairo_bool_t
+_cairo_gral_spline_outside_box (const cairo_box_t   *box,
+                                const cairo_point_t *a,
+                                const cairo_point_t *b,
+                                const cairo_point_t *c,
+                                const cairo_point_t *d);
+
+/* Evaluates to CAIRO_INT_STATUS_UNSUPPORTED, counting the fallback. */
+#define _cairo_gral_surface_fallback(gsurface) \
+  ((gsurface)->fallbacks++, CAIRO_INT_STATUS_UNSUPPORTED)
 
 typedef struct _cairo_gral_vector2 {
   float x, y;
@@ -150,34 +349,62 @@ typedef void
 
 typedef struct _cairo_gral_mesh {
   gral_render_operation_t     op;
-  gral_vertex_buffer_t       *vertex_buf_pos;
-  gral_vertex_buffer_t       *vertex_buf_tex;
-  gral_index_buffer_t        *index_buf;
+  cairo_gral_gpu_resources_t *gpu;
 
+  /* Point into storage and change when it grows. */
   cairo_gral_vertex_pos_t    *vertices;
   cairo_gral_tex_coord3_t    *tex_coords;
   cairo_gral_vertex_index_t  *indices;
   size_t                      num_vertices;
   size_t                      num_indices;
 
+  cairo_gral_mesh_storage_t  *storage;
+  cairo_gral_mesh_storage_t   own_storage;
+
+  /* The batch gets rendered when it reaches this many indices. */
+  size_t                      max_indices;
+
+  cairo_status_t              status;
+
   cairo_gral_splines_buffer_t splines;
 
   cairo_gral_bound_box_t      box;
 
+  /* If set, it's called instead of rendering when the buffers get full. */
+  cairo_gral_mesh_on_full_t  *on_full;
+  void                       *on_full_closure;
+
+  /* Set for the write-once strokes: every batch is drawn again without
+   * colour, to clear the stencil it set. */
+  cairo_bool_t                clear_stencil;
+
 } cairo_gral_mesh_t;
 
+/* A mesh that was uploaded once to static buffers, so that it can be drawn
+ * repeatedly (e.g. with gral_render_instanced) without tesselating again.
+ * Only positions are kept, it's meant for stencil passes and solid fills. */
+struct _cairo_gral_cached_mesh {
+  cairo_gral_resource_t       resource;
+  cairo_gral_gpu_resources_t *gpu;
+  /* Set when the buffers were evicted; the owner makes a new mesh. */
+  cairo_bool_t                evicted;
+
+  gral_vertex_buffer_t       *vertex_buf;
+  gral_index_buffer_t        *index_buf;
+  gral_vertex_data_t         *vertex_data;
+  gral_index_data_t          *index_data;
+  gral_render_operation_t     op;
+
+  cairo_gral_bound_box_t      box;
+};
+
 /* Mesh functions. */
 
 cairo_private void
 _cairo_gral_mesh_init (cairo_gral_mesh_t          *mesh,
-                       cairo_gral_vertex_pos_t    *vertices,
-                       cairo_gral_tex_coord3_t    *tex_coords,
-                       cairo_gral_vertex_index_t  *indices,
-                       gral_vertex_buffer_t       *vertex_buf_pos,
-                       gral_vertex_buffer_t       *vertex_buf_tex,
-                       gral_index_buffer_t        *index_buf,
+                       cairo_gral_gpu_resources_t *gpu,
                        gral_vertex_data_t         *vertex_data,
-                       gral_index_data_t          *index_data);
+                       cairo_bool_t                tex_coords);
 
 cairo_private void
 _cairo_gral_mesh_fini (cairo_gral_mesh_t *mesh);
@@ -196,6 +423,16 @@ _cairo_gral_mesh_add_vertex_pos_and_tex (cairo_gral_mesh_t       *mesh,
                                      (float)_cairo_fixed_to_double((p)->x), \
                                      (float)_cairo_fixed_to_double((p)->y))
 
+cairo_private cairo_bool_t
+_cairo_gral_mesh_reserve (cairo_gral_mesh_t *mesh,
+                          size_t             num_vertices,
+                          size_t             num_indices);
+
+cairo_private cairo_gral_vertex_index_t
+_cairo_gral_mesh_add_vertices_fixed (cairo_gral_mesh_t   *mesh,
+                                     const cairo_point_t *points,
+                                     size_t               num_points);
+
 cairo_private void
 _cairo_gral_mesh_add_index (cairo_gral_mesh_t *mesh,
                             cairo_gral_vertex_index_t *index);
@@ -203,10 +440,39 @@ _cairo_gral_mesh_add_index (cairo_gral_mesh_t *mesh,
 cairo_private void
 _cairo_gral_mesh_render (cairo_gral_mesh_t *mesh);
 
+cairo_private void
+_cairo_gral_write_positions (void                          *dest,
+                             const cairo_gral_vertex_pos_t *vertices,
+                             size_t                         num_vertices,
+                             gral_vertex_element_type_t     type);
+
 cairo_private void
 _cairo_gral_mesh_gpu_spline_fill (cairo_gral_mesh_t          *mesh,
                                   cairo_gral_gpu_resources_t *gpu);
 
+/* Cached mesh functions. */
+
+cairo_private cairo_status_t
+_cairo_gral_cached_mesh_create (cairo_gral_mesh_t         *mesh,
+                                cairo_gral_cached_mesh_t **cached_out);
+
+cairo_private void
+_cairo_gral_cached_mesh_destroy (cairo_gral_cached_mesh_t *cached);
+
+#define _cairo_gral_cached_mesh_is_empty(cached) ((cached)->vertex_buf == NULL)
+#define _cairo_gral_cached_mesh_is_evicted(cached) ((cached)->evicted)
+#define _cairo_gral_cached_mesh_touch(cached) \
+  _cairo_gral_memory_touch ((cached)->gpu, &(cached)->resource)
+
+cairo_private void
+_cairo_gral_cached_mesh_render_instanced (cairo_gral_cached_mesh_t   *cached,
+                                          const gral_instance_data_t *instances,
+                                          size_t                      num_instances,
+                                          unsigned int                data_types);
+
+cairo_private cairo_gral_cached_mesh_t *
+_cairo_gral_gpu_resources_get_unit_quad (cairo_gral_gpu_resources_t *gpu);
+
 /* Stroke functions. */
 
 typedef struct _cairo_gral_stroke_path_mesh cairo_gral_stroke_path_mesh_t;
@@ -232,6 +498,28 @@ _cairo_gral_path_stroke_spline_extend (cairo_gral_stroke_path_mesh_t *mesh,
 cairo_private cairo_status_t
 _cairo_gral_path_stroke_spline_close (cairo_gral_stroke_path_mesh_t *mesh);
 
+/* Sets the arc lengths of the following vertices when the dash is applied on
+ * the GPU: quads go from start (q[0], q[1]) to end (q[2], q[3]), triangles
+ * get start. */
+cairo_private void
+_cairo_gral_path_stroke_set_arc_length (cairo_gral_stroke_path_mesh_t *mesh,
+                                        double                         start,
+                                        double                         end);
+
+/* Pen cache functions. */
+
+cairo_private cairo_status_t
+_cairo_gral_pen_cache_lookup (cairo_gral_pen_cache_t  *cache,
+                              double                   radius,
+                              double                   tolerance,
+                              cairo_matrix_t          *ctm,
+                              const cairo_pen_t      **pen_out);
+
+cairo_private void
+_cairo_gral_pen_cache_fini (cairo_gral_pen_cache_t *cache);
+
+/* The pen of a curve stroke; its vertices are in the scratch array of the
+ * pen cache, so only one can be in use at a time. */
 typedef struct {
   cairo_pen_t pen;
   cairo_spline_t spline;
@@ -246,14 +534,20 @@ typedef struct {
 cairo_private cairo_int_status_t
 _cairo_gral_pen_stroke_spline_init (cairo_gral_pen_stroke_spline_t *stroker,
                                     const cairo_pen_t *pen,
+                                    cairo_gral_pen_cache_t *pen_cache,
                                     const cairo_point_t *a,
                                     const cairo_point_t *b,
                                     const cairo_point_t *c,
                                     const cairo_point_t *d,
                                     cairo_gral_stroke_path_mesh_t *mesh);
 
-cairo_private void
-_cairo_gral_pen_stroke_spline_fini (cairo_gral_pen_stroke_spline_t *stroker);
+/* Adds up to CAIRO_GRAL_PEN_STROKE_SPLINE_EXTRA_POINTS points to the pen. */
+cairo_private cairo_status_t
+_cairo_gral_pen_stroke_spline_add_points (cairo_gral_pen_stroke_spline_t *stroker,
+                                          const cairo_point_t *points,
+                                          int num_points);
+
+#define CAIRO_GRAL_PEN_STROKE_SPLINE_EXTRA_POINTS 4
 
 cairo_private cairo_status_t
 _cairo_gral_pen_stroke_spline (cairo_gral_pen_stroke_spline_t	*stroker,
@@ -265,6 +559,9 @@ _cairo_gral_path_fixed_stroke_to_mesh (cairo_path_fixed_t	*path,
 				   cairo_matrix_t	*ctm,
 				   cairo_matrix_t	*ctm_inverse,
 				   double		 tolerance,
+				   cairo_gral_pen_cache_t *pen_cache,
+				   cairo_bool_t		 dash_on_gpu,
+				   const cairo_box_t	*guard_band,
 				   cairo_gral_stroke_path_mesh_t *mesh);
 
 /* Utility functions. */
@@ -276,26 +573,87 @@ cairo_private cairo_int_status_t
 _cairo_gral_set_source (cairo_gral_surface_t *gsurface,
                         const cairo_pattern_t	*source);
 
+cairo_private void
+_cairo_gral_set_texture_source (gral_texture_t      *tex,
+                                const gral_matrix_t *matrix,
+                                cairo_extend_t       extend,
+                                cairo_filter_t       filter);
+
 cairo_private void
 _cairo_gral_render_quad (cairo_gral_surface_t *gsurface,
                          float left, float top, float right, float bottom);
 
+cairo_private void
+_cairo_gral_set_fill_stencil_state (cairo_fill_rule_t fill_rule);
+
+cairo_private cairo_status_t
+_cairo_gral_fill_path_to_cached_mesh (cairo_gral_gpu_resources_t *gpu,
+                                      cairo_path_fixed_t         *path,
+                                      double                      tolerance,
+                                      cairo_gral_cached_mesh_t  **cached_out);
+
 cairo_private cairo_status_t
 _cairo_gral_prepare_fill_stencil_mask (cairo_gral_surface_t *gsurface,
                                        cairo_path_fixed_t	*path,
+                                       const cairo_rectangle_int_t *extents,
                                        cairo_fill_rule_t	 fill_rule,
                                        double			 tolerance,
                                        cairo_gral_bound_box_t *box);
 
+cairo_private void
+_cairo_gral_set_stroke_stencil_state (void);
+
+cairo_private void
+_cairo_gral_set_stroke_write_once_state (void);
+
+cairo_private void
+_cairo_gral_set_stroke_clear_state (void);
+
+cairo_private cairo_int_status_t
+_cairo_gral_stroke_single_pass (cairo_gral_surface_t        *gsurface,
+                                cairo_path_fixed_t          *path,
+                                const cairo_rectangle_int_t *extents,
+                                const cairo_solid_pattern_t *source,
+                                cairo_stroke_style_t        *style,
+                                cairo_matrix_t              *ctm,
+                                cairo_matrix_t              *ctm_inverse,
+                                double                       tolerance);
+
+cairo_private cairo_status_t
+_cairo_gral_stroke_path_to_cached_mesh (cairo_gral_gpu_resources_t *gpu,
+                                        cairo_path_fixed_t         *path,
+                                        cairo_stroke_style_t       *style,
+                                        cairo_matrix_t             *ctm,
+                                        cairo_matrix_t             *ctm_inverse,
+                                        double                      tolerance,
+                                        cairo_gral_cached_mesh_t  **cached_out);
+
 cairo_private cairo_status_t
 _cairo_gral_prepare_stroke_stencil_mask (cairo_gral_surface_t   *gsurface,
                                          cairo_path_fixed_t     *path,
+                                         const cairo_rectangle_int_t *extents,
                                          cairo_stroke_style_t   *style,
                                          cairo_matrix_t	        *ctm,
                                          cairo_matrix_t	        *ctm_inverse,
                                          double                  tolerance,
                                          cairo_gral_bound_box_t *box);
 
+/* Glyph functions. */
+
+cairo_private cairo_int_status_t
+_cairo_gral_surface_show_glyphs (void                  *asurface,
+                                 cairo_operator_t       op,
+                                 const cairo_pattern_t *source,
+                                 cairo_glyph_t         *glyphs,
+                                 int                    num_glyphs,
+                                 cairo_scaled_font_t   *scaled_font,
+                                 int                   *remaining_glyphs,
+                                 cairo_rectangle_int_t *extents);
+
+cairo_private void
+_cairo_gral_surface_scaled_glyph_fini (cairo_scaled_glyph_t *scaled_glyph,
+                                       cairo_scaled_font_t  *scaled_font);
+
 cairo_private gral_cg_program_t *
 _cairo_gral_load_fragment_program (const char *entry,
                                    const char *profiles);
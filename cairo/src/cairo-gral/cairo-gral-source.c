@@ -57,10 +57,91 @@ _cairo_gral_prepare_color_ramp_tex_state (cairo_gral_surface_t     *gsurface,
                                           cairo_gradient_pattern_t *pat,
                                           size_t unit);
 
+/* Loads the program that evaluates the gradient from its stops, or returns
+ * NULL if the gradient needs the ramp texture. */
+static gral_cg_program_t *
+_cairo_gral_get_stops_program (cairo_gral_surface_t     *gsurface,
+                               cairo_gradient_pattern_t *pat,
+                               gral_cg_program_t       **program,
+                               const char               *entry)
+{
+#if CAIRO_GRAL_DISABLE_SHADER_STOPS
+  return NULL;
+#else
+  if (! (gsurface->gpu->caps & GRAL_CAP_FRAGMENT_PROGRAM))
+    return NULL;
+  if (pat->n_stops == 0 || pat->n_stops > CAIRO_GRAL_MAX_SHADER_STOPS)
+    return NULL;
+  /* The wrap from the last stop to the first isn't a segment. */
+  if (pat->base.extend == CAIRO_EXTEND_REPEAT &&
+      (pat->stops[0].offset != 0 || pat->stops[pat->n_stops-1].offset != 1))
+    return NULL;
+
+  if (*program == NULL)
+    *program = _cairo_gral_load_fragment_program (entry, "ps_2_0 arbfp1");
+  return *program;
+#endif
+}
+
+/* Sets the stop constants of gradient_stops_color in shaders.cg. */
+static void
+_cairo_gral_set_stops_constants (gral_cg_program_t        *prog,
+                                 cairo_gradient_pattern_t *pat)
+{
+  float colors[CAIRO_GRAL_MAX_SHADER_STOPS][4];
+  float seg_scale[CAIRO_GRAL_MAX_SHADER_STOPS];
+  float seg_bias[CAIRO_GRAL_MAX_SHADER_STOPS];
+  float extend[4] = { 0, 0, 0, 0 };
+  float range[4] = { -1e6f, 1e6f, 0, 0 };
+  unsigned int i;
+
+  for (i = 0; i < CAIRO_GRAL_MAX_SHADER_STOPS; ++i) {
+    const cairo_gradient_stop_t *stop = &pat->stops[MIN (i, pat->n_stops-1)];
+    colors[i][0] = (float) stop->color.red;
+    colors[i][1] = (float) stop->color.green;
+    colors[i][2] = (float) stop->color.blue;
+    colors[i][3] = (float) stop->color.alpha;
+
+    seg_scale[i] = seg_bias[i] = 0;
+    if (i + 1 < pat->n_stops) {
+      double delta = pat->stops[i+1].offset - stop->offset;
+      /* Stops at the same offset make a step. */
+      seg_scale[i] = delta > 0 ? (float) (1 / delta) : 1e6f;
+      seg_bias[i] = (float) -stop->offset * seg_scale[i];
+    }
+  }
+
+  switch (pat->base.extend) {
+  case CAIRO_EXTEND_REPEAT:
+    extend[1] = 1;
+    break;
+  case CAIRO_EXTEND_REFLECT:
+    extend[2] = 1;
+    break;
+  case CAIRO_EXTEND_NONE:
+    range[0] = (float) pat->stops[0].offset;
+    range[1] = (float) pat->stops[pat->n_stops-1].offset;
+    /* fall through */
+  default:
+    extend[0] = 1;
+    break;
+  }
+
+  gral_cg_program_set_constant_float4_array (prog, "colors", colors[0],
+                                             CAIRO_GRAL_MAX_SHADER_STOPS);
+  gral_cg_program_set_constant_float4_array (prog, "seg_scale", seg_scale,
+                                             CAIRO_GRAL_MAX_SHADER_STOPS / 4);
+  gral_cg_program_set_constant_float4_array (prog, "seg_bias", seg_bias,
+                                             CAIRO_GRAL_MAX_SHADER_STOPS / 4);
+  gral_cg_program_set_constant_float4_array (prog, "extend", extend, 1);
+  gral_cg_program_set_constant_float4_array (prog, "range", range, 1);
+}
+
 static void
 _cairo_gral_set_linear_source(cairo_gral_surface_t   *gsurface,
                               cairo_linear_pattern_t *pat)
 {
+  gral_cg_program_t *prog;
   cairo_gral_vector2_t center;
   cairo_gral_vector2_t pos2;
   cairo_gral_vector2_t dir;
@@ -94,6 +175,19 @@ _cairo_gral_set_linear_source(cairo_gral_surface_t   *gsurface,
   mat.m[2][0] = mat.m[2][1] = mat.m[2][2] = mat.m[2][3] = 0;
   mat.m[3][0] = mat.m[3][1] = mat.m[3][2] = 0, mat.m[3][3] = 1;
 
+  prog = _cairo_gral_get_stops_program (gsurface, &pat->base,
+                                        &gsurface->gpu->linear_stops_shader,
+                                        "fp_linear_gradient_stops");
+  if (prog != NULL) {
+    gral_cg_program_set_constant_matrix (prog, "matrix", &mat);
+    _cairo_gral_set_stops_constants (prog, &pat->base);
+    gral_disable_texture_units_from (0);
+    gral_set_texture_matrix (0/*unit*/, GRAL_MATRIX_IDENTITY, 2);
+    gral_cg_program_bind (prog);
+    gral_unbind_gpu_program (GRAL_GPU_PROGRAM_TYPE_VERTEX);
+    return;
+  }
+
   gral_disable_texture_units_from (1);
   _cairo_gral_prepare_color_ramp_tex_state (gsurface, &pat->base, 0/*unit*/);
   gral_set_texture_matrix (0/*unit*/, &mat, 3);
@@ -109,13 +203,20 @@ _cairo_gral_set_radial_source(cairo_gral_surface_t   *gsurface,
   cairo_gral_vector2_t center;
   cairo_gral_vector2_t circle2_pos;
   gral_matrix_t mat;
-
-  if (gsurface->gpu->radial_shader == NULL) {
-     gsurface->gpu->radial_shader =
-          _cairo_gral_load_fragment_program ("fp_radial_gradient", "ps_2_0 arbfp1");
-     assert(gsurface->gpu->radial_shader);
+  cairo_bool_t use_stops;
+
+  prog = _cairo_gral_get_stops_program (gsurface, &pat->base,
+                                        &gsurface->gpu->radial_stops_shader,
+                                        "fp_radial_gradient_stops");
+  use_stops = prog != NULL;
+  if (! use_stops) {
+    if (gsurface->gpu->radial_shader == NULL) {
+       gsurface->gpu->radial_shader =
+            _cairo_gral_load_fragment_program ("fp_radial_gradient", "ps_2_0 arbfp1");
+       assert(gsurface->gpu->radial_shader);
+    }
+    prog = gsurface->gpu->radial_shader;
   }
-  prog = gsurface->gpu->radial_shader;
 
   VECTOR2_FROM_POINT (center, pat->c1);
   VECTOR2_FROM_POINT (circle2_pos, pat->c2);
@@ -134,8 +235,14 @@ _cairo_gral_set_radial_source(cairo_gral_surface_t   *gsurface,
     gral_cg_program_set_constant_float (prog, "rad2", param_rad2);
   }
 
-  gral_disable_texture_units_from (1);
-  _cairo_gral_prepare_color_ramp_tex_state (gsurface, &pat->base, 0/*unit*/);
+  if (use_stops) {
+    _cairo_gral_set_stops_constants (prog, &pat->base);
+    gral_disable_texture_units_from (0);
+    gral_set_texture_matrix (0/*unit*/, GRAL_MATRIX_IDENTITY, 2);
+  } else {
+    gral_disable_texture_units_from (1);
+    _cairo_gral_prepare_color_ramp_tex_state (gsurface, &pat->base, 0/*unit*/);
+  }
   gral_cg_program_bind (prog);
   gral_unbind_gpu_program (GRAL_GPU_PROGRAM_TYPE_VERTEX);
 }
@@ -153,6 +260,167 @@ _cairo_gral_set_solid_source(cairo_gral_surface_t  *gsurface,
   gral_unbind_gpu_program (GRAL_GPU_PROGRAM_TYPE_FRAGMENT);
 }
 
+/* Sources the colour and alpha of a texture, with matrix mapping device
+ * coordinates to texture coordinates. */
+void
+_cairo_gral_set_texture_source (gral_texture_t      *tex,
+                                const gral_matrix_t *matrix,
+                                cairo_extend_t       extend,
+                                cairo_filter_t       filter)
+{
+  gral_layer_blend_mode_t color_bm;
+  gral_layer_blend_mode_t alpha_bm;
+  gral_uvw_addressing_mode_t uvw;
+  gral_filter_option_t filter_op;
+
+  switch (filter) {
+  case CAIRO_FILTER_FAST:
+  case CAIRO_FILTER_NEAREST:
+    filter_op = GRAL_FILTER_OPTION_POINT;
+    break;
+  default:
+    filter_op = GRAL_FILTER_OPTION_LINEAR;
+    break;
+  }
+
+  gral_disable_texture_units_from (1);
+  gral_set_texture (0, TRUE/*enabled*/, tex);
+  gral_set_texture_coord_set (0, 0);
+  gral_set_texture_coord_calculation (0, GRAL_TEX_COORD_CALC_METHOD_NONE);
+  gral_set_texture_matrix (0, matrix, 2);
+  gral_set_texture_unit_filtering (0, filter_op, filter_op, GRAL_FILTER_OPTION_NONE);
+
+  color_bm.blend_type = GRAL_LAYER_BLEND_TYPE_COLOR;
+  alpha_bm.blend_type = GRAL_LAYER_BLEND_TYPE_ALPHA;
+  color_bm.operation = alpha_bm.operation = GRAL_LAYER_BLEND_OPERATION_SOURCE1;
+  color_bm.source1 = alpha_bm.source1 = GRAL_LAYER_BLEND_SOURCE_TEXTURE;
+  color_bm.source2 = alpha_bm.source2 = GRAL_LAYER_BLEND_SOURCE_CURRENT;
+  gral_set_texture_blend_mode (0, &color_bm);
+  gral_set_texture_blend_mode (0, &alpha_bm);
+
+  switch (extend) {
+  case CAIRO_EXTEND_NONE:
+    uvw.u = uvw.v = uvw.w = GRAL_TEXTURE_ADDRESSING_MODE_BORDER;
+    gral_set_texture_border_color (0, GRAL_COLOR_ZERO);
+    break;
+  case CAIRO_EXTEND_REPEAT:
+    uvw.u = uvw.v = uvw.w = GRAL_TEXTURE_ADDRESSING_MODE_WRAP;
+    break;
+  case CAIRO_EXTEND_REFLECT:
+    uvw.u = uvw.v = uvw.w = GRAL_TEXTURE_ADDRESSING_MODE_MIRROR;
+    break;
+  default:
+    uvw.u = uvw.v = uvw.w = GRAL_TEXTURE_ADDRESSING_MODE_CLAMP;
+    break;
+  }
+  gral_set_texture_addressing_mode (0, &uvw);
+
+  gral_unbind_gpu_program (GRAL_GPU_PROGRAM_TYPE_VERTEX);
+  gral_unbind_gpu_program (GRAL_GPU_PROGRAM_TYPE_FRAGMENT);
+}
+
+static void
+_cairo_gral_evict_image_texture (cairo_gral_gpu_resources_t *gpu,
+                                 cairo_gral_resource_t      *resource)
+{
+  gral_texture_destroy (gpu->image_tex);
+  gpu->image_tex = NULL;
+  gpu->image_tex_id = 0;
+}
+
+/* Uploads an ARGB32 image into the image source texture, unless it's still
+ * there: drawing into the image or marking it dirty changes its unique_id. */
+static gral_texture_t *
+_cairo_gral_upload_image_source (cairo_gral_surface_t  *gsurface,
+                                 cairo_image_surface_t *image)
+{
+  cairo_gral_gpu_resources_t *gpu = gsurface->gpu;
+
+  if (gpu->image_tex != NULL &&
+      (gral_texture_get_width (gpu->image_tex) != (unsigned int) image->width ||
+       gral_texture_get_height (gpu->image_tex) != (unsigned int) image->height)) {
+    _cairo_gral_memory_remove (gpu, &gpu->image_tex_resource);
+    gral_texture_destroy (gpu->image_tex);
+    gpu->image_tex = NULL;
+    gpu->image_tex_id = 0;
+  }
+
+  if (gpu->image_tex == NULL) {
+    gpu->image_tex = gral_texture_create (
+          GRAL_TEX_TYPE_2D, image->width, image->height, 1,
+          0, /*num_mips*/
+          GRAL_PIXEL_FORMAT_BYTE_BGRA,
+          GRAL_TEXTURE_USAGE_DYNAMIC_WRITE_ONLY_DISCARDABLE,
+          FALSE, /*hw_gamma_correction*/
+          0 /*fsaa*/);
+    if (unlikely (gpu->image_tex == NULL))
+      return NULL;
+
+    _cairo_gral_memory_add (gpu, &gpu->image_tex_resource, CAIRO_GRAL_RESOURCE_TEXTURES,
+                            _cairo_gral_texture_bytes (gpu->image_tex),
+                            _cairo_gral_evict_image_texture);
+  } else {
+    _cairo_gral_memory_touch (gpu, &gpu->image_tex_resource);
+    if (gpu->image_tex_id == image->base.unique_id)
+      return gpu->image_tex;
+  }
+
+  gral_texture_write (gpu->image_tex, image->data, image->stride);
+  gpu->image_tex_id = image->base.unique_id;
+  return gpu->image_tex;
+}
+
+/* Samples gral surfaces that draw into a texture in place; ARGB32 images
+ * are uploaded. Everything else falls back. */
+static cairo_int_status_t
+_cairo_gral_set_surface_source (cairo_gral_surface_t    *gsurface,
+                                cairo_surface_pattern_t *pat)
+{
+  cairo_surface_t *surface = pat->surface;
+  gral_texture_t *tex;
+  gral_bool_t flipped = FALSE;
+  gral_matrix_t mat, pattern_mat;
+
+  if (surface->backend == gsurface->base.backend) {
+    cairo_gral_surface_t *src = (cairo_gral_surface_t *) surface;
+
+    /* Sampling the target while drawing into it is undefined. */
+    if (src->gral_tex == NULL || src == gsurface)
+      return _cairo_gral_surface_fallback (gsurface);
+
+    /* Its fills were painted before the drawing operation bound the render
+     * state of gsurface, by _cairo_gral_surface_flush_source_fills(). */
+    assert (src->fill_batch.num_paths == 0);
+
+    tex = src->gral_tex;
+    flipped = gral_texture_is_flipped (tex);
+  } else if (surface->type == CAIRO_SURFACE_TYPE_IMAGE &&
+             ((cairo_image_surface_t *) surface)->format == CAIRO_FORMAT_ARGB32) {
+    tex = _cairo_gral_upload_image_source (gsurface, (cairo_image_surface_t *) surface);
+    if (unlikely (tex == NULL))
+      return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+  } else {
+    return _cairo_gral_surface_fallback (gsurface);
+  }
+
+  /* The pattern matrix maps device space to the pixels of the surface. */
+  gral_matrix_init_scale (&mat, 1.0f / gral_texture_get_width (tex),
+                          flipped ? -1.0f / gral_texture_get_height (tex)
+                                  : 1.0f / gral_texture_get_height (tex), 1);
+  if (flipped)
+    gral_matrix_set_translate (&mat, 0, 1, 0);
+  _cairo_gral_matrix_from_cairo_matrix (&pattern_mat, &pat->base.matrix);
+  gral_matrix_multiply (&mat, &mat, &pattern_mat);
+
+  _cairo_gral_set_texture_source (tex, &mat, pat->base.extend, pat->base.filter);
+
+  /* Surfaces hold premultiplied colour. */
+  gral_set_scene_blending (GRAL_SCENE_BLEND_FACTOR_SBF_ONE,
+                           GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_SOURCE_ALPHA);
+
+  return CAIRO_STATUS_SUCCESS;
+}
+
 cairo_int_status_t
 _cairo_gral_set_source (cairo_gral_surface_t  *gsurface,
                         const cairo_pattern_t *source)
@@ -167,8 +435,7 @@ _cairo_gral_set_source (cairo_gral_surface_t  *gsurface,
     break;
 
   case CAIRO_PATTERN_TYPE_SURFACE:
-    fprintf(stderr, "CAIRO_PATTERN_TYPE_SURFACE not supported as source yet");
-    return CAIRO_INT_STATUS_UNSUPPORTED;
+    return _cairo_gral_set_surface_source (gsurface, (cairo_surface_pattern_t *)source);
 
   case CAIRO_PATTERN_TYPE_SOLID:
     _cairo_gral_set_solid_source(gsurface, (cairo_solid_pattern_t *)source);
@@ -178,6 +445,14 @@ _cairo_gral_set_source (cairo_gral_surface_t  *gsurface,
   return CAIRO_STATUS_SUCCESS;
 }
 
+static void
+_cairo_gral_evict_color_ramp_texture (cairo_gral_gpu_resources_t *gpu,
+                                      cairo_gral_resource_t      *resource)
+{
+  gral_texture_destroy (gpu->gral_tex);
+  gpu->gral_tex = NULL;
+}
+
 static void
 _cairo_gral_prepare_color_ramp_texture(cairo_gral_surface_t     *gsurface,
                                        cairo_gradient_pattern_t *pat)
@@ -197,6 +472,13 @@ _cairo_gral_prepare_color_ramp_texture(cairo_gral_surface_t     *gsurface,
           FALSE, /*hw_gamma_correction*/
           0 /*fsaa*/);
     assert (gsurface->gpu->gral_tex);
+
+    _cairo_gral_memory_add (gsurface->gpu, &gsurface->gpu->gral_tex_resource,
+                            CAIRO_GRAL_RESOURCE_RAMPS,
+                            _cairo_gral_texture_bytes (gsurface->gpu->gral_tex),
+                            _cairo_gral_evict_color_ramp_texture);
+  } else {
+    _cairo_gral_memory_touch (gsurface->gpu, &gsurface->gpu->gral_tex_resource);
   }
 
   dat = gral_texture_buffer_lock_full (gsurface->gpu->gral_tex,
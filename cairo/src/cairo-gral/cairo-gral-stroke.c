@@ -43,19 +43,53 @@ struct _cairo_gral_stroke_path_mesh {
   cairo_point_t               spline_backward_point;
   cairo_gral_vertex_index_t   spline_forward_index;
   cairo_gral_vertex_index_t   spline_backward_index;
+
+  /* Only used when the mesh has texture coordinates, see
+   * _cairo_gral_path_stroke_set_arc_length. */
+  float                       arc_length_start;
+  float                       arc_length_end;
+
+  cairo_bool_t                overflow;
 };
 
+static cairo_gral_vertex_index_t
+_cairo_gral_path_stroke_add_vertex (cairo_gral_stroke_path_mesh_t *mesh,
+                                    const cairo_point_t           *point,
+                                    float                          arc_length)
+{
+  cairo_gral_tex_coord3_t tex;
+
+  if (mesh->base.tex_coords == NULL)
+    return _cairo_gral_mesh_add_vertex_point (&mesh->base, point);
+
+  tex.x = arc_length;
+  tex.y = tex.z = 0;
+  return _cairo_gral_mesh_add_vertex_pos_and_tex (&mesh->base,
+                                                  (float)_cairo_fixed_to_double (point->x),
+                                                  (float)_cairo_fixed_to_double (point->y),
+                                                  &tex);
+}
+
+void
+_cairo_gral_path_stroke_set_arc_length (cairo_gral_stroke_path_mesh_t *mesh,
+                                        double                         start,
+                                        double                         end)
+{
+  mesh->arc_length_start = (float)start;
+  mesh->arc_length_end = (float)end;
+}
+
 cairo_status_t
 _cairo_gral_path_stroke_triangle (cairo_gral_stroke_path_mesh_t *mesh,
                                   const cairo_point_t t[3])
 {
   cairo_gral_vertex_index_t index;
 
-  index = _cairo_gral_mesh_add_vertex_point (&mesh->base, &t[0]);
+  index = _cairo_gral_path_stroke_add_vertex (mesh, &t[0], mesh->arc_length_start);
   _cairo_gral_mesh_add_index (&mesh->base, &index);
-  index = _cairo_gral_mesh_add_vertex_point (&mesh->base, &t[1]);
+  index = _cairo_gral_path_stroke_add_vertex (mesh, &t[1], mesh->arc_length_start);
   _cairo_gral_mesh_add_index (&mesh->base, &index);
-  index = _cairo_gral_mesh_add_vertex_point (&mesh->base, &t[2]);
+  index = _cairo_gral_path_stroke_add_vertex (mesh, &t[2], mesh->arc_length_start);
   _cairo_gral_mesh_add_index (&mesh->base, &index);
 
   return CAIRO_STATUS_SUCCESS;
@@ -67,16 +101,16 @@ _cairo_gral_path_stroke_convex_quad (cairo_gral_stroke_path_mesh_t *mesh,
 {
   cairo_gral_vertex_index_t index0, index1, index2;
 
-  index0 = _cairo_gral_mesh_add_vertex_point (&mesh->base, &q[0]);
+  index0 = _cairo_gral_path_stroke_add_vertex (mesh, &q[0], mesh->arc_length_start);
   _cairo_gral_mesh_add_index (&mesh->base, &index0);
-  index1 = _cairo_gral_mesh_add_vertex_point (&mesh->base, &q[1]);
+  index1 = _cairo_gral_path_stroke_add_vertex (mesh, &q[1], mesh->arc_length_start);
   _cairo_gral_mesh_add_index (&mesh->base, &index1);
-  index2 = _cairo_gral_mesh_add_vertex_point (&mesh->base, &q[2]);
+  index2 = _cairo_gral_path_stroke_add_vertex (mesh, &q[2], mesh->arc_length_end);
   _cairo_gral_mesh_add_index (&mesh->base, &index2);
 
   _cairo_gral_mesh_add_index (&mesh->base, &index0);
   _cairo_gral_mesh_add_index (&mesh->base, &index2);
-  index1 = _cairo_gral_mesh_add_vertex_point (&mesh->base, &q[3]);
+  index1 = _cairo_gral_path_stroke_add_vertex (mesh, &q[3], mesh->arc_length_end);
   _cairo_gral_mesh_add_index (&mesh->base, &index1);
 
   return CAIRO_STATUS_SUCCESS;
@@ -133,57 +167,318 @@ _cairo_gral_path_stroke_spline_close (cairo_gral_stroke_path_mesh_t *mesh)
   return CAIRO_STATUS_SUCCESS;
 }
 
+/* How the triangles of a stroke mesh are drawn. */
+typedef enum _cairo_gral_stroke_pass {
+  CAIRO_GRAL_STROKE_PASS_STENCIL,     /* into the stencil, for a cover quad */
+  CAIRO_GRAL_STROKE_PASS_OPAQUE,      /* with the source, overlaps draw again */
+  CAIRO_GRAL_STROKE_PASS_WRITE_ONCE   /* with the source, once per pixel */
+} cairo_gral_stroke_pass_t;
+
+static double
+_cairo_gral_dash_period (const cairo_stroke_style_t *style)
+{
+  double period = 0;
+  unsigned int i;
+
+  for (i = 0; i < style->num_dashes; i++)
+    period += style->dash[i];
+
+  /* An odd pattern repeats with the dashes and gaps swapped. */
+  if (style->num_dashes & 1)
+    period *= 2;
+
+  return period;
+}
+
+static cairo_bool_t
+_cairo_gral_can_dash_on_gpu (cairo_gral_surface_t *gsurface,
+                             cairo_stroke_style_t *style,
+                             cairo_matrix_t       *ctm)
+{
+  double period, texel;
+  unsigned int i;
+
+#if CAIRO_GRAL_DISABLE_GPU_DASH
+  return FALSE;
+#endif
+
+  /* Other caps would have to be added at the end of every dash. */
+  if (style->dash == NULL || style->line_cap != CAIRO_LINE_CAP_BUTT)
+    return FALSE;
+  if (! _cairo_gral_has_capability (gsurface, GRAL_CAP_FRAGMENT_PROGRAM))
+    return FALSE;
+  /* Loaded with the other programs; NULL if it failed to compile. */
+  if (gsurface->gpu->dash_shader == NULL)
+    return FALSE;
+  if (style->num_dashes > CAIRO_GRAL_MAX_GPU_DASHES)
+    return FALSE;
+
+  period = _cairo_gral_dash_period (style);
+  if (period <= 0)
+    return FALSE;
+
+  /* The edges are found by the linear filtering, which needs every dash and
+   * gap to span a couple of texels, and a texel no bigger than a pixel. */
+  texel = period / CAIRO_GRAL_DASH_TEX_WIDTH;
+  for (i = 0; i < style->num_dashes; i++) {
+    if (style->dash[i] < 2 * texel)
+      return FALSE;
+  }
+  return _cairo_matrix_transformed_circle_major_axis (ctm, texel) <= 1.0;
+}
+
+static void
+_cairo_gral_add_dash_coverage (float *coverage, double start, double end)
+{
+  int texel = (int) floor (start);
+
+  while (start < end && texel < CAIRO_GRAL_DASH_TEX_WIDTH) {
+    double texel_end = MIN (end, texel + 1);
+    coverage[texel] += (float) (texel_end - start);
+    start = texel_end;
+    ++texel;
+  }
+}
+
+static void
+_cairo_gral_evict_dash_texture (cairo_gral_gpu_resources_t *gpu,
+                                cairo_gral_resource_t      *resource)
+{
+  gral_texture_destroy (gpu->dash_tex);
+  gpu->dash_tex = NULL;
+}
+
+static cairo_int_status_t
+_cairo_gral_prepare_dash_texture (cairo_gral_gpu_resources_t *gpu,
+                                  const cairo_stroke_style_t *style,
+                                  double                      period)
+{
+  float coverage[CAIRO_GRAL_DASH_TEX_WIDTH];
+  double texel = period / CAIRO_GRAL_DASH_TEX_WIDTH;
+  double pos = 0;
+  cairo_bool_t on = TRUE;
+  gral_argb_t *dat;
+  unsigned int i;
+
+  if (gpu->dash_tex == NULL) {
+    gpu->dash_tex = gral_texture_create (
+          GRAL_TEX_TYPE_1D,
+          CAIRO_GRAL_DASH_TEX_WIDTH, /*width*/
+          1, /*height*/
+          1, /*depth*/
+          0, /*num_mips*/
+          GRAL_PIXEL_FORMAT_BYTE_BGRA,
+          GRAL_TEXTURE_USAGE_DYNAMIC_WRITE_ONLY_DISCARDABLE,
+          FALSE, /*hw_gamma_correction*/
+          0 /*fsaa*/);
+    if (unlikely (gpu->dash_tex == NULL))
+      return CAIRO_INT_STATUS_UNSUPPORTED;
+
+    _cairo_gral_memory_add (gpu, &gpu->dash_tex_resource, CAIRO_GRAL_RESOURCE_TEXTURES,
+                            _cairo_gral_texture_bytes (gpu->dash_tex),
+                            _cairo_gral_evict_dash_texture);
+  } else {
+    _cairo_gral_memory_touch (gpu, &gpu->dash_tex_resource);
+
+    if (gpu->dash_tex_num_dashes == style->num_dashes &&
+        memcmp (gpu->dash_tex_pattern, style->dash,
+                style->num_dashes * sizeof (double)) == 0)
+      return CAIRO_STATUS_SUCCESS;
+  }
+
+  memset (coverage, 0, sizeof (coverage));
+  for (i = 0; pos < period; i++) {
+    double end = pos + style->dash[i % style->num_dashes];
+    if (on)
+      _cairo_gral_add_dash_coverage (coverage, pos / texel, end / texel);
+    pos = end;
+    on = ! on;
+  }
+
+  dat = gral_texture_buffer_lock_full (gpu->dash_tex,
+                  0/*face*/,  0/*mipmap*/, GRAL_BUFFER_LOCK_OPTION_DISCARD);
+  if (unlikely (dat == NULL))
+    return CAIRO_INT_STATUS_UNSUPPORTED;
+  for (i = 0; i < CAIRO_GRAL_DASH_TEX_WIDTH; ++i) {
+    float alpha = MIN (coverage[i], 1.0f);
+    dat[i] = ((gral_argb_t) (alpha * 255 + 0.5f) << 24) | 0x00ffffff;
+  }
+  gral_texture_buffer_unlock (gpu->dash_tex, 0/*face*/, 0/*mipmap*/);
+
+  memcpy (gpu->dash_tex_pattern, style->dash, style->num_dashes * sizeof (double));
+  gpu->dash_tex_num_dashes = style->num_dashes;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/* Binds fp_dash with the dash pattern in texture unit 0. Returns
+ * CAIRO_INT_STATUS_UNSUPPORTED, having changed no state, if the pattern
+ * texture can't be created or written, and the stroke has to be dashed on
+ * the CPU. */
+static cairo_int_status_t
+_cairo_gral_set_gpu_dash_state (cairo_gral_gpu_resources_t *gpu,
+                                const cairo_stroke_style_t *style)
+{
+  double period = _cairo_gral_dash_period (style);
+  gral_uvw_addressing_mode_t uvw;
+  cairo_int_status_t status;
+
+  if (unlikely (gpu->dash_shader == NULL))
+    return CAIRO_INT_STATUS_UNSUPPORTED;
+
+  status = _cairo_gral_prepare_dash_texture (gpu, style, period);
+  if (unlikely (status))
+    return status;
+
+  gral_cg_program_set_constant_float (gpu->dash_shader, "offset", (float) style->dash_offset);
+  gral_cg_program_set_constant_float (gpu->dash_shader, "inv_period", (float) (1 / period));
+
+  gral_disable_texture_units_from (1);
+  gral_set_texture (0, TRUE/*enabled*/, gpu->dash_tex);
+  gral_set_texture_coord_set (0, 0);
+  gral_set_texture_unit_filtering (0, GRAL_FILTER_OPTION_LINEAR,
+                                      GRAL_FILTER_OPTION_LINEAR, GRAL_FILTER_OPTION_POINT);
+  uvw.u = uvw.v = uvw.w = GRAL_TEXTURE_ADDRESSING_MODE_WRAP;
+  gral_set_texture_addressing_mode (0, &uvw);
+  gral_set_texture_coord_calculation (0, GRAL_TEX_COORD_CALC_METHOD_NONE);
+
+  gral_cg_program_bind (gpu->dash_shader);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+static void
+_cairo_gral_stroke_path_overflow (void *closure)
+{
+  cairo_gral_stroke_path_mesh_t *mesh = closure;
+
+  /* Same as for fills, the caller won't cache or draw a partial stroke. */
+  mesh->overflow = TRUE;
+  mesh->base.num_vertices = mesh->base.num_indices = 0;
+}
+
 static cairo_status_t
 _cairo_gral_render_stroke_path (cairo_gral_surface_t *gsurface,
                                 cairo_path_fixed_t	*path,
+                                const cairo_rectangle_int_t *extents,
                                 cairo_stroke_style_t	*style,
                                 cairo_matrix_t		*ctm,
                                 cairo_matrix_t		*ctm_inverse,
                                 double			tolerance,
+                                cairo_gral_stroke_pass_t pass,
                                 cairo_gral_bound_box_t *box)
 {
   cairo_gral_stroke_path_mesh_t mesh;
-  cairo_gral_vertex_pos_t vertices[CAIRO_GRAL_MAX_VERTICES];
-  cairo_gral_vertex_index_t indices[CAIRO_GRAL_MAX_INDICES];
   cairo_gral_gpu_resources_t *gpu = gsurface->gpu;
+  cairo_bool_t dash_on_gpu = pass == CAIRO_GRAL_STROKE_PASS_STENCIL &&
+                             _cairo_gral_can_dash_on_gpu (gsurface, style, ctm);
+  cairo_box_t guard_band;
+  cairo_bool_t has_guard_band;
+  double dx, dy;
   cairo_status_t status;
 
-  _cairo_gral_mesh_init (&mesh.base,
-                         vertices,
-                         NULL, /*tex_coords*/
-                         indices,
-                         gpu->vertex_buf_pos,
-                         gpu->vertex_buf_tex,
-                         gpu->index_buf,
-                         gpu->vertex_data_stencil,
-                         gpu->index_data);
+  /* The extents include the line width, so thin strokes of a small path
+   * get both fewer curve segments and a pen with fewer vertices. */
+  tolerance = _cairo_gral_lod_tolerance (tolerance, extents);
+
+  _cairo_stroke_style_max_distance_from_path (style, ctm, &dx, &dy);
+  has_guard_band = _cairo_gral_surface_get_guard_band (gsurface, extents,
+                                                       dx, dy, &guard_band);
+
+  /* Without the pattern texture the dashes are made on the CPU. */
+  if (dash_on_gpu && _cairo_gral_set_gpu_dash_state (gpu, style))
+    dash_on_gpu = FALSE;
+
+  if (dash_on_gpu) {
+    /* The arc lengths go in the first texture coordinate. */
+    _cairo_gral_mesh_init (&mesh.base, gpu, gpu->vertex_data_spline, TRUE);
+  } else {
+    _cairo_gral_mesh_init (&mesh.base, gpu, gpu->vertex_data_stencil, FALSE);
+  }
+  mesh.arc_length_start = mesh.arc_length_end = 0;
+  mesh.overflow = FALSE;
+
+  /* The stencil is cleared after each batch, so a write-once stroke has to
+   * fit in one; the caller stencils and covers the ones that don't. */
+  if (pass == CAIRO_GRAL_STROKE_PASS_WRITE_ONCE) {
+    mesh.base.on_full = _cairo_gral_stroke_path_overflow;
+    mesh.base.on_full_closure = &mesh;
+    mesh.base.clear_stencil = TRUE;
+  }
 
   status = _cairo_gral_path_fixed_stroke_to_mesh (path,
                                                   style,
                                                   ctm,
                                                   ctm_inverse,
                                                   tolerance,
+                                                  &gpu->pen_cache,
+                                                  dash_on_gpu,
+                                                  has_guard_band ? &guard_band : NULL,
                                                   &mesh);
   if (unlikely (status))
     goto BAIL;
 
+  if (mesh.overflow) {
+    status = CAIRO_INT_STATUS_UNSUPPORTED;
+    goto BAIL;
+  }
+
   _cairo_gral_mesh_render (&mesh.base);
+  status = mesh.base.status;
   if (box)
     *box = mesh.base.box;
 
 BAIL:
+  if (dash_on_gpu) {
+    gral_unbind_gpu_program (GRAL_GPU_PROGRAM_TYPE_FRAGMENT);
+    gral_disable_texture_units_from (0);
+  }
   _cairo_gral_mesh_fini (&mesh.base);
   return status;
 }
 
 cairo_status_t
-_cairo_gral_prepare_stroke_stencil_mask (cairo_gral_surface_t   *gsurface,
-                                         cairo_path_fixed_t     *path,
-                                         cairo_stroke_style_t   *style,
-                                         cairo_matrix_t	        *ctm,
-                                         cairo_matrix_t	        *ctm_inverse,
-                                         double                  tolerance,
-                                         cairo_gral_bound_box_t *box)
+_cairo_gral_stroke_path_to_cached_mesh (cairo_gral_gpu_resources_t *gpu,
+                                        cairo_path_fixed_t         *path,
+                                        cairo_stroke_style_t       *style,
+                                        cairo_matrix_t             *ctm,
+                                        cairo_matrix_t             *ctm_inverse,
+                                        double                      tolerance,
+                                        cairo_gral_cached_mesh_t  **cached_out)
+{
+  cairo_gral_stroke_path_mesh_t mesh;
+  cairo_status_t status;
+
+  _cairo_gral_mesh_init (&mesh.base, gpu, NULL, FALSE);
+  mesh.base.on_full = _cairo_gral_stroke_path_overflow;
+  mesh.base.on_full_closure = &mesh;
+  mesh.arc_length_start = mesh.arc_length_end = 0;
+  mesh.overflow = FALSE;
+
+  status = _cairo_gral_path_fixed_stroke_to_mesh (path,
+                                                  style,
+                                                  ctm,
+                                                  ctm_inverse,
+                                                  tolerance,
+                                                  &gpu->pen_cache,
+                                                  FALSE,
+                                                  NULL,
+                                                  &mesh);
+  if (unlikely (status))
+    goto BAIL;
+
+  if (mesh.overflow) {
+    status = CAIRO_INT_STATUS_UNSUPPORTED;
+    goto BAIL;
+  }
+
+  status = _cairo_gral_cached_mesh_create (&mesh.base, cached_out);
+
+BAIL:
+  _cairo_gral_mesh_fini (&mesh.base);
+  return status;
+}
+
+void
+_cairo_gral_set_stroke_stencil_state (void)
 {
   gral_set_stencil_check_enabled (TRUE);
   gral_set_color_buffer_write_enabled (FALSE, FALSE, FALSE, FALSE);
@@ -195,6 +490,91 @@ _cairo_gral_prepare_stroke_stencil_mask (cairo_gral_surface_t   *gsurface,
                                   GRAL_STENCIL_OPERATION_KEEP,
                                   GRAL_STENCIL_OPERATION_INCREMENT,
                                   FALSE);
+}
 
-  return _cairo_gral_render_stroke_path (gsurface, path, style, ctm, ctm_inverse, tolerance, box);
+/* Same test as the stencil pass, but the triangles are drawn with the source:
+ * the first one to cover a pixel blends it, the overlapping ones fail. */
+void
+_cairo_gral_set_stroke_write_once_state (void)
+{
+  _cairo_gral_set_stroke_stencil_state ();
+  gral_set_color_buffer_write_enabled (TRUE, TRUE, TRUE, TRUE);
+}
+
+/* Zeroes the stencil under the triangles that are drawn next. */
+void
+_cairo_gral_set_stroke_clear_state (void)
+{
+  gral_set_stencil_check_enabled (TRUE);
+  gral_set_color_buffer_write_enabled (FALSE, FALSE, FALSE, FALSE);
+  gral_set_stencil_buffer_params (GRAL_COMPARE_FUNC_NOT_EQUAL,
+                                  0, 0xffffffff,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  FALSE);
+}
+
+cairo_status_t
+_cairo_gral_prepare_stroke_stencil_mask (cairo_gral_surface_t   *gsurface,
+                                         cairo_path_fixed_t     *path,
+                                         const cairo_rectangle_int_t *extents,
+                                         cairo_stroke_style_t   *style,
+                                         cairo_matrix_t	        *ctm,
+                                         cairo_matrix_t	        *ctm_inverse,
+                                         double                  tolerance,
+                                         cairo_gral_bound_box_t *box)
+{
+  _cairo_gral_set_stroke_stencil_state ();
+
+  return _cairo_gral_render_stroke_path (gsurface, path, extents, style, ctm, ctm_inverse, tolerance,
+                                         CAIRO_GRAL_STROKE_PASS_STENCIL, box);
+}
+
+/* Draws a stroke with a solid source straight from its mesh, without the
+ * stencil pass and the cover quad over the whole bounding box. Drawing an
+ * opaque color twice where the triangles overlap changes nothing; otherwise
+ * the stencil stops the overlaps from blending again. Returns
+ * CAIRO_INT_STATUS_UNSUPPORTED, having drawn nothing, if the stroke needs the
+ * stencil pass (dashes on the GPU, or more than one batch of triangles). */
+cairo_int_status_t
+_cairo_gral_stroke_single_pass (cairo_gral_surface_t        *gsurface,
+                                cairo_path_fixed_t          *path,
+                                const cairo_rectangle_int_t *extents,
+                                const cairo_solid_pattern_t *source,
+                                cairo_stroke_style_t        *style,
+                                cairo_matrix_t              *ctm,
+                                cairo_matrix_t              *ctm_inverse,
+                                double                       tolerance)
+{
+  cairo_gral_stroke_pass_t pass;
+  cairo_status_t status;
+
+#if CAIRO_GRAL_DISABLE_SINGLE_PASS_STROKES
+  return CAIRO_INT_STATUS_UNSUPPORTED;
+#endif
+
+  if (_cairo_gral_can_dash_on_gpu (gsurface, style, ctm))
+    return CAIRO_INT_STATUS_UNSUPPORTED;
+
+  status = _cairo_gral_set_source (gsurface, &source->base);
+  if (unlikely (status))
+    return status;
+
+  if (CAIRO_COLOR_IS_OPAQUE (&source->color)) {
+    pass = CAIRO_GRAL_STROKE_PASS_OPAQUE;
+    gral_set_stencil_check_enabled (FALSE);
+  } else {
+    pass = CAIRO_GRAL_STROKE_PASS_WRITE_ONCE;
+    _cairo_gral_set_stroke_write_once_state ();
+  }
+
+  status = _cairo_gral_render_stroke_path (gsurface, path, extents, style, ctm, ctm_inverse, tolerance,
+                                           pass, NULL);
+
+  /* Reset state */
+  gral_set_stencil_check_enabled (FALSE);
+  gral_set_color_buffer_write_enabled (TRUE, TRUE, TRUE, TRUE);
+
+  return status;
 }
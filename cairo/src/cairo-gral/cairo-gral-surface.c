@@ -1,7 +1,7 @@
 /* -*- Mode: c; tab-width: 8; c-basic-offset: 4; indent-tabs-mode: t; -*- */
 /* Cairo - a vector graphics library with display and print output
  *
- * Copyright  2009 Argiris Kirtzidis
+ * Copyright � 2009 Argiris Kirtzidis
  *
  * This library is free software; you can redistribute it and/or
  * modify it either under the terms of the GNU Lesser General Public
@@ -41,11 +41,168 @@ static cairo_status_t
 _cairo_gral_surface_finish (void *asurface)
 {
   cairo_gral_surface_t *gsurface = asurface;
+
+  if (gsurface->gpu->bound_surface == gsurface)
+    gsurface->gpu->bound_surface = NULL;
+  _cairo_gral_memory_remove (gsurface->gpu, &gsurface->render_target);
   _cairo_gral_gpu_resources_release (gsurface->gpu);
 
   return CAIRO_STATUS_SUCCESS;
 }
 
+/* Whether anything drawn inside of the extents can be visible. */
+static cairo_bool_t
+_cairo_gral_surface_extents_visible (cairo_gral_surface_t        *gsurface,
+                                     const cairo_rectangle_int_t *extents)
+{
+  cairo_rectangle_int_t clip;
+
+  _cairo_gral_surface_get_clip_extents (gsurface, &clip);
+  return _cairo_rectangle_intersect (&clip, extents);
+}
+
+/* Whether the fill can join the paths that wait in the stencil. */
+static cairo_bool_t
+_cairo_gral_fill_batch_accepts (cairo_gral_fill_batch_t     *batch,
+                                cairo_operator_t             op,
+                                const cairo_pattern_t       *source,
+                                const cairo_rectangle_int_t *extents)
+{
+  const cairo_solid_pattern_t *solid = (const cairo_solid_pattern_t *) source;
+  int i;
+
+  if (source->type != CAIRO_PATTERN_TYPE_SOLID)
+    return FALSE;
+
+  if (batch->num_paths == 0)
+    return TRUE;
+
+  if (batch->num_paths == CAIRO_GRAL_MAX_FILL_BATCH ||
+      op != batch->op ||
+      solid->content != batch->content ||
+      ! _cairo_color_equal (&solid->color, &batch->color))
+    return FALSE;
+
+  /* Overlapping paths would add up their winding numbers in the stencil and
+   * paint the shared pixels only once. */
+  for (i = 0; i < batch->num_paths; ++i) {
+    cairo_rectangle_int_t rect = batch->extents[i];
+    if (_cairo_rectangle_intersect (&rect, extents))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+_cairo_gral_fill_batch_add (cairo_gral_fill_batch_t      *batch,
+                            cairo_operator_t              op,
+                            const cairo_pattern_t        *source,
+                            const cairo_rectangle_int_t  *extents,
+                            const cairo_gral_bound_box_t *box)
+{
+  const cairo_solid_pattern_t *solid = (const cairo_solid_pattern_t *) source;
+
+  if (batch->num_paths == 0) {
+    batch->op = op;
+    batch->color = solid->color;
+    batch->content = solid->content;
+  }
+
+  batch->extents[batch->num_paths] = *extents;
+  batch->boxes[batch->num_paths] = *box;
+  batch->num_paths++;
+}
+
+/* Paints the fills that were deferred by _cairo_gral_surface_fill(), with one
+ * quad per path in a single draw. Every other drawing operation calls this
+ * first, as does cairo_surface_flush(). */
+cairo_status_t
+_cairo_gral_surface_flush_fills (cairo_gral_surface_t *gsurface)
+{
+  cairo_gral_fill_batch_t *batch = &gsurface->fill_batch;
+  cairo_solid_pattern_t pattern;
+  cairo_gral_mesh_t mesh;
+  cairo_status_t status;
+  int i;
+
+  if (batch->num_paths == 0)
+    return CAIRO_STATUS_SUCCESS;
+
+  /* Another surface may have been drawn since the paths were stencilled. */
+  _cairo_gral_init_render_state (gsurface);
+
+  /* Draw paint where stencil not zero */
+  gral_set_stencil_check_enabled (TRUE);
+  gral_set_stencil_buffer_params (GRAL_COMPARE_FUNC_NOT_EQUAL,
+                                  0, 0xffffffff,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  GRAL_STENCIL_OPERATION_ZERO,
+                                  FALSE /*two_sided_operation*/);
+  gral_set_color_buffer_write_enabled (TRUE, TRUE, TRUE, TRUE);
+
+  _cairo_pattern_init_solid (&pattern, &batch->color, batch->content);
+  status = _cairo_gral_set_source (gsurface, &pattern.base);
+  _cairo_pattern_fini (&pattern.base);
+
+  if (status == CAIRO_STATUS_SUCCESS) {
+    _cairo_gral_mesh_init (&mesh, gsurface->gpu, gsurface->gpu->vertex_data_source, FALSE);
+
+    for (i = 0; i < batch->num_paths; ++i) {
+      const cairo_gral_bound_box_t *box = &batch->boxes[i];
+      cairo_gral_vertex_index_t v0, v1, v2, v3;
+
+      v0 = _cairo_gral_mesh_add_vertex_float (&mesh, box->min_x, box->min_y);
+      v1 = _cairo_gral_mesh_add_vertex_float (&mesh, box->max_x, box->min_y);
+      v2 = _cairo_gral_mesh_add_vertex_float (&mesh, box->max_x, box->max_y);
+      v3 = _cairo_gral_mesh_add_vertex_float (&mesh, box->min_x, box->max_y);
+      _cairo_gral_mesh_add_index (&mesh, &v0);
+      _cairo_gral_mesh_add_index (&mesh, &v1);
+      _cairo_gral_mesh_add_index (&mesh, &v2);
+      _cairo_gral_mesh_add_index (&mesh, &v0);
+      _cairo_gral_mesh_add_index (&mesh, &v2);
+      _cairo_gral_mesh_add_index (&mesh, &v3);
+    }
+
+    _cairo_gral_mesh_render (&mesh);
+    status = mesh.status;
+    _cairo_gral_mesh_fini (&mesh);
+  }
+
+  /* Reset state */
+  gral_set_stencil_check_enabled (FALSE);
+
+  batch->num_paths = 0;
+  return status;
+}
+
+/* Paints the deferred fills of the source, if it's another gral surface.
+ * Drawing operations call this before they set up their render state, as
+ * _cairo_gral_set_source() is too late to switch to another surface. */
+cairo_status_t
+_cairo_gral_surface_flush_source_fills (cairo_gral_surface_t  *gsurface,
+                                        const cairo_pattern_t *source)
+{
+  cairo_surface_t *surface;
+
+  if (source->type != CAIRO_PATTERN_TYPE_SURFACE)
+    return CAIRO_STATUS_SUCCESS;
+
+  surface = ((const cairo_surface_pattern_t *) source)->surface;
+  if (surface->backend != gsurface->base.backend ||
+      surface == &gsurface->base)
+    return CAIRO_STATUS_SUCCESS;
+
+  return _cairo_gral_surface_flush_fills ((cairo_gral_surface_t *) surface);
+}
+
+static cairo_status_t
+_cairo_gral_surface_flush (void *asurface)
+{
+  return _cairo_gral_surface_flush_fills (asurface);
+}
+
 static cairo_int_status_t
 _cairo_gral_surface_intersect_clip_path	(void                *asurface,
                                          cairo_path_fixed_t  *path,
@@ -54,18 +211,28 @@ _cairo_gral_surface_intersect_clip_path	(void                *asurface,
                                          cairo_antialias_t    antialias)
 {
   cairo_gral_surface_t *gsurface = asurface;
+  cairo_rectangle_int_t path_extents;
   float width, height;
   cairo_int_status_t status;
 
+  status = _cairo_gral_surface_flush_fills (gsurface);
+  if (unlikely (status))
+    return status;
+
   if (path == NULL) {
     gsurface->has_clip = FALSE;
     return CAIRO_STATUS_SUCCESS;
   }
 
+  _cairo_path_fixed_approximate_extents (path, &path_extents);
+
   if (!gsurface->has_clip) {
     gsurface->has_clip = TRUE;
+    gsurface->clip_extents = path_extents;
     gral_clear_frame_buffer (GRAL_FRAME_BUFFER_TYPE_DEPTH | GRAL_FRAME_BUFFER_TYPE_STENCIL,
                              GRAL_COLOR_BLACK, 1.0f/*depth*/, 0/*stencil*/);
+  } else {
+    _cairo_rectangle_intersect (&gsurface->clip_extents, &path_extents);
   }
 
   _cairo_gral_init_render_state (gsurface);
@@ -73,7 +240,8 @@ _cairo_gral_surface_intersect_clip_path	(void                *asurface,
   gral_set_depth_buffer_write_enabled (FALSE);
 
   /* Tesselate into stencil */
-  status = _cairo_gral_prepare_fill_stencil_mask (gsurface, path, fill_rule, tolerance, NULL);
+  status = _cairo_gral_prepare_fill_stencil_mask (gsurface, path, &path_extents,
+                                                  fill_rule, tolerance, NULL);
   if (status)
     return status;
 
@@ -111,6 +279,208 @@ _cairo_gral_surface_get_extents	(void                  *asurface,
   return CAIRO_STATUS_SUCCESS;
 }
 
+/* Reads a rectangle of the surface into a new image, waiting for the GPU. */
+static cairo_status_t
+_cairo_gral_surface_read_image (cairo_gral_surface_t         *gsurface,
+                                const cairo_rectangle_int_t  *rect,
+                                cairo_image_surface_t       **image_out)
+{
+  cairo_image_surface_t *image;
+  cairo_status_t status;
+
+  status = _cairo_gral_surface_flush_fills (gsurface);
+  if (unlikely (status))
+    return status;
+
+  image = (cairo_image_surface_t *)
+    cairo_image_surface_create (CAIRO_FORMAT_ARGB32, rect->width, rect->height);
+  if (unlikely (image->base.status))
+    return image->base.status;
+
+  if (rect->width && rect->height) {
+    gral_read_pixels (gsurface->gral_surf, rect->x, rect->y,
+                      rect->width, rect->height, image->data, image->stride);
+  }
+
+  *image_out = image;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+static cairo_status_t
+_cairo_gral_surface_acquire_source_image (void                   *asurface,
+                                          cairo_image_surface_t **image_out,
+                                          void                  **image_extra)
+{
+  cairo_gral_surface_t *gsurface = asurface;
+  cairo_rectangle_int_t extents;
+
+  _cairo_gral_surface_get_extents (gsurface, &extents);
+  *image_extra = NULL;
+  return _cairo_gral_surface_read_image (gsurface, &extents, image_out);
+}
+
+static void
+_cairo_gral_surface_release_source_image (void                  *asurface,
+                                          cairo_image_surface_t *image,
+                                          void                  *image_extra)
+{
+  cairo_surface_destroy (&image->base);
+}
+
+static cairo_status_t
+_cairo_gral_surface_acquire_dest_image (void                   *asurface,
+                                        cairo_rectangle_int_t  *interest_rect,
+                                        cairo_image_surface_t **image_out,
+                                        cairo_rectangle_int_t  *image_rect,
+                                        void                  **image_extra)
+{
+  cairo_gral_surface_t *gsurface = asurface;
+
+  _cairo_gral_surface_get_extents (gsurface, image_rect);
+  if (! _cairo_rectangle_intersect (image_rect, interest_rect))
+    image_rect->width = image_rect->height = 0;
+
+  *image_extra = NULL;
+  return _cairo_gral_surface_read_image (gsurface, image_rect, image_out);
+}
+
+/* Writes the image that the fallback drew into back to the surface. */
+static void
+_cairo_gral_surface_release_dest_image (void                  *asurface,
+                                        cairo_rectangle_int_t *interest_rect,
+                                        cairo_image_surface_t *image,
+                                        cairo_rectangle_int_t *image_rect,
+                                        void                  *image_extra)
+{
+  cairo_gral_surface_t *gsurface = asurface;
+  gral_texture_t *tex;
+  gral_matrix_t mat;
+
+  if (image_rect->width == 0 || image_rect->height == 0)
+    goto BAIL;
+
+  tex = gral_texture_create (GRAL_TEX_TYPE_2D, image_rect->width, image_rect->height, 1,
+                             0, /*num_mips*/
+                             GRAL_PIXEL_FORMAT_BYTE_BGRA,
+                             GRAL_TEXTURE_USAGE_STATIC_WRITE_ONLY,
+                             FALSE, /*hw_gamma_correction*/
+                             0 /*fsaa*/);
+  if (unlikely (tex == NULL)) {
+    _cairo_error_throw (CAIRO_STATUS_NO_MEMORY);
+    goto BAIL;
+  }
+  gral_texture_write (tex, image->data, image->stride);
+
+  /* Map the device pixels of the rectangle to the whole texture. */
+  gral_matrix_init_scale (&mat, 1.0f / image_rect->width, 1.0f / image_rect->height, 1);
+  gral_matrix_set_translate (&mat,
+                             (float) -image_rect->x / image_rect->width,
+                             (float) -image_rect->y / image_rect->height, 0);
+
+  _cairo_gral_init_render_state (gsurface);
+  _cairo_gral_set_texture_source (tex, &mat, CAIRO_EXTEND_PAD, CAIRO_FILTER_NEAREST);
+  gral_set_scene_blending (GRAL_SCENE_BLEND_FACTOR_SBF_ONE,
+                           GRAL_SCENE_BLEND_FACTOR_ZERO);
+  _cairo_gral_render_quad (gsurface, (float) image_rect->x, (float) image_rect->y,
+                           (float) (image_rect->x + image_rect->width),
+                           (float) (image_rect->y + image_rect->height));
+  gral_disable_texture_units_from (0);
+
+  gral_texture_destroy (tex);
+
+BAIL:
+  cairo_surface_destroy (&image->base);
+}
+
+static cairo_surface_t *
+_cairo_gral_surface_snapshot (void *asurface)
+{
+  cairo_gral_surface_t *gsurface = asurface;
+  cairo_image_surface_t *image;
+  cairo_rectangle_int_t extents;
+  cairo_status_t status;
+
+  _cairo_gral_surface_get_extents (gsurface, &extents);
+  status = _cairo_gral_surface_read_image (gsurface, &extents, &image);
+  if (unlikely (status))
+    return _cairo_surface_create_in_error (status);
+
+  return &image->base;
+}
+
+#define CAIRO_GRAL_RECT_INSTANCES 64
+
+static cairo_int_status_t
+_cairo_gral_surface_fill_rectangles (void                  *asurface,
+                                     cairo_operator_t       op,
+                                     const cairo_color_t   *color,
+                                     cairo_rectangle_int_t *rects,
+                                     int                    num_rects)
+{
+  cairo_gral_surface_t *gsurface = asurface;
+  cairo_gral_cached_mesh_t *quad;
+  cairo_solid_pattern_t pattern;
+  gral_instance_data_t instances[CAIRO_GRAL_RECT_INSTANCES];
+  size_t num_instances = 0;
+  cairo_int_status_t status;
+  int i;
+
+  if (op == CAIRO_OPERATOR_DEST)
+    return CAIRO_STATUS_SUCCESS;
+
+  /* Any other operator would be drawn as SOURCE by the blending below. */
+  if (op != CAIRO_OPERATOR_OVER &&
+      op != CAIRO_OPERATOR_SOURCE &&
+      op != CAIRO_OPERATOR_CLEAR)
+    return _cairo_gral_surface_fallback (gsurface);
+
+  status = _cairo_gral_surface_flush_fills (gsurface);
+  if (unlikely (status))
+    return status;
+
+  quad = _cairo_gral_gpu_resources_get_unit_quad (gsurface->gpu);
+  if (unlikely (quad == NULL))
+    return _cairo_error (CAIRO_STATUS_NO_MEMORY);
+
+  _cairo_gral_init_render_state (gsurface);
+
+  if (op == CAIRO_OPERATOR_CLEAR)
+    color = CAIRO_COLOR_TRANSPARENT;
+  _cairo_pattern_init_solid (&pattern, color, CAIRO_CONTENT_COLOR_ALPHA);
+  status = _cairo_gral_set_source (gsurface, &pattern.base);
+  _cairo_pattern_fini (&pattern.base);
+  if (status)
+    return status;
+
+  /* SOURCE and CLEAR replace the colour, premultiplied as OVER does. */
+  if (op != CAIRO_OPERATOR_OVER)
+    gral_set_separate_scene_blending (GRAL_SCENE_BLEND_FACTOR_SOURCE_ALPHA,
+                                      GRAL_SCENE_BLEND_FACTOR_ZERO,
+                                      GRAL_SCENE_BLEND_FACTOR_SBF_ONE,
+                                      GRAL_SCENE_BLEND_FACTOR_ZERO);
+
+  /* All the rectangles are instances of the same unit quad. */
+  for (i = 0; i < num_rects; ++i) {
+    gral_instance_data_t *inst = &instances[num_instances++];
+
+    gral_matrix_init_scale (&inst->transform,
+                            (float) rects[i].width, (float) rects[i].height, 1);
+    gral_matrix_set_translate (&inst->transform,
+                               (float) rects[i].x, (float) rects[i].y, 0);
+
+    if (num_instances == ARRAY_LENGTH (instances)) {
+      _cairo_gral_cached_mesh_render_instanced (quad, instances, num_instances,
+                                                GRAL_INSTANCE_DATA_TRANSFORM);
+      num_instances = 0;
+    }
+  }
+
+  _cairo_gral_cached_mesh_render_instanced (quad, instances, num_instances,
+                                            GRAL_INSTANCE_DATA_TRANSFORM);
+
+  return CAIRO_STATUS_SUCCESS;
+}
+
 static cairo_int_status_t
 _cairo_gral_surface_paint (void                   *asurface,
                            cairo_operator_t        op,
@@ -118,18 +488,43 @@ _cairo_gral_surface_paint (void                   *asurface,
                            cairo_rectangle_int_t  *extents)
 {
   cairo_gral_surface_t *gsurface = asurface;
+  cairo_solid_pattern_t clear;
   float width, height;
   cairo_int_status_t status;
 
   if (op == CAIRO_OPERATOR_DEST)
     return CAIRO_STATUS_SUCCESS;
 
+  status = _cairo_gral_surface_flush_fills (gsurface);
+  if (status == CAIRO_STATUS_SUCCESS)
+    status = _cairo_gral_surface_flush_source_fills (gsurface, source);
+  if (unlikely (status))
+    return status;
+
   _cairo_gral_init_render_state(gsurface);
 
-  status = _cairo_gral_set_source(gsurface, source);
+  if (op == CAIRO_OPERATOR_CLEAR) {
+    _cairo_pattern_init_solid (&clear, CAIRO_COLOR_TRANSPARENT, CAIRO_CONTENT_COLOR_ALPHA);
+    status = _cairo_gral_set_source(gsurface, &clear.base);
+    _cairo_pattern_fini (&clear.base);
+  } else {
+    status = _cairo_gral_set_source(gsurface, source);
+  }
   if (status)
     return status;
 
+  /* Within the clip, SOURCE and CLEAR replace what was drawn before. Only
+   * surface sources are premultiplied already; solid and gradient colour
+   * is premultiplied by the blending, like OVER does. */
+  if (op == CAIRO_OPERATOR_SOURCE && source->type == CAIRO_PATTERN_TYPE_SURFACE)
+    gral_set_scene_blending (GRAL_SCENE_BLEND_FACTOR_SBF_ONE,
+                             GRAL_SCENE_BLEND_FACTOR_ZERO);
+  else if (op == CAIRO_OPERATOR_SOURCE || op == CAIRO_OPERATOR_CLEAR)
+    gral_set_separate_scene_blending (GRAL_SCENE_BLEND_FACTOR_SOURCE_ALPHA,
+                                      GRAL_SCENE_BLEND_FACTOR_ZERO,
+                                      GRAL_SCENE_BLEND_FACTOR_SBF_ONE,
+                                      GRAL_SCENE_BLEND_FACTOR_ZERO);
+
   width = (float) gral_surface_get_width (gsurface->gral_surf);
   height = (float) gral_surface_get_height (gsurface->gral_surf);
   _cairo_gral_render_quad(gsurface, 0, 0, width, height);
@@ -151,16 +546,41 @@ _cairo_gral_surface_stroke (void                  *asurface,
 {
     cairo_gral_surface_t *gsurface = asurface;
     cairo_gral_bound_box_t box;
+    cairo_rectangle_int_t path_extents;
     cairo_int_status_t status;
 
     if (op == CAIRO_OPERATOR_DEST)
         return CAIRO_STATUS_SUCCESS;
 
+    _cairo_path_fixed_approximate_stroke_extents (path, style, ctm, &path_extents);
+    if (! _cairo_gral_surface_extents_visible (gsurface, &path_extents))
+        return CAIRO_STATUS_SUCCESS;
+
+    status = _cairo_gral_surface_flush_fills (gsurface);
+    if (status == CAIRO_STATUS_SUCCESS)
+        status = _cairo_gral_surface_flush_source_fills (gsurface, source);
+    if (unlikely (status))
+        return status;
+
     _cairo_gral_init_render_state(gsurface);
 
+    if (source->type == CAIRO_PATTERN_TYPE_SOLID) {
+      status = _cairo_gral_stroke_single_pass (gsurface,
+                                               path,
+                                               &path_extents,
+                                               (const cairo_solid_pattern_t *) source,
+                                               style,
+                                               ctm,
+                                               ctm_inverse,
+                                               tolerance);
+      if (status != CAIRO_INT_STATUS_UNSUPPORTED)
+        return status;
+    }
+
     /* Tesselate into stencil */
     status = _cairo_gral_prepare_stroke_stencil_mask (gsurface,
                                                       path,
+                                                      &path_extents,
                                                       style,
                                                       ctm,
                                                       ctm_inverse,
@@ -200,18 +620,41 @@ _cairo_gral_surface_fill (void                  *asurface,
 {
   cairo_gral_surface_t *gsurface = asurface;
   cairo_gral_bound_box_t box;
+  cairo_rectangle_int_t path_extents;
   cairo_int_status_t status;
 
   if (op == CAIRO_OPERATOR_DEST)
     return CAIRO_STATUS_SUCCESS;
 
-  _cairo_gral_init_render_state(gsurface);
+  _cairo_path_fixed_approximate_extents (path, &path_extents);
+  if (! _cairo_gral_surface_extents_visible (gsurface, &path_extents))
+    return CAIRO_STATUS_SUCCESS;
+
+  if (! _cairo_gral_fill_batch_accepts (&gsurface->fill_batch, op, source, &path_extents)) {
+    status = _cairo_gral_surface_flush_fills (gsurface);
+    if (status == CAIRO_STATUS_SUCCESS)
+      status = _cairo_gral_surface_flush_source_fills (gsurface, source);
+    if (unlikely (status))
+      return status;
+  }
+
+  /* The render state is still the one of the first fill of the batch,
+   * unless another surface was drawn since. */
+  if (gsurface->fill_batch.num_paths == 0 || gsurface->gpu->bound_surface != gsurface)
+    _cairo_gral_init_render_state(gsurface);
 
   /* Tesselate into stencil */
-  status = _cairo_gral_prepare_fill_stencil_mask(gsurface, path, fill_rule, tolerance, &box);
+  status = _cairo_gral_prepare_fill_stencil_mask(gsurface, path, &path_extents,
+                                                 fill_rule, tolerance, &box);
   if (status)
     return status;
 
+  /* Solid fills are covered later, together with the fills that follow. */
+  if (source->type == CAIRO_PATTERN_TYPE_SOLID) {
+    _cairo_gral_fill_batch_add (&gsurface->fill_batch, op, source, &path_extents, &box);
+    return CAIRO_STATUS_SUCCESS;
+  }
+
   /* Draw paint where stencil not zero */
   gral_set_stencil_buffer_params (GRAL_COMPARE_FUNC_NOT_EQUAL,
                                   0, 0xffffffff,
@@ -236,13 +679,13 @@ _cairo_gral_surface_backend = {
     CAIRO_SURFACE_TYPE_GRAL,
     NULL, /* create_similar */
     _cairo_gral_surface_finish,
-    NULL, /* acquire_source_image */
-    NULL, /* release_source_image */
-    NULL, /* acquire_dest_image */
-    NULL, /* release_dest_image */
+    _cairo_gral_surface_acquire_source_image,
+    _cairo_gral_surface_release_source_image,
+    _cairo_gral_surface_acquire_dest_image,
+    _cairo_gral_surface_release_dest_image,
     NULL, /* clone_similar */
     NULL, /* composite */
-    NULL, /* fill_rectangles */
+    _cairo_gral_surface_fill_rectangles,
     NULL, /* composite_trapezoids */
     NULL, /* create_span_renderer */
     NULL, /* check_span_renderer */
@@ -253,18 +696,18 @@ _cairo_gral_surface_backend = {
     _cairo_gral_surface_get_extents,
     NULL, /* old_show_glyphs */
     NULL, /* get_font_options */
-    NULL, /* flush */
+    _cairo_gral_surface_flush,
     NULL, /* mark_dirty_rectangle */
     NULL, /* scaled_font_fini */
-    NULL, /* scaled_glyph_fini */
+    _cairo_gral_surface_scaled_glyph_fini,
 
     _cairo_gral_surface_paint,
     NULL, /* mask */
     _cairo_gral_surface_stroke,
     _cairo_gral_surface_fill,
-    NULL, /* show_glyphs */
+    _cairo_gral_surface_show_glyphs,
 
-    NULL, /* snapshot */
+    _cairo_gral_surface_snapshot,
     NULL, /* is_similar */
     NULL, /* reset */
 };
@@ -281,6 +724,36 @@ cairo_gral_surface_create (gral_surface_t *gral_surf)
   s->gral_surf = gral_surf;
   s->gpu = _cairo_gral_gpu_resources_acquire ();
 
+  /* Four bytes per pixel for the colour buffer. */
+  _cairo_gral_memory_add (s->gpu, &s->render_target, CAIRO_GRAL_RESOURCE_RENDER_TARGETS,
+                          (size_t) gral_surface_get_width (gral_surf) *
+                          gral_surface_get_height (gral_surf) * 4,
+                          NULL);
+
+  return (cairo_surface_t *) s;
+}
+
+/**
+ * cairo_gral_surface_create_for_texture:
+ * @tex: a render target texture
+ *
+ * Creates a surface that draws directly into @tex, which can also be used
+ * in a surface pattern without being copied. @tex is not owned by the
+ * surface and has to outlive it.
+ **/
+cairo_surface_t *
+cairo_gral_surface_create_for_texture (gral_texture_t *tex)
+{
+  cairo_gral_surface_t *s;
+  gral_surface_t *gral_surf;
+
+  gral_surf = gral_texture_get_surface (tex);
+  if (unlikely (gral_surf == NULL))
+    return _cairo_surface_create_in_error (_cairo_error (CAIRO_STATUS_SURFACE_TYPE_MISMATCH));
+
+  s = (cairo_gral_surface_t *) cairo_gral_surface_create (gral_surf);
+  s->gral_tex = tex;
+
   return (cairo_surface_t *) s;
 }
 
@@ -315,3 +788,129 @@ cairo_gral_surface_get_height (cairo_surface_t *surface)
 
   return gral_surface_get_height (gral_surface->gral_surf);
 }
+
+void
+cairo_gral_surface_get_stats (cairo_surface_t    *surface,
+                              cairo_gral_stats_t *stats)
+{
+  cairo_gral_surface_t *gral_surface = (cairo_gral_surface_t *) surface;
+
+  if (! _cairo_surface_is_gral (surface)) {
+    _cairo_error_throw (CAIRO_STATUS_SURFACE_TYPE_MISMATCH);
+    return;
+  }
+
+  gral_get_stats (&stats->gral);
+  stats->fallbacks = gral_surface->fallbacks;
+}
+
+struct _cairo_gral_readback {
+  gral_readback_t *gral_rb;
+  int              width, height;
+};
+
+/**
+ * cairo_gral_surface_begin_readback:
+ * @surface: a gral surface
+ *
+ * Starts copying the content of @surface. The copy is queued on the GPU and
+ * doesn't wait for the drawing in flight; get it with
+ * cairo_gral_readback_finish(). There are no fences:
+ * cairo_gral_readback_is_ready() only estimates from the frames rendered
+ * since when finishing won't stall.
+ **/
+cairo_gral_readback_t *
+cairo_gral_surface_begin_readback (cairo_surface_t *surface)
+{
+  cairo_gral_surface_t *gsurface = (cairo_gral_surface_t *) surface;
+  cairo_gral_readback_t *readback;
+  cairo_status_t status;
+
+  if (! _cairo_surface_is_gral (surface)) {
+    _cairo_error_throw (CAIRO_STATUS_SURFACE_TYPE_MISMATCH);
+    return NULL;
+  }
+
+  status = _cairo_gral_surface_flush_fills (gsurface);
+  if (unlikely (status)) {
+    _cairo_surface_set_error (surface, status);
+    return NULL;
+  }
+
+  readback = malloc (sizeof (cairo_gral_readback_t));
+  if (unlikely (readback == NULL)) {
+    _cairo_error_throw (CAIRO_STATUS_NO_MEMORY);
+    return NULL;
+  }
+
+  readback->width = gral_surface_get_width (gsurface->gral_surf);
+  readback->height = gral_surface_get_height (gsurface->gral_surf);
+  readback->gral_rb = NULL;
+  if (readback->width && readback->height) {
+    readback->gral_rb = gral_readback_begin (gsurface->gral_surf, 0, 0,
+                                             readback->width, readback->height);
+  }
+
+  return readback;
+}
+
+cairo_bool_t
+cairo_gral_readback_is_ready (cairo_gral_readback_t *readback)
+{
+  return readback->gral_rb == NULL || gral_readback_is_ready (readback->gral_rb);
+}
+
+/**
+ * cairo_gral_readback_finish:
+ * @readback: a readback from cairo_gral_surface_begin_readback()
+ *
+ * Destroys @readback and returns its content as a new image surface. The
+ * content is downloaded synchronously, which stalls if the GPU hasn't made
+ * the copy yet. If the download fails the surface is in an error state.
+ **/
+cairo_surface_t *
+cairo_gral_readback_finish (cairo_gral_readback_t *readback)
+{
+  cairo_surface_t *image;
+  const unsigned char *src;
+  unsigned char *dst;
+  size_t src_stride;
+  int dst_stride, row;
+
+  image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                      readback->width, readback->height);
+  if (readback->gral_rb == NULL || unlikely (image->status))
+    goto BAIL;
+
+  src = gral_readback_map (readback->gral_rb, &src_stride);
+  if (unlikely (src == NULL)) {
+    cairo_surface_destroy (image);
+    image = _cairo_surface_create_in_error (_cairo_error (CAIRO_STATUS_NO_MEMORY));
+    goto BAIL;
+  }
+  dst = cairo_image_surface_get_data (image);
+  dst_stride = cairo_image_surface_get_stride (image);
+  for (row = 0; row < readback->height; row++)
+    memcpy (dst + row * dst_stride, src + row * src_stride, readback->width * 4);
+  cairo_surface_mark_dirty (image);
+
+BAIL:
+  if (readback->gral_rb)
+    gral_readback_destroy (readback->gral_rb);
+  free (readback);
+  return image;
+}
+
+/* Only resets the surface counters; use gral_reset_stats for the gral ones. */
+void
+cairo_gral_surface_reset_stats (cairo_surface_t *surface)
+{
+  cairo_gral_surface_t *gral_surface = (cairo_gral_surface_t *) surface;
+
+  if (! _cairo_surface_is_gral (surface)) {
+    _cairo_error_throw (CAIRO_STATUS_SURFACE_TYPE_MISMATCH);
+    return;
+  }
+
+  gral_surface->fallbacks = 0;
+}
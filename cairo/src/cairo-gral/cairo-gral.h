@@ -42,15 +42,100 @@
 
 CAIRO_BEGIN_DECLS
 
+/* The type cairo_surface_get_type() returns for gral surfaces; gral isn't
+ * part of cairo_surface_type_t. */
+#define CAIRO_SURFACE_TYPE_GRAL ((cairo_surface_type_t) 200)
+
 cairo_public cairo_surface_t *
 cairo_gral_surface_create (gral_surface_t *gral_surf);
 
+cairo_public cairo_surface_t *
+cairo_gral_surface_create_for_texture (gral_texture_t *tex);
+
 cairo_public int
 cairo_gral_surface_get_width (cairo_surface_t *surface);
 
 cairo_public int
 cairo_gral_surface_get_height (cairo_surface_t *surface);
 
+typedef struct _cairo_gral_readback cairo_gral_readback_t;
+
+cairo_public cairo_gral_readback_t *
+cairo_gral_surface_begin_readback (cairo_surface_t *surface);
+
+cairo_public cairo_bool_t
+cairo_gral_readback_is_ready (cairo_gral_readback_t *readback);
+
+cairo_public cairo_surface_t *
+cairo_gral_readback_finish (cairo_gral_readback_t *readback);
+
+typedef struct _cairo_gral_stats {
+  gral_stats_t  gral;       /* gral counters, shared by all the surfaces */
+  unsigned long fallbacks;  /* operations the surface left to the image backend */
+} cairo_gral_stats_t;
+
+cairo_public void
+cairo_gral_surface_get_stats (cairo_surface_t    *surface,
+                              cairo_gral_stats_t *stats);
+
+cairo_public void
+cairo_gral_surface_reset_stats (cairo_surface_t *surface);
+
+cairo_public void
+cairo_gral_set_max_batch_size (unsigned int max_triangles);
+
+cairo_public unsigned int
+cairo_gral_get_max_batch_size (void);
+
+typedef struct _cairo_gral_memory_stats {
+  size_t        buffers;         /* dynamic vertex and index buffers */
+  size_t        textures;        /* image source and dash textures */
+  size_t        ramps;           /* gradient ramp textures */
+  size_t        meshes;          /* cached meshes of glyphs and display lists */
+  size_t        render_targets;  /* the surfaces, never evicted */
+  size_t        total;
+  size_t        evictable;       /* textures, ramps and meshes, held to the budget */
+  size_t        budget;          /* limit on evictable, 0 if there is none */
+  unsigned long evictions;
+} cairo_gral_memory_stats_t;
+
+cairo_public void
+cairo_gral_set_memory_budget (size_t bytes);
+
+cairo_public size_t
+cairo_gral_get_memory_budget (void);
+
+cairo_public void
+cairo_gral_get_memory_stats (cairo_gral_memory_stats_t *stats);
+
+typedef struct _cairo_gral_display_list cairo_gral_display_list_t;
+
+cairo_public cairo_gral_display_list_t *
+cairo_gral_display_list_create (void);
+
+cairo_public void
+cairo_gral_display_list_destroy (cairo_gral_display_list_t *list);
+
+cairo_public cairo_t *
+cairo_gral_display_list_begin_recording (cairo_gral_display_list_t *list);
+
+cairo_public cairo_status_t
+cairo_gral_display_list_end_recording (cairo_gral_display_list_t *list,
+                                       cairo_t                   *cr);
+
+cairo_public cairo_status_t
+cairo_gral_display_list_replay (cairo_gral_display_list_t *list,
+                                cairo_t                   *cr);
+
+cairo_public unsigned int
+cairo_gral_display_list_get_num_commands (cairo_gral_display_list_t *list);
+
+cairo_public cairo_status_t
+cairo_gral_display_list_replay_range (cairo_gral_display_list_t *list,
+                                      cairo_t                   *cr,
+                                      unsigned int               first,
+                                      unsigned int               count);
+
 CAIRO_END_DECLS
 
 #endif /* _CAIRO_GRAL_H_ */
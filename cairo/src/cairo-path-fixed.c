@@ -705,6 +705,57 @@ _cairo_path_fixed_interpret (const cairo_path_fixed_t		*path,
     return CAIRO_STATUS_SUCCESS;
 }
 
+/* Interprets the path forward like _cairo_path_fixed_interpret(), but a
+ * sequence of line_to operations is passed to @line_to_run at once, as the
+ * points it takes in the path buffer. A sequence that spans buffers is split
+ * into one run per buffer. */
+cairo_status_t
+_cairo_path_fixed_interpret_runs (const cairo_path_fixed_t		*path,
+				  cairo_path_fixed_move_to_func_t	*move_to,
+				  cairo_path_fixed_line_to_run_func_t	*line_to_run,
+				  cairo_path_fixed_curve_to_func_t	*curve_to,
+				  cairo_path_fixed_close_path_func_t	*close_path,
+				  void					*closure)
+{
+    cairo_status_t status;
+    const cairo_path_buf_t *buf;
+
+    for (buf = &path->buf_head.base; buf; buf = buf->next) {
+	const cairo_point_t *points = buf->points;
+	unsigned int i, n;
+
+	for (i = 0; i < buf->num_ops; i++) {
+	    switch (buf->op[i]) {
+	    case CAIRO_PATH_OP_MOVE_TO:
+		status = (*move_to) (closure, &points[0]);
+		points += 1;
+		break;
+	    case CAIRO_PATH_OP_LINE_TO:
+		for (n = 1;
+		     i + n < buf->num_ops && buf->op[i + n] == CAIRO_PATH_OP_LINE_TO;
+		     n++)
+		    ;
+		status = (*line_to_run) (closure, &points[0], n);
+		points += n;
+		i += n - 1;
+		break;
+	    case CAIRO_PATH_OP_CURVE_TO:
+		status = (*curve_to) (closure, &points[0], &points[1], &points[2]);
+		points += 3;
+		break;
+	    case CAIRO_PATH_OP_CLOSE_PATH:
+	    default:
+		status = (*close_path) (closure);
+		break;
+	    }
+	    if (unlikely (status))
+		return status;
+	}
+    }
+
+    return CAIRO_STATUS_SUCCESS;
+}
+
 static cairo_status_t
 _append_move_to (void		 *closure,
 		 const cairo_point_t  *point)
@@ -93,6 +93,11 @@ struct _cairo_surface {
     /* A "snapshot" surface is immutable. See _cairo_surface_snapshot. */
     cairo_bool_t is_snapshot;
 
+    /* Identifies the content of the surface. Every drawing operation and
+     * cairo_surface_mark_dirty() assign a new one, so backends can tell
+     * whether a copy they keep of a source surface is up to date. */
+    unsigned int unique_id;
+
     /*
      * Surface font options, falling back to backend's default options,
      * and set using _cairo_surface_set_font_options(), and propagated by
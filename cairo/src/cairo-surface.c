@@ -61,6 +61,7 @@ const cairo_surface_t name = {					\
     0,					/* next_clip_serial */	\
     0,					/* current_clip_serial */	\
     FALSE,				/* is_snapshot */	\
+    0,					/* unique_id */		\
     FALSE,				/* has_font_options */	\
     { CAIRO_ANTIALIAS_DEFAULT,		/* antialias */		\
       CAIRO_SUBPIXEL_ORDER_DEFAULT,	/* subpixel_order */	\
@@ -178,6 +179,32 @@ cairo_surface_status (cairo_surface_t *surface)
 }
 slim_hidden_def (cairo_surface_status);
 
+static unsigned int
+_cairo_surface_allocate_unique_id (void)
+{
+    static cairo_atomic_int_t unique_id;
+    cairo_atomic_int_t old, id;
+
+    do {
+	old = _cairo_atomic_int_get (&unique_id);
+	id = old + 1;
+	if (id == 0) /* 0 is never an id */
+	    id = 1;
+    } while (_cairo_atomic_int_cmpxchg (&unique_id, old, id) != old);
+
+    return id;
+}
+
+/* Called before the content of the surface changes, which gives it a new
+ * unique_id: whatever was derived from the old content is stale. */
+static void
+_cairo_surface_begin_modification (cairo_surface_t *surface)
+{
+    assert (! surface->is_snapshot);
+
+    surface->unique_id = _cairo_surface_allocate_unique_id ();
+}
+
 void
 _cairo_surface_init (cairo_surface_t			*surface,
 		     const cairo_surface_backend_t	*backend,
@@ -209,6 +236,7 @@ _cairo_surface_init (cairo_surface_t			*surface,
     surface->current_clip_serial = 0;
 
     surface->is_snapshot = FALSE;
+    surface->unique_id = _cairo_surface_allocate_unique_id ();
 
     surface->has_font_options = FALSE;
 }
@@ -899,7 +927,7 @@ cairo_surface_mark_dirty_rectangle (cairo_surface_t *surface,
     if (surface->status)
 	return;
 
-    assert (! surface->is_snapshot);
+    _cairo_surface_begin_modification (surface);
 
     if (surface->finished) {
 	status = _cairo_surface_set_error (surface, CAIRO_STATUS_SURFACE_FINISHED);
@@ -1462,7 +1490,7 @@ _cairo_surface_composite (cairo_operator_t	op,
     if (dst->status)
 	return dst->status;
 
-    assert (! dst->is_snapshot);
+    _cairo_surface_begin_modification (dst);
 
     if (dst->finished)
 	return _cairo_surface_set_error (dst, CAIRO_STATUS_SURFACE_FINISHED);
@@ -1631,7 +1659,7 @@ _cairo_surface_fill_rectangles (cairo_surface_t		*surface,
     if (surface->status)
 	return surface->status;
 
-    assert (! surface->is_snapshot);
+    _cairo_surface_begin_modification (surface);
 
     if (surface->finished)
 	return _cairo_surface_set_error (surface,CAIRO_STATUS_SURFACE_FINISHED);
@@ -1663,7 +1691,7 @@ _cairo_surface_paint (cairo_surface_t	*surface,
     if (surface->status)
 	return surface->status;
 
-    assert (! surface->is_snapshot);
+    _cairo_surface_begin_modification (surface);
 
     status = _cairo_surface_copy_pattern_for_destination (&source,
 							  surface,
@@ -1700,7 +1728,7 @@ _cairo_surface_mask (cairo_surface_t		*surface,
     if (surface->status)
 	return surface->status;
 
-    assert (! surface->is_snapshot);
+    _cairo_surface_begin_modification (surface);
 
     status = _cairo_surface_copy_pattern_for_destination (&source,
 							  surface,
@@ -1833,7 +1861,7 @@ _cairo_surface_stroke (cairo_surface_t		*surface,
     if (surface->status)
 	return surface->status;
 
-    assert (! surface->is_snapshot);
+    _cairo_surface_begin_modification (surface);
 
     status = _cairo_surface_copy_pattern_for_destination (&source,
 							  surface,
@@ -1882,7 +1910,7 @@ _cairo_surface_fill (cairo_surface_t	*surface,
     if (surface->status)
 	return surface->status;
 
-    assert (! surface->is_snapshot);
+    _cairo_surface_begin_modification (surface);
 
     status = _cairo_surface_copy_pattern_for_destination (&source,
 							  surface,
@@ -1934,7 +1962,7 @@ _cairo_surface_composite_trapezoids (cairo_operator_t		op,
     if (dst->status)
 	return dst->status;
 
-    assert (! dst->is_snapshot);
+    _cairo_surface_begin_modification (dst);
 
     if (dst->finished)
 	return _cairo_surface_set_error (dst, CAIRO_STATUS_SURFACE_FINISHED);
@@ -1967,7 +1995,7 @@ _cairo_surface_create_span_renderer (cairo_operator_t		op,
 				     cairo_antialias_t	        antialias,
 				     const cairo_composite_rectangles_t *rects)
 {
-    assert (! dst->is_snapshot);
+    _cairo_surface_begin_modification (dst);
 
     if (dst->status)
 	return _cairo_span_renderer_create_in_error (dst->status);
@@ -2510,7 +2538,7 @@ _cairo_surface_show_text_glyphs (cairo_surface_t	    *surface,
     if (surface->status)
 	return surface->status;
 
-    assert (! surface->is_snapshot);
+    _cairo_surface_begin_modification (surface);
 
     if (!num_glyphs && !utf8_len)
 	return CAIRO_STATUS_SUCCESS;
@@ -2641,7 +2669,7 @@ _cairo_surface_old_show_glyphs (cairo_scaled_font_t	*scaled_font,
     if (dst->status)
 	return dst->status;
 
-    assert (! dst->is_snapshot);
+    _cairo_surface_begin_modification (dst);
 
     if (dst->finished)
 	return _cairo_surface_set_error (dst, CAIRO_STATUS_SURFACE_FINISHED);
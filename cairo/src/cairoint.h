@@ -1516,6 +1516,11 @@ typedef cairo_status_t
 typedef cairo_status_t
 (cairo_path_fixed_close_path_func_t) (void *closure);
 
+typedef cairo_status_t
+(cairo_path_fixed_line_to_run_func_t) (void		   *closure,
+				       const cairo_point_t *points,
+				       unsigned int	    num_points);
+
 cairo_private cairo_status_t
 _cairo_path_fixed_interpret (const cairo_path_fixed_t	  *path,
 		       cairo_direction_t		   dir,
@@ -1525,6 +1530,14 @@ _cairo_path_fixed_interpret (const cairo_path_fixed_t	  *path,
 		       cairo_path_fixed_close_path_func_t *close_path,
 		       void				  *closure);
 
+cairo_private cairo_status_t
+_cairo_path_fixed_interpret_runs (const cairo_path_fixed_t	    *path,
+		       cairo_path_fixed_move_to_func_t	    *move_to,
+		       cairo_path_fixed_line_to_run_func_t  *line_to_run,
+		       cairo_path_fixed_curve_to_func_t	    *curve_to,
+		       cairo_path_fixed_close_path_func_t   *close_path,
+		       void				    *closure);
+
 cairo_private cairo_status_t
 _cairo_path_fixed_interpret_flat (const cairo_path_fixed_t *path,
 		       cairo_direction_t		   dir,
@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2009 Argiris Kirtzidis
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Author: Argiris Kirtzidis
+ */
+
+/* Fills a square whose sides are made of curves and lines, in a pattern of
+ * two curves and then a line. cairo-gral renders its triangles in batches;
+ * the batch size is lowered for this test so that the path crosses several
+ * batch boundaries, some of them at the end of a curve, right before a run
+ * of lines. The lines must keep fanning from the first vertex of the path
+ * after the batch was rendered.
+ *
+ * The control points of the curves lie on the sides, so every backend
+ * fills exactly the square. */
+
+#include "cairo-test.h"
+
+#if CAIRO_HAS_GRAL_SURFACE
+#include <cairo-gral.h>
+#endif
+
+#define SIZE 100
+#define MARGIN 10
+#define PIECES_PER_SIDE 24
+#define BATCH_TRIANGLES 16
+
+static void
+piece_to (cairo_t *cr, int piece, double x0, double y0, double x1, double y1)
+{
+    if (piece % 3 == 2) {
+	cairo_line_to (cr, x1, y1);
+    } else {
+	cairo_curve_to (cr,
+			x0 + (x1 - x0) / 3, y0 + (y1 - y0) / 3,
+			x0 + (x1 - x0) * 2 / 3, y0 + (y1 - y0) * 2 / 3,
+			x1, y1);
+    }
+}
+
+static cairo_test_status_t
+draw (cairo_t *cr, int width, int height)
+{
+    static const double corners[5][2] = {
+	{ MARGIN, MARGIN },
+	{ SIZE - MARGIN, MARGIN },
+	{ SIZE - MARGIN, SIZE - MARGIN },
+	{ MARGIN, SIZE - MARGIN },
+	{ MARGIN, MARGIN },
+    };
+#if CAIRO_HAS_GRAL_SURFACE
+    cairo_surface_t *target = cairo_get_target (cr);
+    unsigned int max_batch_size = cairo_gral_get_max_batch_size ();
+#endif
+    int side, i;
+
+    cairo_set_source_rgb (cr, 1, 1, 1);
+    cairo_paint (cr);
+
+#if CAIRO_HAS_GRAL_SURFACE
+    if (cairo_surface_get_type (target) == CAIRO_SURFACE_TYPE_GRAL)
+	cairo_gral_set_max_batch_size (BATCH_TRIANGLES);
+#endif
+
+    /* With the even-odd rule any triangle that isn't fanned from the first
+     * vertex leaves a hole. */
+    cairo_set_fill_rule (cr, CAIRO_FILL_RULE_EVEN_ODD);
+    cairo_move_to (cr, corners[0][0], corners[0][1]);
+    for (side = 0; side < 4; side++) {
+	double dx = (corners[side + 1][0] - corners[side][0]) / PIECES_PER_SIDE;
+	double dy = (corners[side + 1][1] - corners[side][1]) / PIECES_PER_SIDE;
+
+	for (i = 0; i < PIECES_PER_SIDE; i++) {
+	    piece_to (cr, side * PIECES_PER_SIDE + i,
+		      corners[side][0] + dx * i, corners[side][1] + dy * i,
+		      corners[side][0] + dx * (i + 1), corners[side][1] + dy * (i + 1));
+	}
+    }
+    cairo_close_path (cr);
+    cairo_set_source_rgb (cr, 0, 0, 0);
+    cairo_fill (cr);
+
+#if CAIRO_HAS_GRAL_SURFACE
+    if (cairo_surface_get_type (target) == CAIRO_SURFACE_TYPE_GRAL) {
+	cairo_surface_flush (target);
+	cairo_gral_set_max_batch_size (max_batch_size);
+    }
+#endif
+
+    return CAIRO_TEST_SUCCESS;
+}
+
+CAIRO_TEST (gral_fill_batch_curve,
+	    "Tests a fill whose triangles are split into batches right after a curve",
+	    "gral, fill, path", /* keywords */
+	    NULL, /* requirements */
+	    SIZE, SIZE,
+	    NULL, draw)
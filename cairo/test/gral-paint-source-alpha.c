@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2009 Argiris Kirtzidis
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Author: Argiris Kirtzidis
+ */
+
+/* Paints translucent colours with the SOURCE operator into a group, the
+ * right half under a clip, and composites the group over black. The group
+ * must hold premultiplied colour, half red on the left and half blue on the
+ * right; a SOURCE paint that stores the colour as it is shows full red and
+ * blue instead. */
+
+#include "cairo-test.h"
+
+#define WIDTH 20
+#define HEIGHT 10
+
+static cairo_test_status_t
+draw (cairo_t *cr, int width, int height)
+{
+    cairo_set_source_rgb (cr, 0, 0, 0);
+    cairo_paint (cr);
+
+    cairo_push_group_with_content (cr, CAIRO_CONTENT_COLOR_ALPHA);
+    cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+
+    cairo_set_source_rgba (cr, 1, 0, 0, .5);
+    cairo_paint (cr);
+
+    cairo_rectangle (cr, WIDTH / 2, 0, WIDTH / 2, HEIGHT);
+    cairo_clip (cr);
+    cairo_set_source_rgba (cr, 0, 0, 1, .5);
+    cairo_paint (cr);
+
+    cairo_pop_group_to_source (cr);
+    cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+    cairo_paint (cr);
+
+    return CAIRO_TEST_SUCCESS;
+}
+
+CAIRO_TEST (gral_paint_source_alpha,
+	    "Tests painting translucent colours with the SOURCE operator",
+	    "gral, paint, operator", /* keywords */
+	    NULL, /* requirements */
+	    WIDTH, HEIGHT,
+	    NULL, draw)
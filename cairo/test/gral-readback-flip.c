@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2009 Argiris Kirtzidis
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Author: Argiris Kirtzidis
+ */
+
+/* Reads back an "F", which has no symmetry, from a render texture: on the
+ * left with cairo_gral_surface_begin_readback(), on the right by painting
+ * the render texture into an image, which acquires its source image. Under
+ * OpenGL render textures are flipped, and a readback that misses it mirrors
+ * the F. Other targets draw into a similar surface instead. */
+
+#include "cairo-test.h"
+
+#if CAIRO_HAS_GRAL_SURFACE
+#include <cairo-gral.h>
+#endif
+
+#define SIZE 20
+
+static void
+draw_f (cairo_t *cr)
+{
+    cairo_set_source_rgb (cr, 1, 1, 1);
+    cairo_paint (cr);
+
+    cairo_set_source_rgb (cr, 0, 0, 0);
+    cairo_rectangle (cr, 2, 2, 4, 16);
+    cairo_rectangle (cr, 6, 2, 10, 4);
+    cairo_rectangle (cr, 6, 9, 6, 3);
+    cairo_fill (cr);
+}
+
+static cairo_test_status_t
+draw (cairo_t *cr, int width, int height)
+{
+    cairo_surface_t *source, *readback, *acquired;
+    cairo_t *cr2;
+#if CAIRO_HAS_GRAL_SURFACE
+    gral_texture_t *tex = NULL;
+
+    if (cairo_surface_get_type (cairo_get_target (cr)) == CAIRO_SURFACE_TYPE_GRAL) {
+	tex = gral_texture_create (GRAL_TEX_TYPE_2D, SIZE, SIZE, 1,
+				   0, /* num_mips */
+				   GRAL_PIXEL_FORMAT_BYTE_BGRA,
+				   GRAL_TEXTURE_USAGE_RENDERTARGET,
+				   FALSE, /* hw_gamma_correction */
+				   0 /* fsaa */);
+	if (tex == NULL)
+	    return CAIRO_TEST_NO_MEMORY;
+	source = cairo_gral_surface_create_for_texture (tex);
+    } else
+#endif
+    {
+	source = cairo_surface_create_similar (cairo_get_target (cr),
+					       CAIRO_CONTENT_COLOR_ALPHA,
+					       SIZE, SIZE);
+    }
+
+    cr2 = cairo_create (source);
+    draw_f (cr2);
+    cairo_destroy (cr2);
+
+#if CAIRO_HAS_GRAL_SURFACE
+    if (tex != NULL)
+	readback = cairo_gral_readback_finish (cairo_gral_surface_begin_readback (source));
+    else
+#endif
+	readback = cairo_surface_reference (source);
+
+    acquired = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, SIZE, SIZE);
+    cr2 = cairo_create (acquired);
+    cairo_set_source_surface (cr2, source, 0, 0);
+    cairo_paint (cr2);
+    cairo_destroy (cr2);
+
+    cairo_set_source_surface (cr, readback, 0, 0);
+    cairo_paint (cr);
+    cairo_set_source_surface (cr, acquired, SIZE, 0);
+    cairo_paint (cr);
+
+    cairo_surface_destroy (acquired);
+    cairo_surface_destroy (readback);
+    cairo_surface_destroy (source);
+#if CAIRO_HAS_GRAL_SURFACE
+    if (tex != NULL)
+	gral_texture_destroy (tex);
+#endif
+
+    return CAIRO_TEST_SUCCESS;
+}
+
+CAIRO_TEST (gral_readback_flip,
+	    "Tests reading back a render texture, which may be flipped",
+	    "gral", /* keywords */
+	    NULL, /* requirements */
+	    2 * SIZE, SIZE,
+	    NULL, draw)
@@ -0,0 +1,208 @@
+/*
+ * Copyright © 2009 Argiris Kirtzidis
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Author: Argiris Kirtzidis
+ */
+
+/* Checks the rasterizer of the software gral backend against the image
+ * backend. gral-soft samples pixel centres, like the image backend does
+ * without antialiasing, so the two must agree pixel for pixel as long as no
+ * pixel centre lies exactly on an edge. The shapes make sure of that: their
+ * vertices sit on odd quarter pixels and each edge moves an odd number of
+ * half pixels along one axis and an even number along the other.
+ *
+ * The shapes are drawn at every orientation and at sizes that cover
+ * several of the 64 pixel tiles of gral-soft, so that the rows of pixels
+ * start and end at every offset within the groups of pixels the rasterizer
+ * steps through at once. */
+
+#include "cairo-test.h"
+#include "buffer-diff.h"
+
+#if CAIRO_HAS_GRAL_SURFACE
+#include <cairo-gral.h>
+#include <gral-soft.h>
+#endif
+
+#define WIDTH 256
+#define HEIGHT 256
+#define CELL 32
+#define ARRAY_SIZE(a) (sizeof (a) / sizeof ((a)[0]))
+
+typedef struct _shape {
+    int num_points;
+    /* In half pixels */
+    int points[6][2];
+} shape_t;
+
+static const shape_t shapes[] = {
+    /* A convex quad */
+    { 4, { { 0, 0 }, { 21, 4 }, { 15, 21 }, { 2, 11 } } },
+    /* A sliver, narrower than a pixel */
+    { 4, { { 0, 0 }, { 1, 60 }, { -1, 61 }, { -2, 1 } } },
+    /* A concave chevron */
+    { 6, { { 0, 0 }, { 9, 2 }, { 7, 9 }, { 4, 5 }, { 0, 10 }, { 1, 6 } } },
+};
+
+/* Draws a shape mirrored if orientation is odd, then turned by orientation / 2
+ * quarter turns, with the top left corner of its bounds at x + 1/4, y + 1/4. */
+static void
+draw_shape (cairo_t *cr, const shape_t *shape, int orientation, int scale, int x, int y)
+{
+    int points[6][2];
+    int min_x = 0, min_y = 0;
+    int i, j;
+
+    for (i = 0; i < shape->num_points; i++) {
+	int px = shape->points[i][0] * scale;
+	int py = shape->points[i][1] * scale;
+
+	if (orientation & 1)
+	    px = -px;
+	for (j = 0; j < orientation / 2; j++) {
+	    int t = px;
+	    px = -py;
+	    py = t;
+	}
+	points[i][0] = px;
+	points[i][1] = py;
+	if (i == 0 || px < min_x)
+	    min_x = px;
+	if (i == 0 || py < min_y)
+	    min_y = py;
+    }
+
+    cairo_new_path (cr);
+    for (i = 0; i < shape->num_points; i++) {
+	cairo_line_to (cr,
+		       x + .25 + (points[i][0] - min_x) / 2.,
+		       y + .25 + (points[i][1] - min_y) / 2.);
+    }
+    cairo_close_path (cr);
+    cairo_fill (cr);
+}
+
+static void
+draw (cairo_t *cr)
+{
+    unsigned int i;
+    int orientation;
+
+    cairo_set_antialias (cr, CAIRO_ANTIALIAS_NONE);
+    cairo_set_source_rgb (cr, 1, 1, 1);
+    cairo_paint (cr);
+
+    /* Each shape at every orientation */
+    for (i = 0; i < ARRAY_SIZE (shapes); i++) {
+	for (orientation = 0; orientation < 8; orientation++) {
+	    /* Any colour but the white of the background */
+	    int colour = (orientation + i) % 7;
+	    cairo_set_source_rgb (cr, (colour >> 2) & 1, (colour >> 1) & 1, colour & 1);
+	    draw_shape (cr, &shapes[i], orientation, i == 1 ? 1 : 3,
+			orientation * CELL, i * CELL);
+	}
+    }
+
+    /* Shapes covering whole tiles */
+    cairo_set_source_rgb (cr, 0, 0, 1);
+    draw_shape (cr, &shapes[0], 3, 11, 0, 3 * CELL + 8);
+    cairo_set_source_rgb (cr, 1, 0, 0);
+    draw_shape (cr, &shapes[2], 6, 21, 4 * CELL, 3 * CELL + 16);
+}
+
+static cairo_test_status_t
+preamble (cairo_test_context_t *ctx)
+{
+#if CAIRO_HAS_GRAL_SURFACE
+    gral_surface_t *gral_surf;
+    cairo_surface_t *reference, *gral, *gral_image, *result, *diff;
+    buffer_diff_result_t diff_result;
+    cairo_test_status_t status = CAIRO_TEST_SUCCESS;
+    void *data;
+    int stride;
+    cairo_t *cr;
+
+    if (! cairo_test_is_target_enabled (ctx, "gral"))
+	return CAIRO_TEST_UNTESTED;
+
+    reference = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT);
+    cr = cairo_create (reference);
+    draw (cr);
+    cairo_destroy (cr);
+
+    gral_surf = gral_soft_surface_create (WIDTH, HEIGHT);
+    if (gral_surf == NULL) {
+	cairo_surface_destroy (reference);
+	return CAIRO_TEST_NO_MEMORY;
+    }
+    gral = cairo_gral_surface_create (gral_surf);
+    cr = cairo_create (gral);
+    draw (cr);
+    cairo_destroy (cr);
+    cairo_surface_flush (gral);
+
+    /* Copy the pixels of gral-soft so that both images have the same stride. */
+    data = gral_soft_surface_get_data (gral_surf, &stride);
+    gral_image = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_ARGB32,
+						      WIDTH, HEIGHT, stride);
+    result = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT);
+    cr = cairo_create (result);
+    cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface (cr, gral_image, 0, 0);
+    cairo_paint (cr);
+    cairo_destroy (cr);
+    cairo_surface_destroy (gral_image);
+
+    diff = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT);
+    buffer_diff_noalpha (cairo_image_surface_get_data (reference),
+			 cairo_image_surface_get_data (result),
+			 cairo_image_surface_get_data (diff),
+			 WIDTH, HEIGHT,
+			 cairo_image_surface_get_stride (reference),
+			 &diff_result);
+    if (diff_result.pixels_changed) {
+	cairo_test_log (ctx,
+			"Error: %u pixels of gral-soft differ from the image backend\n",
+			diff_result.pixels_changed);
+	cairo_surface_write_to_png (result, "gral-soft-raster.out.png");
+	cairo_surface_write_to_png (diff, "gral-soft-raster.diff.png");
+	status = CAIRO_TEST_FAILURE;
+    }
+
+    cairo_surface_destroy (diff);
+    cairo_surface_destroy (result);
+    cairo_surface_destroy (gral);
+    gral_soft_surface_destroy (gral_surf);
+    cairo_surface_destroy (reference);
+
+    return status;
+#else
+    return CAIRO_TEST_UNTESTED;
+#endif
+}
+
+CAIRO_TEST (gral_soft_raster,
+	    "Compares the rasterizer of the software gral backend with the image backend",
+	    "gral, fill", /* keywords */
+	    NULL, /* requirements */
+	    0, 0,
+	    preamble, NULL)
@@ -44,4 +44,13 @@
     assert (NOT_REACHED);             \
   } while (0)
 
+#include "gral.h"
+
+GRAL_BEGIN_DECLS
+
+/* Counters updated by the backend, see gral_get_stats. */
+extern gral_stats_t _gral_stats;
+
+GRAL_END_DECLS
+
 #endif /* _GRAL_INTERNAL_H_ */
\ No newline at end of file
@@ -22,6 +22,19 @@
  */
 
 #include <Ogre.h>
+#include <cstdio>
+#include <fstream>
+#ifdef _WIN32
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
 #include "gral-internal.h"
 #include "gral.h"
 #include "gral-ogre.h"
@@ -36,6 +49,8 @@ using namespace Ogre;
 
 struct _gral_texture {
   TexturePtr ogre_tex;
+  /// Whether gral created the texture and removes it from the TextureManager
+  bool owned;
 };
 
 struct _gral_vertex_buffer {
@@ -47,10 +62,110 @@ struct _gral_index_buffer {
 };
 
 struct _gral_cg_program {
-  HighLevelGpuProgramPtr ogre_prog;
+  /// The Cg program, or the assembler program it was compiled to when that
+  /// came from the program cache
+  GpuProgramPtr ogre_prog;
   GpuProgramParametersSharedPtr params;
 };
 
+/* The world matrix last set through gral, restored after emulated instancing. */
+static Matrix4 worldMatrix = Matrix4::IDENTITY;
+
+/* Render state last issued through gral. A state is only compared against
+ * when its bit is set in validStates; gral_reset_state_cache clears them. */
+enum {
+  STATE_VIEW_MATRIX       = 1 << 0,
+  STATE_PROJECTION_MATRIX = 1 << 1,
+  STATE_WORLD_MATRIX      = 1 << 2,
+  STATE_LIGHTING          = 1 << 3,
+  STATE_CULLING           = 1 << 4,
+  STATE_SHADING           = 1 << 5,
+  STATE_SURFACE_PARAMS    = 1 << 6,
+  STATE_DEPTH_PARAMS      = 1 << 7,
+  STATE_DEPTH_WRITE       = 1 << 8,
+  STATE_COLOR_WRITE       = 1 << 9,
+  STATE_STENCIL_CHECK     = 1 << 10,
+  STATE_STENCIL_PARAMS    = 1 << 11,
+  STATE_SCENE_BLENDING    = 1 << 12
+};
+
+static struct {
+  gral_matrix_t view, projection, world;
+  bool lighting;
+  gral_culling_mode_t culling;
+  gral_shade_type_t shading;
+  gral_color_t surface[4];
+  float shininess;
+  gral_track_vertex_color_type_t tracking;
+  bool depthTest, depthWrite;
+  gral_compare_func_t depthFunc;
+  bool colorWrite[4];
+  bool stencilCheck;
+  gral_compare_func_t stencilFunc;
+  uint32_t stencilRef, stencilMask;
+  gral_stencil_operation_t stencilOps[3];
+  bool stencilTwoSided;
+  gral_scene_blend_factor_t blendSrc, blendDst, blendSrcAlpha, blendDstAlpha;
+  /* Restored by gral_render_instanced, which changes it per instance. */
+  bool texture0Set;
+  Matrix4 texture0;
+  size_t texture0Coords;
+} stateCache;
+
+static unsigned int validStates = 0;
+
+/* Returns true if the state change can be dropped, and updates the counters. */
+static bool
+filterStateChange (unsigned int state, bool same)
+{
+  if ((validStates & state) && same) {
+    ++_gral_stats.state_changes_filtered;
+    return true;
+  }
+  validStates |= state;
+  ++_gral_stats.state_changes_issued;
+  return false;
+}
+
+static bool
+sameMatrix (const gral_matrix_t *a, const gral_matrix_t *b)
+{
+  return memcmp(a, b, sizeof(gral_matrix_t)) == 0;
+}
+
+static bool
+sameColor (const gral_color_t *a, const gral_color_t *b)
+{
+  return a->r == b->r && a->g == b->g && a->b == b->b && a->a == b->a;
+}
+
+static void
+countRender (const RenderOperation &ogre_op, size_t count)
+{
+  size_t n = ogre_op.useIndexes ? ogre_op.indexData->indexCount : ogre_op.vertexData->vertexCount;
+
+  _gral_stats.draw_calls += count;
+  _gral_stats.vertices += ogre_op.vertexData->vertexCount * count;
+  if (ogre_op.useIndexes)
+    _gral_stats.indices += n * count;
+  if (ogre_op.operationType == RenderOperation::OT_TRIANGLE_LIST)
+    _gral_stats.triangles += n / 3 * count;
+  else if ((ogre_op.operationType == RenderOperation::OT_TRIANGLE_STRIP ||
+            ogre_op.operationType == RenderOperation::OT_TRIANGLE_FAN) && n >= 3)
+    _gral_stats.triangles += (n - 2) * count;
+  if (stateCache.stencilCheck && !stateCache.colorWrite[0] && !stateCache.colorWrite[1] &&
+      !stateCache.colorWrite[2] && !stateCache.colorWrite[3])
+    _gral_stats.stencil_passes += count;
+}
+
+static void
+countLock (size_t length, gral_buffer_lock_option_t opt)
+{
+  ++_gral_stats.buffer_locks;
+  if (opt != GRAL_BUFFER_LOCK_OPTION_READ_ONLY)
+    _gral_stats.bytes_uploaded += length;
+}
+
 static CullingMode convertEnum(gral_culling_mode_t mode);
 static RenderOperation::OperationType convertEnum(gral_render_operation_type_t op);
 static HardwareBuffer::Usage convertEnum(gral_buffer_usage_t usage);
@@ -91,6 +206,15 @@ gral_ogre_surface_from_viewport(Viewport *vp)
   return reinterpret_cast<gral_surface_t *>(vp);
 }
 
+gral_texture_t *
+gral_ogre_texture_from_texture(const TexturePtr &ogre_tex)
+{
+  gral_texture_t *tex = new gral_texture_t();
+  tex->ogre_tex = ogre_tex;
+  tex->owned = false;
+  return tex;
+}
+
 int
 gral_surface_get_width (gral_surface_t *surf)
 {
@@ -109,12 +233,17 @@ void
 gral_set_render_surface (gral_surface_t *surf)
 {
   Viewport *vp = reinterpret_cast<Viewport *>(surf);  
+  ++_gral_stats.state_changes_issued;
   Root::getSingleton().getRenderSystem()->_setViewport(vp);
 }
 
 void
 gral_set_view_matrix (const gral_matrix_t *m)
 {
+  if (filterStateChange(STATE_VIEW_MATRIX, sameMatrix(&stateCache.view, m)))
+    return;
+  stateCache.view = *m;
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setViewMatrix(TO_MATRIX4(*m));
 }
@@ -122,6 +251,10 @@ gral_set_view_matrix (const gral_matrix_t *m)
 void
 gral_set_projection_matrix (const gral_matrix_t *m)
 {
+  if (filterStateChange(STATE_PROJECTION_MATRIX, sameMatrix(&stateCache.projection, m)))
+    return;
+  stateCache.projection = *m;
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setProjectionMatrix(TO_MATRIX4(*m));
 }
@@ -129,8 +262,13 @@ gral_set_projection_matrix (const gral_matrix_t *m)
 void
 gral_set_world_matrix (const gral_matrix_t *m)
 {
+  if (filterStateChange(STATE_WORLD_MATRIX, sameMatrix(&stateCache.world, m)))
+    return;
+  stateCache.world = *m;
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
-  rs->_setWorldMatrix(TO_MATRIX4(*m));
+  worldMatrix = TO_MATRIX4(*m);
+  rs->_setWorldMatrix(worldMatrix);
 }
 
 float
@@ -155,12 +293,19 @@ gral_get_capabilities (void)
   const RenderSystemCapabilities *ogre_caps = rs->getCapabilities();
   if (ogre_caps->hasCapability(RSC_FRAGMENT_PROGRAM))
     caps = caps | GRAL_CAP_FRAGMENT_PROGRAM;
+  /* Direct3D's fixed-function pipeline only takes 3 float positions. */
+  if (StringUtil::startsWith(rs->getName(), "OpenGL", false/*lowerCase*/))
+    caps = caps | GRAL_CAP_VERTEX_POSITION_FLOAT2 | GRAL_CAP_VERTEX_POSITION_SHORT2;
   return gral_capabilities_t(caps);
 }
 
 void
 gral_set_lighting_enabled (gral_bool_t enabled)
 {
+  if (filterStateChange(STATE_LIGHTING, stateCache.lighting == (enabled != 0)))
+    return;
+  stateCache.lighting = (enabled != 0);
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->setLightingEnabled(enabled);
 }
@@ -168,6 +313,10 @@ gral_set_lighting_enabled (gral_bool_t enabled)
 void
 gral_set_culling_mode (gral_culling_mode_t mode)
 {
+  if (filterStateChange(STATE_CULLING, stateCache.culling == mode))
+    return;
+  stateCache.culling = mode;
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setCullingMode(convertEnum(mode));
 }
@@ -175,6 +324,7 @@ gral_set_culling_mode (gral_culling_mode_t mode)
 void
 gral_unbind_gpu_program (gral_gpu_program_type_t gptype)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->unbindGpuProgram(convertEnum(gptype));
 }
@@ -182,15 +332,16 @@ gral_unbind_gpu_program (gral_gpu_program_type_t gptype)
 void
 gral_set_shading_type (gral_shade_type_t so)
 {
+  if (filterStateChange(STATE_SHADING, stateCache.shading == so))
+    return;
+  stateCache.shading = so;
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->setShadingType(convertEnum(so));  
 }
 
-void
-gral_set_surface_params (const gral_color_t *ambient,
-                         const gral_color_t *diffuse, const gral_color_t *specular,
-                         const gral_color_t *emissive, float shininess,
-                         gral_track_vertex_color_type_t tracking)
+static TrackVertexColourType
+convertTracking (gral_track_vertex_color_type_t tracking)
 {
   TrackVertexColourType ogre_tracking = 0;
   if (tracking & GRAL_TRACK_VERTEX_COLOR_TYPE_AMBIENT)
@@ -201,16 +352,48 @@ gral_set_surface_params (const gral_color_t *ambient,
     ogre_tracking |= TVC_SPECULAR;
   if (tracking & GRAL_TRACK_VERTEX_COLOR_TYPE_EMISSIVE)
     ogre_tracking |= TVC_EMISSIVE;
+  return ogre_tracking;
+}
+
+void
+gral_set_surface_params (const gral_color_t *ambient,
+                         const gral_color_t *diffuse, const gral_color_t *specular,
+                         const gral_color_t *emissive, float shininess,
+                         gral_track_vertex_color_type_t tracking)
+{
+  if (filterStateChange(STATE_SURFACE_PARAMS,
+                        sameColor(&stateCache.surface[0], ambient) &&
+                        sameColor(&stateCache.surface[1], diffuse) &&
+                        sameColor(&stateCache.surface[2], specular) &&
+                        sameColor(&stateCache.surface[3], emissive) &&
+                        stateCache.shininess == shininess && stateCache.tracking == tracking))
+    return;
+  stateCache.surface[0] = *ambient;
+  stateCache.surface[1] = *diffuse;
+  stateCache.surface[2] = *specular;
+  stateCache.surface[3] = *emissive;
+  stateCache.shininess = shininess;
+  stateCache.tracking = tracking;
 
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setSurfaceParams(TO_COLOURVALUE(*ambient), TO_COLOURVALUE(*diffuse), TO_COLOURVALUE(*specular),
-                        TO_COLOURVALUE(*emissive), shininess, ogre_tracking);
+                        TO_COLOURVALUE(*emissive), shininess, convertTracking(tracking));
 }
 
 void
 gral_set_depth_buffer_params (gral_bool_t depthTest, gral_bool_t depthWrite,
                               gral_compare_func_t depthFunction)
 {
+  if (filterStateChange(STATE_DEPTH_PARAMS | STATE_DEPTH_WRITE,
+                        (validStates & STATE_DEPTH_PARAMS) && (validStates & STATE_DEPTH_WRITE) &&
+                        stateCache.depthTest == (depthTest != 0) &&
+                        stateCache.depthWrite == (depthWrite != 0) &&
+                        stateCache.depthFunc == depthFunction))
+    return;
+  stateCache.depthTest = (depthTest != 0);
+  stateCache.depthWrite = (depthWrite != 0);
+  stateCache.depthFunc = depthFunction;
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setDepthBufferParams(depthTest, depthWrite, convertEnum(depthFunction));
 }
@@ -218,6 +401,10 @@ gral_set_depth_buffer_params (gral_bool_t depthTest, gral_bool_t depthWrite,
 void
 gral_set_depth_buffer_write_enabled (gral_bool_t enabled)
 {
+  if (filterStateChange(STATE_DEPTH_WRITE, stateCache.depthWrite == (enabled != 0)))
+    return;
+  stateCache.depthWrite = (enabled != 0);
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setDepthBufferWriteEnabled(enabled);
 }
@@ -228,6 +415,17 @@ gral_set_color_buffer_write_enabled(gral_bool_t red,
                                     gral_bool_t blue,
                                     gral_bool_t alpha)
 {
+  if (filterStateChange(STATE_COLOR_WRITE,
+                        stateCache.colorWrite[0] == (red != 0) &&
+                        stateCache.colorWrite[1] == (green != 0) &&
+                        stateCache.colorWrite[2] == (blue != 0) &&
+                        stateCache.colorWrite[3] == (alpha != 0)))
+    return;
+  stateCache.colorWrite[0] = (red != 0);
+  stateCache.colorWrite[1] = (green != 0);
+  stateCache.colorWrite[2] = (blue != 0);
+  stateCache.colorWrite[3] = (alpha != 0);
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setColourBufferWriteEnabled(red, green, blue, alpha);
 }
@@ -235,6 +433,10 @@ gral_set_color_buffer_write_enabled(gral_bool_t red,
 void
 gral_set_stencil_check_enabled (gral_bool_t enabled)
 {
+  if (filterStateChange(STATE_STENCIL_CHECK, stateCache.stencilCheck == (enabled != 0)))
+    return;
+  stateCache.stencilCheck = (enabled != 0);
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->setStencilCheckEnabled(enabled);
 }
@@ -247,6 +449,22 @@ gral_set_stencil_buffer_params(gral_compare_func_t func,
                                gral_stencil_operation_t passOp, 
                                gral_bool_t twoSidedOperation)
 {
+  if (filterStateChange(STATE_STENCIL_PARAMS,
+                        stateCache.stencilFunc == func &&
+                        stateCache.stencilRef == refValue && stateCache.stencilMask == mask &&
+                        stateCache.stencilOps[0] == stencilFailOp &&
+                        stateCache.stencilOps[1] == depthFailOp &&
+                        stateCache.stencilOps[2] == passOp &&
+                        stateCache.stencilTwoSided == (twoSidedOperation != 0)))
+    return;
+  stateCache.stencilFunc = func;
+  stateCache.stencilRef = refValue;
+  stateCache.stencilMask = mask;
+  stateCache.stencilOps[0] = stencilFailOp;
+  stateCache.stencilOps[1] = depthFailOp;
+  stateCache.stencilOps[2] = passOp;
+  stateCache.stencilTwoSided = (twoSidedOperation != 0);
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->setStencilBufferParams(convertEnum(func), refValue, mask,
                              convertEnum(stencilFailOp), convertEnum(depthFailOp), convertEnum(passOp),
@@ -272,6 +490,7 @@ gral_clear_frame_buffer (unsigned int buffers,
 void
 gral_disable_texture_units_from (size_t texUnit)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_disableTextureUnitsFrom(texUnit);
 }
@@ -279,10 +498,36 @@ gral_disable_texture_units_from (size_t texUnit)
 void
 gral_set_scene_blending (gral_scene_blend_factor_t sourceFactor, gral_scene_blend_factor_t destFactor)
 {
+  if (filterStateChange(STATE_SCENE_BLENDING,
+                        stateCache.blendSrc == sourceFactor && stateCache.blendDst == destFactor &&
+                        stateCache.blendSrcAlpha == sourceFactor && stateCache.blendDstAlpha == destFactor))
+    return;
+  stateCache.blendSrc = stateCache.blendSrcAlpha = sourceFactor;
+  stateCache.blendDst = stateCache.blendDstAlpha = destFactor;
+
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setSceneBlending(convertEnum(sourceFactor), convertEnum(destFactor));
 }
 
+void
+gral_set_separate_scene_blending (gral_scene_blend_factor_t sourceFactor, gral_scene_blend_factor_t destFactor,
+                                  gral_scene_blend_factor_t sourceFactorAlpha, gral_scene_blend_factor_t destFactorAlpha)
+{
+  if (filterStateChange(STATE_SCENE_BLENDING,
+                        stateCache.blendSrc == sourceFactor && stateCache.blendDst == destFactor &&
+                        stateCache.blendSrcAlpha == sourceFactorAlpha &&
+                        stateCache.blendDstAlpha == destFactorAlpha))
+    return;
+  stateCache.blendSrc = sourceFactor;
+  stateCache.blendDst = destFactor;
+  stateCache.blendSrcAlpha = sourceFactorAlpha;
+  stateCache.blendDstAlpha = destFactorAlpha;
+
+  RenderSystem *rs = Root::getSingleton().getRenderSystem();
+  rs->_setSeparateSceneBlending(convertEnum(sourceFactor), convertEnum(destFactor),
+                                convertEnum(sourceFactorAlpha), convertEnum(destFactorAlpha));
+}
+
 void
 gral_render (gral_render_operation_t *op)
 {
@@ -291,11 +536,67 @@ gral_render (gral_render_operation_t *op)
   ogre_op.indexData = reinterpret_cast<IndexData*>(op->index_data);
   ogre_op.useIndexes = op->use_indexes;
   ogre_op.operationType = convertEnum(op->operation_type);
+  countRender(ogre_op, 1);
 
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_render(ogre_op);
 }
 
+void
+gral_render_instanced (gral_render_operation_t *op,
+                       const gral_instance_data_t *instances,
+                       size_t num_instances,
+                       unsigned int data_types)
+{
+  RenderOperation ogre_op;
+  ogre_op.vertexData = reinterpret_cast<VertexData*>(op->vertex_data);
+  ogre_op.indexData = reinterpret_cast<IndexData*>(op->index_data);
+  ogre_op.useIndexes = op->use_indexes;
+  ogre_op.operationType = convertEnum(op->operation_type);
+  countRender(ogre_op, num_instances);
+
+  /* The fixed-function pipeline has no per-instance streams, so emulate by
+   * changing the instance state between draws. The vertex and index buffers
+   * are only uploaded once for all the instances. */
+  RenderSystem *rs = Root::getSingleton().getRenderSystem();
+  for (size_t i = 0; i < num_instances; ++i) {
+    const gral_instance_data_t *inst = &instances[i];
+
+    if (data_types & GRAL_INSTANCE_DATA_TRANSFORM)
+      rs->_setWorldMatrix(worldMatrix * TO_MATRIX4(inst->transform));
+
+    if (data_types & GRAL_INSTANCE_DATA_COLOR) {
+      ColourValue col = TO_COLOURVALUE(inst->color);
+      rs->_setSurfaceParams(ColourValue::ZERO, col, ColourValue::ZERO, col, 0, TVC_NONE);
+    }
+
+    if (data_types & GRAL_INSTANCE_DATA_TEX_RECT) {
+      Matrix4 tex = Matrix4::IDENTITY;
+      tex.setScale(Vector3(inst->tex_rect[2] - inst->tex_rect[0],
+                           inst->tex_rect[3] - inst->tex_rect[1], 1));
+      tex.setTrans(Vector3(inst->tex_rect[0], inst->tex_rect[1], 0));
+      rs->_setTextureMatrix(0, tex, 2);
+    }
+
+    rs->_render(ogre_op);
+  }
+
+  if (data_types & GRAL_INSTANCE_DATA_TRANSFORM)
+    rs->_setWorldMatrix(worldMatrix);
+  if (data_types & GRAL_INSTANCE_DATA_COLOR) {
+    if (validStates & STATE_SURFACE_PARAMS)
+      rs->_setSurfaceParams(TO_COLOURVALUE(stateCache.surface[0]), TO_COLOURVALUE(stateCache.surface[1]),
+                            TO_COLOURVALUE(stateCache.surface[2]), TO_COLOURVALUE(stateCache.surface[3]),
+                            stateCache.shininess, convertTracking(stateCache.tracking));
+    else
+      rs->_setSurfaceParams(ColourValue::White, ColourValue::White, ColourValue::Black,
+                            ColourValue::Black, 0, TVC_NONE);
+  }
+  if (data_types & GRAL_INSTANCE_DATA_TEX_RECT)
+    rs->_setTextureMatrix(0, stateCache.texture0Set ? stateCache.texture0 : Matrix4::IDENTITY,
+                          stateCache.texture0Coords);
+}
+
 gral_vertex_buffer_t *
 gral_vertex_buffer_create (size_t vertexSize, size_t numVerts, gral_buffer_usage_t usage)
 {
@@ -325,6 +626,7 @@ void *
 gral_vertex_buffer_lock (gral_vertex_buffer_t *vb, size_t offset, size_t length,
                          gral_buffer_lock_option_t opt)
 {
+  countLock(length, opt);
   return vb->ogre_buf->lock(offset, length, convertEnum(opt));
 }
 
@@ -364,6 +666,7 @@ void *
 gral_index_buffer_lock (gral_index_buffer_t *ib, size_t offset, size_t length,
                         gral_buffer_lock_option_t opt)
 {
+  countLock(length, opt);
   return ib->ogre_buf->lock(offset, length, convertEnum(opt));
 }
 
@@ -467,6 +770,7 @@ gral_index_data_set_buffer (gral_index_data_t *id, gral_index_buffer_t *buffer)
 void
 gral_set_texture(size_t unit, gral_bool_t enabled, gral_texture_t *tex)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTexture(unit, enabled, tex->ogre_tex);
 }
@@ -474,13 +778,20 @@ gral_set_texture(size_t unit, gral_bool_t enabled, gral_texture_t *tex)
 void
 gral_set_texture_matrix (size_t unit, const gral_matrix_t *xform, size_t numTexCoords)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
+  if (unit == 0) {
+    stateCache.texture0Set = true;
+    stateCache.texture0 = TO_MATRIX4(*xform);
+    stateCache.texture0Coords = numTexCoords;
+  }
   rs->_setTextureMatrix(unit, TO_MATRIX4(*xform), numTexCoords);
 }
 
 void
 gral_set_texture_coord_set (size_t unit, size_t index)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTextureCoordSet(unit, index);
 }
@@ -489,6 +800,7 @@ void
 gral_set_texture_unit_filtering (size_t unit, gral_filter_option_t minFilter,
                                  gral_filter_option_t magFilter, gral_filter_option_t mipFilter)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTextureUnitFiltering(unit, convertEnum(minFilter), convertEnum(magFilter), convertEnum(mipFilter));
 }
@@ -496,6 +808,7 @@ gral_set_texture_unit_filtering (size_t unit, gral_filter_option_t minFilter,
 void
 gral_set_texture_layer_anisotropy (size_t unit, unsigned int maxAnisotropy)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTextureLayerAnisotropy(unit, maxAnisotropy);
 }
@@ -503,6 +816,7 @@ gral_set_texture_layer_anisotropy (size_t unit, unsigned int maxAnisotropy)
 void
 gral_set_texture_mipmap_bias (size_t unit, float bias)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTextureMipmapBias(unit, bias);
 }
@@ -521,6 +835,7 @@ gral_set_texture_blend_mode (size_t unit, const gral_layer_blend_mode_t *bm)
   ogre_bm.alphaArg2 = bm->alpha_arg2;
   ogre_bm.factor = bm->factor;
   
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTextureBlendMode(unit, ogre_bm);  
 }
@@ -533,6 +848,7 @@ gral_set_texture_addressing_mode (size_t unit, const gral_uvw_addressing_mode_t
   ogre_uvw.v = convertEnum(uvw->v);
   ogre_uvw.w = convertEnum(uvw->w);
 
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTextureAddressingMode(unit, ogre_uvw);
 }
@@ -540,6 +856,7 @@ gral_set_texture_addressing_mode (size_t unit, const gral_uvw_addressing_mode_t
 void
 gral_set_texture_border_color (size_t unit, const gral_color_t *color)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTextureBorderColour(unit, TO_COLOURVALUE(*color));
 }
@@ -547,6 +864,7 @@ gral_set_texture_border_color (size_t unit, const gral_color_t *color)
 void
 gral_set_texture_coord_calculation (size_t unit, gral_tex_coord_calc_method_t m)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->_setTextureCoordCalculation(unit, convertEnum(m));
 }
@@ -571,20 +889,63 @@ gral_texture_create (gral_texture_type_t tex_type,
 
   gral_texture_t *tex = new gral_texture_t();
   tex->ogre_tex = ogre_tex;
+  tex->owned = true;
   return tex;
 }
 
 void
 gral_texture_destroy (gral_texture_t *tus)
 {
+  if (tus->owned)
+    TextureManager::getSingleton().remove(tus->ogre_tex->getHandle());
   delete tus;
 }
 
+unsigned int
+gral_texture_get_width (gral_texture_t *tex)
+{
+  return static_cast<unsigned int>(tex->ogre_tex->getWidth());
+}
+
+unsigned int
+gral_texture_get_height (gral_texture_t *tex)
+{
+  return static_cast<unsigned int>(tex->ogre_tex->getHeight());
+}
+
+gral_surface_t *
+gral_texture_get_surface (gral_texture_t *tex)
+{
+  if (!(tex->ogre_tex->getUsage() & TU_RENDERTARGET))
+    return NULL;
+
+  RenderTarget *target = tex->ogre_tex->getBuffer()->getRenderTarget();
+  if (target->getNumViewports() > 0)
+    return gral_ogre_surface_from_viewport(target->getViewport(0));
+
+  Viewport *vp = target->addViewport(NULL);
+  vp->setClearEveryFrame(false);
+  vp->setOverlaysEnabled(false);
+  return gral_ogre_surface_from_viewport(vp);
+}
+
+gral_bool_t
+gral_texture_is_flipped (gral_texture_t *tex)
+{
+  if (!(tex->ogre_tex->getUsage() & TU_RENDERTARGET))
+    return FALSE;
+  return tex->ogre_tex->getBuffer()->getRenderTarget()->requiresTextureFlipping();
+}
+
 void *
 gral_texture_buffer_lock_full (gral_texture_t *tex, size_t face, size_t mipmap,
                                gral_buffer_lock_option_t options)
 {
-  return tex->ogre_tex->getBuffer(face, mipmap)->lock(convertEnum(options));
+  HardwarePixelBufferSharedPtr buf = tex->ogre_tex->getBuffer(face, mipmap);
+  countLock(buf->getSizeInBytes(), options);
+  if (options != GRAL_BUFFER_LOCK_OPTION_READ_ONLY)
+    ++_gral_stats.texture_uploads;
+  return buf->lock(convertEnum(options));
 }
 
 void
@@ -593,26 +954,424 @@ gral_texture_buffer_unlock (gral_texture_t *tex, size_t face, size_t mipmap)
   tex->ogre_tex->getBuffer(face, mipmap)->unlock();
 }
 
-static HighLevelGpuProgramPtr
-createOgreProgram (gral_gpu_program_type_t gptype,
-                   const char *entry_point,
-                   const char *profiles)
+size_t
+gral_texture_buffer_get_row_pitch (gral_texture_t *tex, size_t face, size_t mipmap)
+{
+  HardwarePixelBufferSharedPtr buf = tex->ogre_tex->getBuffer(face, mipmap);
+  size_t pixels = buf->isLocked() ? buf->getCurrentLock().rowPitch : buf->getWidth();
+  return pixels * PixelUtil::getNumElemBytes(buf->getFormat());
+}
+
+void
+gral_texture_write (gral_texture_t *tex, const void *data, size_t stride)
+{
+  HardwarePixelBufferSharedPtr buf = tex->ogre_tex->getBuffer();
+  PixelFormat format = tex->ogre_tex->getFormat();
+  PixelBox src(buf->getWidth(), buf->getHeight(), 1, format, const_cast<void *>(data));
+  src.rowPitch = stride / PixelUtil::getNumElemBytes(format);
+  src.slicePitch = src.rowPitch * buf->getHeight();
+
+  countLock(buf->getSizeInBytes(), GRAL_BUFFER_LOCK_OPTION_DISCARD);
+  ++_gral_stats.texture_uploads;
+  buf->blitFromMemory(src);
+}
+
+/* Ogre has no fences, so gral_readback_is_ready only guesses: it assumes the
+ * GPU runs at most this many frames behind the frame that queued a copy. The
+ * download itself is a synchronous blitToMemory in gral_readback_map. */
+#define READBACK_LATENCY_FRAMES 2
+
+/// Staging textures kept for the next readbacks of the same size
+#define READBACK_POOL_SIZE 4
+
+struct _gral_readback {
+  /// The copy on the GPU, until it is downloaded into data
+  TexturePtr staging;
+  unsigned long frame;
+  unsigned int width, height;
+  /// The rows of the copy are bottom up
+  bool flipped;
+  unsigned char *data;
+};
+
+/// Names of the idle staging textures, oldest first. The textures are looked
+/// up by name, as the texture manager may have removed them since.
+static std::vector<String> readbackPool;
+
+static TexturePtr
+acquireStagingTexture (unsigned int width, unsigned int height)
+{
+  for (size_t i = 0; i < readbackPool.size(); ) {
+    TexturePtr tex = TextureManager::getSingleton().getByName(readbackPool[i]);
+    if (tex.isNull()) {
+      readbackPool.erase(readbackPool.begin() + i);
+      continue;
+    }
+    if (tex->getWidth() == width && tex->getHeight() == height) {
+      readbackPool.erase(readbackPool.begin() + i);
+      return tex;
+    }
+    ++i;
+  }
+
+  // Only a copy target; it doesn't need to be a render target.
+  static int counter = 0;
+  std::ostringstream name;
+  name << "##GRAL-READBACK-" << (counter++);
+  return TextureManager::getSingleton().createManual(
+          name.str(), ResourceGroupManager::INTERNAL_RESOURCE_GROUP_NAME,
+          TEX_TYPE_2D, width, height, 0, PF_A8R8G8B8, TU_DYNAMIC);
+}
+
+static void
+releaseStagingTexture (TexturePtr &tex)
+{
+  if (tex.isNull())
+    return;
+
+  if (readbackPool.size() == READBACK_POOL_SIZE) {
+    TextureManager::getSingleton().remove(readbackPool.front());
+    readbackPool.erase(readbackPool.begin());
+  }
+  readbackPool.push_back(tex->getName());
+  tex.setNull();
+}
+
+static TexturePtr
+textureOfRenderTarget (RenderTarget *target)
+{
+  // Render textures don't point back to their texture.
+  ResourceManager::ResourceMapIterator it = TextureManager::getSingleton().getResourceIterator();
+  while (it.hasMoreElements()) {
+    TexturePtr tex = it.getNext();
+    if ((tex->getUsage() & TU_RENDERTARGET) && tex->getBuffer()->getRenderTarget() == target)
+      return tex;
+  }
+  return TexturePtr();
+}
+
+gral_readback_t *
+gral_readback_begin (gral_surface_t *surf, int x, int y,
+                     unsigned int width, unsigned int height)
+{
+  Viewport *vp = reinterpret_cast<Viewport *>(surf);
+  RenderTarget *target = vp->getTarget();
+  size_t left = vp->getActualLeft() + x;
+  size_t top = vp->getActualTop() + y;
+
+  gral_readback_t *rb = new gral_readback_t();
+  rb->frame = Root::getSingleton().getNextFrameNumber();
+  rb->width = width;
+  rb->height = height;
+  rb->flipped = false;
+  rb->data = NULL;
+
+  TexturePtr source = textureOfRenderTarget(target);
+  if (!source.isNull()) {
+    // Flipped render textures hold the viewport upside down, see
+    // gral_texture_is_flipped; gral_readback_map turns the rows back.
+    if (target->requiresTextureFlipping()) {
+      top = source->getHeight() - (top + height);
+      rb->flipped = true;
+    }
+    Image::Box box(left, top, left + width, top + height);
+    rb->staging = acquireStagingTexture(width, height);
+    rb->staging->getBuffer()->blit(source->getBuffer(), box, Image::Box(0, 0, width, height));
+    return rb;
+  }
+
+  Image::Box box(left, top, left + width, top + height);
+
+  // Render windows can only be read right away.
+  rb->data = new unsigned char[width * height * 4];
+  target->copyContentsToMemory(PixelBox(box, PF_A8R8G8B8, rb->data));
+  return rb;
+}
+
+gral_bool_t
+gral_readback_is_ready (gral_readback_t *rb)
+{
+  return rb->data != NULL ||
+         Root::getSingleton().getNextFrameNumber() >= rb->frame + READBACK_LATENCY_FRAMES;
+}
+
+const void *
+gral_readback_map (gral_readback_t *rb, size_t *stride)
+{
+  if (rb->data == NULL) {
+    if (rb->staging.isNull())
+      return NULL;
+    rb->data = new unsigned char[rb->width * rb->height * 4];
+    rb->staging->getBuffer()->blitToMemory(PixelBox(rb->width, rb->height, 1, PF_A8R8G8B8, rb->data));
+    releaseStagingTexture(rb->staging);
+
+    if (rb->flipped) {
+      size_t row_size = rb->width * 4;
+      std::vector<unsigned char> tmp(row_size);
+      for (unsigned int row = 0; row < rb->height / 2; ++row) {
+        unsigned char *a = rb->data + row * row_size;
+        unsigned char *b = rb->data + (rb->height - 1 - row) * row_size;
+        memcpy(&tmp[0], a, row_size);
+        memcpy(a, b, row_size);
+        memcpy(b, &tmp[0], row_size);
+      }
+    }
+  }
+
+  *stride = rb->width * 4;
+  return rb->data;
+}
+
+void
+gral_readback_destroy (gral_readback_t *rb)
+{
+  releaseStagingTexture(rb->staging);
+  delete [] rb->data;
+  delete rb;
+}
+
+void
+gral_read_pixels (gral_surface_t *surf, int x, int y,
+                  unsigned int width, unsigned int height,
+                  void *data, size_t stride)
+{
+  gral_readback_t *rb = gral_readback_begin(surf, x, y, width, height);
+  size_t rb_stride;
+  const unsigned char *src = (const unsigned char *) gral_readback_map(rb, &rb_stride);
+  unsigned char *dst = (unsigned char *) data;
+  for (unsigned int row = 0; src != NULL && row < height; ++row)
+    memcpy(dst + row * stride, src + row * rb_stride, width * 4);
+  gral_readback_destroy(rb);
+}
+
+/// Directory of compiled programs; empty if they aren't cached
+static String programCacheDir;
+
+/// Changed whenever the layout of the cache files changes
+#define PROGRAM_CACHE_VERSION 1
+
+void
+gral_set_program_cache_dir (const char *dir)
+{
+  programCacheDir = dir ? dir : "";
+}
+
+// 64-bit FNV-1a
+static unsigned long long
+fnv1a (const String &str, unsigned long long hash = 14695981039346656037ULL)
+{
+  for (size_t i = 0; i < str.size(); ++i) {
+    hash ^= static_cast<unsigned char>(str[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* Identifies the cached compiles of a program. The key covers everything the
+ * compiled code depends on: the source, the entry point, the profiles and
+ * the render system and driver that picked the profile. */
+static unsigned long long
+programCacheKey (gral_gpu_program_type_t gptype, const String &source,
+                 const char *entry_point, const char *profiles)
+{
+  const RenderSystemCapabilities *caps =
+          Root::getSingleton().getRenderSystem()->getCapabilities();
+  std::ostringstream key;
+  key << gptype << '\n' << source << '\n' << entry_point << '\n' << profiles << '\n'
+      << Root::getSingleton().getRenderSystem()->getName() << '\n'
+      << caps->getDeviceName() << '\n' << caps->getDriverVersion().toString();
+  return fnv1a(key.str());
+}
+
+static String
+programCachePath (unsigned long long key)
+{
+  std::ostringstream name;
+  name << programCacheDir << "/" << std::hex << key;
+  return name.str();
+}
+
+static bool
+readFile (const String &path, String &contents)
+{
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file)
+    return false;
+  std::ostringstream data;
+  data << file.rdbuf();
+  contents = data.str();
+  return !file.bad();
+}
+
+/* Moves a file over another one in a single step, so that readers see either
+ * of them whole. */
+static bool
+replaceFile (const String &from, const String &to)
+{
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+static unsigned long
+processId ()
+{
+#ifdef _WIN32
+  return GetCurrentProcessId();
+#else
+  return static_cast<unsigned long>(getpid());
+#endif
+}
+
+static String
+uniqueProgramName ()
 {
   static int counter = 0;
   std::ostringstream name;
   name << "##GRAL-PROGRAM-" << (counter++);
+  return name.str();
+}
+
+/* Loads the assembler code and constants saved by saveCachedProgram. Files
+ * that are stale, truncated or don't belong together are ignored and the
+ * program is compiled again. */
+static GpuProgramPtr
+loadCachedProgram (gral_gpu_program_type_t gptype, unsigned long long key)
+{
+  String path = programCachePath(key);
+  String code, consts;
+  if (!readFile(path + ".asm", code) || !readFile(path + ".constants", consts) ||
+      consts.empty())
+    return GpuProgramPtr();
+
+  // The header line of the .asm file describes both files.
+  size_t eol = code.find('\n');
+  if (eol == String::npos)
+    return GpuProgramPtr();
+  std::istringstream header(code.substr(0, eol));
+  code.erase(0, eol + 1);
+  String magic;
+  int version = 0;
+  unsigned long long file_key = 0, checksum = 0;
+  size_t code_size = 0, consts_size = 0;
+  header >> magic >> version >> std::hex >> file_key >> std::dec >> code_size >> consts_size
+         >> std::hex >> checksum;
+  if (header.fail() || magic != "gral-program" || version != PROGRAM_CACHE_VERSION ||
+      file_key != key || code_size != code.size() || consts_size != consts.size() ||
+      checksum != fnv1a(consts, fnv1a(code)))
+    return GpuProgramPtr();
+
+  // Then the syntax code the program was compiled for, and the program.
+  eol = code.find('\n');
+  if (eol == String::npos)
+    return GpuProgramPtr();
+  String syntax = code.substr(0, eol);
+  code.erase(0, eol + 1);
+  if (!GpuProgramManager::getSingleton().isSyntaxSupported(syntax))
+    return GpuProgramPtr();
+
+  GpuNamedConstants named_consts;
+  DataStreamPtr consts_stream(OGRE_NEW MemoryDataStream(&consts[0], consts.size(), false));
+  named_consts.load(consts_stream);
+
+  GpuProgramPtr ogre_prog = GpuProgramManager::getSingleton().createProgramFromString(
+          uniqueProgramName(), ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+          code, convertEnum(gptype), syntax);
+  ogre_prog->setManualNamedConstants(named_consts);
+  ogre_prog->load();
+  if (ogre_prog->hasCompileError()) {
+    GpuProgramManager::getSingleton().remove(ogre_prog->getHandle());
+    return GpuProgramPtr();
+  }
+  return ogre_prog;
+}
+
+/* Saves the code the Cg program was compiled to, with its constants, since
+ * assembler programs have no names for their constants. Both are written to
+ * temporary files that are renamed into place, the .asm file last: its header
+ * holds the size and checksum of the .constants file, so a process that
+ * reads the cache while another one writes it never loads a mismatched pair. */
+static void
+saveCachedProgram (const HighLevelGpuProgramPtr &ogre_prog, unsigned long long key)
+{
+  GpuProgram *compiled = ogre_prog->_getBindingDelegate();
+  if (compiled == NULL || compiled == ogre_prog.get())
+    return;
+
+  String path = programCachePath(key);
+  std::ostringstream suffix;
+  suffix << ".tmp" << processId();
+  String consts_tmp = path + ".constants" + suffix.str();
+  String code_tmp = path + ".asm" + suffix.str();
+
+  ogre_prog->getConstantDefinitions().save(consts_tmp);
+  String consts;
+  bool ok = readFile(consts_tmp, consts) && !consts.empty();
+
+  String code = compiled->getSyntaxCode() + "\n" + compiled->getSource();
+  if (ok) {
+    std::ofstream code_file(code_tmp.c_str(), std::ios::binary);
+    code_file << "gral-program " << PROGRAM_CACHE_VERSION << ' '
+              << std::hex << key << std::dec << ' ' << code.size() << ' ' << consts.size() << ' '
+              << std::hex << fnv1a(consts, fnv1a(code)) << '\n' << code;
+    code_file.close();
+    ok = !code_file.fail();
+  }
+
+  if (!ok || !replaceFile(consts_tmp, path + ".constants") ||
+      !replaceFile(code_tmp, path + ".asm")) {
+    std::remove(consts_tmp.c_str());
+    std::remove(code_tmp.c_str());
+  }
+}
+
+static gral_cg_program_t *
+createProgram (gral_gpu_program_type_t gptype,
+               const String &source,
+               const char *entry_point,
+               const char *profiles)
+{
+  bool use_cache = !programCacheDir.empty();
+  unsigned long long cache_key = 0;
+  GpuProgramPtr cached;
+  if (use_cache) {
+    cache_key = programCacheKey(gptype, source, entry_point, profiles);
+    cached = loadCachedProgram(gptype, cache_key);
+  }
+
+  gral_cg_program_t *prog;
+  if (!cached.isNull()) {
+    prog = new gral_cg_program_t();
+    prog->ogre_prog = cached;
+    prog->params = cached->createParameters();
+    return prog;
+  }
+
   HighLevelGpuProgramPtr ogre_prog = HighLevelGpuProgramManager::getSingleton().createProgram(
-              name.str(),
+              uniqueProgramName(),
               ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
               "cg",
               convertEnum(gptype));
   if (ogre_prog.isNull())
-    return ogre_prog;
+    return NULL;
 
   ogre_prog->setParameter("entry_point", entry_point);
   ogre_prog->setParameter("profiles", profiles);
+  ogre_prog->setSource(source);
+  ogre_prog->load();
 
-  return ogre_prog;
+  if (ogre_prog->hasCompileError())
+    return NULL; 
+
+  if (use_cache)
+    saveCachedProgram(ogre_prog, cache_key);
+
+  prog = new gral_cg_program_t();
+  prog->ogre_prog = ogre_prog;
+  prog->params = ogre_prog->createParameters();
+  return prog;
 }
 
 gral_cg_program_t *
@@ -621,20 +1380,9 @@ gral_cg_program_create_from_file (gral_gpu_program_type_t gptype,
                                   const char *entry_point,
                                   const char *profiles)
 {
-  HighLevelGpuProgramPtr ogre_prog = createOgreProgram(gptype, entry_point, profiles);
-  if (ogre_prog.isNull())
-    return NULL;
-
-  ogre_prog->setSourceFile(filename);
-  ogre_prog->load();
-
-  if (ogre_prog->hasCompileError())
-    return NULL; 
-
-  gral_cg_program_t *prog = new gral_cg_program_t();
-  prog->ogre_prog = ogre_prog;
-  prog->params = ogre_prog->createParameters();
-  return prog;
+  DataStreamPtr stream = ResourceGroupManager::getSingleton().openResource(
+          filename, ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+  return createProgram(gptype, stream->getAsString(), entry_point, profiles);
 }
 
 gral_cg_program_t *
@@ -643,20 +1391,7 @@ gral_cg_program_create_from_source (gral_gpu_program_type_t gptype,
                                     const char *entry_point,
                                     const char *profiles)
 {
-  HighLevelGpuProgramPtr ogre_prog = createOgreProgram(gptype, entry_point, profiles);
-  if (ogre_prog.isNull())
-    return NULL;
-
-  ogre_prog->setSource(source_string);
-  ogre_prog->load();
-
-  if (ogre_prog->hasCompileError())
-    return NULL; 
-
-  gral_cg_program_t *prog = new gral_cg_program_t();
-  prog->ogre_prog = ogre_prog;
-  prog->params = ogre_prog->createParameters();
-  return prog;
+  return createProgram(gptype, source_string, entry_point, profiles);
 }
 
 void
@@ -679,14 +1414,29 @@ gral_cg_program_set_constant_float (gral_cg_program_t *prog,
   prog->params->setNamedConstant(name, val);
 }
 
+void
+gral_cg_program_set_constant_float4_array (gral_cg_program_t *prog,
+                                           const char *name, const float *vals,
+                                           size_t count)
+{
+  prog->params->setNamedConstant(name, vals, count, 4);
+}
+
 void
 gral_cg_program_bind (gral_cg_program_t *prog)
 {
+  ++_gral_stats.state_changes_issued;
   RenderSystem *rs = Root::getSingleton().getRenderSystem();
   rs->bindGpuProgram(prog->ogre_prog->_getBindingDelegate());
   rs->bindGpuProgramParameters(prog->ogre_prog->getType(), prog->params);
 }
 
+void
+gral_reset_state_cache (void)
+{
+  validStates = 0;
+}
+
 CullingMode
 convertEnum(gral_culling_mode_t mode)
 {
@@ -28,6 +28,7 @@
 
 namespace Ogre {
   class Viewport;
+  class TexturePtr;
 }
 
 GRAL_BEGIN_DECLS
@@ -35,6 +36,11 @@ GRAL_BEGIN_DECLS
 gral_public gral_surface_t *
 gral_ogre_surface_from_viewport(Ogre::Viewport *vp);
 
+/// Wraps a texture owned by the application; gral_texture_destroy only
+/// releases the wrapper's reference to it.
+gral_public gral_texture_t *
+gral_ogre_texture_from_texture(const Ogre::TexturePtr &tex);
+
 GRAL_END_DECLS
 
 #endif
\ No newline at end of file
@@ -0,0 +1,3173 @@
+/* Copyright (c) 2009, Argiris Kirtzidis
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ARGIRIS KIRTZIDIS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL ARGIRIS KIRTZIDIS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* gral-soft - a gral backend that renders on the CPU.
+ *
+ * Draws are not rasterized when they are submitted. gral_render transforms
+ * the vertices, sets up the triangles and sorts them into bins of
+ * SOFT_TILE_SIZE x SOFT_TILE_SIZE pixels, together with a copy of the render
+ * state they were drawn with. When the rendering is needed (a readback,
+ * gral_soft_surface_get_data, switching to another render surface or locking
+ * a render target texture) the tiles are handed out to a pool of threads.
+ * Each thread replays the bins of a tile in submission order, so the
+ * stencil, depth and colour of a tile stay in its cache while all the passes
+ * of stencil-then-cover are done on it, and no two threads ever touch the
+ * same pixel.
+ *
+ * Coverage is computed with 64 bit integer edge functions over vertices
+ * snapped to 1/256 of a pixel, sampling pixel centres with the top-left
+ * rule, like Direct3D 10 and OpenGL do; the texel offsets are therefore 0.
+ * Blending is done with SSE2 where it is available.
+ *
+ * Only what cairo-gral uses is implemented: triangles (point and line
+ * operations draw nothing), 1D and 2D textures without mipmaps, the
+ * fixed-function texture stages and the fragment programs of
+ * cairo-gral's shaders.cg, which are native C functions selected by their
+ * entry point. Vertex programs are not supported. Attributes are interpolated
+ * linearly in screen space and triangles with a vertex behind the eye are
+ * dropped; gral is only used to draw 2D geometry with w = 1.
+ *
+ * Like the other backends it is only called from one thread at a time.
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+# define SOFT_HAS_SSE2 1
+# include <emmintrin.h>
+#endif
+
+#include "gral-internal.h"
+#include "gral.h"
+#include "gral-soft.h"
+
+#define SOFT_TILE_SHIFT 6
+#define SOFT_TILE_SIZE (1 << SOFT_TILE_SHIFT)
+#define SOFT_SUBPIXEL_BITS 8
+#define SOFT_SUBPIXEL_ONE (1 << SOFT_SUBPIXEL_BITS)
+/* Triangles reaching beyond this many pixels are clipped, keeping the snapped
+ * coordinates within 23 bits and the edge functions within 64 bits. */
+#define SOFT_GUARD_BAND 16384.0
+#define SOFT_MAX_TEXTURE_UNITS 4
+#define SOFT_MAX_VERTEX_SOURCES 8
+#define SOFT_MAX_VERTEX_ELEMENTS 16
+/* z, the diffuse colour and 3 coordinates per texture unit */
+#define SOFT_MAX_ATTRIBUTES (1 + 4 + 3 * SOFT_MAX_TEXTURE_UNITS)
+/* Queued triangles after which gral_render renders them, to bound memory. */
+#define SOFT_MAX_QUEUED_TRIANGLES (1 << 20)
+/* Bin entries of triangles that cover the whole tile. */
+#define SOFT_BIN_FULL 0x80000000u
+
+#ifdef _MSC_VER
+# define SOFT_INLINE __inline
+#else
+# define SOFT_INLINE inline
+#endif
+
+#ifndef MIN
+# define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+# define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#define CLAMP(v, lo, hi) ((v) < (lo) ? (lo) : ((v) > (hi) ? (hi) : (v)))
+
+/* Pixels of textures and surfaces, 32 bit ARGB in native byte order. Draws
+ * that sample a texture hold a reference to its storage, and a texture that
+ * is written to while it is still referenced gets new storage (renaming)
+ * instead of waiting for the draws to be rendered. */
+typedef struct _soft_storage {
+  int ref_count;
+  uint32_t *pixels;
+} soft_storage_t;
+
+struct _gral_texture {
+  gral_texture_type_t type;
+  gral_pixel_format_t format;
+  gral_texture_usage_t usage;
+  unsigned int width, height;
+  soft_storage_t *storage;
+  /// The pixels handed out by a lock of a format other than BGRA
+  unsigned char *lock_buf;
+  gral_buffer_lock_option_t lock_opt;
+  /// The surface of a render target, drawing into storage
+  gral_surface_t *surface;
+};
+
+typedef struct _soft_triangle {
+  uint32_t cmd;
+  /// Index of the first attribute plane in the planes of the surface
+  uint32_t planes;
+  /// Uses the stencil operations of back faces
+  int back_facing;
+  /// Bounds of the pixels that may be covered, max exclusive
+  int minx, miny, maxx, maxy;
+  /// Edge functions a * x + b * y + c in subpixels, >= 0 inside
+  int32_t a[3], b[3];
+  int64_t c[3];
+} soft_triangle_t;
+
+typedef struct _soft_bin {
+  uint32_t *entries;
+  size_t count, size;
+} soft_bin_t;
+
+typedef enum {
+  SOFT_PROGRAM_CUBIC_BEZIER_FILL,
+  SOFT_PROGRAM_DASH,
+  SOFT_PROGRAM_RADIAL_GRADIENT,
+  SOFT_PROGRAM_LINEAR_GRADIENT_STOPS,
+  SOFT_PROGRAM_RADIAL_GRADIENT_STOPS
+} soft_program_kind_t;
+
+/* The uniforms of all the programs; each program uses some of them. */
+typedef struct _soft_constants {
+  float matrix[16];
+  float offset, inv_period;
+  float circle2_posx, circle2_posy, rad1, rad2;
+  float colors[8][4];
+  float seg_scale[2][4];
+  float seg_bias[2][4];
+  float extend[4];
+  float range[4];
+} soft_constants_t;
+
+struct _gral_cg_program {
+  soft_program_kind_t kind;
+  soft_constants_t constants;
+};
+
+/* A texture unit as it was when a draw was submitted. */
+typedef struct _soft_unit {
+  soft_storage_t *storage;
+  unsigned int width, height;
+  gral_bool_t is_1d;
+  gral_bool_t linear;
+  gral_texture_addressing_mode_t address_u, address_v;
+  gral_color_t border;
+  gral_layer_blend_mode_t color_bm, alpha_bm;
+} soft_unit_t;
+
+typedef struct _soft_command {
+  gral_bool_t is_clear;
+  unsigned int clear_buffers;
+  uint32_t clear_color;
+  float clear_depth;
+  uint8_t clear_stencil;
+
+  gral_bool_t depth_test, depth_write;
+  gral_compare_func_t depth_func;
+  gral_bool_t stencil_check;
+  gral_compare_func_t stencil_func;
+  uint8_t stencil_ref, stencil_mask;
+  /// Fail, depth fail and pass operations, of front and back faces
+  gral_stencil_operation_t stencil_ops[2][3];
+  /// Bits of the pixels that are written
+  uint32_t color_mask;
+  gral_scene_blend_factor_t blend_src, blend_dst, blend_src_alpha, blend_dst_alpha;
+
+  /// The diffuse colour when it is the same for all the pixels
+  gral_color_t color;
+  /// First attribute of the diffuse colour, or 0 if it is constant
+  int color_attr;
+  /// First attribute of the coordinates of each unit
+  int tex_attr[SOFT_MAX_TEXTURE_UNITS];
+  int num_attrs;
+  int num_units;
+  soft_unit_t units[SOFT_MAX_TEXTURE_UNITS];
+
+  gral_bool_t has_program;
+  /// The program may discard fragments, so it runs before the stencil test
+  gral_bool_t can_discard;
+  soft_program_kind_t program;
+  soft_constants_t constants;
+} soft_command_t;
+
+struct _gral_surface {
+  int width, height;
+  int tiles_x, tiles_y;
+  uint32_t *color;
+  /// Depth and stencil are stored tile by tile, each tile contiguous
+  float *depth;
+  uint8_t *stencil;
+  /// The render target texture whose storage color is, or NULL
+  gral_texture_t *texture;
+
+  soft_command_t *commands;
+  size_t num_commands, commands_size;
+  soft_triangle_t *triangles;
+  size_t num_triangles, triangles_size;
+  float *planes;
+  size_t num_planes, planes_size;
+  soft_bin_t *bins;
+};
+
+struct _gral_vertex_buffer {
+  size_t vertex_size, num_verts;
+  unsigned char *data;
+};
+
+struct _gral_index_buffer {
+  gral_index_buffer_type_t itype;
+  size_t num_indexes;
+  unsigned char *data;
+};
+
+typedef struct _soft_element {
+  unsigned short source;
+  size_t offset;
+  gral_vertex_element_type_t type;
+  gral_vertex_element_semantic_t semantic;
+  unsigned short index;
+} soft_element_t;
+
+struct _gral_vertex_data {
+  size_t start, count;
+  soft_element_t elements[SOFT_MAX_VERTEX_ELEMENTS];
+  size_t num_elements;
+  size_t vertex_size[SOFT_MAX_VERTEX_SOURCES];
+  gral_vertex_buffer_t *buffers[SOFT_MAX_VERTEX_SOURCES];
+};
+
+struct _gral_index_data {
+  size_t start, count;
+  gral_index_buffer_t *buffer;
+};
+
+struct _gral_readback {
+  unsigned int width, height;
+  uint32_t *data;
+};
+
+/* A transformed vertex. */
+typedef struct _soft_vertex {
+  double x, y;
+  float z;
+  gral_bool_t behind;
+  gral_color_t color;
+  float tex[SOFT_MAX_TEXTURE_UNITS][3];
+} soft_vertex_t;
+
+typedef struct _soft_unit_state {
+  gral_texture_t *texture;
+  gral_matrix_t matrix;
+  size_t coord_set;
+  gral_filter_option_t filter;
+  gral_uvw_addressing_mode_t addressing;
+  gral_color_t border;
+  gral_layer_blend_mode_t color_bm, alpha_bm;
+} soft_unit_state_t;
+
+/* The current render state. */
+static struct {
+  gral_bool_t initialized;
+  gral_surface_t *target;
+  gral_matrix_t view, projection, world;
+  gral_bool_t lighting;
+  gral_culling_mode_t culling;
+  gral_shade_type_t shading;
+  gral_color_t ambient, diffuse, specular, emissive;
+  gral_track_vertex_color_type_t tracking;
+  gral_bool_t depth_test, depth_write;
+  gral_compare_func_t depth_func;
+  gral_bool_t color_write[4];
+  gral_bool_t stencil_check;
+  gral_compare_func_t stencil_func;
+  uint32_t stencil_ref, stencil_mask;
+  gral_stencil_operation_t stencil_ops[3];
+  gral_bool_t stencil_two_sided;
+  gral_scene_blend_factor_t blend_src, blend_dst, blend_src_alpha, blend_dst_alpha;
+  soft_unit_state_t units[SOFT_MAX_TEXTURE_UNITS];
+  gral_cg_program_t *program;
+
+  /// Scratch space for the vertices of a draw
+  soft_vertex_t *vertices;
+  size_t vertices_size;
+} soft;
+
+/* Thread pool. The threads wait on the start semaphore, take tiles until
+ * none is left and post the done semaphore; the calling thread takes tiles
+ * too. */
+
+#ifdef _WIN32
+
+typedef HANDLE soft_thread_t;
+typedef HANDLE soft_semaphore_t;
+typedef LONG soft_atomic_t;
+
+static void
+_soft_semaphore_init (soft_semaphore_t *sem)
+{
+  *sem = CreateSemaphore (NULL, 0, 0x7fffffff, NULL);
+}
+
+static void
+_soft_semaphore_post (soft_semaphore_t *sem)
+{
+  ReleaseSemaphore (*sem, 1, NULL);
+}
+
+static void
+_soft_semaphore_wait (soft_semaphore_t *sem)
+{
+  WaitForSingleObject (*sem, INFINITE);
+}
+
+#define _soft_atomic_increment(ptr) InterlockedIncrement (ptr)
+
+static unsigned int
+_soft_num_processors (void)
+{
+  SYSTEM_INFO info;
+  GetSystemInfo (&info);
+  return info.dwNumberOfProcessors;
+}
+
+#else
+
+typedef pthread_t soft_thread_t;
+typedef struct _soft_semaphore {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  unsigned int count;
+} soft_semaphore_t;
+typedef long soft_atomic_t;
+
+static void
+_soft_semaphore_init (soft_semaphore_t *sem)
+{
+  pthread_mutex_init (&sem->mutex, NULL);
+  pthread_cond_init (&sem->cond, NULL);
+  sem->count = 0;
+}
+
+static void
+_soft_semaphore_post (soft_semaphore_t *sem)
+{
+  pthread_mutex_lock (&sem->mutex);
+  ++sem->count;
+  pthread_cond_signal (&sem->cond);
+  pthread_mutex_unlock (&sem->mutex);
+}
+
+static void
+_soft_semaphore_wait (soft_semaphore_t *sem)
+{
+  pthread_mutex_lock (&sem->mutex);
+  while (sem->count == 0)
+    pthread_cond_wait (&sem->cond, &sem->mutex);
+  --sem->count;
+  pthread_mutex_unlock (&sem->mutex);
+}
+
+#define _soft_atomic_increment(ptr) __sync_add_and_fetch (ptr, 1)
+
+static unsigned int
+_soft_num_processors (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (unsigned int) n : 1;
+}
+
+#endif
+
+static struct {
+  /// Requested threads, 0 for one per processor
+  unsigned int num_threads;
+  gral_bool_t started;
+  /// Threads besides the calling one
+  unsigned int num_workers;
+  soft_thread_t *workers;
+  soft_semaphore_t start, done;
+  gral_surface_t *job;
+  gral_bool_t quit;
+  volatile soft_atomic_t next_tile;
+} pool;
+
+static void _soft_render_tile (gral_surface_t *surf, int tile);
+
+static void
+_soft_run_tiles (gral_surface_t *surf)
+{
+  int num_tiles = surf->tiles_x * surf->tiles_y;
+  for (;;) {
+    int tile = (int) _soft_atomic_increment (&pool.next_tile) - 1;
+    if (tile >= num_tiles)
+      break;
+    _soft_render_tile (surf, tile);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+_soft_worker (LPVOID arg)
+#else
+static void *
+_soft_worker (void *arg)
+#endif
+{
+  (void) arg;
+  for (;;) {
+    _soft_semaphore_wait (&pool.start);
+    if (pool.quit)
+      break;
+    _soft_run_tiles (pool.job);
+    _soft_semaphore_post (&pool.done);
+  }
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static void
+_soft_pool_start (void)
+{
+  static gral_bool_t semaphores;
+  unsigned int i, num_threads = pool.num_threads;
+
+  pool.started = TRUE;
+  if (num_threads == 0)
+    num_threads = _soft_num_processors ();
+  if (num_threads <= 1)
+    return;
+
+  if (! semaphores) {
+    _soft_semaphore_init (&pool.start);
+    _soft_semaphore_init (&pool.done);
+    semaphores = TRUE;
+  }
+  pool.workers = (soft_thread_t *) malloc ((num_threads - 1) * sizeof (soft_thread_t));
+  if (pool.workers == NULL)
+    return;
+  for (i = 0; i < num_threads - 1; ++i) {
+#ifdef _WIN32
+    pool.workers[i] = CreateThread (NULL, 0, _soft_worker, NULL, 0, NULL);
+    if (pool.workers[i] == NULL)
+      break;
+#else
+    if (pthread_create (&pool.workers[i], NULL, _soft_worker, NULL) != 0)
+      break;
+#endif
+  }
+  pool.num_workers = i;
+}
+
+static void
+_soft_pool_stop (void)
+{
+  unsigned int i;
+
+  pool.quit = TRUE;
+  for (i = 0; i < pool.num_workers; ++i)
+    _soft_semaphore_post (&pool.start);
+  for (i = 0; i < pool.num_workers; ++i) {
+#ifdef _WIN32
+    WaitForSingleObject (pool.workers[i], INFINITE);
+    CloseHandle (pool.workers[i]);
+#else
+    pthread_join (pool.workers[i], NULL);
+#endif
+  }
+  free (pool.workers);
+  pool.workers = NULL;
+  pool.num_workers = 0;
+  pool.quit = FALSE;
+  pool.started = FALSE;
+}
+
+/* Renders all the tiles of the surface, in parallel. */
+static void
+_soft_pool_run (gral_surface_t *surf)
+{
+  unsigned int i, num_workers;
+
+  if (! pool.started)
+    _soft_pool_start ();
+
+  /* Not worth waking up threads for a surface of a few tiles. */
+  num_workers = MIN (pool.num_workers, (unsigned int) (surf->tiles_x * surf->tiles_y - 1));
+
+  pool.job = surf;
+  pool.next_tile = 0;
+  for (i = 0; i < num_workers; ++i)
+    _soft_semaphore_post (&pool.start);
+  _soft_run_tiles (surf);
+  for (i = 0; i < num_workers; ++i)
+    _soft_semaphore_wait (&pool.done);
+}
+
+/* Pixels */
+
+static SOFT_INLINE void
+_soft_unpack (uint32_t p, gral_color_t *c)
+{
+  c->a = (float) (p >> 24) * (1.0f / 255);
+  c->r = (float) ((p >> 16) & 0xff) * (1.0f / 255);
+  c->g = (float) ((p >> 8) & 0xff) * (1.0f / 255);
+  c->b = (float) (p & 0xff) * (1.0f / 255);
+}
+
+static SOFT_INLINE uint32_t
+_soft_pack_channel (float v)
+{
+  return (uint32_t) (CLAMP (v, 0.0f, 1.0f) * 255 + 0.5f);
+}
+
+static SOFT_INLINE uint32_t
+_soft_pack (const gral_color_t *c)
+{
+  return (_soft_pack_channel (c->a) << 24) | (_soft_pack_channel (c->r) << 16) |
+         (_soft_pack_channel (c->g) << 8) | _soft_pack_channel (c->b);
+}
+
+static SOFT_INLINE gral_bool_t
+_soft_compare_float (gral_compare_func_t func, float a, float b)
+{
+  switch (func) {
+  case GRAL_COMPARE_FUNC_ALWAYS_FAIL:   return FALSE;
+  case GRAL_COMPARE_FUNC_ALWAYS_PASS:   return TRUE;
+  case GRAL_COMPARE_FUNC_LESS:          return a < b;
+  case GRAL_COMPARE_FUNC_LESS_EQUAL:    return a <= b;
+  case GRAL_COMPARE_FUNC_EQUAL:         return a == b;
+  case GRAL_COMPARE_FUNC_NOT_EQUAL:     return a != b;
+  case GRAL_COMPARE_FUNC_GREATER_EQUAL: return a >= b;
+  case GRAL_COMPARE_FUNC_GREATER:       return a > b;
+  }
+  return TRUE;
+}
+
+static SOFT_INLINE gral_bool_t
+_soft_compare_stencil (gral_compare_func_t func, unsigned int ref, unsigned int val)
+{
+  switch (func) {
+  case GRAL_COMPARE_FUNC_ALWAYS_FAIL:   return FALSE;
+  case GRAL_COMPARE_FUNC_ALWAYS_PASS:   return TRUE;
+  case GRAL_COMPARE_FUNC_LESS:          return ref < val;
+  case GRAL_COMPARE_FUNC_LESS_EQUAL:    return ref <= val;
+  case GRAL_COMPARE_FUNC_EQUAL:         return ref == val;
+  case GRAL_COMPARE_FUNC_NOT_EQUAL:     return ref != val;
+  case GRAL_COMPARE_FUNC_GREATER_EQUAL: return ref >= val;
+  case GRAL_COMPARE_FUNC_GREATER:       return ref > val;
+  }
+  return TRUE;
+}
+
+/* Applies a stencil operation; only the bits in mask are written. */
+static SOFT_INLINE uint8_t
+_soft_stencil_op (gral_stencil_operation_t op, uint8_t val, uint8_t ref, uint8_t mask)
+{
+  uint8_t res;
+  switch (op) {
+  default:
+  case GRAL_STENCIL_OPERATION_KEEP:           return val;
+  case GRAL_STENCIL_OPERATION_ZERO:           res = 0; break;
+  case GRAL_STENCIL_OPERATION_REPLACE:        res = ref; break;
+  case GRAL_STENCIL_OPERATION_INCREMENT:      res = val == 0xff ? val : val + 1; break;
+  case GRAL_STENCIL_OPERATION_DECREMENT:      res = val == 0 ? val : val - 1; break;
+  case GRAL_STENCIL_OPERATION_INCREMENT_WRAP: res = (uint8_t) (val + 1); break;
+  case GRAL_STENCIL_OPERATION_DECREMENT_WRAP: res = (uint8_t) (val - 1); break;
+  case GRAL_STENCIL_OPERATION_INVERT:         res = (uint8_t) ~val; break;
+  }
+  return (uint8_t) ((val & ~mask) | (res & mask));
+}
+
+/* Back faces of two sided stencil operations count the other way. */
+static gral_stencil_operation_t
+_soft_invert_stencil_op (gral_stencil_operation_t op)
+{
+  switch (op) {
+  case GRAL_STENCIL_OPERATION_INCREMENT:      return GRAL_STENCIL_OPERATION_DECREMENT;
+  case GRAL_STENCIL_OPERATION_DECREMENT:      return GRAL_STENCIL_OPERATION_INCREMENT;
+  case GRAL_STENCIL_OPERATION_INCREMENT_WRAP: return GRAL_STENCIL_OPERATION_DECREMENT_WRAP;
+  case GRAL_STENCIL_OPERATION_DECREMENT_WRAP: return GRAL_STENCIL_OPERATION_INCREMENT_WRAP;
+  default:                                    return op;
+  }
+}
+
+/* Textures */
+
+/* Maps a texel index into [0, size), or returns -1 for the border colour. */
+static SOFT_INLINE int
+_soft_address (gral_texture_addressing_mode_t mode, int i, int size)
+{
+  if (i >= 0 && i < size)
+    return i;
+  switch (mode) {
+  case GRAL_TEXTURE_ADDRESSING_MODE_WRAP:
+    i %= size;
+    return i < 0 ? i + size : i;
+  case GRAL_TEXTURE_ADDRESSING_MODE_MIRROR:
+    i %= 2 * size;
+    if (i < 0)
+      i += 2 * size;
+    return i < size ? i : 2 * size - 1 - i;
+  case GRAL_TEXTURE_ADDRESSING_MODE_BORDER:
+    return -1;
+  default:
+    return i < 0 ? 0 : size - 1;
+  }
+}
+
+static SOFT_INLINE void
+_soft_texel (const soft_unit_t *unit, int x, int y, gral_color_t *c)
+{
+  x = _soft_address (unit->address_u, x, unit->width);
+  y = _soft_address (unit->address_v, y, unit->height);
+  if (x < 0 || y < 0)
+    *c = unit->border;
+  else
+    _soft_unpack (unit->storage->pixels[y * unit->width + x], c);
+}
+
+/* Float texture coordinates are limited before they are converted, so that
+ * they don't overflow an int; the texels they address don't change. */
+#define SOFT_COORD_LIMIT 8388608.0f
+
+static void
+_soft_sample (const soft_unit_t *unit, float s, float t, gral_color_t *c)
+{
+  float u = CLAMP (s * unit->width, -SOFT_COORD_LIMIT, SOFT_COORD_LIMIT);
+  float v = CLAMP (t * unit->height, -SOFT_COORD_LIMIT, SOFT_COORD_LIMIT);
+  gral_color_t c00, c10, c01, c11;
+  float fu, fv;
+  int x, y;
+
+  if (! unit->linear) {
+    _soft_texel (unit, (int) floor (u), (int) floor (v), c);
+    return;
+  }
+
+  u -= 0.5f;
+  v -= 0.5f;
+  x = (int) floor (u);
+  y = (int) floor (v);
+  fu = u - x;
+  fv = v - y;
+
+  _soft_texel (unit, x, y, &c00);
+  _soft_texel (unit, x + 1, y, &c10);
+  if (unit->height == 1 && unit->address_v != GRAL_TEXTURE_ADDRESSING_MODE_BORDER) {
+    c01 = c00;
+    c11 = c10;
+  } else {
+    _soft_texel (unit, x, y + 1, &c01);
+    _soft_texel (unit, x + 1, y + 1, &c11);
+  }
+
+#define LERP2(ch) \
+  c->ch = (c00.ch + (c10.ch - c00.ch) * fu) * (1 - fv) + (c01.ch + (c11.ch - c01.ch) * fu) * fv
+  LERP2 (r);
+  LERP2 (g);
+  LERP2 (b);
+  LERP2 (a);
+#undef LERP2
+}
+
+/* Samples a 1D texture, whose v is always the middle of its row. */
+static void
+_soft_sample_1d (const soft_unit_t *unit, float s, gral_color_t *c)
+{
+  _soft_sample (unit, s, 0.5f / unit->height, c);
+}
+
+/* Fixed-function texture stages */
+
+typedef struct _soft_stage_args {
+  const gral_color_t *current, *texture, *diffuse;
+} soft_stage_args_t;
+
+static void
+_soft_stage_source (const gral_layer_blend_mode_t *bm, gral_layer_blend_source_t source,
+                    gral_bool_t first, const soft_stage_args_t *args, gral_color_t *c)
+{
+  switch (source) {
+  default:
+  case GRAL_LAYER_BLEND_SOURCE_CURRENT:
+    *c = *args->current;
+    break;
+  case GRAL_LAYER_BLEND_SOURCE_TEXTURE:
+    *c = *args->texture;
+    break;
+  case GRAL_LAYER_BLEND_SOURCE_DIFFUSE:
+    *c = *args->diffuse;
+    break;
+  case GRAL_LAYER_BLEND_SOURCE_SPECULAR:
+    gral_color_init (c, 0, 0, 0, 0);
+    break;
+  case GRAL_LAYER_BLEND_SOURCE_MANUAL:
+    *c = first ? bm->color_arg1 : bm->color_arg2;
+    c->a = first ? bm->alpha_arg1 : bm->alpha_arg2;
+    break;
+  }
+}
+
+static SOFT_INLINE float
+_soft_stage_op (const gral_layer_blend_mode_t *bm, const soft_stage_args_t *args,
+                float s1, float s2, float diffuse)
+{
+  float f;
+  switch (bm->operation) {
+  default:
+  case GRAL_LAYER_BLEND_OPERATION_SOURCE1:      return s1;
+  case GRAL_LAYER_BLEND_OPERATION_SOURCE2:      return s2;
+  case GRAL_LAYER_BLEND_OPERATION_MODULATE:     return s1 * s2;
+  case GRAL_LAYER_BLEND_OPERATION_MODULATE_X2:  return MIN (s1 * s2 * 2, 1.0f);
+  case GRAL_LAYER_BLEND_OPERATION_MODULATE_X4:  return MIN (s1 * s2 * 4, 1.0f);
+  case GRAL_LAYER_BLEND_OPERATION_ADD:          return MIN (s1 + s2, 1.0f);
+  case GRAL_LAYER_BLEND_OPERATION_ADD_SIGNED:   return CLAMP (s1 + s2 - 0.5f, 0.0f, 1.0f);
+  case GRAL_LAYER_BLEND_OPERATION_ADD_SMOOTH:   return s1 + s2 - s1 * s2;
+  case GRAL_LAYER_BLEND_OPERATION_SUBTRACT:     return MAX (s1 - s2, 0.0f);
+  case GRAL_LAYER_BLEND_OPERATION_BLEND_DIFFUSE_ALPHA: f = args->diffuse->a; break;
+  case GRAL_LAYER_BLEND_OPERATION_BLEND_TEXTURE_ALPHA: f = args->texture->a; break;
+  case GRAL_LAYER_BLEND_OPERATION_BLEND_CURRENT_ALPHA: f = args->current->a; break;
+  case GRAL_LAYER_BLEND_OPERATION_BLEND_MANUAL:        f = bm->factor; break;
+  case GRAL_LAYER_BLEND_OPERATION_BLEND_DIFFUSE_COLOUR: f = diffuse; break;
+  }
+  return s1 * f + s2 * (1 - f);
+}
+
+static void
+_soft_stage (const soft_unit_t *unit, const gral_color_t *texture,
+             const gral_color_t *diffuse, gral_color_t *current)
+{
+  soft_stage_args_t args;
+  gral_color_t s1, s2, res;
+
+  args.current = current;
+  args.texture = texture;
+  args.diffuse = diffuse;
+
+  _soft_stage_source (&unit->color_bm, unit->color_bm.source1, TRUE, &args, &s1);
+  _soft_stage_source (&unit->color_bm, unit->color_bm.source2, FALSE, &args, &s2);
+  if (unit->color_bm.operation == GRAL_LAYER_BLEND_OPERATION_DOTPRODUCT) {
+    float dot = 4 * ((s1.r - 0.5f) * (s2.r - 0.5f) + (s1.g - 0.5f) * (s2.g - 0.5f) +
+                     (s1.b - 0.5f) * (s2.b - 0.5f));
+    res.r = res.g = res.b = CLAMP (dot, 0.0f, 1.0f);
+  } else {
+    res.r = _soft_stage_op (&unit->color_bm, &args, s1.r, s2.r, diffuse->r);
+    res.g = _soft_stage_op (&unit->color_bm, &args, s1.g, s2.g, diffuse->g);
+    res.b = _soft_stage_op (&unit->color_bm, &args, s1.b, s2.b, diffuse->b);
+  }
+
+  _soft_stage_source (&unit->alpha_bm, unit->alpha_bm.source1, TRUE, &args, &s1);
+  _soft_stage_source (&unit->alpha_bm, unit->alpha_bm.source2, FALSE, &args, &s2);
+  if (unit->alpha_bm.operation == GRAL_LAYER_BLEND_OPERATION_DOTPRODUCT)
+    res.a = res.r;
+  else
+    res.a = _soft_stage_op (&unit->alpha_bm, &args, s1.a, s2.a, diffuse->a);
+
+  *current = res;
+}
+
+/* Fragment programs, the C versions of the ones in cairo-gral's shaders.cg */
+
+static float
+_soft_radial_gradient_t (const soft_constants_t *k, float x, float y)
+{
+  const float *m = k->matrix;
+  float posx = m[0] * x + m[1] * y + m[3];
+  float posy = m[4] * x + m[5] * y + m[7];
+  float dr = k->rad2 - k->rad1;
+  float A = k->circle2_posx * k->circle2_posx + k->circle2_posy * k->circle2_posy - dr * dr;
+  float B = -2 * (posx * k->circle2_posx + posy * k->circle2_posy + k->rad1 * dr);
+  float C = posx * posx + posy * posy - k->rad1 * k->rad1;
+  float det = B * B - 4 * A * C;
+  float sqr_det = (float) sqrt (MAX (det, 0.0f));
+
+  if (A < 0)
+    sqr_det = -sqr_det;
+  return (-B + sqr_det) / (2 * A);
+}
+
+static void
+_soft_gradient_stops_color (const soft_constants_t *k, float t, gral_color_t *c)
+{
+  float inside = (t >= k->range[0] && t <= k->range[1]) ? 1.0f : 0.0f;
+  float fract = t - (float) floor (t);
+  float half = t * 0.5f - (float) floor (t * 0.5f);
+  float w[8];
+  int i;
+
+  t = k->extend[0] * t + k->extend[1] * fract + k->extend[2] * (1 - (float) fabs (half * 2 - 1));
+
+  for (i = 0; i < 7; ++i) {
+    float v = t * k->seg_scale[i / 4][i % 4] + k->seg_bias[i / 4][i % 4];
+    w[i] = CLAMP (v, 0.0f, 1.0f);
+  }
+
+  c->r = k->colors[0][0];
+  c->g = k->colors[0][1];
+  c->b = k->colors[0][2];
+  c->a = k->colors[0][3];
+  for (i = 0; i < 7; ++i) {
+    const float *next = k->colors[i + 1];
+    c->r += (next[0] - c->r) * w[i];
+    c->g += (next[1] - c->g) * w[i];
+    c->b += (next[2] - c->b) * w[i];
+    c->a += (next[3] - c->a) * w[i];
+  }
+  c->a *= inside;
+}
+
+/* Runs the program of a draw; returns FALSE if it discards the fragment. */
+static gral_bool_t
+_soft_run_program (const soft_command_t *cmd, const float *tex,
+                   const gral_color_t *diffuse, gral_color_t *c)
+{
+  const soft_constants_t *k = &cmd->constants;
+  float t;
+
+  switch (cmd->program) {
+  case SOFT_PROGRAM_CUBIC_BEZIER_FILL:
+    if (tex[0] * tex[0] * tex[0] - tex[1] * tex[2] > 0)
+      return FALSE;
+    *c = *diffuse;
+    return TRUE;
+
+  case SOFT_PROGRAM_DASH:
+    if (cmd->num_units > 0) {
+      _soft_sample_1d (&cmd->units[0], (tex[0] + k->offset) * k->inv_period, c);
+      if (c->a < 0.5f)
+        return FALSE;
+    }
+    gral_color_init (c, 0, 0, 0, 1);
+    return TRUE;
+
+  case SOFT_PROGRAM_RADIAL_GRADIENT:
+    t = _soft_radial_gradient_t (k, tex[0], tex[1]);
+    if (cmd->num_units > 0)
+      _soft_sample_1d (&cmd->units[0], t, c);
+    else
+      gral_color_init (c, 0, 0, 0, 0);
+    return TRUE;
+
+  case SOFT_PROGRAM_LINEAR_GRADIENT_STOPS:
+    t = k->matrix[0] * tex[0] + k->matrix[1] * tex[1] + k->matrix[3];
+    _soft_gradient_stops_color (k, t, c);
+    return TRUE;
+
+  case SOFT_PROGRAM_RADIAL_GRADIENT_STOPS:
+    t = _soft_radial_gradient_t (k, tex[0], tex[1]);
+    _soft_gradient_stops_color (k, t, c);
+    return TRUE;
+  }
+  return TRUE;
+}
+
+/* Computes the colour of a fragment; returns FALSE if it is discarded. */
+static gral_bool_t
+_soft_shade (const soft_command_t *cmd, const float *planes, float x, float y,
+             gral_color_t *c)
+{
+  gral_color_t diffuse, texel;
+  float tex[SOFT_MAX_TEXTURE_UNITS][3];
+  int i, j;
+
+  if (cmd->color_attr) {
+    const float *p = planes + 3 * cmd->color_attr;
+    diffuse.r = p[0] * x + p[1] * y + p[2];
+    diffuse.g = p[3] * x + p[4] * y + p[5];
+    diffuse.b = p[6] * x + p[7] * y + p[8];
+    diffuse.a = p[9] * x + p[10] * y + p[11];
+  } else {
+    diffuse = cmd->color;
+  }
+
+  for (i = 0; i < SOFT_MAX_TEXTURE_UNITS && cmd->tex_attr[i]; ++i) {
+    const float *p = planes + 3 * cmd->tex_attr[i];
+    for (j = 0; j < 3; ++j, p += 3)
+      tex[i][j] = p[0] * x + p[1] * y + p[2];
+  }
+
+  if (cmd->has_program)
+    return _soft_run_program (cmd, tex[0], &diffuse, c);
+
+  *c = diffuse;
+  for (i = 0; i < cmd->num_units; ++i) {
+    if (cmd->units[i].is_1d)
+      _soft_sample_1d (&cmd->units[i], tex[i][0], &texel);
+    else
+      _soft_sample (&cmd->units[i], tex[i][0], tex[i][1], &texel);
+    _soft_stage (&cmd->units[i], &texel, &diffuse, c);
+  }
+  return TRUE;
+}
+
+/* Blending */
+
+/* Whether the source replaces the pixel. */
+static SOFT_INLINE gral_bool_t
+_soft_blend_is_replace (const soft_command_t *cmd)
+{
+  return cmd->blend_src == GRAL_SCENE_BLEND_FACTOR_SBF_ONE &&
+         cmd->blend_dst == GRAL_SCENE_BLEND_FACTOR_ZERO &&
+         cmd->blend_src_alpha == GRAL_SCENE_BLEND_FACTOR_SBF_ONE &&
+         cmd->blend_dst_alpha == GRAL_SCENE_BLEND_FACTOR_ZERO;
+}
+
+#ifdef SOFT_HAS_SSE2
+
+static SOFT_INLINE __m128
+_soft_blend_factor (gral_scene_blend_factor_t factor, __m128 src, __m128 dst)
+{
+  __m128 one = _mm_set1_ps (1.0f);
+  switch (factor) {
+  default:
+  case GRAL_SCENE_BLEND_FACTOR_SBF_ONE:                return one;
+  case GRAL_SCENE_BLEND_FACTOR_ZERO:                   return _mm_setzero_ps ();
+  case GRAL_SCENE_BLEND_FACTOR_DEST_COLOUR:            return dst;
+  case GRAL_SCENE_BLEND_FACTOR_SOURCE_COLOUR:          return src;
+  case GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_DEST_COLOUR:  return _mm_sub_ps (one, dst);
+  case GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_SOURCE_COLOUR: return _mm_sub_ps (one, src);
+  case GRAL_SCENE_BLEND_FACTOR_DEST_ALPHA:
+    return _mm_shuffle_ps (dst, dst, _MM_SHUFFLE (3, 3, 3, 3));
+  case GRAL_SCENE_BLEND_FACTOR_SOURCE_ALPHA:
+    return _mm_shuffle_ps (src, src, _MM_SHUFFLE (3, 3, 3, 3));
+  case GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_DEST_ALPHA:
+    return _mm_sub_ps (one, _mm_shuffle_ps (dst, dst, _MM_SHUFFLE (3, 3, 3, 3)));
+  case GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_SOURCE_ALPHA:
+    return _mm_sub_ps (one, _mm_shuffle_ps (src, src, _MM_SHUFFLE (3, 3, 3, 3)));
+  }
+}
+
+/* The colour factor, with the alpha factor in the alpha channel. */
+static SOFT_INLINE __m128
+_soft_blend_factors (gral_scene_blend_factor_t factor, gral_scene_blend_factor_t alpha_factor,
+                     __m128 src, __m128 dst)
+{
+  __m128 f = _soft_blend_factor (factor, src, dst);
+
+  if (alpha_factor != factor) {
+    __m128 hi = _mm_unpackhi_ps (f, _soft_blend_factor (alpha_factor, src, dst));
+    f = _mm_shuffle_ps (f, hi, _MM_SHUFFLE (3, 0, 1, 0));
+  }
+  return f;
+}
+
+/* The channels are kept in the byte order of the pixels, b, g, r, a. */
+static SOFT_INLINE uint32_t
+_soft_blend (const soft_command_t *cmd, const gral_color_t *c, uint32_t pixel)
+{
+  __m128i zero = _mm_setzero_si128 ();
+  __m128 src = _mm_setr_ps (c->b, c->g, c->r, c->a);
+  __m128 dst, res;
+  __m128i packed;
+
+  src = _mm_min_ps (_mm_max_ps (src, _mm_setzero_ps ()), _mm_set1_ps (1.0f));
+  if (_soft_blend_is_replace (cmd)) {
+    res = src;
+  } else {
+    packed = _mm_unpacklo_epi16 (_mm_unpacklo_epi8 (_mm_cvtsi32_si128 ((int) pixel), zero), zero);
+    dst = _mm_mul_ps (_mm_cvtepi32_ps (packed), _mm_set1_ps (1.0f / 255));
+    res = _mm_add_ps (_mm_mul_ps (src, _soft_blend_factors (cmd->blend_src, cmd->blend_src_alpha,
+                                                            src, dst)),
+                      _mm_mul_ps (dst, _soft_blend_factors (cmd->blend_dst, cmd->blend_dst_alpha,
+                                                            src, dst)));
+  }
+
+  res = _mm_add_ps (_mm_mul_ps (res, _mm_set1_ps (255.0f)), _mm_set1_ps (0.5f));
+  packed = _mm_cvttps_epi32 (res);
+  packed = _mm_packs_epi32 (packed, packed);
+  packed = _mm_packus_epi16 (packed, packed);
+  return ((uint32_t) _mm_cvtsi128_si32 (packed) & cmd->color_mask) | (pixel & ~cmd->color_mask);
+}
+
+#else
+
+static SOFT_INLINE void
+_soft_blend_factor (gral_scene_blend_factor_t factor, const gral_color_t *src,
+                    const gral_color_t *dst, gral_color_t *f)
+{
+  switch (factor) {
+  default:
+  case GRAL_SCENE_BLEND_FACTOR_SBF_ONE:
+    gral_color_init (f, 1, 1, 1, 1);
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_ZERO:
+    gral_color_init (f, 0, 0, 0, 0);
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_DEST_COLOUR:
+    *f = *dst;
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_SOURCE_COLOUR:
+    *f = *src;
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_DEST_COLOUR:
+    gral_color_init (f, 1 - dst->r, 1 - dst->g, 1 - dst->b, 1 - dst->a);
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_SOURCE_COLOUR:
+    gral_color_init (f, 1 - src->r, 1 - src->g, 1 - src->b, 1 - src->a);
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_DEST_ALPHA:
+    gral_color_init (f, dst->a, dst->a, dst->a, dst->a);
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_SOURCE_ALPHA:
+    gral_color_init (f, src->a, src->a, src->a, src->a);
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_DEST_ALPHA:
+    gral_color_init (f, 1 - dst->a, 1 - dst->a, 1 - dst->a, 1 - dst->a);
+    break;
+  case GRAL_SCENE_BLEND_FACTOR_ONE_MINUS_SOURCE_ALPHA:
+    gral_color_init (f, 1 - src->a, 1 - src->a, 1 - src->a, 1 - src->a);
+    break;
+  }
+}
+
+static SOFT_INLINE uint32_t
+_soft_blend (const soft_command_t *cmd, const gral_color_t *c, uint32_t pixel)
+{
+  gral_color_t src, dst, sf, df, af, res;
+
+  src.r = CLAMP (c->r, 0.0f, 1.0f);
+  src.g = CLAMP (c->g, 0.0f, 1.0f);
+  src.b = CLAMP (c->b, 0.0f, 1.0f);
+  src.a = CLAMP (c->a, 0.0f, 1.0f);
+  if (_soft_blend_is_replace (cmd)) {
+    res = src;
+  } else {
+    _soft_unpack (pixel, &dst);
+    _soft_blend_factor (cmd->blend_src, &src, &dst, &sf);
+    _soft_blend_factor (cmd->blend_dst, &src, &dst, &df);
+    if (cmd->blend_src_alpha != cmd->blend_src) {
+      _soft_blend_factor (cmd->blend_src_alpha, &src, &dst, &af);
+      sf.a = af.a;
+    }
+    if (cmd->blend_dst_alpha != cmd->blend_dst) {
+      _soft_blend_factor (cmd->blend_dst_alpha, &src, &dst, &af);
+      df.a = af.a;
+    }
+    res.r = src.r * sf.r + dst.r * df.r;
+    res.g = src.g * sf.g + dst.g * df.g;
+    res.b = src.b * sf.b + dst.b * df.b;
+    res.a = src.a * sf.a + dst.a * df.a;
+  }
+  return (_soft_pack (&res) & cmd->color_mask) | (pixel & ~cmd->color_mask);
+}
+
+#endif
+
+/* Rasterization */
+
+/* Runs the fragments of n pixels of a row through the stencil and depth tests
+ * and blends them; color, depth and stencil point to the first of them. */
+static void
+_soft_shade_span (const soft_command_t *cmd, const soft_triangle_t *tri,
+                  const float *planes, int x, int y, int n,
+                  uint32_t *color, float *depth, uint8_t *stencil)
+{
+  const gral_stencil_operation_t *ops = cmd->stencil_ops[tri->back_facing];
+  uint8_t ref = cmd->stencil_ref & cmd->stencil_mask;
+  uint8_t mask = cmd->stencil_mask;
+  float fy = y + 0.5f;
+  float fx = x + 0.5f;
+  gral_color_t c;
+  int i;
+
+  /* The stencil passes of stencil-then-cover. */
+  if (cmd->stencil_check && cmd->color_mask == 0 && ! cmd->depth_test && ! cmd->can_discard) {
+    if (cmd->stencil_func == GRAL_COMPARE_FUNC_ALWAYS_PASS) {
+      for (i = 0; i < n; ++i)
+        stencil[i] = _soft_stencil_op (ops[2], stencil[i], cmd->stencil_ref, mask);
+    } else {
+      for (i = 0; i < n; ++i) {
+        gral_bool_t pass = _soft_compare_stencil (cmd->stencil_func, ref, stencil[i] & mask);
+        stencil[i] = _soft_stencil_op (ops[pass ? 2 : 0], stencil[i], cmd->stencil_ref, mask);
+      }
+    }
+    return;
+  }
+
+  for (i = 0; i < n; ++i, fx += 1) {
+    gral_bool_t shaded = FALSE;
+
+    if (cmd->can_discard) {
+      if (! _soft_shade (cmd, planes, fx, fy, &c))
+        continue;
+      shaded = TRUE;
+    }
+
+    if (cmd->stencil_check &&
+        ! _soft_compare_stencil (cmd->stencil_func, ref, stencil[i] & mask)) {
+      stencil[i] = _soft_stencil_op (ops[0], stencil[i], cmd->stencil_ref, mask);
+      continue;
+    }
+
+    if (cmd->depth_test) {
+      float z = planes[0] * fx + planes[1] * fy + planes[2];
+      z = CLAMP (z, 0.0f, 1.0f);
+      if (! _soft_compare_float (cmd->depth_func, z, depth[i])) {
+        if (cmd->stencil_check)
+          stencil[i] = _soft_stencil_op (ops[1], stencil[i], cmd->stencil_ref, mask);
+        continue;
+      }
+      if (cmd->depth_write)
+        depth[i] = z;
+    }
+
+    if (cmd->stencil_check)
+      stencil[i] = _soft_stencil_op (ops[2], stencil[i], cmd->stencil_ref, mask);
+
+    if (cmd->color_mask == 0)
+      continue;
+    if (! shaded)
+      _soft_shade (cmd, planes, fx, fy, &c);
+    color[i] = _soft_blend (cmd, &c, color[i]);
+  }
+}
+
+static void
+_soft_clear_tile (gral_surface_t *surf, const soft_command_t *cmd,
+                  int x0, int y0, int x1, int y1, float *depth, uint8_t *stencil)
+{
+  int x, y;
+
+  for (y = y0; y < y1; ++y) {
+    int row = (y - y0) * SOFT_TILE_SIZE;
+    if (cmd->clear_buffers & GRAL_FRAME_BUFFER_TYPE_COLOUR) {
+      uint32_t *color = surf->color + y * surf->width;
+      for (x = x0; x < x1; ++x)
+        color[x] = cmd->clear_color;
+    }
+    if (cmd->clear_buffers & GRAL_FRAME_BUFFER_TYPE_DEPTH) {
+      for (x = 0; x < x1 - x0; ++x)
+        depth[row + x] = cmd->clear_depth;
+    }
+    if (cmd->clear_buffers & GRAL_FRAME_BUFFER_TYPE_STENCIL)
+      memset (stencil + row, cmd->clear_stencil, x1 - x0);
+  }
+}
+
+static SOFT_INLINE int64_t
+_soft_edge (const soft_triangle_t *tri, int i, int x, int y)
+{
+  return (int64_t) tri->a[i] * ((x << SOFT_SUBPIXEL_BITS) + SOFT_SUBPIXEL_ONE / 2) +
+         (int64_t) tri->b[i] * ((y << SOFT_SUBPIXEL_BITS) + SOFT_SUBPIXEL_ONE / 2) +
+         tri->c[i];
+}
+
+#ifdef SOFT_HAS_SSE2
+
+static SOFT_INLINE __m128i
+_soft_load_epi64 (int64_t lo, int64_t hi)
+{
+  int64_t v[2];
+  v[0] = lo;
+  v[1] = hi;
+  return _mm_loadu_si128 ((const __m128i *) v);
+}
+
+/* The signs of four 64-bit values held in two registers, pixel i in bit i. */
+static SOFT_INLINE int
+_soft_sign_mask (__m128i lo, __m128i hi)
+{
+  return _mm_movemask_ps (_mm_shuffle_ps (_mm_castsi128_ps (lo), _mm_castsi128_ps (hi),
+                                          _MM_SHUFFLE (3, 1, 3, 1)));
+}
+
+/* Finds the pixels of a row inside a triangle, given its edge functions e at
+ * x0 and their steps dx from one pixel to the next. The edge functions of
+ * four pixels are stepped at a time. */
+static SOFT_INLINE void
+_soft_row_span (const int64_t *e, const int64_t *dx, int x0, int x1, int *start, int *end)
+{
+  __m128i lo[3], hi[3], step[3];
+  int i, x, n, outside;
+
+  for (i = 0; i < 3; ++i) {
+    lo[i] = _soft_load_epi64 (e[i], e[i] + dx[i]);
+    hi[i] = _soft_load_epi64 (e[i] + 2 * dx[i], e[i] + 3 * dx[i]);
+    step[i] = _soft_load_epi64 (4 * dx[i], 4 * dx[i]);
+  }
+
+#define SOFT_OUTSIDE() \
+  _soft_sign_mask (_mm_or_si128 (_mm_or_si128 (lo[0], lo[1]), lo[2]), \
+                   _mm_or_si128 (_mm_or_si128 (hi[0], hi[1]), hi[2]))
+#define SOFT_STEP() \
+  for (i = 0; i < 3; ++i) { \
+    lo[i] = _mm_add_epi64 (lo[i], step[i]); \
+    hi[i] = _mm_add_epi64 (hi[i], step[i]); \
+  }
+
+  /* The pixels of a triangle on a row are contiguous. Pixels past x1 are
+   * tested too, and clamped at the end. */
+  for (x = x0; x < x1; x += 4) {
+    outside = SOFT_OUTSIDE ();
+    if (outside != 0xf)
+      break;
+    SOFT_STEP ();
+  }
+  *start = *end = x1;
+  if (x >= x1)
+    return;
+
+  for (n = 0; outside & (1 << n); ++n)
+    ;
+  *start = MIN (x + n, x1);
+  for (;;) {
+    for (; n < 4 && ! (outside & (1 << n)); ++n)
+      ;
+    if (n < 4 || x + 4 >= x1)
+      break;
+    x += 4;
+    n = 0;
+    SOFT_STEP ();
+    outside = SOFT_OUTSIDE ();
+  }
+  *end = MIN (x + n, x1);
+
+#undef SOFT_OUTSIDE
+#undef SOFT_STEP
+}
+
+#else
+
+/* Finds the pixels of a row inside a triangle, given its edge functions e at
+ * x0 and their steps dx from one pixel to the next. */
+static SOFT_INLINE void
+_soft_row_span (const int64_t *e, const int64_t *dx, int x0, int x1, int *start, int *end)
+{
+  int64_t e0 = e[0], e1 = e[1], e2 = e[2];
+  int x;
+
+  /* The pixels of a triangle on a row are contiguous. */
+  for (x = x0; x < x1 && (e0 | e1 | e2) < 0; ++x)
+    e0 += dx[0], e1 += dx[1], e2 += dx[2];
+  *start = x;
+  for (; x < x1 && (e0 | e1 | e2) >= 0; ++x)
+    e0 += dx[0], e1 += dx[1], e2 += dx[2];
+  *end = x;
+}
+
+#endif
+
+static void
+_soft_render_tile (gral_surface_t *surf, int tile)
+{
+  soft_bin_t *bin = &surf->bins[tile];
+  int tile_x0 = (tile % surf->tiles_x) << SOFT_TILE_SHIFT;
+  int tile_y0 = (tile / surf->tiles_x) << SOFT_TILE_SHIFT;
+  int tile_x1 = MIN (tile_x0 + SOFT_TILE_SIZE, surf->width);
+  int tile_y1 = MIN (tile_y0 + SOFT_TILE_SIZE, surf->height);
+  float *depth = surf->depth + (size_t) tile * SOFT_TILE_SIZE * SOFT_TILE_SIZE;
+  uint8_t *stencil = surf->stencil + (size_t) tile * SOFT_TILE_SIZE * SOFT_TILE_SIZE;
+  size_t e;
+
+  for (e = 0; e < bin->count; ++e) {
+    const soft_triangle_t *tri = &surf->triangles[bin->entries[e] & ~SOFT_BIN_FULL];
+    const soft_command_t *cmd = &surf->commands[tri->cmd];
+    const float *planes = surf->planes + tri->planes;
+    gral_bool_t full = (bin->entries[e] & SOFT_BIN_FULL) != 0;
+    int64_t edge[3], dx[3], dy[3];
+    int x0, y0, x1, y1, y, i;
+
+    if (cmd->is_clear) {
+      _soft_clear_tile (surf, cmd, tile_x0, tile_y0, tile_x1, tile_y1, depth, stencil);
+      continue;
+    }
+
+    x0 = MAX (tri->minx, tile_x0);
+    y0 = MAX (tri->miny, tile_y0);
+    x1 = MIN (tri->maxx, tile_x1);
+    y1 = MIN (tri->maxy, tile_y1);
+
+    /* The edge functions are stepped from row to row. */
+    if (! full) {
+      for (i = 0; i < 3; ++i) {
+        edge[i] = _soft_edge (tri, i, x0, y0);
+        dx[i] = (int64_t) tri->a[i] << SOFT_SUBPIXEL_BITS;
+        dy[i] = (int64_t) tri->b[i] << SOFT_SUBPIXEL_BITS;
+      }
+    }
+
+    for (y = y0; y < y1; ++y) {
+      int row = (y - tile_y0) * SOFT_TILE_SIZE - tile_x0;
+      int start = x0, end = x1;
+
+      if (! full) {
+        _soft_row_span (edge, dx, x0, x1, &start, &end);
+        for (i = 0; i < 3; ++i)
+          edge[i] += dy[i];
+      }
+
+      if (start < end)
+        _soft_shade_span (cmd, tri, planes, start, y, end - start,
+                          surf->color + (size_t) y * surf->width + start,
+                          depth + row + start, stencil + row + start);
+    }
+  }
+}
+
+/* Queued work */
+
+/* Makes room for count more elements in an array; FALSE if out of memory. */
+static gral_bool_t
+_soft_reserve (void **array, size_t *size, size_t used, size_t count, size_t elem_size)
+{
+  size_t new_size = *size ? *size : 64;
+  void *new_array;
+
+  if (used + count <= *size)
+    return TRUE;
+  while (new_size < used + count)
+    new_size *= 2;
+  new_array = realloc (*array, new_size * elem_size);
+  if (new_array == NULL)
+    return FALSE;
+  *array = new_array;
+  *size = new_size;
+  return TRUE;
+}
+
+static void
+_soft_storage_release (soft_storage_t *storage)
+{
+  if (--storage->ref_count == 0) {
+    free (storage->pixels);
+    free (storage);
+  }
+}
+
+/* Drops the queued work of the surface, without rendering it. */
+static void
+_soft_reset (gral_surface_t *surf)
+{
+  size_t i;
+  int j;
+
+  for (i = 0; i < surf->num_commands; ++i) {
+    for (j = 0; j < surf->commands[i].num_units; ++j)
+      _soft_storage_release (surf->commands[i].units[j].storage);
+  }
+  for (j = 0; j < surf->tiles_x * surf->tiles_y; ++j)
+    surf->bins[j].count = 0;
+  surf->num_commands = 0;
+  surf->num_triangles = 0;
+  surf->num_planes = 0;
+}
+
+/* Renders the work queued for the surface. */
+static void
+_soft_flush (gral_surface_t *surf)
+{
+  if (surf == NULL || surf->num_commands == 0)
+    return;
+  _soft_pool_run (surf);
+  _soft_reset (surf);
+}
+
+static gral_surface_t *
+_soft_surface_create (int width, int height, soft_storage_t *storage)
+{
+  gral_surface_t *surf = (gral_surface_t *) calloc (1, sizeof (gral_surface_t));
+  size_t tile_pixels;
+  size_t i;
+
+  if (surf == NULL)
+    return NULL;
+  surf->width = width;
+  surf->height = height;
+  surf->tiles_x = (width + SOFT_TILE_SIZE - 1) >> SOFT_TILE_SHIFT;
+  surf->tiles_y = (height + SOFT_TILE_SIZE - 1) >> SOFT_TILE_SHIFT;
+  tile_pixels = (size_t) surf->tiles_x * surf->tiles_y * SOFT_TILE_SIZE * SOFT_TILE_SIZE;
+
+  if (storage != NULL)
+    surf->color = storage->pixels;
+  else
+    surf->color = (uint32_t *) calloc ((size_t) width * height, sizeof (uint32_t));
+  surf->depth = (float *) malloc (tile_pixels * sizeof (float));
+  surf->stencil = (uint8_t *) calloc (tile_pixels, 1);
+  surf->bins = (soft_bin_t *) calloc ((size_t) surf->tiles_x * surf->tiles_y, sizeof (soft_bin_t));
+  if (surf->color == NULL || surf->depth == NULL || surf->stencil == NULL || surf->bins == NULL) {
+    if (storage == NULL)
+      free (surf->color);
+    free (surf->depth);
+    free (surf->stencil);
+    free (surf->bins);
+    free (surf);
+    return NULL;
+  }
+
+  for (i = 0; i < tile_pixels; ++i)
+    surf->depth[i] = 1.0f;
+  return surf;
+}
+
+static void
+_soft_surface_destroy (gral_surface_t *surf)
+{
+  int i;
+
+  _soft_reset (surf);
+  if (soft.target == surf)
+    soft.target = NULL;
+  for (i = 0; i < surf->tiles_x * surf->tiles_y; ++i)
+    free (surf->bins[i].entries);
+  if (surf->texture == NULL)
+    free (surf->color);
+  free (surf->depth);
+  free (surf->stencil);
+  free (surf->bins);
+  free (surf->commands);
+  free (surf->triangles);
+  free (surf->planes);
+  free (surf);
+}
+
+static soft_command_t *
+_soft_add_command (gral_surface_t *surf)
+{
+  soft_command_t *cmd;
+
+  if (! _soft_reserve ((void **) &surf->commands, &surf->commands_size,
+                       surf->num_commands, 1, sizeof (soft_command_t)))
+    return NULL;
+  cmd = &surf->commands[surf->num_commands++];
+  memset (cmd, 0, sizeof (soft_command_t));
+  return cmd;
+}
+
+static void
+_soft_bin_add (soft_bin_t *bin, uint32_t entry)
+{
+  if (_soft_reserve ((void **) &bin->entries, &bin->size, bin->count, 1, sizeof (uint32_t)))
+    bin->entries[bin->count++] = entry;
+}
+
+/* Sorts a triangle, given in pixels, into the bins of the tiles it touches.
+ * Tiles that are outside of one of its edges are skipped, and tiles that are
+ * inside all of them are marked so that their pixels aren't tested. */
+static void
+_soft_bin_triangle (gral_surface_t *surf, uint32_t cmd, uint32_t planes,
+                    gral_bool_t back_facing, const double *xs, const double *ys)
+{
+  soft_triangle_t *tri;
+  int32_t x[3], y[3];
+  int64_t area;
+  int i, tx, ty, tx0, ty0, tx1, ty1;
+  uint32_t index;
+
+  for (i = 0; i < 3; ++i) {
+    x[i] = (int32_t) floor (xs[i] * SOFT_SUBPIXEL_ONE + 0.5);
+    y[i] = (int32_t) floor (ys[i] * SOFT_SUBPIXEL_ONE + 0.5);
+  }
+
+  area = (int64_t) (x[1] - x[0]) * (y[2] - y[0]) - (int64_t) (x[2] - x[0]) * (y[1] - y[0]);
+  if (area == 0)
+    return;
+  if (area < 0) {
+    int32_t t;
+    t = x[1], x[1] = x[2], x[2] = t;
+    t = y[1], y[1] = y[2], y[2] = t;
+  }
+
+  if (! _soft_reserve ((void **) &surf->triangles, &surf->triangles_size,
+                       surf->num_triangles, 1, sizeof (soft_triangle_t)))
+    return;
+  index = (uint32_t) surf->num_triangles;
+  tri = &surf->triangles[index];
+
+  /* Pixels whose centres may be inside. */
+  tri->minx = MAX (MIN (MIN (x[0], x[1]), x[2]) >> SOFT_SUBPIXEL_BITS, 0);
+  tri->miny = MAX (MIN (MIN (y[0], y[1]), y[2]) >> SOFT_SUBPIXEL_BITS, 0);
+  tri->maxx = MIN ((MAX (MAX (x[0], x[1]), x[2]) >> SOFT_SUBPIXEL_BITS) + 1, surf->width);
+  tri->maxy = MIN ((MAX (MAX (y[0], y[1]), y[2]) >> SOFT_SUBPIXEL_BITS) + 1, surf->height);
+  if (tri->minx >= tri->maxx || tri->miny >= tri->maxy)
+    return;
+
+  tri->cmd = cmd;
+  tri->planes = planes;
+  tri->back_facing = back_facing;
+  for (i = 0; i < 3; ++i) {
+    int j = (i + 1) % 3;
+    tri->a[i] = -(y[j] - y[i]);
+    tri->b[i] = x[j] - x[i];
+    tri->c[i] = -(int64_t) tri->a[i] * x[i] - (int64_t) tri->b[i] * y[i];
+    /* Top-left rule: pixel centres on other edges are outside. */
+    if (! (tri->a[i] > 0 || (tri->a[i] == 0 && tri->b[i] > 0)))
+      tri->c[i] -= 1;
+  }
+  ++surf->num_triangles;
+
+  tx0 = tri->minx >> SOFT_TILE_SHIFT;
+  ty0 = tri->miny >> SOFT_TILE_SHIFT;
+  tx1 = (tri->maxx - 1) >> SOFT_TILE_SHIFT;
+  ty1 = (tri->maxy - 1) >> SOFT_TILE_SHIFT;
+  for (ty = ty0; ty <= ty1; ++ty) {
+    int py0 = ty << SOFT_TILE_SHIFT;
+    int py1 = MIN (py0 + SOFT_TILE_SIZE, surf->height) - 1;
+    for (tx = tx0; tx <= tx1; ++tx) {
+      int px0 = tx << SOFT_TILE_SHIFT;
+      int px1 = MIN (px0 + SOFT_TILE_SIZE, surf->width) - 1;
+      gral_bool_t outside = FALSE, inside = TRUE;
+      for (i = 0; i < 3 && ! outside; ++i) {
+        /* The corner of the tile furthest inside the edge, and the one furthest outside. */
+        int64_t in = _soft_edge (tri, i, tri->a[i] > 0 ? px1 : px0, tri->b[i] > 0 ? py1 : py0);
+        int64_t out = _soft_edge (tri, i, tri->a[i] > 0 ? px0 : px1, tri->b[i] > 0 ? py0 : py1);
+        outside = in < 0;
+        inside = inside && out >= 0;
+      }
+      if (! outside)
+        _soft_bin_add (&surf->bins[ty * surf->tiles_x + tx], index | (inside ? SOFT_BIN_FULL : 0));
+    }
+  }
+}
+
+/* Computes the attribute plane v = a * x + b * y + c of a triangle. */
+static void
+_soft_plane (const soft_vertex_t *v0, const soft_vertex_t *v1, const soft_vertex_t *v2,
+             double det, float a0, float a1, float a2, float *plane)
+{
+  double dx1 = v1->x - v0->x, dy1 = v1->y - v0->y;
+  double dx2 = v2->x - v0->x, dy2 = v2->y - v0->y;
+  double a = ((a1 - a0) * dy2 - (a2 - a0) * dy1) / det;
+  double b = ((a2 - a0) * dx1 - (a1 - a0) * dx2) / det;
+  plane[0] = (float) a;
+  plane[1] = (float) b;
+  plane[2] = (float) (a0 - a * v0->x - b * v0->y);
+}
+
+/* Clips a polygon to one side of the guard band. */
+static int
+_soft_clip_polygon (const double *xs, const double *ys, int n, int axis, double limit,
+                    double *out_x, double *out_y)
+{
+  int i, m = 0;
+  for (i = 0; i < n; ++i) {
+    int j = (i + 1) % n;
+    double a = (axis ? ys[i] : xs[i]) * (limit < 0 ? -1 : 1) - fabs (limit);
+    double b = (axis ? ys[j] : xs[j]) * (limit < 0 ? -1 : 1) - fabs (limit);
+    if (a <= 0) {
+      out_x[m] = xs[i];
+      out_y[m] = ys[i];
+      ++m;
+    }
+    if ((a < 0 && b > 0) || (a > 0 && b < 0)) {
+      double t = a / (a - b);
+      out_x[m] = xs[i] + (xs[j] - xs[i]) * t;
+      out_y[m] = ys[i] + (ys[j] - ys[i]) * t;
+      ++m;
+    }
+  }
+  return m;
+}
+
+static void
+_soft_setup_triangle (gral_surface_t *surf, soft_command_t *cmd,
+                      const soft_vertex_t *v0, const soft_vertex_t *v1, const soft_vertex_t *v2)
+{
+  double xs[3], ys[3];
+  double det;
+  gral_bool_t back_facing;
+  uint32_t planes;
+  float *p;
+  int i, j;
+
+  if (v0->behind || v1->behind || v2->behind)
+    return;
+
+  /* Positive when the vertices are clockwise on the screen. */
+  det = (v1->x - v0->x) * (v2->y - v0->y) - (v2->x - v0->x) * (v1->y - v0->y);
+  if (det == 0)
+    return;
+  back_facing = det > 0;
+  if ((soft.culling == GRAL_CULL_CLOCKWISE && det > 0) ||
+      (soft.culling == GRAL_CULL_ANTICLOCKWISE && det < 0))
+    return;
+
+  if (! _soft_reserve ((void **) &surf->planes, &surf->planes_size,
+                       surf->num_planes, 3 * cmd->num_attrs, sizeof (float)))
+    return;
+  planes = (uint32_t) surf->num_planes;
+  p = surf->planes + planes;
+  _soft_plane (v0, v1, v2, det, v0->z, v1->z, v2->z, p);
+  if (cmd->color_attr) {
+    const float *c0 = &v0->color.r, *c1 = &v1->color.r, *c2 = &v2->color.r;
+    for (i = 0; i < 4; ++i) {
+      float *plane = p + 3 * (cmd->color_attr + i);
+      if (soft.shading == GRAL_SHADE_TYPE_FLAT) {
+        /* The first vertex provides the colour, as in Direct3D. */
+        plane[0] = plane[1] = 0;
+        plane[2] = c0[i];
+      } else {
+        _soft_plane (v0, v1, v2, det, c0[i], c1[i], c2[i], plane);
+      }
+    }
+  }
+  for (i = 0; i < SOFT_MAX_TEXTURE_UNITS && cmd->tex_attr[i]; ++i) {
+    for (j = 0; j < 3; ++j)
+      _soft_plane (v0, v1, v2, det, v0->tex[i][j], v1->tex[i][j], v2->tex[i][j],
+                   p + 3 * (cmd->tex_attr[i] + j));
+  }
+  surf->num_planes += 3 * cmd->num_attrs;
+
+  xs[0] = v0->x, xs[1] = v1->x, xs[2] = v2->x;
+  ys[0] = v0->y, ys[1] = v1->y, ys[2] = v2->y;
+  for (i = 0; i < 3; ++i) {
+    if (fabs (xs[i]) > SOFT_GUARD_BAND || fabs (ys[i]) > SOFT_GUARD_BAND)
+      break;
+  }
+
+  if (i == 3) {
+    _soft_bin_triangle (surf, (uint32_t) (cmd - surf->commands), planes, back_facing, xs, ys);
+  } else {
+    /* Clip to the guard band and draw the fan of the polygon left. The planes
+     * of the whole triangle still apply. */
+    double px[2][9], py[2][9];
+    int n = 3;
+    memcpy (px[0], xs, sizeof (xs));
+    memcpy (py[0], ys, sizeof (ys));
+    n = _soft_clip_polygon (px[0], py[0], n, 0, -SOFT_GUARD_BAND, px[1], py[1]);
+    n = _soft_clip_polygon (px[1], py[1], n, 0, SOFT_GUARD_BAND, px[0], py[0]);
+    n = _soft_clip_polygon (px[0], py[0], n, 1, -SOFT_GUARD_BAND, px[1], py[1]);
+    n = _soft_clip_polygon (px[1], py[1], n, 1, SOFT_GUARD_BAND, px[0], py[0]);
+    for (i = 2; i < n; ++i) {
+      xs[0] = px[0][0], xs[1] = px[0][i - 1], xs[2] = px[0][i];
+      ys[0] = py[0][0], ys[1] = py[0][i - 1], ys[2] = py[0][i];
+      _soft_bin_triangle (surf, (uint32_t) (cmd - surf->commands), planes, back_facing, xs, ys);
+    }
+  }
+}
+
+/* Vertex processing */
+
+static size_t
+_soft_element_size (gral_vertex_element_type_t type)
+{
+  switch (type) {
+  case GRAL_VERTEX_ELEMENT_TYPE_FLOAT1: return 4;
+  case GRAL_VERTEX_ELEMENT_TYPE_FLOAT2: return 8;
+  case GRAL_VERTEX_ELEMENT_TYPE_FLOAT3: return 12;
+  case GRAL_VERTEX_ELEMENT_TYPE_FLOAT4: return 16;
+  case GRAL_VERTEX_ELEMENT_TYPE_COLOR:  return 4;
+  case GRAL_VERTEX_ELEMENT_TYPE_SHORT1: return 2;
+  case GRAL_VERTEX_ELEMENT_TYPE_SHORT2: return 4;
+  case GRAL_VERTEX_ELEMENT_TYPE_SHORT3: return 6;
+  case GRAL_VERTEX_ELEMENT_TYPE_SHORT4: return 8;
+  case GRAL_VERTEX_ELEMENT_TYPE_UBYTE4: return 4;
+  }
+  ASSERT_NOT_REACHED;
+  return 0;
+}
+
+/* Reads an element of a vertex, with missing components (0, 0, 0, 1). */
+static void
+_soft_fetch (const gral_vertex_data_t *vd, const soft_element_t *el, size_t vertex, float *out)
+{
+  const gral_vertex_buffer_t *vb = vd->buffers[el->source];
+  const unsigned char *src;
+  float f[4];
+  int16_t s[4];
+  uint32_t argb;
+  int i, n = 0;
+
+  out[0] = out[1] = out[2] = 0;
+  out[3] = 1;
+  if (vb == NULL || vertex >= vb->num_verts)
+    return;
+  src = vb->data + vertex * vb->vertex_size + el->offset;
+
+  switch (el->type) {
+  case GRAL_VERTEX_ELEMENT_TYPE_FLOAT4: ++n;
+  case GRAL_VERTEX_ELEMENT_TYPE_FLOAT3: ++n;
+  case GRAL_VERTEX_ELEMENT_TYPE_FLOAT2: ++n;
+  case GRAL_VERTEX_ELEMENT_TYPE_FLOAT1: ++n;
+    memcpy (f, src, n * sizeof (float));
+    for (i = 0; i < n; ++i)
+      out[i] = f[i];
+    break;
+  case GRAL_VERTEX_ELEMENT_TYPE_SHORT4: ++n;
+  case GRAL_VERTEX_ELEMENT_TYPE_SHORT3: ++n;
+  case GRAL_VERTEX_ELEMENT_TYPE_SHORT2: ++n;
+  case GRAL_VERTEX_ELEMENT_TYPE_SHORT1: ++n;
+    memcpy (s, src, n * sizeof (int16_t));
+    for (i = 0; i < n; ++i)
+      out[i] = s[i];
+    break;
+  case GRAL_VERTEX_ELEMENT_TYPE_COLOR:
+    memcpy (&argb, src, sizeof (argb));
+    out[0] = ((argb >> 16) & 0xff) * (1.0f / 255);
+    out[1] = ((argb >> 8) & 0xff) * (1.0f / 255);
+    out[2] = (argb & 0xff) * (1.0f / 255);
+    out[3] = (argb >> 24) * (1.0f / 255);
+    break;
+  case GRAL_VERTEX_ELEMENT_TYPE_UBYTE4:
+    for (i = 0; i < 4; ++i)
+      out[i] = src[i];
+    break;
+  }
+}
+
+static const soft_element_t *
+_soft_find_element (const gral_vertex_data_t *vd, gral_vertex_element_semantic_t semantic,
+                    unsigned short index)
+{
+  size_t i;
+  for (i = 0; i < vd->num_elements; ++i) {
+    if (vd->elements[i].semantic == semantic && vd->elements[i].index == index)
+      return &vd->elements[i];
+  }
+  return NULL;
+}
+
+static void
+_soft_transform (const gral_matrix_t *m, const float *v, float *out)
+{
+  int i;
+  for (i = 0; i < 4; ++i)
+    out[i] = m->m[i][0] * v[0] + m->m[i][1] * v[1] + m->m[i][2] * v[2] + m->m[i][3] * v[3];
+}
+
+/* The material colour of lit vertices: the emissive colour with the alpha of
+ * the diffuse one, as there are no lights. */
+static void
+_soft_lit_color (const float *vertex_color, gral_color_t *c)
+{
+  const gral_color_t *emissive = &soft.emissive;
+  const gral_color_t *diffuse = &soft.diffuse;
+  gral_color_t tracked;
+
+  if (vertex_color != NULL) {
+    gral_color_init (&tracked, vertex_color[0], vertex_color[1], vertex_color[2], vertex_color[3]);
+    if (soft.tracking & GRAL_TRACK_VERTEX_COLOR_TYPE_EMISSIVE)
+      emissive = &tracked;
+    if (soft.tracking & GRAL_TRACK_VERTEX_COLOR_TYPE_DIFFUSE)
+      diffuse = &tracked;
+  }
+  gral_color_init (c, CLAMP (emissive->r, 0.0f, 1.0f), CLAMP (emissive->g, 0.0f, 1.0f),
+                   CLAMP (emissive->b, 0.0f, 1.0f), CLAMP (diffuse->a, 0.0f, 1.0f));
+}
+
+/* Takes a copy of the render state for a draw. */
+static soft_command_t *
+_soft_record_draw (gral_surface_t *surf, const gral_vertex_data_t *vd)
+{
+  soft_command_t *cmd = _soft_add_command (surf);
+  gral_bool_t vertex_color = _soft_find_element (vd, GRAL_VERTEX_ELEMENT_SEMANTIC_DIFFUSE, 0) != NULL;
+  int i, num_units = 0;
+
+  if (cmd == NULL)
+    return NULL;
+
+  cmd->depth_test = soft.depth_test;
+  cmd->depth_write = soft.depth_write;
+  cmd->depth_func = soft.depth_func;
+  cmd->stencil_check = soft.stencil_check;
+  cmd->stencil_func = soft.stencil_func;
+  cmd->stencil_ref = (uint8_t) soft.stencil_ref;
+  cmd->stencil_mask = (uint8_t) soft.stencil_mask;
+  for (i = 0; i < 3; ++i) {
+    cmd->stencil_ops[0][i] = soft.stencil_ops[i];
+    cmd->stencil_ops[1][i] = soft.stencil_two_sided ?
+                             _soft_invert_stencil_op (soft.stencil_ops[i]) : soft.stencil_ops[i];
+  }
+  cmd->color_mask = (soft.color_write[0] ? 0x00ff0000 : 0) | (soft.color_write[1] ? 0x0000ff00 : 0) |
+                    (soft.color_write[2] ? 0x000000ff : 0) | (soft.color_write[3] ? 0xff000000 : 0);
+  cmd->blend_src = soft.blend_src;
+  cmd->blend_dst = soft.blend_dst;
+  cmd->blend_src_alpha = soft.blend_src_alpha;
+  cmd->blend_dst_alpha = soft.blend_dst_alpha;
+
+  cmd->num_attrs = 1;
+  if (vertex_color) {
+    cmd->color_attr = cmd->num_attrs;
+    cmd->num_attrs += 4;
+  } else if (soft.lighting) {
+    _soft_lit_color (NULL, &cmd->color);
+  } else {
+    gral_color_init (&cmd->color, 1, 1, 1, 1);
+  }
+
+  if (soft.program != NULL) {
+    cmd->has_program = TRUE;
+    cmd->program = soft.program->kind;
+    cmd->constants = soft.program->constants;
+    cmd->can_discard = cmd->program == SOFT_PROGRAM_CUBIC_BEZIER_FILL ||
+                       cmd->program == SOFT_PROGRAM_DASH;
+    cmd->tex_attr[0] = cmd->num_attrs;
+    cmd->num_attrs += 3;
+    /* The samplers of the programs are on unit 0. */
+    if (soft.units[0].texture != NULL)
+      num_units = 1;
+  } else {
+    while (num_units < SOFT_MAX_TEXTURE_UNITS && soft.units[num_units].texture != NULL) {
+      cmd->tex_attr[num_units] = cmd->num_attrs;
+      cmd->num_attrs += 3;
+      ++num_units;
+    }
+  }
+
+  for (i = 0; i < num_units; ++i) {
+    const soft_unit_state_t *state = &soft.units[i];
+    soft_unit_t *unit = &cmd->units[i];
+    unit->storage = state->texture->storage;
+    ++unit->storage->ref_count;
+    unit->width = state->texture->width;
+    unit->height = state->texture->height;
+    unit->is_1d = state->texture->type == GRAL_TEX_TYPE_1D;
+    unit->linear = state->filter != GRAL_FILTER_OPTION_POINT && state->filter != GRAL_FILTER_OPTION_NONE;
+    unit->address_u = state->addressing.u;
+    unit->address_v = state->addressing.v;
+    unit->border = state->border;
+    unit->color_bm = state->color_bm;
+    unit->alpha_bm = state->alpha_bm;
+  }
+  cmd->num_units = num_units;
+  return cmd;
+}
+
+/* Transforms the vertices [start, start + count) of the vertex data. */
+static gral_bool_t
+_soft_process_vertices (const gral_vertex_data_t *vd, const soft_command_t *cmd,
+                        const gral_matrix_t *world)
+{
+  const soft_element_t *pos = _soft_find_element (vd, GRAL_VERTEX_ELEMENT_SEMANTIC_POSITION, 0);
+  const soft_element_t *diffuse = _soft_find_element (vd, GRAL_VERTEX_ELEMENT_SEMANTIC_DIFFUSE, 0);
+  const soft_element_t *coords[SOFT_MAX_TEXTURE_UNITS];
+  gral_matrix_t view_world, mvp;
+  float half_width = 0.5f * soft.target->width;
+  float half_height = 0.5f * soft.target->height;
+  size_t v;
+  int i, j;
+
+  if (! _soft_reserve ((void **) &soft.vertices, &soft.vertices_size, 0, vd->count,
+                       sizeof (soft_vertex_t)))
+    return FALSE;
+
+  gral_matrix_multiply (&view_world, &soft.view, world);
+  gral_matrix_multiply (&mvp, &soft.projection, &view_world);
+
+  for (i = 0; i < SOFT_MAX_TEXTURE_UNITS; ++i) {
+    coords[i] = NULL;
+    if (cmd->tex_attr[i]) {
+      size_t set = cmd->has_program ? 0 : soft.units[i].coord_set;
+      coords[i] = _soft_find_element (vd, GRAL_VERTEX_ELEMENT_SEMANTIC_TEXTURE_COORDINATES,
+                                      (unsigned short) set);
+    }
+  }
+
+  for (v = 0; v < vd->count; ++v) {
+    soft_vertex_t *out = &soft.vertices[v];
+    size_t vertex = vd->start + v;
+    float in[4], clip[4], color[4];
+
+    if (pos != NULL)
+      _soft_fetch (vd, pos, vertex, in);
+    else
+      in[0] = in[1] = in[2] = 0, in[3] = 1;
+    _soft_transform (&mvp, in, clip);
+    out->behind = clip[3] <= 0;
+    if (! out->behind) {
+      out->x = ((double) clip[0] / clip[3] + 1) * half_width;
+      out->y = (1 - (double) clip[1] / clip[3]) * half_height;
+      out->z = clip[2] / clip[3];
+    }
+
+    if (cmd->color_attr) {
+      _soft_fetch (vd, diffuse, vertex, color);
+      if (soft.lighting)
+        _soft_lit_color (color, &out->color);
+      else
+        gral_color_init (&out->color, color[0], color[1], color[2], color[3]);
+    }
+
+    for (i = 0; i < SOFT_MAX_TEXTURE_UNITS && cmd->tex_attr[i]; ++i) {
+      float tc[4];
+      if (coords[i] != NULL)
+        _soft_fetch (vd, coords[i], vertex, in);
+      else
+        in[0] = in[1] = in[2] = 0, in[3] = 1;
+      in[3] = 1;
+      /* Fragment programs get the coordinates untransformed. */
+      if (cmd->has_program)
+        memcpy (tc, in, sizeof (tc));
+      else
+        _soft_transform (&soft.units[i].matrix, in, tc);
+      for (j = 0; j < 3; ++j)
+        out->tex[i][j] = tc[j];
+    }
+  }
+  return TRUE;
+}
+
+static size_t
+_soft_index (const gral_render_operation_t *op, size_t i)
+{
+  const gral_index_buffer_t *ib = op->index_data->buffer;
+  size_t k = op->index_data->start + i;
+  if (ib == NULL || k >= ib->num_indexes)
+    return 0;
+  if (ib->itype == GRAL_INDEX_BUFFER_TYPE_16BIT)
+    return ((const uint16_t *) ib->data)[k];
+  return ((const uint32_t *) ib->data)[k];
+}
+
+static void
+_soft_render (gral_render_operation_t *op, const gral_matrix_t *world)
+{
+  gral_surface_t *surf = soft.target;
+  const gral_vertex_data_t *vd = op->vertex_data;
+  soft_command_t *cmd;
+  size_t count, i;
+
+  if (surf == NULL)
+    return;
+  if (op->operation_type != GRAL_RENDER_OPERATION_TYPE_TRIANGLE_LIST &&
+      op->operation_type != GRAL_RENDER_OPERATION_TYPE_TRIANGLE_STRIP &&
+      op->operation_type != GRAL_RENDER_OPERATION_TYPE_TRIANGLE_FAN)
+    return;
+
+  if (surf->num_triangles >= SOFT_MAX_QUEUED_TRIANGLES)
+    _soft_flush (surf);
+
+  cmd = _soft_record_draw (surf, vd);
+  if (cmd == NULL)
+    return;
+  if (! _soft_process_vertices (vd, cmd, world))
+    return;
+
+  count = op->use_indexes ? op->index_data->count : vd->count;
+  for (i = 0; i + 2 < count; ) {
+    size_t a, b, c;
+    switch (op->operation_type) {
+    default:
+    case GRAL_RENDER_OPERATION_TYPE_TRIANGLE_LIST:
+      a = i, b = i + 1, c = i + 2;
+      i += 3;
+      break;
+    case GRAL_RENDER_OPERATION_TYPE_TRIANGLE_STRIP:
+      /* Keep the winding of every other triangle. */
+      a = i, b = (i & 1) ? i + 2 : i + 1, c = (i & 1) ? i + 1 : i + 2;
+      i += 1;
+      break;
+    case GRAL_RENDER_OPERATION_TYPE_TRIANGLE_FAN:
+      a = 0, b = i + 1, c = i + 2;
+      i += 1;
+      break;
+    }
+    if (op->use_indexes) {
+      a = _soft_index (op, a);
+      b = _soft_index (op, b);
+      c = _soft_index (op, c);
+    }
+    if (a < vd->count && b < vd->count && c < vd->count)
+      _soft_setup_triangle (surf, cmd, &soft.vertices[a], &soft.vertices[b], &soft.vertices[c]);
+  }
+}
+
+/* Render state */
+
+static void
+_soft_init_state (void)
+{
+  int i;
+
+  soft.initialized = TRUE;
+  gral_matrix_init_identity (&soft.view);
+  gral_matrix_init_identity (&soft.projection);
+  gral_matrix_init_identity (&soft.world);
+  soft.culling = GRAL_CULL_CLOCKWISE;
+  soft.shading = GRAL_SHADE_TYPE_GOURAUD;
+  soft.ambient = soft.diffuse = *GRAL_COLOR_WHITE;
+  soft.specular = soft.emissive = *GRAL_COLOR_BLACK;
+  soft.depth_test = soft.depth_write = TRUE;
+  soft.depth_func = GRAL_COMPARE_FUNC_LESS_EQUAL;
+  for (i = 0; i < 4; ++i)
+    soft.color_write[i] = TRUE;
+  soft.stencil_func = GRAL_COMPARE_FUNC_ALWAYS_PASS;
+  soft.stencil_mask = 0xffffffff;
+  soft.blend_src = soft.blend_src_alpha = GRAL_SCENE_BLEND_FACTOR_SBF_ONE;
+  soft.blend_dst = soft.blend_dst_alpha = GRAL_SCENE_BLEND_FACTOR_ZERO;
+
+  for (i = 0; i < SOFT_MAX_TEXTURE_UNITS; ++i) {
+    soft_unit_state_t *unit = &soft.units[i];
+    gral_matrix_init_identity (&unit->matrix);
+    unit->filter = GRAL_FILTER_OPTION_LINEAR;
+    unit->addressing.u = unit->addressing.v = unit->addressing.w = GRAL_TEXTURE_ADDRESSING_MODE_WRAP;
+    unit->border = *GRAL_COLOR_BLACK;
+    unit->color_bm.blend_type = GRAL_LAYER_BLEND_TYPE_COLOR;
+    unit->color_bm.operation = GRAL_LAYER_BLEND_OPERATION_MODULATE;
+    unit->color_bm.source1 = GRAL_LAYER_BLEND_SOURCE_TEXTURE;
+    unit->color_bm.source2 = GRAL_LAYER_BLEND_SOURCE_CURRENT;
+    unit->alpha_bm = unit->color_bm;
+    unit->alpha_bm.blend_type = GRAL_LAYER_BLEND_TYPE_ALPHA;
+  }
+}
+
+/* Every state change is applied; there is nothing to gain by filtering them. */
+static void
+_soft_state_change (void)
+{
+  if (! soft.initialized)
+    _soft_init_state ();
+  ++_gral_stats.state_changes_issued;
+}
+
+static void
+_soft_count_lock (size_t length, gral_buffer_lock_option_t opt)
+{
+  ++_gral_stats.buffer_locks;
+  if (opt != GRAL_BUFFER_LOCK_OPTION_READ_ONLY)
+    _gral_stats.bytes_uploaded += length;
+}
+
+static void
+_soft_count_render (const gral_render_operation_t *op, size_t count)
+{
+  size_t n = op->vertex_data->count;
+
+  _gral_stats.draw_calls += count;
+  _gral_stats.vertices += n * count;
+  if (op->use_indexes) {
+    n = op->index_data->count;
+    _gral_stats.indices += n * count;
+  }
+  if (op->operation_type == GRAL_RENDER_OPERATION_TYPE_TRIANGLE_LIST)
+    _gral_stats.triangles += n / 3 * count;
+  else if ((op->operation_type == GRAL_RENDER_OPERATION_TYPE_TRIANGLE_STRIP ||
+            op->operation_type == GRAL_RENDER_OPERATION_TYPE_TRIANGLE_FAN) && n >= 3)
+    _gral_stats.triangles += (n - 2) * count;
+  if (soft.stencil_check && ! soft.color_write[0] && ! soft.color_write[1] &&
+      ! soft.color_write[2] && ! soft.color_write[3])
+    _gral_stats.stencil_passes += count;
+}
+
+gral_argb_t
+gral_color_to_argb (gral_color_t *col)
+{
+  return ((gral_argb_t) (uint8_t) (col->a * 255) << 24) | ((gral_argb_t) (uint8_t) (col->r * 255) << 16) |
+         ((gral_argb_t) (uint8_t) (col->g * 255) << 8) | (gral_argb_t) (uint8_t) (col->b * 255);
+}
+
+gral_abgr_t
+gral_color_to_abgr (gral_color_t *col)
+{
+  return ((gral_abgr_t) (uint8_t) (col->a * 255) << 24) | ((gral_abgr_t) (uint8_t) (col->b * 255) << 16) |
+         ((gral_abgr_t) (uint8_t) (col->g * 255) << 8) | (gral_abgr_t) (uint8_t) (col->r * 255);
+}
+
+gral_surface_t *
+gral_soft_surface_create (int width, int height)
+{
+  if (! soft.initialized)
+    _soft_init_state ();
+  if (width <= 0 || height <= 0)
+    return NULL;
+  return _soft_surface_create (width, height, NULL);
+}
+
+void
+gral_soft_surface_destroy (gral_surface_t *surf)
+{
+  _soft_surface_destroy (surf);
+}
+
+void *
+gral_soft_surface_get_data (gral_surface_t *surf, int *stride)
+{
+  _soft_flush (surf);
+  if (stride != NULL)
+    *stride = surf->width * 4;
+  return surf->color;
+}
+
+void
+gral_soft_set_num_threads (unsigned int num_threads)
+{
+  if (pool.started)
+    _soft_pool_stop ();
+  pool.num_threads = num_threads;
+}
+
+void
+gral_soft_flush (void)
+{
+  _soft_flush (soft.target);
+}
+
+int
+gral_surface_get_width (gral_surface_t *surf)
+{
+  return surf->width;
+}
+
+int
+gral_surface_get_height (gral_surface_t *surf)
+{
+  return surf->height;
+}
+
+void
+gral_set_render_surface (gral_surface_t *surf)
+{
+  _soft_state_change ();
+  /* Only the render surface has queued work, so draws that sample a render
+   * target texture always see all of its rendering. */
+  if (soft.target != surf)
+    _soft_flush (soft.target);
+  soft.target = surf;
+}
+
+void
+gral_set_view_matrix (const gral_matrix_t *m)
+{
+  _soft_state_change ();
+  soft.view = *m;
+}
+
+void
+gral_set_projection_matrix (const gral_matrix_t *m)
+{
+  _soft_state_change ();
+  soft.projection = *m;
+}
+
+void
+gral_set_world_matrix (const gral_matrix_t *m)
+{
+  _soft_state_change ();
+  soft.world = *m;
+}
+
+float
+gral_get_horizontal_texel_offset (void)
+{
+  return 0;
+}
+
+float
+gral_get_vertical_texel_offset (void)
+{
+  return 0;
+}
+
+gral_capabilities_t
+gral_get_capabilities (void)
+{
+  return (gral_capabilities_t) (GRAL_CAP_FRAGMENT_PROGRAM |
+                                GRAL_CAP_VERTEX_POSITION_FLOAT2 |
+                                GRAL_CAP_VERTEX_POSITION_SHORT2);
+}
+
+void
+gral_set_lighting_enabled (gral_bool_t enabled)
+{
+  _soft_state_change ();
+  soft.lighting = enabled != 0;
+}
+
+void
+gral_set_culling_mode (gral_culling_mode_t mode)
+{
+  _soft_state_change ();
+  soft.culling = mode;
+}
+
+void
+gral_unbind_gpu_program (gral_gpu_program_type_t gptype)
+{
+  _soft_state_change ();
+  if (gptype == GRAL_GPU_PROGRAM_TYPE_FRAGMENT)
+    soft.program = NULL;
+}
+
+void
+gral_set_shading_type (gral_shade_type_t so)
+{
+  _soft_state_change ();
+  soft.shading = so;
+}
+
+void
+gral_set_surface_params (const gral_color_t *ambient,
+                         const gral_color_t *diffuse, const gral_color_t *specular,
+                         const gral_color_t *emissive, float shininess,
+                         gral_track_vertex_color_type_t tracking)
+{
+  _soft_state_change ();
+  soft.ambient = *ambient;
+  soft.diffuse = *diffuse;
+  soft.specular = *specular;
+  soft.emissive = *emissive;
+  soft.tracking = tracking;
+  (void) shininess;
+}
+
+void
+gral_set_depth_buffer_params (gral_bool_t depthTest, gral_bool_t depthWrite,
+                              gral_compare_func_t depthFunction)
+{
+  _soft_state_change ();
+  soft.depth_test = depthTest != 0;
+  soft.depth_write = depthWrite != 0;
+  soft.depth_func = depthFunction;
+}
+
+void
+gral_set_depth_buffer_write_enabled (gral_bool_t enabled)
+{
+  _soft_state_change ();
+  soft.depth_write = enabled != 0;
+}
+
+void
+gral_set_color_buffer_write_enabled (gral_bool_t red,
+                                     gral_bool_t green,
+                                     gral_bool_t blue,
+                                     gral_bool_t alpha)
+{
+  _soft_state_change ();
+  soft.color_write[0] = red != 0;
+  soft.color_write[1] = green != 0;
+  soft.color_write[2] = blue != 0;
+  soft.color_write[3] = alpha != 0;
+}
+
+void
+gral_set_stencil_check_enabled (gral_bool_t enabled)
+{
+  _soft_state_change ();
+  soft.stencil_check = enabled != 0;
+}
+
+void
+gral_set_stencil_buffer_params (gral_compare_func_t func, 
+                                uint32_t refValue, uint32_t mask, 
+                                gral_stencil_operation_t stencilFailOp, 
+                                gral_stencil_operation_t depthFailOp,
+                                gral_stencil_operation_t passOp, 
+                                gral_bool_t twoSidedOperation)
+{
+  _soft_state_change ();
+  soft.stencil_func = func;
+  soft.stencil_ref = refValue;
+  soft.stencil_mask = mask;
+  soft.stencil_ops[0] = stencilFailOp;
+  soft.stencil_ops[1] = depthFailOp;
+  soft.stencil_ops[2] = passOp;
+  soft.stencil_two_sided = twoSidedOperation != 0;
+}
+
+void
+gral_clear_frame_buffer (unsigned int buffers, 
+                         const gral_color_t *color, float depth, unsigned short stencil)
+{
+  gral_surface_t *surf = soft.target;
+  soft_command_t *cmd;
+  soft_triangle_t *tri;
+  uint32_t index;
+  int i;
+
+  if (surf == NULL)
+    return;
+
+  /* Nothing drawn before a clear of everything is visible. */
+  if ((buffers & (GRAL_FRAME_BUFFER_TYPE_COLOUR | GRAL_FRAME_BUFFER_TYPE_DEPTH |
+                  GRAL_FRAME_BUFFER_TYPE_STENCIL)) ==
+      (GRAL_FRAME_BUFFER_TYPE_COLOUR | GRAL_FRAME_BUFFER_TYPE_DEPTH | GRAL_FRAME_BUFFER_TYPE_STENCIL))
+    _soft_reset (surf);
+
+  if (! _soft_reserve ((void **) &surf->triangles, &surf->triangles_size,
+                       surf->num_triangles, 1, sizeof (soft_triangle_t)))
+    return;
+  cmd = _soft_add_command (surf);
+  if (cmd == NULL)
+    return;
+
+  cmd->is_clear = TRUE;
+  cmd->clear_buffers = buffers;
+  cmd->clear_color = _soft_pack (color);
+  cmd->clear_depth = depth;
+  cmd->clear_stencil = (uint8_t) stencil;
+
+  index = (uint32_t) surf->num_triangles++;
+  tri = &surf->triangles[index];
+  memset (tri, 0, sizeof (soft_triangle_t));
+  tri->cmd = (uint32_t) (cmd - surf->commands);
+  for (i = 0; i < surf->tiles_x * surf->tiles_y; ++i)
+    _soft_bin_add (&surf->bins[i], index | SOFT_BIN_FULL);
+}
+
+void
+gral_disable_texture_units_from (size_t tex_unit)
+{
+  size_t i;
+  _soft_state_change ();
+  for (i = tex_unit; i < SOFT_MAX_TEXTURE_UNITS; ++i)
+    soft.units[i].texture = NULL;
+}
+
+void
+gral_set_scene_blending (gral_scene_blend_factor_t sourceFactor, gral_scene_blend_factor_t destFactor)
+{
+  _soft_state_change ();
+  soft.blend_src = soft.blend_src_alpha = sourceFactor;
+  soft.blend_dst = soft.blend_dst_alpha = destFactor;
+}
+
+void
+gral_set_separate_scene_blending (gral_scene_blend_factor_t sourceFactor, gral_scene_blend_factor_t destFactor,
+                                  gral_scene_blend_factor_t sourceFactorAlpha, gral_scene_blend_factor_t destFactorAlpha)
+{
+  _soft_state_change ();
+  soft.blend_src = sourceFactor;
+  soft.blend_dst = destFactor;
+  soft.blend_src_alpha = sourceFactorAlpha;
+  soft.blend_dst_alpha = destFactorAlpha;
+}
+
+void
+gral_render (gral_render_operation_t *op)
+{
+  _soft_count_render (op, 1);
+  _soft_render (op, &soft.world);
+}
+
+void
+gral_render_instanced (gral_render_operation_t *op,
+                       const gral_instance_data_t *instances,
+                       size_t num_instances,
+                       unsigned int data_types)
+{
+  gral_color_t ambient = soft.ambient, diffuse = soft.diffuse;
+  gral_color_t specular = soft.specular, emissive = soft.emissive;
+  gral_track_vertex_color_type_t tracking = soft.tracking;
+  gral_matrix_t tex_matrix = soft.units[0].matrix;
+  size_t i;
+
+  _soft_count_render (op, num_instances);
+
+  /* Emulated like gral-ogre does; each instance is a draw of its own. */
+  for (i = 0; i < num_instances; ++i) {
+    const gral_instance_data_t *inst = &instances[i];
+    gral_matrix_t world = soft.world;
+
+    if (data_types & GRAL_INSTANCE_DATA_TRANSFORM)
+      gral_matrix_multiply (&world, &soft.world, &inst->transform);
+
+    if (data_types & GRAL_INSTANCE_DATA_COLOR) {
+      soft.ambient = soft.specular = *GRAL_COLOR_ZERO;
+      soft.diffuse = soft.emissive = inst->color;
+      soft.tracking = GRAL_TRACK_VERTEX_COLOR_TYPE_NONE;
+    }
+
+    if (data_types & GRAL_INSTANCE_DATA_TEX_RECT) {
+      gral_matrix_t *tex = &soft.units[0].matrix;
+      gral_matrix_init_scale (tex, inst->tex_rect[2] - inst->tex_rect[0],
+                              inst->tex_rect[3] - inst->tex_rect[1], 1);
+      tex->m[0][3] = inst->tex_rect[0];
+      tex->m[1][3] = inst->tex_rect[1];
+    }
+
+    _soft_render (op, &world);
+  }
+
+  soft.ambient = ambient;
+  soft.diffuse = diffuse;
+  soft.specular = specular;
+  soft.emissive = emissive;
+  soft.tracking = tracking;
+  soft.units[0].matrix = tex_matrix;
+}
+
+/* Buffers live in system memory, and draws read them while they are
+ * submitted, so they can be locked in any way at any time. */
+
+gral_vertex_buffer_t *
+gral_vertex_buffer_create (size_t vertexSize, size_t numVerts, gral_buffer_usage_t usage)
+{
+  gral_vertex_buffer_t *vb = (gral_vertex_buffer_t *) malloc (sizeof (gral_vertex_buffer_t));
+  if (vb == NULL)
+    return NULL;
+  vb->vertex_size = vertexSize;
+  vb->num_verts = numVerts;
+  vb->data = (unsigned char *) malloc (vertexSize * numVerts);
+  if (vb->data == NULL) {
+    free (vb);
+    return NULL;
+  }
+  (void) usage;
+  return vb;
+}
+
+void
+gral_vertex_buffer_destroy (gral_vertex_buffer_t *vb)
+{
+  free (vb->data);
+  free (vb);
+}
+
+size_t
+gral_vertex_buffer_get_size (gral_vertex_buffer_t *vb)
+{
+  return vb->vertex_size * vb->num_verts;
+}
+
+void *
+gral_vertex_buffer_lock (gral_vertex_buffer_t *vb, size_t offset, size_t length,
+                         gral_buffer_lock_option_t opt)
+{
+  _soft_count_lock (length, opt);
+  return vb->data + offset;
+}
+
+void
+gral_vertex_buffer_unlock (gral_vertex_buffer_t *vb)
+{
+  (void) vb;
+}
+
+static size_t
+_soft_index_size (gral_index_buffer_type_t itype)
+{
+  return itype == GRAL_INDEX_BUFFER_TYPE_16BIT ? sizeof (uint16_t) : sizeof (uint32_t);
+}
+
+gral_index_buffer_t *
+gral_index_buffer_create (gral_index_buffer_type_t itype, size_t numIndexes, 
+                          gral_buffer_usage_t usage)
+{
+  gral_index_buffer_t *ib = (gral_index_buffer_t *) malloc (sizeof (gral_index_buffer_t));
+  if (ib == NULL)
+    return NULL;
+  ib->itype = itype;
+  ib->num_indexes = numIndexes;
+  ib->data = (unsigned char *) malloc (numIndexes * _soft_index_size (itype));
+  if (ib->data == NULL) {
+    free (ib);
+    return NULL;
+  }
+  (void) usage;
+  return ib;
+}
+
+void
+gral_index_buffer_destroy (gral_index_buffer_t *ib)
+{
+  free (ib->data);
+  free (ib);
+}
+
+size_t
+gral_index_buffer_get_size (gral_index_buffer_t *ib)
+{
+  return ib->num_indexes * _soft_index_size (ib->itype);
+}
+
+void *
+gral_index_buffer_lock (gral_index_buffer_t *ib, size_t offset, size_t length,
+                        gral_buffer_lock_option_t opt)
+{
+  _soft_count_lock (length, opt);
+  return ib->data + offset;
+}
+
+void
+gral_index_buffer_unlock (gral_index_buffer_t *ib)
+{
+  (void) ib;
+}
+
+gral_vertex_data_t *
+gral_vertex_data_create (void)
+{
+  return (gral_vertex_data_t *) calloc (1, sizeof (gral_vertex_data_t));
+}
+
+void
+gral_vertex_data_destroy (gral_vertex_data_t *vd)
+{
+  free (vd);
+}
+
+void
+gral_vertex_data_set_start (gral_vertex_data_t *vd, size_t start)
+{
+  vd->start = start;
+}
+
+void
+gral_vertex_data_set_count (gral_vertex_data_t *vd, size_t count)
+{
+  vd->count = count;
+}
+
+void
+gral_vertex_data_add_element (gral_vertex_data_t *vertex_data,
+                              unsigned short source, size_t offset,
+                              gral_vertex_element_type_t theType,
+                              gral_vertex_element_semantic_t semantic,
+                              unsigned short index)
+{
+  soft_element_t *el;
+
+  if (source >= SOFT_MAX_VERTEX_SOURCES || vertex_data->num_elements >= SOFT_MAX_VERTEX_ELEMENTS)
+    return;
+
+  el = &vertex_data->elements[vertex_data->num_elements++];
+  el->source = source;
+  el->offset = offset;
+  el->type = theType;
+  el->semantic = semantic;
+  el->index = index;
+  vertex_data->vertex_size[source] += _soft_element_size (theType);
+}
+
+size_t
+gral_vertex_data_get_vertex_size (gral_vertex_data_t *vertex_data,
+                                  unsigned short source)
+{
+  return source < SOFT_MAX_VERTEX_SOURCES ? vertex_data->vertex_size[source] : 0;
+}
+
+void
+gral_vertex_data_bind_buffer (gral_vertex_data_t *vd,
+                              unsigned short source,
+                              gral_vertex_buffer_t *buffer)
+{
+  if (source < SOFT_MAX_VERTEX_SOURCES)
+    vd->buffers[source] = buffer;
+}
+
+gral_index_data_t *
+gral_index_data_create (void)
+{
+  return (gral_index_data_t *) calloc (1, sizeof (gral_index_data_t));
+}
+
+void
+gral_index_data_destroy (gral_index_data_t *id)
+{
+  free (id);
+}
+
+void
+gral_index_data_set_start (gral_index_data_t *id, size_t start)
+{
+  id->start = start;
+}
+
+void
+gral_index_data_set_count (gral_index_data_t *id, size_t count)
+{
+  id->count = count;
+}
+
+void
+gral_index_data_set_buffer (gral_index_data_t *id, gral_index_buffer_t *buffer)
+{
+  id->buffer = buffer;
+}
+
+void
+gral_set_texture (size_t unit, gral_bool_t enabled, gral_texture_t *tex)
+{
+  _soft_state_change ();
+  if (unit < SOFT_MAX_TEXTURE_UNITS)
+    soft.units[unit].texture = enabled ? tex : NULL;
+}
+
+void
+gral_set_texture_matrix (size_t unit, const gral_matrix_t *xform, size_t numTexCoords)
+{
+  _soft_state_change ();
+  if (unit < SOFT_MAX_TEXTURE_UNITS)
+    soft.units[unit].matrix = *xform;
+  (void) numTexCoords;
+}
+
+void
+gral_set_texture_coord_set (size_t unit, size_t index)
+{
+  _soft_state_change ();
+  if (unit < SOFT_MAX_TEXTURE_UNITS)
+    soft.units[unit].coord_set = index;
+}
+
+void
+gral_set_texture_unit_filtering (size_t unit, gral_filter_option_t minFilter,
+                                 gral_filter_option_t magFilter, gral_filter_option_t mipFilter)
+{
+  _soft_state_change ();
+  if (unit >= SOFT_MAX_TEXTURE_UNITS)
+    return;
+  /* There are no mipmaps, and anisotropic filtering is done bilinearly. */
+  if (minFilter == GRAL_FILTER_OPTION_POINT && magFilter == GRAL_FILTER_OPTION_POINT)
+    soft.units[unit].filter = GRAL_FILTER_OPTION_POINT;
+  else
+    soft.units[unit].filter = GRAL_FILTER_OPTION_LINEAR;
+  (void) mipFilter;
+}
+
+void
+gral_set_texture_layer_anisotropy (size_t unit, unsigned int maxAnisotropy)
+{
+  _soft_state_change ();
+  (void) unit;
+  (void) maxAnisotropy;
+}
+
+void
+gral_set_texture_mipmap_bias (size_t unit, float bias)
+{
+  _soft_state_change ();
+  (void) unit;
+  (void) bias;
+}
+
+void
+gral_set_texture_blend_mode (size_t unit, const gral_layer_blend_mode_t *bm)
+{
+  _soft_state_change ();
+  if (unit >= SOFT_MAX_TEXTURE_UNITS)
+    return;
+  if (bm->blend_type == GRAL_LAYER_BLEND_TYPE_COLOR)
+    soft.units[unit].color_bm = *bm;
+  else
+    soft.units[unit].alpha_bm = *bm;
+}
+
+void
+gral_set_texture_addressing_mode (size_t unit, const gral_uvw_addressing_mode_t *uvw)
+{
+  _soft_state_change ();
+  if (unit < SOFT_MAX_TEXTURE_UNITS)
+    soft.units[unit].addressing = *uvw;
+}
+
+void
+gral_set_texture_border_color (size_t unit, const gral_color_t *color)
+{
+  _soft_state_change ();
+  if (unit < SOFT_MAX_TEXTURE_UNITS)
+    soft.units[unit].border = *color;
+}
+
+void
+gral_set_texture_coord_calculation (size_t unit, gral_tex_coord_calc_method_t m)
+{
+  _soft_state_change ();
+  /* Only GRAL_TEX_COORD_CALC_METHOD_NONE is supported. */
+  (void) unit;
+  (void) m;
+}
+
+gral_texture_t *
+gral_texture_create (gral_texture_type_t tex_type,
+                     unsigned int width, unsigned int height, unsigned int depth,
+                     int num_mips,
+                     gral_pixel_format_t format, gral_texture_usage_t usage,
+                     gral_bool_t hw_gamma_correction, unsigned int fsaa)
+{
+  gral_texture_t *tex;
+
+  if (tex_type == GRAL_TEX_TYPE_3D || tex_type == GRAL_TEX_TYPE_CUBE_MAP)
+    return NULL;
+  if (tex_type == GRAL_TEX_TYPE_1D || height == 0)
+    height = 1;
+
+  tex = (gral_texture_t *) calloc (1, sizeof (gral_texture_t));
+  if (tex == NULL)
+    return NULL;
+  tex->type = tex_type;
+  tex->format = format;
+  tex->usage = usage;
+  tex->width = width;
+  tex->height = height;
+  tex->storage = (soft_storage_t *) malloc (sizeof (soft_storage_t));
+  if (tex->storage == NULL) {
+    free (tex);
+    return NULL;
+  }
+  tex->storage->ref_count = 1;
+  tex->storage->pixels = (uint32_t *) calloc ((size_t) width * height, sizeof (uint32_t));
+  if (tex->storage->pixels == NULL) {
+    free (tex->storage);
+    free (tex);
+    return NULL;
+  }
+
+  /* There are no mipmaps, gamma correction or multisampling. */
+  (void) depth;
+  (void) num_mips;
+  (void) hw_gamma_correction;
+  (void) fsaa;
+  return tex;
+}
+
+void
+gral_texture_destroy (gral_texture_t *tus)
+{
+  if (tus->surface != NULL)
+    _soft_surface_destroy (tus->surface);
+  _soft_storage_release (tus->storage);
+  free (tus->lock_buf);
+  free (tus);
+}
+
+unsigned int
+gral_texture_get_width (gral_texture_t *tex)
+{
+  return tex->width;
+}
+
+unsigned int
+gral_texture_get_height (gral_texture_t *tex)
+{
+  return tex->height;
+}
+
+gral_surface_t *
+gral_texture_get_surface (gral_texture_t *tex)
+{
+  if (tex->usage != GRAL_TEXTURE_USAGE_RENDERTARGET)
+    return NULL;
+  if (tex->surface == NULL) {
+    tex->surface = _soft_surface_create ((int) tex->width, (int) tex->height, tex->storage);
+    if (tex->surface != NULL)
+      tex->surface->texture = tex;
+  }
+  return tex->surface;
+}
+
+gral_bool_t
+gral_texture_is_flipped (gral_texture_t *tex)
+{
+  (void) tex;
+  return FALSE;
+}
+
+/* Makes the pixels of the texture safe to write: the queued draws that
+ * sample it must not see the new pixels. */
+static void
+_soft_texture_prepare_write (gral_texture_t *tex, gral_buffer_lock_option_t options)
+{
+  soft_storage_t *storage = tex->storage;
+  soft_storage_t *renamed;
+  size_t size;
+
+  if (storage->ref_count == 1)
+    return;
+
+  /* Render targets can't get new storage, since their surface draws into
+   * it; only the render surface has queued work, so render it. */
+  if (tex->surface != NULL) {
+    _soft_flush (soft.target);
+    return;
+  }
+
+  size = (size_t) tex->width * tex->height * sizeof (uint32_t);
+  renamed = (soft_storage_t *) malloc (sizeof (soft_storage_t));
+  if (renamed == NULL) {
+    _soft_flush (soft.target);
+    return;
+  }
+  renamed->ref_count = 1;
+  renamed->pixels = (uint32_t *) malloc (size);
+  if (renamed->pixels == NULL) {
+    free (renamed);
+    _soft_flush (soft.target);
+    return;
+  }
+  if (options != GRAL_BUFFER_LOCK_OPTION_DISCARD)
+    memcpy (renamed->pixels, storage->pixels, size);
+  _soft_storage_release (storage);
+  tex->storage = renamed;
+}
+
+static size_t
+_soft_format_size (gral_pixel_format_t format)
+{
+  return (format == GRAL_PIXEL_FORMAT_BYTE_RGB || format == GRAL_PIXEL_FORMAT_BYTE_BGR) ? 3 : 4;
+}
+
+/* Converts a row between the pixel format and native ARGB. */
+static void
+_soft_convert_row (gral_pixel_format_t format, const unsigned char *src, uint32_t *dst,
+                   unsigned int width)
+{
+  unsigned int i;
+
+  for (i = 0; i < width; ++i) {
+    switch (format) {
+    case GRAL_PIXEL_FORMAT_BYTE_RGB:
+      dst[i] = 0xff000000 | ((uint32_t) src[0] << 16) | ((uint32_t) src[1] << 8) | src[2];
+      src += 3;
+      break;
+    case GRAL_PIXEL_FORMAT_BYTE_BGR:
+      dst[i] = 0xff000000 | ((uint32_t) src[2] << 16) | ((uint32_t) src[1] << 8) | src[0];
+      src += 3;
+      break;
+    case GRAL_PIXEL_FORMAT_BYTE_BGRA:
+      dst[i] = ((uint32_t) src[3] << 24) | ((uint32_t) src[2] << 16) | ((uint32_t) src[1] << 8) | src[0];
+      src += 4;
+      break;
+    case GRAL_PIXEL_FORMAT_BYTE_RGBA:
+      dst[i] = ((uint32_t) src[3] << 24) | ((uint32_t) src[0] << 16) | ((uint32_t) src[1] << 8) | src[2];
+      src += 4;
+      break;
+    }
+  }
+}
+
+static void
+_soft_convert_row_back (gral_pixel_format_t format, const uint32_t *src, unsigned char *dst,
+                        unsigned int width)
+{
+  unsigned int i;
+
+  for (i = 0; i < width; ++i) {
+    uint32_t p = src[i];
+    unsigned char a = (unsigned char) (p >> 24), r = (unsigned char) (p >> 16);
+    unsigned char g = (unsigned char) (p >> 8), b = (unsigned char) p;
+    switch (format) {
+    case GRAL_PIXEL_FORMAT_BYTE_RGB:
+      *dst++ = r, *dst++ = g, *dst++ = b;
+      break;
+    case GRAL_PIXEL_FORMAT_BYTE_BGR:
+      *dst++ = b, *dst++ = g, *dst++ = r;
+      break;
+    case GRAL_PIXEL_FORMAT_BYTE_BGRA:
+      *dst++ = b, *dst++ = g, *dst++ = r, *dst++ = a;
+      break;
+    case GRAL_PIXEL_FORMAT_BYTE_RGBA:
+      *dst++ = r, *dst++ = g, *dst++ = b, *dst++ = a;
+      break;
+    }
+  }
+}
+
+void *
+gral_texture_buffer_lock_full (gral_texture_t *tex, size_t face, size_t mipmap,
+                               gral_buffer_lock_option_t options)
+{
+  size_t row_size = tex->width * _soft_format_size (tex->format);
+  unsigned int y;
+
+  if (face != 0 || mipmap != 0)
+    return NULL;
+
+  _soft_count_lock (row_size * tex->height, options);
+  if (options != GRAL_BUFFER_LOCK_OPTION_READ_ONLY) {
+    ++_gral_stats.texture_uploads;
+    _soft_texture_prepare_write (tex, options);
+  } else if (tex->surface != NULL) {
+    _soft_flush (tex->surface);
+  }
+  tex->lock_opt = options;
+
+  /* Native ARGB is BGRA in memory, on the little endian machines gral runs on. */
+  if (tex->format == GRAL_PIXEL_FORMAT_BYTE_BGRA)
+    return tex->storage->pixels;
+
+  free (tex->lock_buf);
+  tex->lock_buf = (unsigned char *) malloc (row_size * tex->height);
+  if (tex->lock_buf == NULL)
+    return NULL;
+  if (options != GRAL_BUFFER_LOCK_OPTION_DISCARD) {
+    for (y = 0; y < tex->height; ++y)
+      _soft_convert_row_back (tex->format, tex->storage->pixels + (size_t) y * tex->width,
+                              tex->lock_buf + y * row_size, tex->width);
+  }
+  return tex->lock_buf;
+}
+
+void
+gral_texture_buffer_unlock (gral_texture_t *tex, size_t face, size_t mipmap)
+{
+  size_t row_size = tex->width * _soft_format_size (tex->format);
+  unsigned int y;
+
+  if (face != 0 || mipmap != 0 || tex->lock_buf == NULL)
+    return;
+
+  if (tex->lock_opt != GRAL_BUFFER_LOCK_OPTION_READ_ONLY) {
+    for (y = 0; y < tex->height; ++y)
+      _soft_convert_row (tex->format, tex->lock_buf + y * row_size,
+                         tex->storage->pixels + (size_t) y * tex->width, tex->width);
+  }
+  free (tex->lock_buf);
+  tex->lock_buf = NULL;
+}
+
+size_t
+gral_texture_buffer_get_row_pitch (gral_texture_t *tex, size_t face, size_t mipmap)
+{
+  (void) face;
+  (void) mipmap;
+  return tex->width * _soft_format_size (tex->format);
+}
+
+void
+gral_texture_write (gral_texture_t *tex, const void *data, size_t stride)
+{
+  const unsigned char *src = (const unsigned char *) data;
+  unsigned int y;
+
+  _soft_count_lock (tex->width * _soft_format_size (tex->format) * tex->height,
+                    GRAL_BUFFER_LOCK_OPTION_DISCARD);
+  ++_gral_stats.texture_uploads;
+  _soft_texture_prepare_write (tex, GRAL_BUFFER_LOCK_OPTION_DISCARD);
+
+  for (y = 0; y < tex->height; ++y)
+    _soft_convert_row (tex->format, src + y * stride,
+                       tex->storage->pixels + (size_t) y * tex->width, tex->width);
+}
+
+/* Readbacks render the queued work of the surface and copy right away, so
+ * they are always ready. */
+
+gral_readback_t *
+gral_readback_begin (gral_surface_t *surf, int x, int y,
+                     unsigned int width, unsigned int height)
+{
+  gral_readback_t *rb = (gral_readback_t *) malloc (sizeof (gral_readback_t));
+  unsigned int row, col;
+
+  if (rb == NULL)
+    return NULL;
+  rb->width = width;
+  rb->height = height;
+  rb->data = (uint32_t *) malloc ((size_t) width * height * sizeof (uint32_t));
+  if (rb->data == NULL) {
+    free (rb);
+    return NULL;
+  }
+
+  _soft_flush (surf);
+  for (row = 0; row < height; ++row) {
+    int sy = y + (int) row;
+    for (col = 0; col < width; ++col) {
+      int sx = x + (int) col;
+      rb->data[(size_t) row * width + col] =
+        (sx >= 0 && sy >= 0 && sx < surf->width && sy < surf->height) ?
+        surf->color[(size_t) sy * surf->width + sx] : 0;
+    }
+  }
+  return rb;
+}
+
+gral_bool_t
+gral_readback_is_ready (gral_readback_t *rb)
+{
+  (void) rb;
+  return TRUE;
+}
+
+const void *
+gral_readback_map (gral_readback_t *rb, size_t *stride)
+{
+  *stride = rb->width * 4;
+  return rb->data;
+}
+
+void
+gral_readback_destroy (gral_readback_t *rb)
+{
+  free (rb->data);
+  free (rb);
+}
+
+void
+gral_read_pixels (gral_surface_t *surf, int x, int y,
+                  unsigned int width, unsigned int height,
+                  void *data, size_t stride)
+{
+  gral_readback_t *rb = gral_readback_begin (surf, x, y, width, height);
+  size_t rb_stride;
+  const unsigned char *src;
+  unsigned char *dst = (unsigned char *) data;
+  unsigned int row;
+
+  if (rb == NULL)
+    return;
+  src = (const unsigned char *) gral_readback_map (rb, &rb_stride);
+  for (row = 0; row < height; ++row)
+    memcpy (dst + row * stride, src + row * rb_stride, width * 4);
+  gral_readback_destroy (rb);
+}
+
+void
+gral_set_program_cache_dir (const char *dir)
+{
+  /* Programs are native code; there is nothing to cache. */
+  (void) dir;
+}
+
+/* The programs of shaders.cg, by entry point. */
+static const struct {
+  const char *entry_point;
+  soft_program_kind_t kind;
+} _soft_programs[] = {
+  { "fp_cubic_bezier_fill", SOFT_PROGRAM_CUBIC_BEZIER_FILL },
+  { "fp_dash", SOFT_PROGRAM_DASH },
+  { "fp_radial_gradient", SOFT_PROGRAM_RADIAL_GRADIENT },
+  { "fp_linear_gradient_stops", SOFT_PROGRAM_LINEAR_GRADIENT_STOPS },
+  { "fp_radial_gradient_stops", SOFT_PROGRAM_RADIAL_GRADIENT_STOPS }
+};
+
+static gral_cg_program_t *
+_soft_program_create (gral_gpu_program_type_t gptype, const char *entry_point)
+{
+  gral_cg_program_t *prog;
+  size_t i;
+
+  if (gptype != GRAL_GPU_PROGRAM_TYPE_FRAGMENT)
+    return NULL;
+
+  for (i = 0; i < sizeof (_soft_programs) / sizeof (_soft_programs[0]); ++i) {
+    if (strcmp (entry_point, _soft_programs[i].entry_point) == 0)
+      break;
+  }
+  if (i == sizeof (_soft_programs) / sizeof (_soft_programs[0]))
+    return NULL;
+
+  prog = (gral_cg_program_t *) calloc (1, sizeof (gral_cg_program_t));
+  if (prog == NULL)
+    return NULL;
+  prog->kind = _soft_programs[i].kind;
+  return prog;
+}
+
+gral_cg_program_t *
+gral_cg_program_create_from_file (gral_gpu_program_type_t gptype,
+                                  const char *filename,
+                                  const char *entry_point,
+                                  const char *profiles)
+{
+  (void) filename;
+  (void) profiles;
+  return _soft_program_create (gptype, entry_point);
+}
+
+gral_cg_program_t *
+gral_cg_program_create_from_source (gral_gpu_program_type_t gptype,
+                                    const char *source_string,
+                                    const char *entry_point,
+                                    const char *profiles)
+{
+  (void) source_string;
+  (void) profiles;
+  return _soft_program_create (gptype, entry_point);
+}
+
+void
+gral_cg_program_destroy (gral_cg_program_t *prog)
+{
+  if (soft.program == prog)
+    soft.program = NULL;
+  free (prog);
+}
+
+/* The constants of the programs, by name. */
+static const struct {
+  const char *name;
+  size_t offset;
+  size_t size;
+} _soft_program_constants[] = {
+  { "matrix", offsetof (soft_constants_t, matrix), 16 },
+  { "offset", offsetof (soft_constants_t, offset), 1 },
+  { "inv_period", offsetof (soft_constants_t, inv_period), 1 },
+  { "circle2_posx", offsetof (soft_constants_t, circle2_posx), 1 },
+  { "circle2_posy", offsetof (soft_constants_t, circle2_posy), 1 },
+  { "rad1", offsetof (soft_constants_t, rad1), 1 },
+  { "rad2", offsetof (soft_constants_t, rad2), 1 },
+  { "colors", offsetof (soft_constants_t, colors), 32 },
+  { "seg_scale", offsetof (soft_constants_t, seg_scale), 8 },
+  { "seg_bias", offsetof (soft_constants_t, seg_bias), 8 },
+  { "extend", offsetof (soft_constants_t, extend), 4 },
+  { "range", offsetof (soft_constants_t, range), 4 }
+};
+
+/* Returns the floats of a constant and their number, or NULL. */
+static float *
+_soft_program_constant (gral_cg_program_t *prog, const char *name, size_t *size)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof (_soft_program_constants) / sizeof (_soft_program_constants[0]); ++i) {
+    if (strcmp (name, _soft_program_constants[i].name) == 0) {
+      *size = _soft_program_constants[i].size;
+      return (float *) ((char *) &prog->constants + _soft_program_constants[i].offset);
+    }
+  }
+  return NULL;
+}
+
+void
+gral_cg_program_set_constant_matrix (gral_cg_program_t *prog, 
+                                     const char *name, const gral_matrix_t *m)
+{
+  size_t size;
+  float *dst = _soft_program_constant (prog, name, &size);
+
+  if (dst != NULL && size == 16)
+    memcpy (dst, m->_m, 16 * sizeof (float));
+}
+
+void
+gral_cg_program_set_constant_float (gral_cg_program_t *prog, 
+                                    const char *name, float val)
+{
+  size_t size;
+  float *dst = _soft_program_constant (prog, name, &size);
+
+  if (dst != NULL)
+    *dst = val;
+}
+
+void
+gral_cg_program_set_constant_float4_array (gral_cg_program_t *prog,
+                                           const char *name, const float *vals,
+                                           size_t count)
+{
+  size_t size;
+  float *dst = _soft_program_constant (prog, name, &size);
+
+  if (dst != NULL)
+    memcpy (dst, vals, MIN (count * 4, size) * sizeof (float));
+}
+
+void
+gral_cg_program_bind (gral_cg_program_t *prog)
+{
+  _soft_state_change ();
+  soft.program = prog;
+}
+
+void
+gral_reset_state_cache (void)
+{
+  /* State changes are never filtered. */
+}
@@ -0,0 +1,60 @@
+/* Copyright (c) 2009, Argiris Kirtzidis
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ARGIRIS KIRTZIDIS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL ARGIRIS KIRTZIDIS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GRAL_SOFT_H_
+#define _GRAL_SOFT_H_
+
+#include "gral.h"
+
+GRAL_BEGIN_DECLS
+
+/** Creates a surface in system memory for the software backend.
+  @remarks
+    The surface has an 8 bit stencil and a float depth buffer. Its pixels
+    start out transparent black.
+*/
+gral_public gral_surface_t *
+gral_soft_surface_create (int width, int height);
+
+gral_public void
+gral_soft_surface_destroy (gral_surface_t *surf);
+
+/// Finishes the rendering queued for the surface and returns its pixels, which are
+/// premultiplied 32 bit ARGB values in native byte order (like CAIRO_FORMAT_ARGB32),
+/// with the top row first.
+gral_public void *
+gral_soft_surface_get_data (gral_surface_t *surf, int *stride);
+
+/** Sets the number of threads that rasterize the tiles of a surface,
+  including the calling thread. 0, the default, uses one per processor.
+*/
+gral_public void
+gral_soft_set_num_threads (unsigned int num_threads);
+
+/// Finishes the rendering queued for the current render surface
+gral_public void
+gral_soft_flush (void);
+
+GRAL_END_DECLS
+
+#endif /* _GRAL_SOFT_H_ */
@@ -185,7 +185,11 @@ gral_get_vertical_texel_offset (void);
 
 #define GRAL_CAPS_VALUE(val) (1 << val)
 typedef enum {
-  GRAL_CAP_FRAGMENT_PROGRAM = GRAL_CAPS_VALUE(1)
+  GRAL_CAP_FRAGMENT_PROGRAM = GRAL_CAPS_VALUE(1),
+  /// Vertex positions can be GRAL_VERTEX_ELEMENT_TYPE_FLOAT2, with z taken as 0
+  GRAL_CAP_VERTEX_POSITION_FLOAT2 = GRAL_CAPS_VALUE(3),
+  /// Vertex positions can be GRAL_VERTEX_ELEMENT_TYPE_SHORT2 (not normalized), with z taken as 0
+  GRAL_CAP_VERTEX_POSITION_SHORT2 = GRAL_CAPS_VALUE(4)
 } gral_capabilities_t;
 
 gral_public gral_capabilities_t
@@ -333,6 +337,11 @@ typedef enum
 gral_public void
 gral_set_scene_blending (gral_scene_blend_factor_t sourceFactor, gral_scene_blend_factor_t destFactor);
 
+/// Like gral_set_scene_blending, but the alpha channel is blended with its own factors
+gral_public void
+gral_set_separate_scene_blending (gral_scene_blend_factor_t sourceFactor, gral_scene_blend_factor_t destFactor,
+                                  gral_scene_blend_factor_t sourceFactorAlpha, gral_scene_blend_factor_t destFactorAlpha);
+
 /// The rendering operation type to perform
 typedef enum {
   /// A list of points, 1 vertex per point
@@ -370,6 +379,38 @@ typedef struct _gral_render_operation {
 gral_public void
 gral_render (gral_render_operation_t *op);
 
+/// Which members of gral_instance_data_t are used by gral_render_instanced
+typedef enum {
+  /// Apply the instance transform after the world matrix
+  GRAL_INSTANCE_DATA_TRANSFORM = 0x1,
+  /// Use the instance color as the diffuse and emissive material colour
+  GRAL_INSTANCE_DATA_COLOR     = 0x2,
+  /// Map the [0,1] texture coordinates of texture unit 0 into the instance texture rect
+  GRAL_INSTANCE_DATA_TEX_RECT  = 0x4
+} gral_instance_data_type_t;
+
+/** Per-instance data for gral_render_instanced. */
+typedef struct _gral_instance_data {
+  /// Object space transform of the instance
+  gral_matrix_t transform;
+  /// Material colour of the instance; it is only visible when lighting is enabled
+  gral_color_t color;
+  /// Texture rectangle as u0, v0, u1, v1
+  float tex_rect[4];
+} gral_instance_data_t;
+
+/** Renders the same operation once for every instance.
+  @remarks
+    The backends emulate this by issuing one draw per instance, changing only
+    the state selected by data_types in between. The world matrix, surface
+    params and texture matrix of unit 0 are restored afterwards.
+*/
+gral_public void
+gral_render_instanced (gral_render_operation_t *op,
+                       const gral_instance_data_t *instances,
+                       size_t num_instances,
+                       unsigned int data_types);
+
 typedef enum
 {
   /** Static buffer which the application rarely modifies once created. Modifying 
@@ -735,9 +776,26 @@ gral_texture_create (gral_texture_type_t tex_type,
                      gral_pixel_format_t format, gral_texture_usage_t usage,
                      gral_bool_t hw_gamma_correction, unsigned int fsaa);
 
+/// Textures wrapped by the platform layer are only released, not destroyed
 gral_public void
 gral_texture_destroy (gral_texture_t *tus);
 
+gral_public unsigned int
+gral_texture_get_width (gral_texture_t *tex);
+
+gral_public unsigned int
+gral_texture_get_height (gral_texture_t *tex);
+
+/// Returns the surface that draws into a render target texture, or NULL
+/// if the texture isn't a render target
+gral_public gral_surface_t *
+gral_texture_get_surface (gral_texture_t *tex);
+
+/// TRUE if the rows of the texture are stored bottom up, as render targets
+/// are on some render systems
+gral_public gral_bool_t
+gral_texture_is_flipped (gral_texture_t *tex);
+
 gral_public void *
 gral_texture_buffer_lock_full (gral_texture_t *tex, size_t face, size_t mipmap,
                                gral_buffer_lock_option_t options);
@@ -745,6 +803,56 @@ gral_texture_buffer_lock_full (gral_texture_t *tex, size_t face, size_t mipmap,
 gral_public void
 gral_texture_buffer_unlock (gral_texture_t *tex, size_t face, size_t mipmap);
 
+/// Returns the distance in bytes between the rows of a locked texture buffer,
+/// which can be more than the size of a row
+gral_public size_t
+gral_texture_buffer_get_row_pitch (gral_texture_t *tex, size_t face, size_t mipmap);
+
+/// Copies rows of pixels, in the format of the texture, into its first face and mipmap
+gral_public void
+gral_texture_write (gral_texture_t *tex, const void *data, size_t stride);
+
+/** A copy of a rectangle of a surface into a staging buffer. The copy is
+queued on the GPU by gral_readback_begin and downloaded by gral_readback_map.
+@remarks
+    This is not fence based. gral_readback_is_ready only estimates, from the
+    number of frames rendered since the copy was queued, when the download
+    won't stall; gral_readback_map downloads synchronously whenever it is
+    called. The pixels are 32 bit ARGB values in native byte order, like
+    PF_A8R8G8B8, with the top row first, also for render textures that are
+    flipped (see gral_texture_is_flipped).
+*/
+typedef struct _gral_readback gral_readback_t;
+
+gral_public gral_readback_t *
+gral_readback_begin (gral_surface_t *surf, int x, int y,
+                     unsigned int width, unsigned int height);
+
+gral_public gral_bool_t
+gral_readback_is_ready (gral_readback_t *rb);
+
+/// Returns the pixels of the readback and the distance in bytes between their rows,
+/// or NULL if the copy failed
+gral_public const void *
+gral_readback_map (gral_readback_t *rb, size_t *stride);
+
+gral_public void
+gral_readback_destroy (gral_readback_t *rb);
+
+/// Reads a rectangle of the surface into data, waiting for the GPU
+gral_public void
+gral_read_pixels (gral_surface_t *surf, int x, int y,
+                  unsigned int width, unsigned int height,
+                  void *data, size_t stride);
+
+/** Sets the directory where compiled programs are saved, and loaded from
+instead of compiling them again. The cached code is keyed by a hash of the
+program source, entry point and profiles and of the render system and driver.
+NULL, the default, disables the cache. The directory has to exist.
+*/
+gral_public void
+gral_set_program_cache_dir (const char *dir);
+
 gral_public gral_cg_program_t *
 gral_cg_program_create_from_file (gral_gpu_program_type_t gptype,
                                   const char *filename,
@@ -768,9 +876,56 @@ gral_public void
 gral_cg_program_set_constant_float (gral_cg_program_t *prog, 
                                     const char *name, float val);
 
+/// Sets count float4 values, either of an array or of the components of a
+/// float2 or float3 that are padded to four floats
+gral_public void
+gral_cg_program_set_constant_float4_array (gral_cg_program_t *prog,
+                                           const char *name, const float *vals,
+                                           size_t count);
+
 gral_public void
 gral_cg_program_bind (gral_cg_program_t *prog);
 
+/** Counters of the work submitted through gral since the last gral_reset_stats. */
+typedef struct _gral_stats {
+  /// Draws issued to the render system (an emulated instanced render counts once per instance)
+  unsigned long draw_calls;
+  /// Vertices referenced by the draws
+  unsigned long vertices;
+  /// Indices referenced by the draws
+  unsigned long indices;
+  /// Triangles drawn by list, strip and fan draws
+  unsigned long triangles;
+  /// Vertex, index and texture buffer locks
+  unsigned long buffer_locks;
+  /// Bytes made available for writing through buffer locks
+  uint64_t bytes_uploaded;
+  /// Texture buffer locks that were not read-only
+  unsigned long texture_uploads;
+  /// Render state changes passed on to the render system
+  unsigned long state_changes_issued;
+  /// Render state changes dropped because they didn't change anything
+  unsigned long state_changes_filtered;
+  /// Draws done with stencil checking on and all colour writes off
+  unsigned long stencil_passes;
+} gral_stats_t;
+
+gral_public void
+gral_get_stats (gral_stats_t *stats);
+
+gral_public void
+gral_reset_stats (void);
+
+/** Forgets the render state that gral assumes is current.
+  @remarks
+    gral drops state changes that are identical to the last one it issued.
+    Call this whenever something other than gral may have touched the render
+    system (e.g. after the application rendered its scene), otherwise a needed
+    state change could be filtered out.
+*/
+gral_public void
+gral_reset_state_cache (void);
+
 GRAL_END_DECLS
 
 #endif /* _GRAL_H_ */
\ No newline at end of file
@@ -0,0 +1,109 @@
+/* Copyright (c) 2009, Argiris Kirtzidis
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ARGIRIS KIRTZIDIS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL ARGIRIS KIRTZIDIS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* gral-replay - plays gral traces against the software backend and reports
+ * their timing and counters.
+ *
+ *   gral-replay [-s WIDTHxHEIGHT] [-r REPEATS] [-t THREADS] trace...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gral.h"
+#include "gral-soft.h"
+#include "gral-replay.h"
+
+static void
+_usage (void)
+{
+  fprintf (stderr, "usage: gral-replay [-s WIDTHxHEIGHT] [-r REPEATS] [-t THREADS] trace...\n");
+  exit (2);
+}
+
+static void
+_print_result (const char *filename, const gral_replay_result_t *result)
+{
+  const gral_stats_t *stats = &result->stats;
+
+  printf ("%s: %lu frames, %lu calls, %.3f ms",
+          filename, result->frames, result->calls, result->seconds * 1e3);
+  if (result->frames)
+    printf (" (%.3f ms/frame, min %.3f, max %.3f)",
+            result->seconds * 1e3 / result->frames,
+            result->min_frame_seconds * 1e3, result->max_frame_seconds * 1e3);
+  printf ("\n  %lu draws, %lu vertices, %lu indices, %lu triangles, %lu stencil passes\n",
+          stats->draw_calls, stats->vertices, stats->indices, stats->triangles,
+          stats->stencil_passes);
+  printf ("  %lu locks, %llu bytes uploaded, %lu texture uploads, %lu/%lu state changes issued/filtered\n",
+          stats->buffer_locks, (unsigned long long) stats->bytes_uploaded,
+          stats->texture_uploads, stats->state_changes_issued,
+          stats->state_changes_filtered);
+}
+
+int
+main (int argc, char **argv)
+{
+  int width = 1024, height = 768, repeats = 1;
+  int i, n, status = 0;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+    if (i + 1 >= argc)
+      _usage ();
+    if (strcmp (argv[i], "-s") == 0) {
+      if (sscanf (argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+        _usage ();
+    } else if (strcmp (argv[i], "-r") == 0) {
+      if ((repeats = atoi (argv[++i])) <= 0)
+        _usage ();
+    } else if (strcmp (argv[i], "-t") == 0) {
+      gral_soft_set_num_threads ((unsigned int) atoi (argv[++i]));
+    } else {
+      _usage ();
+    }
+  }
+  if (i == argc)
+    _usage ();
+
+  for (; i < argc; ++i) {
+    for (n = 0; n < repeats; ++n) {
+      gral_surface_t *surface = gral_soft_surface_create (width, height);
+      gral_replay_result_t result;
+
+      if (surface == NULL) {
+        fprintf (stderr, "gral-replay: unable to create a %dx%d surface\n", width, height);
+        return 1;
+      }
+      if (gral_replay_file (argv[i], surface, &result) == 0) {
+        gral_soft_flush ();
+        _print_result (argv[i], &result);
+      } else {
+        status = 1;
+      }
+      gral_soft_surface_destroy (surface);
+    }
+  }
+
+  return status;
+}
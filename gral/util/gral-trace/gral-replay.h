@@ -0,0 +1,59 @@
+/* Copyright (c) 2009, Argiris Kirtzidis
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ARGIRIS KIRTZIDIS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL ARGIRIS KIRTZIDIS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GRAL_REPLAY_H_
+#define _GRAL_REPLAY_H_
+
+#include "gral.h"
+
+GRAL_BEGIN_DECLS
+
+typedef struct _gral_replay_result {
+  /// Frames played, i.e. the gral_reset_state_cache calls in the trace
+  unsigned long frames;
+  /// Calls played
+  unsigned long calls;
+  /// Time spent submitting the calls to the backend, in seconds
+  double seconds;
+  /// Fastest and slowest frame, in seconds
+  double min_frame_seconds, max_frame_seconds;
+  /// The gral counters accumulated during the replay
+  gral_stats_t stats;
+} gral_replay_result_t;
+
+/** Plays back a trace recorded by gral-trace against the linked gral backend.
+  @remarks
+    The surfaces of the trace are redirected to @surface, except those of
+    render target textures, which are replayed into the textures. The trace is
+    read into memory first, so only the gral calls are timed; the time does
+    not include the backend finishing the work it queued (e.g. on the GPU)
+    unless the backend does it synchronously.
+  @returns 0 on success, -1 if the file could not be read or is not a valid trace.
+*/
+int
+gral_replay_file (const char *filename, gral_surface_t *surface,
+                  gral_replay_result_t *result);
+
+GRAL_END_DECLS
+
+#endif /* _GRAL_REPLAY_H_ */
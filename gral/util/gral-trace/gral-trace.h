@@ -0,0 +1,148 @@
+/* Copyright (c) 2009, Argiris Kirtzidis
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ARGIRIS KIRTZIDIS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL ARGIRIS KIRTZIDIS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* The gral trace file format, shared by the recording shim (trace.c) and
+ * the replayer (replay.c, driven by gral-replay.c).
+ *
+ * The file starts with GRAL_TRACE_MAGIC followed by the uint32 version and
+ * then a sequence of records, each an uint16 opcode followed by its
+ * arguments. Integers and floats are written in the byte order of the
+ * recording machine, so traces are only replayable on machines with the
+ * same endianness. Objects (buffers, vertex/index data, textures, programs,
+ * readbacks and surfaces) are referred to by uint32 ids that are assigned on
+ * creation; id 0 is NULL.
+ *
+ * Argument encodings:
+ *   u32     - uint32_t
+ *   f32     - float
+ *   color   - 4 x f32 (r, g, b, a)
+ *   matrix  - 16 x f32, row major
+ *   string  - u32 length, then that many bytes (no terminator)
+ *   bytes   - u32 length, then that many bytes
+ */
+
+#ifndef _GRAL_TRACE_H_
+#define _GRAL_TRACE_H_
+
+#define GRAL_TRACE_MAGIC "GRALTRCE"
+#define GRAL_TRACE_VERSION 2
+
+/* Bytes per pixel of the formats gral textures are created with. */
+#define GRAL_TRACE_PIXEL_SIZE(format) \
+  ((format) == GRAL_PIXEL_FORMAT_BYTE_RGB || (format) == GRAL_PIXEL_FORMAT_BYTE_BGR ? 3 : 4)
+
+/* Size of a texture dimension at a mipmap level. */
+#define GRAL_TRACE_MIP_SIZE(size, mip) ((size) >> (mip) ? (size) >> (mip) : 1)
+
+typedef enum {
+  GRAL_TRACE_OP_END = 0,
+
+  /* Render state */
+  GRAL_TRACE_OP_SET_RENDER_SURFACE,        /* u32 surface, u32 width, u32 height */
+  GRAL_TRACE_OP_SET_VIEW_MATRIX,           /* matrix */
+  GRAL_TRACE_OP_SET_PROJECTION_MATRIX,     /* matrix */
+  GRAL_TRACE_OP_SET_WORLD_MATRIX,          /* matrix */
+  GRAL_TRACE_OP_SET_LIGHTING_ENABLED,      /* u32 */
+  GRAL_TRACE_OP_SET_CULLING_MODE,          /* u32 */
+  GRAL_TRACE_OP_UNBIND_GPU_PROGRAM,        /* u32 */
+  GRAL_TRACE_OP_SET_SHADING_TYPE,          /* u32 */
+  GRAL_TRACE_OP_SET_SURFACE_PARAMS,        /* 4 x color, f32 shininess, u32 tracking */
+  GRAL_TRACE_OP_SET_DEPTH_BUFFER_PARAMS,   /* u32 test, u32 write, u32 func */
+  GRAL_TRACE_OP_SET_DEPTH_BUFFER_WRITE,    /* u32 */
+  GRAL_TRACE_OP_SET_COLOR_BUFFER_WRITE,    /* 4 x u32 */
+  GRAL_TRACE_OP_SET_STENCIL_CHECK_ENABLED, /* u32 */
+  GRAL_TRACE_OP_SET_STENCIL_BUFFER_PARAMS, /* 7 x u32 */
+  GRAL_TRACE_OP_CLEAR_FRAME_BUFFER,        /* u32 buffers, color, f32 depth, u32 stencil */
+  GRAL_TRACE_OP_DISABLE_TEXTURE_UNITS_FROM,/* u32 */
+  GRAL_TRACE_OP_SET_SCENE_BLENDING,        /* u32 src, u32 dst */
+  GRAL_TRACE_OP_RESET_STATE_CACHE,         /* - , also marks the start of a frame */
+
+  /* Rendering */
+  GRAL_TRACE_OP_RENDER,                    /* u32 vertex_data, u32 type, u32 use_indexes, u32 index_data */
+  GRAL_TRACE_OP_RENDER_INSTANCED,          /* as RENDER, u32 data_types, u32 count,
+                                              count x (matrix, color, 4 x f32) */
+
+  /* Vertex and index buffers */
+  GRAL_TRACE_OP_VERTEX_BUFFER_CREATE,      /* u32 id, u32 vertex_size, u32 num_verts, u32 usage */
+  GRAL_TRACE_OP_VERTEX_BUFFER_DESTROY,     /* u32 id */
+  GRAL_TRACE_OP_VERTEX_BUFFER_LOCK,        /* u32 id, u32 offset, u32 length, u32 options */
+  GRAL_TRACE_OP_VERTEX_BUFFER_UNLOCK,      /* u32 id, bytes written while locked */
+  GRAL_TRACE_OP_INDEX_BUFFER_CREATE,       /* u32 id, u32 type, u32 num_indexes, u32 usage */
+  GRAL_TRACE_OP_INDEX_BUFFER_DESTROY,      /* u32 id */
+  GRAL_TRACE_OP_INDEX_BUFFER_LOCK,         /* u32 id, u32 offset, u32 length, u32 options */
+  GRAL_TRACE_OP_INDEX_BUFFER_UNLOCK,       /* u32 id, bytes written while locked */
+
+  /* Vertex and index data */
+  GRAL_TRACE_OP_VERTEX_DATA_CREATE,        /* u32 id */
+  GRAL_TRACE_OP_VERTEX_DATA_DESTROY,       /* u32 id */
+  GRAL_TRACE_OP_VERTEX_DATA_SET_START,     /* u32 id, u32 */
+  GRAL_TRACE_OP_VERTEX_DATA_SET_COUNT,     /* u32 id, u32 */
+  GRAL_TRACE_OP_VERTEX_DATA_ADD_ELEMENT,   /* u32 id, u32 source, u32 offset, u32 type, u32 semantic, u32 index */
+  GRAL_TRACE_OP_VERTEX_DATA_BIND_BUFFER,   /* u32 id, u32 source, u32 vertex_buffer */
+  GRAL_TRACE_OP_INDEX_DATA_CREATE,         /* u32 id */
+  GRAL_TRACE_OP_INDEX_DATA_DESTROY,        /* u32 id */
+  GRAL_TRACE_OP_INDEX_DATA_SET_START,      /* u32 id, u32 */
+  GRAL_TRACE_OP_INDEX_DATA_SET_COUNT,      /* u32 id, u32 */
+  GRAL_TRACE_OP_INDEX_DATA_SET_BUFFER,     /* u32 id, u32 index_buffer */
+
+  /* Texture units */
+  GRAL_TRACE_OP_SET_TEXTURE,               /* u32 unit, u32 enabled, u32 texture */
+  GRAL_TRACE_OP_SET_TEXTURE_MATRIX,        /* u32 unit, matrix, u32 num_tex_coords */
+  GRAL_TRACE_OP_SET_TEXTURE_COORD_SET,     /* u32 unit, u32 index */
+  GRAL_TRACE_OP_SET_TEXTURE_UNIT_FILTERING,/* u32 unit, u32 min, u32 mag, u32 mip */
+  GRAL_TRACE_OP_SET_TEXTURE_LAYER_ANISOTROPY, /* u32 unit, u32 */
+  GRAL_TRACE_OP_SET_TEXTURE_MIPMAP_BIAS,   /* u32 unit, f32 */
+  GRAL_TRACE_OP_SET_TEXTURE_BLEND_MODE,    /* u32 unit, 4 x u32, 2 x color, 3 x f32 */
+  GRAL_TRACE_OP_SET_TEXTURE_ADDRESSING_MODE, /* u32 unit, 3 x u32 */
+  GRAL_TRACE_OP_SET_TEXTURE_BORDER_COLOR,  /* u32 unit, color */
+  GRAL_TRACE_OP_SET_TEXTURE_COORD_CALCULATION, /* u32 unit, u32 */
+
+  /* Textures */
+  GRAL_TRACE_OP_TEXTURE_CREATE,            /* u32 id, u32 type, u32 width, u32 height, u32 depth,
+                                              u32 num_mips, u32 format, u32 usage, u32 gamma, u32 fsaa */
+  GRAL_TRACE_OP_TEXTURE_DESTROY,           /* u32 id */
+  GRAL_TRACE_OP_TEXTURE_LOCK,              /* u32 id, u32 face, u32 mipmap, u32 options */
+  GRAL_TRACE_OP_TEXTURE_UNLOCK,            /* u32 id, u32 face, u32 mipmap, u32 row_size, bytes written
+                                              while locked, as rows of row_size without the row pitch padding */
+
+  /* Programs */
+  GRAL_TRACE_OP_CG_PROGRAM_CREATE_FROM_FILE,   /* u32 id, u32 type, string filename, string entry, string profiles */
+  GRAL_TRACE_OP_CG_PROGRAM_CREATE_FROM_SOURCE, /* u32 id, u32 type, string source, string entry, string profiles */
+  GRAL_TRACE_OP_CG_PROGRAM_DESTROY,        /* u32 id */
+  GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_MATRIX, /* u32 id, string name, matrix */
+  GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_FLOAT,  /* u32 id, string name, f32 */
+  GRAL_TRACE_OP_CG_PROGRAM_BIND,           /* u32 id */
+
+  /* Added in version 2 */
+  GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_FLOAT4_ARRAY, /* u32 id, string name, u32 count, count x 4 x f32 */
+  GRAL_TRACE_OP_TEXTURE_WRITE,             /* u32 id, u32 row_size, bytes, as rows of row_size */
+  GRAL_TRACE_OP_TEXTURE_GET_SURFACE,       /* u32 texture, u32 surface */
+  GRAL_TRACE_OP_READ_PIXELS,               /* u32 surface, u32 x, u32 y, u32 width, u32 height */
+  GRAL_TRACE_OP_READBACK_BEGIN,            /* u32 id, u32 surface, u32 x, u32 y, u32 width, u32 height */
+  GRAL_TRACE_OP_READBACK_MAP,              /* u32 id */
+  GRAL_TRACE_OP_READBACK_DESTROY,          /* u32 id */
+  GRAL_TRACE_OP_SET_PROGRAM_CACHE_DIR,     /* string dir, empty for NULL */
+  GRAL_TRACE_OP_SET_SEPARATE_SCENE_BLENDING /* u32 src, u32 dst, u32 src_alpha, u32 dst_alpha */
+} gral_trace_op_t;
+
+#endif /* _GRAL_TRACE_H_ */
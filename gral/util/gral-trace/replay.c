@@ -0,0 +1,929 @@
+/* Copyright (c) 2009, Argiris Kirtzidis
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ARGIRIS KIRTZIDIS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL ARGIRIS KIRTZIDIS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Plays back a trace recorded by gral-trace, see gral-replay.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#include "gral.h"
+#include "gral-trace.h"
+#include "gral-replay.h"
+
+typedef struct _replay_object {
+  void *ptr;
+  /* The region locked for writing. Texture locks are locked_rows rows,
+   * locked_pitch bytes apart; buffer locks are locked_length bytes. */
+  void *locked;
+  size_t locked_length, locked_pitch, locked_rows;
+  /* Textures: their size and format, and the id of their surface if the
+   * trace asked for it. */
+  uint32_t width, height, depth, format;
+  uint32_t surface;
+} replay_object_t;
+
+typedef struct _replay {
+  const unsigned char *pos, *end;
+  int error;
+
+  gral_surface_t *surface;
+  replay_object_t *objects;
+  uint32_t num_objects;
+} replay_t;
+
+static double
+_get_time (void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&count);
+  return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static const void *
+_read (replay_t *r, size_t size)
+{
+  const void *data = r->pos;
+
+  if (r->error || (size_t) (r->end - r->pos) < size) {
+    r->error = 1;
+    return NULL;
+  }
+  r->pos += size;
+  return data;
+}
+
+static uint32_t
+_read_u32 (replay_t *r)
+{
+  uint32_t val = 0;
+  const void *data = _read (r, sizeof (val));
+  if (data)
+    memcpy (&val, data, sizeof (val));
+  return val;
+}
+
+static float
+_read_f32 (replay_t *r)
+{
+  float val = 0;
+  const void *data = _read (r, sizeof (val));
+  if (data)
+    memcpy (&val, data, sizeof (val));
+  return val;
+}
+
+static void
+_read_color (replay_t *r, gral_color_t *color)
+{
+  color->r = _read_f32 (r);
+  color->g = _read_f32 (r);
+  color->b = _read_f32 (r);
+  color->a = _read_f32 (r);
+}
+
+static void
+_read_matrix (replay_t *r, gral_matrix_t *m)
+{
+  const void *data = _read (r, sizeof (m->m));
+  if (data)
+    memcpy (m->m, data, sizeof (m->m));
+  else
+    gral_matrix_init_identity (m);
+}
+
+static const void *
+_read_bytes (replay_t *r, uint32_t *length)
+{
+  *length = _read_u32 (r);
+  return _read (r, *length);
+}
+
+/* Returns a nul-terminated copy that the caller frees. */
+static char *
+_read_string (replay_t *r)
+{
+  uint32_t length;
+  const void *data = _read_bytes (r, &length);
+  char *str;
+
+  if (data == NULL)
+    return NULL;
+  str = malloc (length + 1);
+  if (str == NULL) {
+    r->error = 1;
+    return NULL;
+  }
+  memcpy (str, data, length);
+  str[length] = '\0';
+  return str;
+}
+
+static replay_object_t *
+_lookup (replay_t *r, uint32_t id)
+{
+  if (id == 0 || id >= r->num_objects)
+    return NULL;
+  return &r->objects[id];
+}
+
+static void *
+_read_object (replay_t *r)
+{
+  replay_object_t *obj = _lookup (r, _read_u32 (r));
+  return obj ? obj->ptr : NULL;
+}
+
+static void
+_define_object (replay_t *r, uint32_t id, void *ptr)
+{
+  if (id >= r->num_objects) {
+    uint32_t num = r->num_objects ? r->num_objects : 64;
+    replay_object_t *objects;
+
+    while (num <= id)
+      num *= 2;
+    objects = realloc (r->objects, num * sizeof (replay_object_t));
+    if (objects == NULL) {
+      r->error = 1;
+      return;
+    }
+    memset (objects + r->num_objects, 0, (num - r->num_objects) * sizeof (replay_object_t));
+    r->objects = objects;
+    r->num_objects = num;
+  }
+
+  memset (&r->objects[id], 0, sizeof (replay_object_t));
+  r->objects[id].ptr = ptr;
+}
+
+static void
+_undefine_object (replay_t *r, uint32_t id)
+{
+  replay_object_t *obj = _lookup (r, id);
+  if (obj)
+    memset (obj, 0, sizeof (replay_object_t));
+}
+
+/* The surface a trace surface id refers to: a render target texture's
+ * surface if the trace asked for it, otherwise the replay surface. */
+static gral_surface_t *
+_read_surface (replay_t *r)
+{
+  replay_object_t *obj = _lookup (r, _read_u32 (r));
+  return obj && obj->ptr ? obj->ptr : r->surface;
+}
+
+/* Copies the bytes recorded on a buffer unlock into the region that was
+ * locked, failing if they don't fit in it. */
+static void
+_read_locked (replay_t *r, replay_object_t *obj)
+{
+  uint32_t length;
+  const void *data = _read_bytes (r, &length);
+
+  if (obj != NULL && obj->locked != NULL && data != NULL) {
+    if (length <= obj->locked_length)
+      memcpy (obj->locked, data, length);
+    else
+      r->error = 1;
+  }
+  if (obj != NULL)
+    obj->locked = NULL;
+}
+
+/* Copies the rows recorded on a texture unlock into the locked region,
+ * which may have a different row pitch than the recording had. */
+static void
+_read_locked_rows (replay_t *r, replay_object_t *obj)
+{
+  uint32_t row_size = _read_u32 (r), length, rows, i;
+  const unsigned char *data = _read_bytes (r, &length);
+
+  if (obj != NULL && obj->locked != NULL && data != NULL && row_size != 0) {
+    rows = length / row_size;
+    if (row_size <= obj->locked_pitch && rows <= obj->locked_rows) {
+      for (i = 0; i < rows; ++i)
+        memcpy ((unsigned char *) obj->locked + i * obj->locked_pitch,
+                data + i * row_size, row_size);
+    } else {
+      r->error = 1;
+    }
+  }
+  if (obj != NULL)
+    obj->locked = NULL;
+}
+
+static void
+_read_render_operation (replay_t *r, gral_render_operation_t *op)
+{
+  op->vertex_data = _read_object (r);
+  op->operation_type = _read_u32 (r);
+  op->use_indexes = _read_u32 (r);
+  op->index_data = _read_object (r);
+}
+
+/* Plays one call, returns the opcode that was played. */
+static gral_trace_op_t
+_replay_call (replay_t *r)
+{
+  gral_trace_op_t op;
+  const void *data = _read (r, sizeof (uint16_t));
+  uint16_t val;
+  uint32_t id, a, b, c, d;
+  replay_object_t *obj;
+  gral_matrix_t m;
+  gral_color_t colors[4];
+
+  if (data == NULL)
+    return GRAL_TRACE_OP_END;
+  memcpy (&val, data, sizeof (val));
+  op = (gral_trace_op_t) val;
+
+  switch (op) {
+  case GRAL_TRACE_OP_END:
+    break;
+
+  case GRAL_TRACE_OP_SET_RENDER_SURFACE: {
+    gral_surface_t *surf = _read_surface (r);
+    _read_u32 (r); /* width */
+    _read_u32 (r); /* height */
+    gral_set_render_surface (surf);
+    break;
+  }
+  case GRAL_TRACE_OP_SET_VIEW_MATRIX:
+    _read_matrix (r, &m);
+    gral_set_view_matrix (&m);
+    break;
+  case GRAL_TRACE_OP_SET_PROJECTION_MATRIX:
+    _read_matrix (r, &m);
+    gral_set_projection_matrix (&m);
+    break;
+  case GRAL_TRACE_OP_SET_WORLD_MATRIX:
+    _read_matrix (r, &m);
+    gral_set_world_matrix (&m);
+    break;
+  case GRAL_TRACE_OP_SET_LIGHTING_ENABLED:
+    gral_set_lighting_enabled (_read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_CULLING_MODE:
+    gral_set_culling_mode (_read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_UNBIND_GPU_PROGRAM:
+    gral_unbind_gpu_program (_read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_SHADING_TYPE:
+    gral_set_shading_type (_read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_SURFACE_PARAMS: {
+    float shininess;
+    _read_color (r, &colors[0]);
+    _read_color (r, &colors[1]);
+    _read_color (r, &colors[2]);
+    _read_color (r, &colors[3]);
+    shininess = _read_f32 (r);
+    gral_set_surface_params (&colors[0], &colors[1], &colors[2], &colors[3],
+                             shininess, _read_u32 (r));
+    break;
+  }
+  case GRAL_TRACE_OP_SET_DEPTH_BUFFER_PARAMS:
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    gral_set_depth_buffer_params (a, b, _read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_DEPTH_BUFFER_WRITE:
+    gral_set_depth_buffer_write_enabled (_read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_COLOR_BUFFER_WRITE:
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    gral_set_color_buffer_write_enabled (a, b, c, _read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_STENCIL_CHECK_ENABLED:
+    gral_set_stencil_check_enabled (_read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_STENCIL_BUFFER_PARAMS: {
+    uint32_t ops[3];
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    ops[0] = _read_u32 (r);
+    ops[1] = _read_u32 (r);
+    ops[2] = _read_u32 (r);
+    gral_set_stencil_buffer_params (a, b, c, ops[0], ops[1], ops[2], _read_u32 (r));
+    break;
+  }
+  case GRAL_TRACE_OP_CLEAR_FRAME_BUFFER: {
+    float depth;
+    a = _read_u32 (r);
+    _read_color (r, &colors[0]);
+    depth = _read_f32 (r);
+    gral_clear_frame_buffer (a, &colors[0], depth, (unsigned short) _read_u32 (r));
+    break;
+  }
+  case GRAL_TRACE_OP_DISABLE_TEXTURE_UNITS_FROM:
+    gral_disable_texture_units_from (_read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_SCENE_BLENDING:
+    a = _read_u32 (r);
+    gral_set_scene_blending (a, _read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_SEPARATE_SCENE_BLENDING:
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    gral_set_separate_scene_blending (a, b, c, _read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_RESET_STATE_CACHE:
+    gral_reset_state_cache ();
+    break;
+
+  case GRAL_TRACE_OP_RENDER: {
+    gral_render_operation_t rop;
+    _read_render_operation (r, &rop);
+    if (!r->error && rop.vertex_data)
+      gral_render (&rop);
+    break;
+  }
+  case GRAL_TRACE_OP_RENDER_INSTANCED: {
+    gral_render_operation_t rop;
+    gral_instance_data_t *instances;
+    uint32_t i;
+
+    _read_render_operation (r, &rop);
+    a = _read_u32 (r); /* data types */
+    b = _read_u32 (r); /* count */
+    if (r->error)
+      break;
+    instances = malloc (b * sizeof (gral_instance_data_t) + 1);
+    if (instances == NULL) {
+      r->error = 1;
+      break;
+    }
+    for (i = 0; i < b; ++i) {
+      _read_matrix (r, &instances[i].transform);
+      _read_color (r, &instances[i].color);
+      instances[i].tex_rect[0] = _read_f32 (r);
+      instances[i].tex_rect[1] = _read_f32 (r);
+      instances[i].tex_rect[2] = _read_f32 (r);
+      instances[i].tex_rect[3] = _read_f32 (r);
+    }
+    if (!r->error && rop.vertex_data)
+      gral_render_instanced (&rop, instances, b, a);
+    free (instances);
+    break;
+  }
+
+  case GRAL_TRACE_OP_VERTEX_BUFFER_CREATE:
+    id = _read_u32 (r);
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    if (!r->error)
+      _define_object (r, id, gral_vertex_buffer_create (a, b, c));
+    break;
+  case GRAL_TRACE_OP_VERTEX_BUFFER_DESTROY:
+    id = _read_u32 (r);
+    if ((obj = _lookup (r, id)) && obj->ptr)
+      gral_vertex_buffer_destroy (obj->ptr);
+    _undefine_object (r, id);
+    break;
+  case GRAL_TRACE_OP_VERTEX_BUFFER_LOCK:
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    if (obj && obj->ptr) {
+      void *ptr = gral_vertex_buffer_lock (obj->ptr, a, b, c);
+      obj->locked = c == GRAL_BUFFER_LOCK_OPTION_READ_ONLY ? NULL : ptr;
+      obj->locked_length = b;
+    }
+    break;
+  case GRAL_TRACE_OP_VERTEX_BUFFER_UNLOCK:
+    obj = _lookup (r, _read_u32 (r));
+    _read_locked (r, obj);
+    if (obj && obj->ptr)
+      gral_vertex_buffer_unlock (obj->ptr);
+    break;
+  case GRAL_TRACE_OP_INDEX_BUFFER_CREATE:
+    id = _read_u32 (r);
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    if (!r->error)
+      _define_object (r, id, gral_index_buffer_create (a, b, c));
+    break;
+  case GRAL_TRACE_OP_INDEX_BUFFER_DESTROY:
+    id = _read_u32 (r);
+    if ((obj = _lookup (r, id)) && obj->ptr)
+      gral_index_buffer_destroy (obj->ptr);
+    _undefine_object (r, id);
+    break;
+  case GRAL_TRACE_OP_INDEX_BUFFER_LOCK:
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    if (obj && obj->ptr) {
+      void *ptr = gral_index_buffer_lock (obj->ptr, a, b, c);
+      obj->locked = c == GRAL_BUFFER_LOCK_OPTION_READ_ONLY ? NULL : ptr;
+      obj->locked_length = b;
+    }
+    break;
+  case GRAL_TRACE_OP_INDEX_BUFFER_UNLOCK:
+    obj = _lookup (r, _read_u32 (r));
+    _read_locked (r, obj);
+    if (obj && obj->ptr)
+      gral_index_buffer_unlock (obj->ptr);
+    break;
+
+  case GRAL_TRACE_OP_VERTEX_DATA_CREATE:
+    id = _read_u32 (r);
+    if (!r->error)
+      _define_object (r, id, gral_vertex_data_create ());
+    break;
+  case GRAL_TRACE_OP_VERTEX_DATA_DESTROY:
+    id = _read_u32 (r);
+    if ((obj = _lookup (r, id)) && obj->ptr)
+      gral_vertex_data_destroy (obj->ptr);
+    _undefine_object (r, id);
+    break;
+  case GRAL_TRACE_OP_VERTEX_DATA_SET_START:
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    if (obj && obj->ptr)
+      gral_vertex_data_set_start (obj->ptr, a);
+    break;
+  case GRAL_TRACE_OP_VERTEX_DATA_SET_COUNT:
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    if (obj && obj->ptr)
+      gral_vertex_data_set_count (obj->ptr, a);
+    break;
+  case GRAL_TRACE_OP_VERTEX_DATA_ADD_ELEMENT: {
+    uint32_t index;
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    d = _read_u32 (r);
+    index = _read_u32 (r);
+    if (obj && obj->ptr)
+      gral_vertex_data_add_element (obj->ptr, (unsigned short) a, b, c, d, (unsigned short) index);
+    break;
+  }
+  case GRAL_TRACE_OP_VERTEX_DATA_BIND_BUFFER: {
+    void *vb;
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    vb = _read_object (r);
+    if (obj && obj->ptr && vb)
+      gral_vertex_data_bind_buffer (obj->ptr, (unsigned short) a, vb);
+    break;
+  }
+  case GRAL_TRACE_OP_INDEX_DATA_CREATE:
+    id = _read_u32 (r);
+    if (!r->error)
+      _define_object (r, id, gral_index_data_create ());
+    break;
+  case GRAL_TRACE_OP_INDEX_DATA_DESTROY:
+    id = _read_u32 (r);
+    if ((obj = _lookup (r, id)) && obj->ptr)
+      gral_index_data_destroy (obj->ptr);
+    _undefine_object (r, id);
+    break;
+  case GRAL_TRACE_OP_INDEX_DATA_SET_START:
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    if (obj && obj->ptr)
+      gral_index_data_set_start (obj->ptr, a);
+    break;
+  case GRAL_TRACE_OP_INDEX_DATA_SET_COUNT:
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    if (obj && obj->ptr)
+      gral_index_data_set_count (obj->ptr, a);
+    break;
+  case GRAL_TRACE_OP_INDEX_DATA_SET_BUFFER: {
+    void *ib;
+    obj = _lookup (r, _read_u32 (r));
+    ib = _read_object (r);
+    if (obj && obj->ptr && ib)
+      gral_index_data_set_buffer (obj->ptr, ib);
+    break;
+  }
+
+  case GRAL_TRACE_OP_SET_TEXTURE: {
+    void *tex;
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    tex = _read_object (r);
+    if (tex)
+      gral_set_texture (a, b, tex);
+    break;
+  }
+  case GRAL_TRACE_OP_SET_TEXTURE_MATRIX:
+    a = _read_u32 (r);
+    _read_matrix (r, &m);
+    gral_set_texture_matrix (a, &m, _read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_TEXTURE_COORD_SET:
+    a = _read_u32 (r);
+    gral_set_texture_coord_set (a, _read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_TEXTURE_UNIT_FILTERING:
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    gral_set_texture_unit_filtering (a, b, c, _read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_TEXTURE_LAYER_ANISOTROPY:
+    a = _read_u32 (r);
+    gral_set_texture_layer_anisotropy (a, _read_u32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_TEXTURE_MIPMAP_BIAS:
+    a = _read_u32 (r);
+    gral_set_texture_mipmap_bias (a, _read_f32 (r));
+    break;
+  case GRAL_TRACE_OP_SET_TEXTURE_BLEND_MODE: {
+    gral_layer_blend_mode_t bm;
+    a = _read_u32 (r);
+    bm.blend_type = _read_u32 (r);
+    bm.operation = _read_u32 (r);
+    bm.source1 = _read_u32 (r);
+    bm.source2 = _read_u32 (r);
+    _read_color (r, &bm.color_arg1);
+    _read_color (r, &bm.color_arg2);
+    bm.alpha_arg1 = _read_f32 (r);
+    bm.alpha_arg2 = _read_f32 (r);
+    bm.factor = _read_f32 (r);
+    gral_set_texture_blend_mode (a, &bm);
+    break;
+  }
+  case GRAL_TRACE_OP_SET_TEXTURE_ADDRESSING_MODE: {
+    gral_uvw_addressing_mode_t uvw;
+    a = _read_u32 (r);
+    uvw.u = _read_u32 (r);
+    uvw.v = _read_u32 (r);
+    uvw.w = _read_u32 (r);
+    gral_set_texture_addressing_mode (a, &uvw);
+    break;
+  }
+  case GRAL_TRACE_OP_SET_TEXTURE_BORDER_COLOR:
+    a = _read_u32 (r);
+    _read_color (r, &colors[0]);
+    gral_set_texture_border_color (a, &colors[0]);
+    break;
+  case GRAL_TRACE_OP_SET_TEXTURE_COORD_CALCULATION:
+    a = _read_u32 (r);
+    gral_set_texture_coord_calculation (a, _read_u32 (r));
+    break;
+
+  case GRAL_TRACE_OP_TEXTURE_CREATE: {
+    uint32_t args[9];
+    int i;
+    id = _read_u32 (r);
+    for (i = 0; i < 9; ++i)
+      args[i] = _read_u32 (r);
+    if (!r->error) {
+      _define_object (r, id, gral_texture_create (args[0], args[1], args[2], args[3],
+                                                  (int) args[4], args[5], args[6],
+                                                  args[7], args[8]));
+      if ((obj = _lookup (r, id)) != NULL) {
+        obj->width = args[1];
+        obj->height = args[2];
+        obj->depth = args[3];
+        obj->format = args[5];
+      }
+    }
+    break;
+  }
+  case GRAL_TRACE_OP_TEXTURE_DESTROY:
+    id = _read_u32 (r);
+    if ((obj = _lookup (r, id)) && obj->ptr) {
+      /* The texture's surface goes away with it. */
+      if (obj->surface)
+        _undefine_object (r, obj->surface);
+      gral_texture_destroy (obj->ptr);
+    }
+    _undefine_object (r, id);
+    break;
+  case GRAL_TRACE_OP_TEXTURE_LOCK:
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    if (obj && obj->ptr) {
+      void *ptr = gral_texture_buffer_lock_full (obj->ptr, a, b, c);
+      obj->locked = c == GRAL_BUFFER_LOCK_OPTION_READ_ONLY ? NULL : ptr;
+      obj->locked_pitch = gral_texture_buffer_get_row_pitch (obj->ptr, a, b);
+      obj->locked_rows = (size_t) GRAL_TRACE_MIP_SIZE (obj->height, b) *
+                         GRAL_TRACE_MIP_SIZE (obj->depth, b);
+    }
+    break;
+  case GRAL_TRACE_OP_TEXTURE_UNLOCK:
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    _read_locked_rows (r, obj);
+    if (obj && obj->ptr)
+      gral_texture_buffer_unlock (obj->ptr, a, b);
+    break;
+  case GRAL_TRACE_OP_TEXTURE_WRITE: {
+    const void *pixels;
+    obj = _lookup (r, _read_u32 (r));
+    a = _read_u32 (r); /* row size */
+    pixels = _read_bytes (r, &b);
+    if (obj && obj->ptr && pixels) {
+      /* gral_texture_write reads height rows of width pixels. */
+      if (a >= obj->width * GRAL_TRACE_PIXEL_SIZE (obj->format) &&
+          b >= (size_t) a * obj->height)
+        gral_texture_write (obj->ptr, pixels, a);
+      else
+        r->error = 1;
+    }
+    break;
+  }
+  case GRAL_TRACE_OP_TEXTURE_GET_SURFACE: {
+    gral_surface_t *surf;
+    a = _read_u32 (r);
+    id = _read_u32 (r);
+    obj = _lookup (r, a);
+    if (obj && obj->ptr && id != 0 && !r->error) {
+      surf = gral_texture_get_surface (obj->ptr);
+      if (surf != NULL) {
+        _define_object (r, id, surf);
+        /* _define_object may have moved the objects. */
+        if (!r->error)
+          r->objects[a].surface = id;
+      }
+    }
+    break;
+  }
+
+  case GRAL_TRACE_OP_READ_PIXELS: {
+    gral_surface_t *surf = _read_surface (r);
+    unsigned char *pixels;
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    d = _read_u32 (r);
+    if (r->error || c == 0 || d == 0)
+      break;
+    pixels = malloc ((size_t) c * d * 4);
+    if (pixels == NULL) {
+      r->error = 1;
+      break;
+    }
+    gral_read_pixels (surf, (int) a, (int) b, c, d, pixels, (size_t) c * 4);
+    free (pixels);
+    break;
+  }
+  case GRAL_TRACE_OP_READBACK_BEGIN: {
+    gral_surface_t *surf;
+    id = _read_u32 (r);
+    surf = _read_surface (r);
+    a = _read_u32 (r);
+    b = _read_u32 (r);
+    c = _read_u32 (r);
+    d = _read_u32 (r);
+    if (!r->error)
+      _define_object (r, id, gral_readback_begin (surf, (int) a, (int) b, c, d));
+    break;
+  }
+  case GRAL_TRACE_OP_READBACK_MAP: {
+    void *rb = _read_object (r);
+    size_t stride;
+    if (rb)
+      gral_readback_map (rb, &stride);
+    break;
+  }
+  case GRAL_TRACE_OP_READBACK_DESTROY:
+    id = _read_u32 (r);
+    if ((obj = _lookup (r, id)) && obj->ptr)
+      gral_readback_destroy (obj->ptr);
+    _undefine_object (r, id);
+    break;
+
+  case GRAL_TRACE_OP_SET_PROGRAM_CACHE_DIR: {
+    char *dir = _read_string (r);
+    if (!r->error)
+      gral_set_program_cache_dir (dir[0] ? dir : NULL);
+    free (dir);
+    break;
+  }
+
+  case GRAL_TRACE_OP_CG_PROGRAM_CREATE_FROM_FILE:
+  case GRAL_TRACE_OP_CG_PROGRAM_CREATE_FROM_SOURCE: {
+    char *str, *entry, *profiles;
+    id = _read_u32 (r);
+    a = _read_u32 (r);
+    str = _read_string (r);
+    entry = _read_string (r);
+    profiles = _read_string (r);
+    if (!r->error) {
+      if (op == GRAL_TRACE_OP_CG_PROGRAM_CREATE_FROM_FILE)
+        _define_object (r, id, gral_cg_program_create_from_file (a, str, entry, profiles));
+      else
+        _define_object (r, id, gral_cg_program_create_from_source (a, str, entry, profiles));
+    }
+    free (str);
+    free (entry);
+    free (profiles);
+    break;
+  }
+  case GRAL_TRACE_OP_CG_PROGRAM_DESTROY:
+    id = _read_u32 (r);
+    if ((obj = _lookup (r, id)) && obj->ptr)
+      gral_cg_program_destroy (obj->ptr);
+    _undefine_object (r, id);
+    break;
+  case GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_MATRIX: {
+    void *prog = _read_object (r);
+    char *name = _read_string (r);
+    _read_matrix (r, &m);
+    if (prog && name)
+      gral_cg_program_set_constant_matrix (prog, name, &m);
+    free (name);
+    break;
+  }
+  case GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_FLOAT: {
+    void *prog = _read_object (r);
+    char *name = _read_string (r);
+    float f = _read_f32 (r);
+    if (prog && name)
+      gral_cg_program_set_constant_float (prog, name, f);
+    free (name);
+    break;
+  }
+  case GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_FLOAT4_ARRAY: {
+    void *prog = _read_object (r);
+    char *name = _read_string (r);
+    const void *data;
+    float *vals;
+    a = _read_u32 (r);
+    data = _read (r, (size_t) a * 4 * sizeof (float));
+    if (data == NULL || r->error) {
+      r->error = 1;
+      free (name);
+      break;
+    }
+    /* The trace data isn't aligned for floats. */
+    vals = malloc ((size_t) a * 4 * sizeof (float) + 1);
+    if (vals == NULL) {
+      r->error = 1;
+    } else {
+      memcpy (vals, data, (size_t) a * 4 * sizeof (float));
+      if (prog && name)
+        gral_cg_program_set_constant_float4_array (prog, name, vals, a);
+      free (vals);
+    }
+    free (name);
+    break;
+  }
+  case GRAL_TRACE_OP_CG_PROGRAM_BIND: {
+    void *prog = _read_object (r);
+    if (prog)
+      gral_cg_program_bind (prog);
+    break;
+  }
+
+  default:
+    fprintf (stderr, "gral-replay: unknown opcode %d\n", (int) op);
+    r->error = 1;
+    break;
+  }
+
+  return op;
+}
+
+static unsigned char *
+_read_file (const char *filename, size_t *size)
+{
+  FILE *file;
+  unsigned char *data = NULL;
+  long length;
+
+  file = fopen (filename, "rb");
+  if (file == NULL)
+    return NULL;
+
+  if (fseek (file, 0, SEEK_END) == 0 && (length = ftell (file)) > 0 &&
+      fseek (file, 0, SEEK_SET) == 0) {
+    data = malloc (length);
+    if (data != NULL && fread (data, 1, length, file) != (size_t) length) {
+      free (data);
+      data = NULL;
+    }
+    *size = length;
+  }
+
+  fclose (file);
+  return data;
+}
+
+int
+gral_replay_file (const char *filename, gral_surface_t *surface,
+                  gral_replay_result_t *result)
+{
+  replay_t r;
+  unsigned char *data;
+  size_t size, magic_len = strlen (GRAL_TRACE_MAGIC);
+  double start, frame_start, now;
+  gral_trace_op_t op;
+  int in_frame = 0;
+
+  memset (result, 0, sizeof (gral_replay_result_t));
+
+  data = _read_file (filename, &size);
+  if (data == NULL) {
+    fprintf (stderr, "gral-replay: unable to read '%s'\n", filename);
+    return -1;
+  }
+
+  memset (&r, 0, sizeof (r));
+  r.pos = data;
+  r.end = data + size;
+  r.surface = surface;
+
+  if (size < magic_len || memcmp (data, GRAL_TRACE_MAGIC, magic_len) != 0) {
+    fprintf (stderr, "gral-replay: '%s' is not a gral trace\n", filename);
+    free (data);
+    return -1;
+  }
+  r.pos += magic_len;
+  if (_read_u32 (&r) != GRAL_TRACE_VERSION) {
+    fprintf (stderr, "gral-replay: '%s' has an unsupported version\n", filename);
+    free (data);
+    return -1;
+  }
+
+  gral_reset_stats ();
+  start = frame_start = _get_time ();
+
+  do {
+    op = _replay_call (&r);
+    if (op != GRAL_TRACE_OP_END)
+      ++result->calls;
+
+    /* Every frame starts with gral_reset_state_cache. */
+    if (op == GRAL_TRACE_OP_RESET_STATE_CACHE || op == GRAL_TRACE_OP_END) {
+      now = _get_time ();
+      if (in_frame) {
+        double seconds = now - frame_start;
+        if (result->frames == 0 || seconds < result->min_frame_seconds)
+          result->min_frame_seconds = seconds;
+        if (seconds > result->max_frame_seconds)
+          result->max_frame_seconds = seconds;
+        ++result->frames;
+      }
+      in_frame = 1;
+      frame_start = now;
+    }
+  } while (op != GRAL_TRACE_OP_END && !r.error);
+
+  result->seconds = _get_time () - start;
+  gral_get_stats (&result->stats);
+
+  free (r.objects);
+  free (data);
+
+  if (r.error) {
+    fprintf (stderr, "gral-replay: '%s' is truncated or corrupt\n", filename);
+    return -1;
+  }
+  return 0;
+}
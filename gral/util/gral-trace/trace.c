@@ -0,0 +1,1139 @@
+/* Copyright (c) 2009, Argiris Kirtzidis
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ARGIRIS KIRTZIDIS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL ARGIRIS KIRTZIDIS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* gral-trace - records the calls made to a gral backend.
+ *
+ * Build it as a shared object and preload it into the application:
+ *
+ *   GRAL_TRACE_FILE=frame.trace LD_PRELOAD=gral-trace.so ./app
+ *
+ * Every call is forwarded to the real backend and serialized into the trace
+ * file (default "gral-<pid>.trace"), together with the contents written into
+ * buffers and textures while they are locked. See gral-trace.h for the
+ * format and replay.c for playing a trace back.
+ *
+ * Queries that don't change any state (sizes, capabilities, texel offsets,
+ * row pitches, gral_readback_is_ready, the counters and the helpers in
+ * gral-color.c/gral-matrix.c) are forwarded without being recorded. gral is
+ * only used from the render thread, so no locking is done.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gral.h"
+#include "gral-trace.h"
+
+#define DLCALL(name, args...) ({ \
+    static typeof (&name) name##_real; \
+    if (name##_real == NULL) \
+	name##_real = dlsym (RTLD_NEXT, #name); \
+    (*name##_real) (args);  \
+})
+
+typedef struct _object object_t;
+
+struct _object {
+  const void *addr;
+  uint32_t id;
+  /* The region that was locked for writing, emitted on unlock. Texture
+   * locks are locked_rows rows of locked_row_size bytes, locked_pitch apart. */
+  void *locked;
+  size_t locked_length;
+  size_t locked_pitch, locked_row_size, locked_rows;
+  /* Texture dimensions, to know how much a texture lock covers. */
+  unsigned int width, height, depth;
+  gral_pixel_format_t format;
+  object_t *next;
+};
+
+#define BUCKETS 251
+#define BUCKET(ptr) (((unsigned long) (ptr) >> 3) % BUCKETS)
+
+static object_t *objects[BUCKETS];
+static uint32_t next_id = 1;
+static FILE *logfile;
+
+static void
+_close_trace (void)
+{
+  if (logfile != NULL) {
+    uint16_t op = GRAL_TRACE_OP_END;
+    fwrite (&op, sizeof (op), 1, logfile);
+    fclose (logfile);
+    logfile = NULL;
+  }
+}
+
+static FILE *
+_get_trace (void)
+{
+  static int initialized;
+  const char *filename;
+  char buf[64];
+  uint32_t version = GRAL_TRACE_VERSION;
+
+  if (initialized)
+    return logfile;
+  initialized = 1;
+
+  filename = getenv ("GRAL_TRACE_FILE");
+  if (filename == NULL) {
+    snprintf (buf, sizeof (buf), "gral-%d.trace", (int) getpid ());
+    filename = buf;
+  }
+
+  logfile = fopen (filename, "wb");
+  if (logfile == NULL) {
+    fprintf (stderr, "gral-trace: unable to open '%s' for writing\n", filename);
+    return NULL;
+  }
+
+  fwrite (GRAL_TRACE_MAGIC, 1, strlen (GRAL_TRACE_MAGIC), logfile);
+  fwrite (&version, sizeof (version), 1, logfile);
+  atexit (_close_trace);
+
+  return logfile;
+}
+
+static void
+_emit_op (gral_trace_op_t op)
+{
+  uint16_t val = (uint16_t) op;
+  if (_get_trace ())
+    fwrite (&val, sizeof (val), 1, logfile);
+}
+
+static void
+_emit_u32 (size_t val)
+{
+  uint32_t v = (uint32_t) val;
+  if (logfile)
+    fwrite (&v, sizeof (v), 1, logfile);
+}
+
+static void
+_emit_f32 (float val)
+{
+  if (logfile)
+    fwrite (&val, sizeof (val), 1, logfile);
+}
+
+static void
+_emit_color (const gral_color_t *color)
+{
+  _emit_f32 (color->r);
+  _emit_f32 (color->g);
+  _emit_f32 (color->b);
+  _emit_f32 (color->a);
+}
+
+static void
+_emit_matrix (const gral_matrix_t *m)
+{
+  if (logfile)
+    fwrite (m->m, sizeof (float), 16, logfile);
+}
+
+static void
+_emit_bytes (const void *data, size_t length)
+{
+  _emit_u32 (length);
+  if (logfile && length)
+    fwrite (data, 1, length, logfile);
+}
+
+static void
+_emit_string (const char *str)
+{
+  _emit_bytes (str, str ? strlen (str) : 0);
+}
+
+static object_t *
+_get_object (const void *addr)
+{
+  object_t *obj;
+
+  for (obj = objects[BUCKET (addr)]; obj != NULL; obj = obj->next)
+    if (obj->addr == addr)
+      return obj;
+
+  return NULL;
+}
+
+static object_t *
+_create_object (const void *addr)
+{
+  object_t *obj;
+
+  obj = calloc (1, sizeof (object_t));
+  if (obj == NULL)
+    return NULL;
+
+  obj->addr = addr;
+  obj->id = next_id++;
+  obj->next = objects[BUCKET (addr)];
+  objects[BUCKET (addr)] = obj;
+  return obj;
+}
+
+static void
+_destroy_object (const void *addr)
+{
+  object_t **prev, *obj;
+
+  for (prev = &objects[BUCKET (addr)]; (obj = *prev) != NULL; prev = &obj->next) {
+    if (obj->addr == addr) {
+      *prev = obj->next;
+      free (obj);
+      return;
+    }
+  }
+}
+
+/* The id of an existing object, or 0 for NULL and unknown objects. */
+static uint32_t
+_get_id (const void *addr)
+{
+  object_t *obj;
+
+  if (addr == NULL)
+    return 0;
+  obj = _get_object (addr);
+  return obj ? obj->id : 0;
+}
+
+static void
+_emit_id (const void *addr)
+{
+  _emit_u32 (_get_id (addr));
+}
+
+/* Surfaces come from backend specific functions, so they are registered the
+ * first time they are seen. */
+static uint32_t
+_get_surface_id (gral_surface_t *surf)
+{
+  object_t *obj;
+
+  if (surf == NULL)
+    return 0;
+  obj = _get_object (surf);
+  if (obj == NULL)
+    obj = _create_object (surf);
+  return obj ? obj->id : 0;
+}
+
+static void
+_emit_locked (object_t *obj)
+{
+  if (obj != NULL && obj->locked != NULL) {
+    _emit_bytes (obj->locked, obj->locked_length);
+    obj->locked = NULL;
+    obj->locked_length = 0;
+  } else {
+    _emit_u32 (0);
+  }
+}
+
+/* Emits rows bytes of row_size each, leaving out the padding of the pitch. */
+static void
+_emit_rows (const void *data, size_t row_size, size_t rows, size_t pitch)
+{
+  const unsigned char *row = data;
+  size_t i;
+
+  _emit_u32 (row_size);
+  _emit_u32 (row_size * rows);
+  for (i = 0; i < rows && logfile; ++i, row += pitch)
+    fwrite (row, 1, row_size, logfile);
+}
+
+static void
+_emit_locked_rows (object_t *obj)
+{
+  if (obj != NULL && obj->locked != NULL) {
+    _emit_rows (obj->locked, obj->locked_row_size, obj->locked_rows, obj->locked_pitch);
+    obj->locked = NULL;
+  } else {
+    _emit_u32 (0);
+    _emit_u32 (0);
+  }
+}
+
+static void
+_emit_render_operation (gral_render_operation_t *op)
+{
+  _emit_id (op->vertex_data);
+  _emit_u32 (op->operation_type);
+  _emit_u32 (op->use_indexes);
+  _emit_id (op->use_indexes ? op->index_data : NULL);
+}
+
+/*
+ * Render state
+ */
+
+void
+gral_set_render_surface (gral_surface_t *surf)
+{
+  uint32_t id = _get_surface_id (surf);
+
+  _emit_op (GRAL_TRACE_OP_SET_RENDER_SURFACE);
+  _emit_u32 (id);
+  _emit_u32 (DLCALL (gral_surface_get_width, surf));
+  _emit_u32 (DLCALL (gral_surface_get_height, surf));
+  DLCALL (gral_set_render_surface, surf);
+}
+
+void
+gral_set_view_matrix (const gral_matrix_t *m)
+{
+  _emit_op (GRAL_TRACE_OP_SET_VIEW_MATRIX);
+  _emit_matrix (m);
+  DLCALL (gral_set_view_matrix, m);
+}
+
+void
+gral_set_projection_matrix (const gral_matrix_t *m)
+{
+  _emit_op (GRAL_TRACE_OP_SET_PROJECTION_MATRIX);
+  _emit_matrix (m);
+  DLCALL (gral_set_projection_matrix, m);
+}
+
+void
+gral_set_world_matrix (const gral_matrix_t *m)
+{
+  _emit_op (GRAL_TRACE_OP_SET_WORLD_MATRIX);
+  _emit_matrix (m);
+  DLCALL (gral_set_world_matrix, m);
+}
+
+void
+gral_set_lighting_enabled (gral_bool_t enabled)
+{
+  _emit_op (GRAL_TRACE_OP_SET_LIGHTING_ENABLED);
+  _emit_u32 (enabled);
+  DLCALL (gral_set_lighting_enabled, enabled);
+}
+
+void
+gral_set_culling_mode (gral_culling_mode_t mode)
+{
+  _emit_op (GRAL_TRACE_OP_SET_CULLING_MODE);
+  _emit_u32 (mode);
+  DLCALL (gral_set_culling_mode, mode);
+}
+
+void
+gral_unbind_gpu_program (gral_gpu_program_type_t gptype)
+{
+  _emit_op (GRAL_TRACE_OP_UNBIND_GPU_PROGRAM);
+  _emit_u32 (gptype);
+  DLCALL (gral_unbind_gpu_program, gptype);
+}
+
+void
+gral_set_shading_type (gral_shade_type_t so)
+{
+  _emit_op (GRAL_TRACE_OP_SET_SHADING_TYPE);
+  _emit_u32 (so);
+  DLCALL (gral_set_shading_type, so);
+}
+
+void
+gral_set_surface_params (const gral_color_t *ambient,
+                         const gral_color_t *diffuse, const gral_color_t *specular,
+                         const gral_color_t *emissive, float shininess,
+                         gral_track_vertex_color_type_t tracking)
+{
+  _emit_op (GRAL_TRACE_OP_SET_SURFACE_PARAMS);
+  _emit_color (ambient);
+  _emit_color (diffuse);
+  _emit_color (specular);
+  _emit_color (emissive);
+  _emit_f32 (shininess);
+  _emit_u32 (tracking);
+  DLCALL (gral_set_surface_params, ambient, diffuse, specular, emissive, shininess, tracking);
+}
+
+void
+gral_set_depth_buffer_params (gral_bool_t depthTest, gral_bool_t depthWrite,
+                              gral_compare_func_t depthFunction)
+{
+  _emit_op (GRAL_TRACE_OP_SET_DEPTH_BUFFER_PARAMS);
+  _emit_u32 (depthTest);
+  _emit_u32 (depthWrite);
+  _emit_u32 (depthFunction);
+  DLCALL (gral_set_depth_buffer_params, depthTest, depthWrite, depthFunction);
+}
+
+void
+gral_set_depth_buffer_write_enabled (gral_bool_t enabled)
+{
+  _emit_op (GRAL_TRACE_OP_SET_DEPTH_BUFFER_WRITE);
+  _emit_u32 (enabled);
+  DLCALL (gral_set_depth_buffer_write_enabled, enabled);
+}
+
+void
+gral_set_color_buffer_write_enabled (gral_bool_t red,
+                                     gral_bool_t green,
+                                     gral_bool_t blue,
+                                     gral_bool_t alpha)
+{
+  _emit_op (GRAL_TRACE_OP_SET_COLOR_BUFFER_WRITE);
+  _emit_u32 (red);
+  _emit_u32 (green);
+  _emit_u32 (blue);
+  _emit_u32 (alpha);
+  DLCALL (gral_set_color_buffer_write_enabled, red, green, blue, alpha);
+}
+
+void
+gral_set_stencil_check_enabled (gral_bool_t enabled)
+{
+  _emit_op (GRAL_TRACE_OP_SET_STENCIL_CHECK_ENABLED);
+  _emit_u32 (enabled);
+  DLCALL (gral_set_stencil_check_enabled, enabled);
+}
+
+void
+gral_set_stencil_buffer_params (gral_compare_func_t func,
+                                uint32_t refValue, uint32_t mask,
+                                gral_stencil_operation_t stencilFailOp,
+                                gral_stencil_operation_t depthFailOp,
+                                gral_stencil_operation_t passOp,
+                                gral_bool_t twoSidedOperation)
+{
+  _emit_op (GRAL_TRACE_OP_SET_STENCIL_BUFFER_PARAMS);
+  _emit_u32 (func);
+  _emit_u32 (refValue);
+  _emit_u32 (mask);
+  _emit_u32 (stencilFailOp);
+  _emit_u32 (depthFailOp);
+  _emit_u32 (passOp);
+  _emit_u32 (twoSidedOperation);
+  DLCALL (gral_set_stencil_buffer_params, func, refValue, mask,
+          stencilFailOp, depthFailOp, passOp, twoSidedOperation);
+}
+
+void
+gral_clear_frame_buffer (unsigned int buffers,
+                         const gral_color_t *color, float depth, unsigned short stencil)
+{
+  _emit_op (GRAL_TRACE_OP_CLEAR_FRAME_BUFFER);
+  _emit_u32 (buffers);
+  _emit_color (color);
+  _emit_f32 (depth);
+  _emit_u32 (stencil);
+  DLCALL (gral_clear_frame_buffer, buffers, color, depth, stencil);
+}
+
+void
+gral_disable_texture_units_from (size_t tex_unit)
+{
+  _emit_op (GRAL_TRACE_OP_DISABLE_TEXTURE_UNITS_FROM);
+  _emit_u32 (tex_unit);
+  DLCALL (gral_disable_texture_units_from, tex_unit);
+}
+
+void
+gral_set_scene_blending (gral_scene_blend_factor_t sourceFactor, gral_scene_blend_factor_t destFactor)
+{
+  _emit_op (GRAL_TRACE_OP_SET_SCENE_BLENDING);
+  _emit_u32 (sourceFactor);
+  _emit_u32 (destFactor);
+  DLCALL (gral_set_scene_blending, sourceFactor, destFactor);
+}
+
+void
+gral_set_separate_scene_blending (gral_scene_blend_factor_t sourceFactor, gral_scene_blend_factor_t destFactor,
+                                  gral_scene_blend_factor_t sourceFactorAlpha, gral_scene_blend_factor_t destFactorAlpha)
+{
+  _emit_op (GRAL_TRACE_OP_SET_SEPARATE_SCENE_BLENDING);
+  _emit_u32 (sourceFactor);
+  _emit_u32 (destFactor);
+  _emit_u32 (sourceFactorAlpha);
+  _emit_u32 (destFactorAlpha);
+  DLCALL (gral_set_separate_scene_blending, sourceFactor, destFactor,
+          sourceFactorAlpha, destFactorAlpha);
+}
+
+void
+gral_reset_state_cache (void)
+{
+  _emit_op (GRAL_TRACE_OP_RESET_STATE_CACHE);
+  DLCALL (gral_reset_state_cache);
+}
+
+/*
+ * Rendering
+ */
+
+void
+gral_render (gral_render_operation_t *op)
+{
+  _emit_op (GRAL_TRACE_OP_RENDER);
+  _emit_render_operation (op);
+  DLCALL (gral_render, op);
+}
+
+void
+gral_render_instanced (gral_render_operation_t *op,
+                       const gral_instance_data_t *instances,
+                       size_t num_instances,
+                       unsigned int data_types)
+{
+  size_t i;
+
+  _emit_op (GRAL_TRACE_OP_RENDER_INSTANCED);
+  _emit_render_operation (op);
+  _emit_u32 (data_types);
+  _emit_u32 (num_instances);
+  for (i = 0; i < num_instances; ++i) {
+    _emit_matrix (&instances[i].transform);
+    _emit_color (&instances[i].color);
+    _emit_f32 (instances[i].tex_rect[0]);
+    _emit_f32 (instances[i].tex_rect[1]);
+    _emit_f32 (instances[i].tex_rect[2]);
+    _emit_f32 (instances[i].tex_rect[3]);
+  }
+  DLCALL (gral_render_instanced, op, instances, num_instances, data_types);
+}
+
+/*
+ * Vertex and index buffers
+ */
+
+gral_vertex_buffer_t *
+gral_vertex_buffer_create (size_t vertexSize, size_t numVerts, gral_buffer_usage_t usage)
+{
+  gral_vertex_buffer_t *vb = DLCALL (gral_vertex_buffer_create, vertexSize, numVerts, usage);
+  object_t *obj;
+
+  if (vb != NULL && (obj = _create_object (vb)) != NULL) {
+    _emit_op (GRAL_TRACE_OP_VERTEX_BUFFER_CREATE);
+    _emit_u32 (obj->id);
+    _emit_u32 (vertexSize);
+    _emit_u32 (numVerts);
+    _emit_u32 (usage);
+  }
+  return vb;
+}
+
+void
+gral_vertex_buffer_destroy (gral_vertex_buffer_t *vb)
+{
+  _emit_op (GRAL_TRACE_OP_VERTEX_BUFFER_DESTROY);
+  _emit_id (vb);
+  _destroy_object (vb);
+  DLCALL (gral_vertex_buffer_destroy, vb);
+}
+
+void *
+gral_vertex_buffer_lock (gral_vertex_buffer_t *vb, size_t offset, size_t length,
+                         gral_buffer_lock_option_t opt)
+{
+  void *ptr = DLCALL (gral_vertex_buffer_lock, vb, offset, length, opt);
+  object_t *obj = _get_object (vb);
+
+  _emit_op (GRAL_TRACE_OP_VERTEX_BUFFER_LOCK);
+  _emit_id (vb);
+  _emit_u32 (offset);
+  _emit_u32 (length);
+  _emit_u32 (opt);
+  if (obj != NULL && opt != GRAL_BUFFER_LOCK_OPTION_READ_ONLY) {
+    obj->locked = ptr;
+    obj->locked_length = length;
+  }
+  return ptr;
+}
+
+void
+gral_vertex_buffer_unlock (gral_vertex_buffer_t *vb)
+{
+  _emit_op (GRAL_TRACE_OP_VERTEX_BUFFER_UNLOCK);
+  _emit_id (vb);
+  _emit_locked (_get_object (vb));
+  DLCALL (gral_vertex_buffer_unlock, vb);
+}
+
+gral_index_buffer_t *
+gral_index_buffer_create (gral_index_buffer_type_t itype, size_t numIndexes,
+                          gral_buffer_usage_t usage)
+{
+  gral_index_buffer_t *ib = DLCALL (gral_index_buffer_create, itype, numIndexes, usage);
+  object_t *obj;
+
+  if (ib != NULL && (obj = _create_object (ib)) != NULL) {
+    _emit_op (GRAL_TRACE_OP_INDEX_BUFFER_CREATE);
+    _emit_u32 (obj->id);
+    _emit_u32 (itype);
+    _emit_u32 (numIndexes);
+    _emit_u32 (usage);
+  }
+  return ib;
+}
+
+void
+gral_index_buffer_destroy (gral_index_buffer_t *ib)
+{
+  _emit_op (GRAL_TRACE_OP_INDEX_BUFFER_DESTROY);
+  _emit_id (ib);
+  _destroy_object (ib);
+  DLCALL (gral_index_buffer_destroy, ib);
+}
+
+void *
+gral_index_buffer_lock (gral_index_buffer_t *ib, size_t offset, size_t length,
+                        gral_buffer_lock_option_t opt)
+{
+  void *ptr = DLCALL (gral_index_buffer_lock, ib, offset, length, opt);
+  object_t *obj = _get_object (ib);
+
+  _emit_op (GRAL_TRACE_OP_INDEX_BUFFER_LOCK);
+  _emit_id (ib);
+  _emit_u32 (offset);
+  _emit_u32 (length);
+  _emit_u32 (opt);
+  if (obj != NULL && opt != GRAL_BUFFER_LOCK_OPTION_READ_ONLY) {
+    obj->locked = ptr;
+    obj->locked_length = length;
+  }
+  return ptr;
+}
+
+void
+gral_index_buffer_unlock (gral_index_buffer_t *ib)
+{
+  _emit_op (GRAL_TRACE_OP_INDEX_BUFFER_UNLOCK);
+  _emit_id (ib);
+  _emit_locked (_get_object (ib));
+  DLCALL (gral_index_buffer_unlock, ib);
+}
+
+/*
+ * Vertex and index data
+ */
+
+gral_vertex_data_t *
+gral_vertex_data_create (void)
+{
+  gral_vertex_data_t *vd = DLCALL (gral_vertex_data_create);
+  object_t *obj;
+
+  if (vd != NULL && (obj = _create_object (vd)) != NULL) {
+    _emit_op (GRAL_TRACE_OP_VERTEX_DATA_CREATE);
+    _emit_u32 (obj->id);
+  }
+  return vd;
+}
+
+void
+gral_vertex_data_destroy (gral_vertex_data_t *vd)
+{
+  _emit_op (GRAL_TRACE_OP_VERTEX_DATA_DESTROY);
+  _emit_id (vd);
+  _destroy_object (vd);
+  DLCALL (gral_vertex_data_destroy, vd);
+}
+
+void
+gral_vertex_data_set_start (gral_vertex_data_t *vd, size_t start)
+{
+  _emit_op (GRAL_TRACE_OP_VERTEX_DATA_SET_START);
+  _emit_id (vd);
+  _emit_u32 (start);
+  DLCALL (gral_vertex_data_set_start, vd, start);
+}
+
+void
+gral_vertex_data_set_count (gral_vertex_data_t *vd, size_t count)
+{
+  _emit_op (GRAL_TRACE_OP_VERTEX_DATA_SET_COUNT);
+  _emit_id (vd);
+  _emit_u32 (count);
+  DLCALL (gral_vertex_data_set_count, vd, count);
+}
+
+void
+gral_vertex_data_add_element (gral_vertex_data_t *vertex_data,
+                              unsigned short source, size_t offset,
+                              gral_vertex_element_type_t theType,
+                              gral_vertex_element_semantic_t semantic,
+                              unsigned short index)
+{
+  _emit_op (GRAL_TRACE_OP_VERTEX_DATA_ADD_ELEMENT);
+  _emit_id (vertex_data);
+  _emit_u32 (source);
+  _emit_u32 (offset);
+  _emit_u32 (theType);
+  _emit_u32 (semantic);
+  _emit_u32 (index);
+  DLCALL (gral_vertex_data_add_element, vertex_data, source, offset, theType, semantic, index);
+}
+
+void
+gral_vertex_data_bind_buffer (gral_vertex_data_t *vd,
+                              unsigned short source,
+                              gral_vertex_buffer_t *buffer)
+{
+  _emit_op (GRAL_TRACE_OP_VERTEX_DATA_BIND_BUFFER);
+  _emit_id (vd);
+  _emit_u32 (source);
+  _emit_id (buffer);
+  DLCALL (gral_vertex_data_bind_buffer, vd, source, buffer);
+}
+
+gral_index_data_t *
+gral_index_data_create (void)
+{
+  gral_index_data_t *id = DLCALL (gral_index_data_create);
+  object_t *obj;
+
+  if (id != NULL && (obj = _create_object (id)) != NULL) {
+    _emit_op (GRAL_TRACE_OP_INDEX_DATA_CREATE);
+    _emit_u32 (obj->id);
+  }
+  return id;
+}
+
+void
+gral_index_data_destroy (gral_index_data_t *id)
+{
+  _emit_op (GRAL_TRACE_OP_INDEX_DATA_DESTROY);
+  _emit_id (id);
+  _destroy_object (id);
+  DLCALL (gral_index_data_destroy, id);
+}
+
+void
+gral_index_data_set_start (gral_index_data_t *id, size_t start)
+{
+  _emit_op (GRAL_TRACE_OP_INDEX_DATA_SET_START);
+  _emit_id (id);
+  _emit_u32 (start);
+  DLCALL (gral_index_data_set_start, id, start);
+}
+
+void
+gral_index_data_set_count (gral_index_data_t *id, size_t count)
+{
+  _emit_op (GRAL_TRACE_OP_INDEX_DATA_SET_COUNT);
+  _emit_id (id);
+  _emit_u32 (count);
+  DLCALL (gral_index_data_set_count, id, count);
+}
+
+void
+gral_index_data_set_buffer (gral_index_data_t *id, gral_index_buffer_t *buffer)
+{
+  _emit_op (GRAL_TRACE_OP_INDEX_DATA_SET_BUFFER);
+  _emit_id (id);
+  _emit_id (buffer);
+  DLCALL (gral_index_data_set_buffer, id, buffer);
+}
+
+/*
+ * Texture units
+ */
+
+void
+gral_set_texture (size_t unit, gral_bool_t enabled, gral_texture_t *tex)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE);
+  _emit_u32 (unit);
+  _emit_u32 (enabled);
+  _emit_id (tex);
+  DLCALL (gral_set_texture, unit, enabled, tex);
+}
+
+void
+gral_set_texture_matrix (size_t unit, const gral_matrix_t *xform, size_t numTexCoords)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_MATRIX);
+  _emit_u32 (unit);
+  _emit_matrix (xform);
+  _emit_u32 (numTexCoords);
+  DLCALL (gral_set_texture_matrix, unit, xform, numTexCoords);
+}
+
+void
+gral_set_texture_coord_set (size_t unit, size_t index)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_COORD_SET);
+  _emit_u32 (unit);
+  _emit_u32 (index);
+  DLCALL (gral_set_texture_coord_set, unit, index);
+}
+
+void
+gral_set_texture_unit_filtering (size_t unit, gral_filter_option_t minFilter,
+                                 gral_filter_option_t magFilter, gral_filter_option_t mipFilter)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_UNIT_FILTERING);
+  _emit_u32 (unit);
+  _emit_u32 (minFilter);
+  _emit_u32 (magFilter);
+  _emit_u32 (mipFilter);
+  DLCALL (gral_set_texture_unit_filtering, unit, minFilter, magFilter, mipFilter);
+}
+
+void
+gral_set_texture_layer_anisotropy (size_t unit, unsigned int maxAnisotropy)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_LAYER_ANISOTROPY);
+  _emit_u32 (unit);
+  _emit_u32 (maxAnisotropy);
+  DLCALL (gral_set_texture_layer_anisotropy, unit, maxAnisotropy);
+}
+
+void
+gral_set_texture_mipmap_bias (size_t unit, float bias)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_MIPMAP_BIAS);
+  _emit_u32 (unit);
+  _emit_f32 (bias);
+  DLCALL (gral_set_texture_mipmap_bias, unit, bias);
+}
+
+void
+gral_set_texture_blend_mode (size_t unit, const gral_layer_blend_mode_t *bm)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_BLEND_MODE);
+  _emit_u32 (unit);
+  _emit_u32 (bm->blend_type);
+  _emit_u32 (bm->operation);
+  _emit_u32 (bm->source1);
+  _emit_u32 (bm->source2);
+  _emit_color (&bm->color_arg1);
+  _emit_color (&bm->color_arg2);
+  _emit_f32 (bm->alpha_arg1);
+  _emit_f32 (bm->alpha_arg2);
+  _emit_f32 (bm->factor);
+  DLCALL (gral_set_texture_blend_mode, unit, bm);
+}
+
+void
+gral_set_texture_addressing_mode (size_t unit, const gral_uvw_addressing_mode_t *uvw)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_ADDRESSING_MODE);
+  _emit_u32 (unit);
+  _emit_u32 (uvw->u);
+  _emit_u32 (uvw->v);
+  _emit_u32 (uvw->w);
+  DLCALL (gral_set_texture_addressing_mode, unit, uvw);
+}
+
+void
+gral_set_texture_border_color (size_t unit, const gral_color_t *color)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_BORDER_COLOR);
+  _emit_u32 (unit);
+  _emit_color (color);
+  DLCALL (gral_set_texture_border_color, unit, color);
+}
+
+void
+gral_set_texture_coord_calculation (size_t unit, gral_tex_coord_calc_method_t m)
+{
+  _emit_op (GRAL_TRACE_OP_SET_TEXTURE_COORD_CALCULATION);
+  _emit_u32 (unit);
+  _emit_u32 (m);
+  DLCALL (gral_set_texture_coord_calculation, unit, m);
+}
+
+/*
+ * Textures
+ */
+
+gral_texture_t *
+gral_texture_create (gral_texture_type_t tex_type,
+                     unsigned int width, unsigned int height, unsigned int depth,
+                     int num_mips,
+                     gral_pixel_format_t format, gral_texture_usage_t usage,
+                     gral_bool_t hw_gamma_correction, unsigned int fsaa)
+{
+  gral_texture_t *tex = DLCALL (gral_texture_create, tex_type, width, height, depth,
+                                num_mips, format, usage, hw_gamma_correction, fsaa);
+  object_t *obj;
+
+  if (tex != NULL && (obj = _create_object (tex)) != NULL) {
+    obj->width = width;
+    obj->height = height;
+    obj->depth = depth;
+    obj->format = format;
+
+    _emit_op (GRAL_TRACE_OP_TEXTURE_CREATE);
+    _emit_u32 (obj->id);
+    _emit_u32 (tex_type);
+    _emit_u32 (width);
+    _emit_u32 (height);
+    _emit_u32 (depth);
+    _emit_u32 (num_mips);
+    _emit_u32 (format);
+    _emit_u32 (usage);
+    _emit_u32 (hw_gamma_correction);
+    _emit_u32 (fsaa);
+  }
+  return tex;
+}
+
+void
+gral_texture_destroy (gral_texture_t *tus)
+{
+  _emit_op (GRAL_TRACE_OP_TEXTURE_DESTROY);
+  _emit_id (tus);
+  _destroy_object (tus);
+  DLCALL (gral_texture_destroy, tus);
+}
+
+void *
+gral_texture_buffer_lock_full (gral_texture_t *tex, size_t face, size_t mipmap,
+                               gral_buffer_lock_option_t options)
+{
+  void *ptr = DLCALL (gral_texture_buffer_lock_full, tex, face, mipmap, options);
+  object_t *obj = _get_object (tex);
+
+  _emit_op (GRAL_TRACE_OP_TEXTURE_LOCK);
+  _emit_id (tex);
+  _emit_u32 (face);
+  _emit_u32 (mipmap);
+  _emit_u32 (options);
+  if (obj != NULL && options != GRAL_BUFFER_LOCK_OPTION_READ_ONLY) {
+    obj->locked = ptr;
+    obj->locked_pitch = DLCALL (gral_texture_buffer_get_row_pitch, tex, face, mipmap);
+    obj->locked_row_size = (size_t) GRAL_TRACE_MIP_SIZE (obj->width, mipmap) *
+                           GRAL_TRACE_PIXEL_SIZE (obj->format);
+    obj->locked_rows = (size_t) GRAL_TRACE_MIP_SIZE (obj->height, mipmap) *
+                       GRAL_TRACE_MIP_SIZE (obj->depth, mipmap);
+  }
+  return ptr;
+}
+
+void
+gral_texture_buffer_unlock (gral_texture_t *tex, size_t face, size_t mipmap)
+{
+  _emit_op (GRAL_TRACE_OP_TEXTURE_UNLOCK);
+  _emit_id (tex);
+  _emit_u32 (face);
+  _emit_u32 (mipmap);
+  _emit_locked_rows (_get_object (tex));
+  DLCALL (gral_texture_buffer_unlock, tex, face, mipmap);
+}
+
+void
+gral_texture_write (gral_texture_t *tex, const void *data, size_t stride)
+{
+  object_t *obj = _get_object (tex);
+
+  _emit_op (GRAL_TRACE_OP_TEXTURE_WRITE);
+  _emit_id (tex);
+  if (obj != NULL)
+    _emit_rows (data, obj->width * GRAL_TRACE_PIXEL_SIZE (obj->format), obj->height, stride);
+  else
+    _emit_rows (data, 0, 0, stride);
+  DLCALL (gral_texture_write, tex, data, stride);
+}
+
+gral_surface_t *
+gral_texture_get_surface (gral_texture_t *tex)
+{
+  gral_surface_t *surf = DLCALL (gral_texture_get_surface, tex);
+
+  _emit_op (GRAL_TRACE_OP_TEXTURE_GET_SURFACE);
+  _emit_id (tex);
+  _emit_u32 (_get_surface_id (surf));
+  return surf;
+}
+
+/*
+ * Readback
+ */
+
+void
+gral_read_pixels (gral_surface_t *surf, int x, int y,
+                  unsigned int width, unsigned int height,
+                  void *data, size_t stride)
+{
+  uint32_t id = _get_surface_id (surf);
+
+  _emit_op (GRAL_TRACE_OP_READ_PIXELS);
+  _emit_u32 (id);
+  _emit_u32 (x);
+  _emit_u32 (y);
+  _emit_u32 (width);
+  _emit_u32 (height);
+  DLCALL (gral_read_pixels, surf, x, y, width, height, data, stride);
+}
+
+gral_readback_t *
+gral_readback_begin (gral_surface_t *surf, int x, int y,
+                     unsigned int width, unsigned int height)
+{
+  uint32_t surf_id = _get_surface_id (surf);
+  gral_readback_t *rb = DLCALL (gral_readback_begin, surf, x, y, width, height);
+  object_t *obj;
+
+  if (rb != NULL && (obj = _create_object (rb)) != NULL) {
+    _emit_op (GRAL_TRACE_OP_READBACK_BEGIN);
+    _emit_u32 (obj->id);
+    _emit_u32 (surf_id);
+    _emit_u32 (x);
+    _emit_u32 (y);
+    _emit_u32 (width);
+    _emit_u32 (height);
+  }
+  return rb;
+}
+
+const void *
+gral_readback_map (gral_readback_t *rb, size_t *stride)
+{
+  _emit_op (GRAL_TRACE_OP_READBACK_MAP);
+  _emit_id (rb);
+  return DLCALL (gral_readback_map, rb, stride);
+}
+
+void
+gral_readback_destroy (gral_readback_t *rb)
+{
+  _emit_op (GRAL_TRACE_OP_READBACK_DESTROY);
+  _emit_id (rb);
+  _destroy_object (rb);
+  DLCALL (gral_readback_destroy, rb);
+}
+
+/*
+ * Programs
+ */
+
+void
+gral_set_program_cache_dir (const char *dir)
+{
+  _emit_op (GRAL_TRACE_OP_SET_PROGRAM_CACHE_DIR);
+  _emit_string (dir);
+  DLCALL (gral_set_program_cache_dir, dir);
+}
+
+gral_cg_program_t *
+gral_cg_program_create_from_file (gral_gpu_program_type_t gptype,
+                                  const char *filename,
+                                  const char *entry_point,
+                                  const char *profiles)
+{
+  gral_cg_program_t *prog = DLCALL (gral_cg_program_create_from_file, gptype,
+                                    filename, entry_point, profiles);
+  object_t *obj;
+
+  if (prog != NULL && (obj = _create_object (prog)) != NULL) {
+    _emit_op (GRAL_TRACE_OP_CG_PROGRAM_CREATE_FROM_FILE);
+    _emit_u32 (obj->id);
+    _emit_u32 (gptype);
+    _emit_string (filename);
+    _emit_string (entry_point);
+    _emit_string (profiles);
+  }
+  return prog;
+}
+
+gral_cg_program_t *
+gral_cg_program_create_from_source (gral_gpu_program_type_t gptype,
+                                    const char *source_string,
+                                    const char *entry_point,
+                                    const char *profiles)
+{
+  gral_cg_program_t *prog = DLCALL (gral_cg_program_create_from_source, gptype,
+                                    source_string, entry_point, profiles);
+  object_t *obj;
+
+  if (prog != NULL && (obj = _create_object (prog)) != NULL) {
+    _emit_op (GRAL_TRACE_OP_CG_PROGRAM_CREATE_FROM_SOURCE);
+    _emit_u32 (obj->id);
+    _emit_u32 (gptype);
+    _emit_string (source_string);
+    _emit_string (entry_point);
+    _emit_string (profiles);
+  }
+  return prog;
+}
+
+void
+gral_cg_program_destroy (gral_cg_program_t *prog)
+{
+  _emit_op (GRAL_TRACE_OP_CG_PROGRAM_DESTROY);
+  _emit_id (prog);
+  _destroy_object (prog);
+  DLCALL (gral_cg_program_destroy, prog);
+}
+
+void
+gral_cg_program_set_constant_matrix (gral_cg_program_t *prog,
+                                     const char *name, const gral_matrix_t *m)
+{
+  _emit_op (GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_MATRIX);
+  _emit_id (prog);
+  _emit_string (name);
+  _emit_matrix (m);
+  DLCALL (gral_cg_program_set_constant_matrix, prog, name, m);
+}
+
+void
+gral_cg_program_set_constant_float (gral_cg_program_t *prog,
+                                    const char *name, float val)
+{
+  _emit_op (GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_FLOAT);
+  _emit_id (prog);
+  _emit_string (name);
+  _emit_f32 (val);
+  DLCALL (gral_cg_program_set_constant_float, prog, name, val);
+}
+
+void
+gral_cg_program_set_constant_float4_array (gral_cg_program_t *prog,
+                                           const char *name, const float *vals,
+                                           size_t count)
+{
+  _emit_op (GRAL_TRACE_OP_CG_PROGRAM_SET_CONSTANT_FLOAT4_ARRAY);
+  _emit_id (prog);
+  _emit_string (name);
+  _emit_u32 (count);
+  if (logfile)
+    fwrite (vals, sizeof (float), count * 4, logfile);
+  DLCALL (gral_cg_program_set_constant_float4_array, prog, name, vals, count);
+}
+
+void
+gral_cg_program_bind (gral_cg_program_t *prog)
+{
+  _emit_op (GRAL_TRACE_OP_CG_PROGRAM_BIND);
+  _emit_id (prog);
+  DLCALL (gral_cg_program_bind, prog);
+}
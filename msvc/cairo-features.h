@@ -17,4 +17,6 @@
 #define CAIRO_HAS_WIN32_FONT 1
 #define CAIRO_HAS_WIN32_SURFACE 1
 
+#define CAIRO_HAS_GRAL_SURFACE 1
+
 #endif